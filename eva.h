@@ -18,10 +18,29 @@ typedef struct eva_pixel {
     uint8_t b, g, r, a;
 } eva_pixel;
 
+/**
+ * @brief The format of the pixels the application draws.
+ *
+ * Compact formats trade color depth for less memory traffic while drawing,
+ * eva expands the damaged part of each frame to eva_pixel before presenting.
+ *
+ * @see @ref eva_set_pixel_format
+ */
+typedef enum eva_pixel_format {
+    /** 4 bytes per pixel, eva_pixel. The default. */
+    EVA_PIXEL_FORMAT_BGRA8,
+    /** 2 bytes per pixel, a uint16_t with red in the top 5 bits. */
+    EVA_PIXEL_FORMAT_RGB565,
+    /** 1 byte per pixel, an index into the [palette](@ref eva_set_palette). */
+    EVA_PIXEL_FORMAT_INDEXED8,
+    /** 1 byte per pixel, the gray level. */
+    EVA_PIXEL_FORMAT_GRAY8,
+} eva_pixel_format;
+
 typedef struct eva_framebuffer {
     uint32_t w, h;
 
-    uint32_t pitch;       // Max width
+    uint32_t pitch;       // Row stride in pixels, at least the max width
     uint32_t max_height;  // Max height
     
     /**
@@ -34,8 +53,145 @@ typedef struct eva_framebuffer {
     float scale_x, scale_y; 
 
     eva_pixel *pixels;
+
+    /**
+     * @brief The format of the pixels.
+     *
+     * For EVA_PIXEL_FORMAT_BGRA8 the pixels are in pixels. For the compact
+     * formats pixels is NULL and data points to the pixels instead, rows are
+     * still pitch pixels apart.
+     */
+    eva_pixel_format format;
+    void            *data;
 } eva_framebuffer;
 
+/**
+ * @brief A rectangle in framebuffer pixels. The origin is the top left of the
+ * framebuffer.
+ */
+typedef struct eva_rect {
+    int32_t x, y;
+    int32_t w, h;
+} eva_rect;
+
+/**
+ * @brief The number of frames kept by
+ * [eva_get_frame_stats](@ref eva_get_frame_stats).
+ */
+#define EVA_FRAME_STATS_LEN 128
+
+/**
+ * @brief Statistics for a single frame. Times are in the same units as
+ * eva_time_now(), convert them with eva_time_ms().
+ *
+ * @see @ref eva_get_frame_stats
+ */
+typedef struct eva_frame_stat {
+    /** The number of the frame, counting from 0 when eva_run() starts. */
+    uint64_t frame;
+
+    /** When drawing of the frame started. */
+    uint64_t start_time;
+
+    /** How long the frame callback took. */
+    uint64_t frame_duration;
+
+    /** How long it took to copy or upload the frame to the display. */
+    uint64_t present_duration;
+
+    /**
+     * How long eva was blocked waiting for the display to release the
+     * previous frame, e.g. on the GPU semaphore, the MIT-SHM completion or a
+     * wl_buffer release.
+     */
+    uint64_t wait_duration;
+
+    /** The number of bytes copied to present the frame. */
+    uint64_t bytes_copied;
+
+    /** Frame requests that were folded into this frame. */
+    uint32_t coalesced;
+
+    /** Continuous frames that were skipped because the previous was late. */
+    uint32_t dropped;
+} eva_frame_stat;
+
+/**
+ * @brief Statistics for the most recent frames.
+ *
+ * The frames form a ring buffer. Frame i, counting from the oldest, is
+ * frames[(first + i) % EVA_FRAME_STATS_LEN] for i in [0, count).
+ *
+ * @see @ref eva_get_frame_stats
+ */
+typedef struct eva_frame_stats {
+    /** The most recent frames. */
+    eva_frame_stat frames[EVA_FRAME_STATS_LEN];
+
+    /** Index of the oldest frame in frames. */
+    uint32_t first;
+
+    /** The number of frames in frames. */
+    uint32_t count;
+
+    /** Totals since eva_run() started. */
+    uint64_t frame_count;
+    uint64_t coalesced_count;
+    uint64_t dropped_count;
+} eva_frame_stats;
+
+/**
+ * @brief The most framebuffers [eva_set_pipeline](@ref eva_set_pipeline)
+ * accepts.
+ */
+#define EVA_MAX_PIPELINE_BUFFERS 4
+
+/**
+ * @brief How the framebuffer memory is backed on Linux.
+ *
+ * @see @ref eva_set_huge_pages
+ */
+typedef enum eva_huge_pages {
+    /** Regular pages, the default. */
+    EVA_HUGE_PAGES_OFF,
+    /** Transparent huge pages, used when the kernel has them to spare. */
+    EVA_HUGE_PAGES_TRANSPARENT,
+    /**
+     * Huge pages reserved with vm.nr_hugepages, transparent ones when none
+     * are left.
+     */
+    EVA_HUGE_PAGES_EXPLICIT,
+} eva_huge_pages;
+
+/**
+ * @brief Pass to [eva_set_frame_rate](@ref eva_set_frame_rate) to draw a
+ * frame for every display refresh.
+ */
+#define EVA_FRAME_RATE_DISPLAY UINT32_MAX
+
+/**
+ * @brief The timing of a frame. All times are in the same units as
+ * eva_time_now().
+ *
+ * @see @ref eva_get_frame_timing
+ */
+typedef struct eva_frame_timing {
+    /**
+     * The time the frame is meant for. For continuous frames this moves
+     * forward by exactly one frame interval per frame, or by a whole number
+     * of intervals when frames were skipped, so animations stay smooth when
+     * they are driven by it. For requested frames it is the time drawing
+     * started.
+     */
+    uint64_t target_time;
+
+    /** The target time of the previous frame. */
+    uint64_t prev_target_time;
+
+    /** The time the previous frame was actually handed to the display. */
+    uint64_t prev_present_time;
+} eva_frame_timing;
+
 /**
  * @brief Identifiers for individual mouse buttons.
  *
@@ -218,6 +374,43 @@ typedef enum eva_input_action {
     EVA_INPUT_RELEASED
 } eva_input_action;
 
+/**
+ * @brief 64-bit words of the key bitsets of @ref eva_input_state.
+ *
+ * @ingroup input
+ */
+#define EVA_INPUT_KEY_WORDS ((EVA_KEY_LAST + 64) / 64)
+
+/**
+ * @brief The state of the keyboard and mouse at the start of a frame.
+ *
+ * Keys are bits of the key bitsets, key % 64 of the word key / 64, see
+ * eva_key_down(). A key or button that was pressed and released again
+ * between two frames is in both the pressed and the released set but not
+ * held.
+ *
+ * @see @ref eva_get_input_state
+ *
+ * @ingroup input
+ */
+typedef struct eva_input_state {
+    uint64_t keys[EVA_INPUT_KEY_WORDS];          // Held keys
+    uint64_t keys_pressed[EVA_INPUT_KEY_WORDS];  // Pressed since the last frame
+    uint64_t keys_released[EVA_INPUT_KEY_WORDS]; // Released since the last frame
+    eva_mod_flags mod; // The modifier keys at the last key event
+
+    uint32_t mouse_btns;          // Held, a bit each, 1 << EVA_MOUSE_BTN_LEFT...
+    uint32_t mouse_btns_pressed;  // Pressed since the last frame
+    uint32_t mouse_btns_released; // Released since the last frame
+    double   mouse_x;             // The last pointer position in the window
+    double   mouse_y;
+
+    double scroll_x; // Scrolled since the last frame
+    double scroll_y;
+
+    uint64_t time; // When the frame started, in eva_time_now() units
+} eva_input_state;
+
 /**
  * @brief The function pointer type for the initialization callback.
  *
@@ -294,6 +487,31 @@ typedef void(*eva_fail_fn)(int32_t error_code, const char *error_string);
  */
 typedef void(*eva_frame_fn)(const eva_framebuffer* fb);
 
+/**
+ * @brief The function pointer type for tiled frame callbacks.
+ *
+ * This is the function pointer type for tiled frame callbacks. It has the
+ * following signature:
+ * @code
+ * void tile_frame(const eva_framebuffer *tile, eva_rect rect);
+ * @endcode
+ *
+ * @param[in] tile A view of the framebuffer that covers only the tile. Its
+ * pixels point at the top left pixel of the tile, w and h are the size of the
+ * tile and the pitch is the pitch of the full framebuffer.
+ * @param[in] rect The position and size of the tile within the full
+ * framebuffer. Drawing at (x - rect.x, y - rect.y) in the tile draws at (x, y)
+ * in the framebuffer.
+ *
+ * The callback is called from several threads at once, each call drawing a
+ * different tile. It must only write to the pixels of its tile.
+ *
+ * @see @ref eva_set_tile_frame_fn
+ *
+ * @ingroup drawing
+ */
+typedef void(*eva_tile_frame_fn)(const eva_framebuffer *tile, eva_rect rect);
+
 /**
  * @brief The function pointer type for mouse moved event callbacks.
  *
@@ -360,6 +578,40 @@ typedef void(*eva_mouse_dragged_fn)(double x, double y, eva_mouse_btn);
 typedef void(*eva_mouse_btn_fn)(double x, double y, 
                                 eva_mouse_btn btn, eva_input_action action);
 
+/**
+ * @brief A pointer position reported by the window system.
+ *
+ * @see @ref eva_pointer_batch_fn
+ *
+ * @ingroup input
+ */
+typedef struct eva_pointer_sample {
+    double   x;       // Relative to the left of the window's content area
+    double   y;       // Relative to the top of the window's content area
+    uint32_t buttons; // A bit for each held button, 1 << EVA_MOUSE_BTN_LEFT...
+    uint64_t time;    // When the window system saw it, in eva_time_now() units
+} eva_pointer_sample;
+
+/**
+ * @brief The function pointer type for pointer sample batch callbacks.
+ *
+ * This is the function pointer type for pointer sample batch callbacks. It
+ * has the following signature:
+ * @code
+ * void pointer_batch(const eva_pointer_sample *samples, uint32_t count);
+ * @endcode
+ *
+ * @param[in] samples Every pointer position and button change since the last
+ * batch, oldest first. Only valid during the callback.
+ * @param[in] count The number of samples, never 0.
+ *
+ * @see @ref eva_set_pointer_batch_fn
+ *
+ * @ingroup input
+ */
+typedef void(*eva_pointer_batch_fn)(const eva_pointer_sample *samples,
+                                    uint32_t count);
+
 /**
  * @brief The function pointer type for scroll event callbacks.
  *
@@ -400,6 +652,17 @@ typedef void(*eva_scroll_fn)(double delta_x, double delta_y);
 typedef void(*eva_key_fn)(eva_key key, eva_input_action action,
                           eva_mod_flags mod);
 
+/**
+ * @brief The most UTF-16 characters a text input callback is called with.
+ *
+ * Longer text, e.g. a large paste, is handed over in several calls, without
+ * splitting characters. The UTF-8 callback gets at most 3 bytes for each of
+ * them.
+ *
+ * @ingroup input
+ */
+#define EVA_TEXT_INPUT_CHUNK 16384
+
 /**
  * @brief The function pointer type for the unicode text input event callback.
  *
@@ -411,7 +674,8 @@ typedef void(*eva_key_fn)(eva_key key, eva_input_action action,
  *
  * @param[in] utf8_text The UTF16 encoded text that was input via key-presses or
  * via paste.
- * @param[in] len The length of the text in UTF16 characters.
+ * @param[in] len The length of the text in UTF16 characters, at most
+ * EVA_TEXT_INPUT_CHUNK.
  * @param[in] mod The [modifier keys](/ref eva_mod_flags) that were active at
  * the time the text input occurred.
  *
@@ -422,6 +686,29 @@ typedef void(*eva_key_fn)(eva_key key, eva_input_action action,
 typedef void(*eva_text_input_fn)(const uint16_t *utf16_text, uint32_t len,
                                  eva_mod_flags mod);
 
+/**
+ * @brief The function pointer type for the UTF-8 text input event callback.
+ *
+ * This is the function pointer type for the UTF-8 text input event callback.
+ * It has the following signature:
+ * @code
+ * void text_input_utf8(const char* utf8_text, uint32_t len, eva_mod_flags mods);
+ * @endcode
+ *
+ * @param[in] utf8_text The UTF-8 encoded text that was input via key-presses
+ * or via paste. Not null terminated and only valid during the callback.
+ * @param[in] len The length of the text in bytes, at most
+ * 3 * EVA_TEXT_INPUT_CHUNK.
+ * @param[in] mod The [modifier keys](/ref eva_mod_flags) that were active at
+ * the time the text input occurred.
+ *
+ * @see @ref eva_set_text_input_utf8_fn
+ *
+ * @ingroup input
+ */
+typedef void(*eva_text_input_utf8_fn)(const char *utf8_text, uint32_t len,
+                                      eva_mod_flags mod);
+
 /**
  * @brief The function pointer type for the window resize callback.
  *
@@ -441,6 +728,36 @@ typedef void(*eva_text_input_fn)(const uint16_t *utf16_text, uint32_t len,
 typedef void(*eva_window_resize_fn)(uint32_t framebuffer_width, 
                                     uint32_t framebuffer_height);
 
+/**
+ * @brief The function pointer type for events posted with eva_post_event().
+ *
+ * @code
+ * void posted(void *userdata);
+ * @endcode
+ *
+ * @see @ref eva_post_event
+ */
+typedef void(*eva_post_fn)(void *userdata);
+
+/**
+ * @brief A timer set with eva_set_timer().
+ */
+typedef struct eva_timer eva_timer;
+
+/**
+ * @brief The function pointer type for timers set with eva_set_timer().
+ *
+ * @code
+ * void timer_fired(eva_timer *timer, void *userdata);
+ * @endcode
+ *
+ * @param[in] timer The timer, which may be canceled from its own callback.
+ * @param[in] userdata The userdata passed to eva_set_timer().
+ *
+ * @see @ref eva_set_timer
+ */
+typedef void(*eva_timer_fn)(eva_timer *timer, void *userdata);
+
 /**
  * Start the application. This will create a window with high-dpi support
  * if possible. The provided event function is resposible for populating
@@ -465,6 +782,439 @@ void eva_run(const char     *window_title,
  */
 void eva_request_frame(void);
 
+/**
+ * @brief Request that a frame be drawn but only present the given rectangle.
+ *
+ * Behaves like [eva_request_frame](@ref eva_request_frame) but tells eva that
+ * only the pixels inside the rectangle changed. All rectangles requested
+ * before the frame is drawn are merged and only their union is uploaded to
+ * the screen. The rest of the window keeps showing the previous frame, so the
+ * [frame callback](@ref eva_frame_fn) must not change pixels outside of the
+ * requested rectangles.
+ *
+ * A call to [eva_request_frame](@ref eva_request_frame) in the same event, or
+ * a frame triggered by the window system (e.g. a resize), presents the entire
+ * framebuffer.
+ *
+ * The rectangle is clipped to the framebuffer.
+ *
+ * @ingroup draw
+ */
+void eva_request_frame_rect(int32_t x, int32_t y, int32_t w, int32_t h);
+
+/**
+ * @brief Call fn with userdata on the event loop, from any thread.
+ *
+ * Lets worker threads hand results to the application: fn runs on the thread
+ * that runs eva_run(), between window system events, in the order the
+ * events were posted. Posting is lock-free and never blocks, a posting
+ * thread only wakes the event loop when it was idle. Events posted by fn are
+ * called on the next iteration of the loop. Events posted while eva_run()
+ * isn't running are called once it starts.
+ *
+ * While eva_run() runs, from the [init callback](@ref eva_init_fn) on,
+ * [eva_request_frame](@ref eva_request_frame) and
+ * [eva_request_frame_rect](@ref eva_request_frame_rect) may also be called
+ * from any thread, they are handed to the event loop the same way.
+ *
+ * @return false if the event could not be allocated.
+ */
+bool eva_post_event(eva_post_fn fn, void *userdata);
+
+/**
+ * @brief Call fn with userdata after delay_ms, and every period_ms after that.
+ *
+ * For periodic work like blinking a text cursor, polling or debouncing a
+ * relayout without requesting frames to get called back. The event loop
+ * sleeps until the earliest timer is due and calls it between window system
+ * events, so a timer is never called early but can be late while the
+ * application is busy. Periods missed that way are skipped.
+ *
+ * A timer with a period_ms of 0 fires once and is destroyed after its
+ * callback returns, a periodic timer until it is canceled. Setting and
+ * canceling a timer take constant time no matter how many timers there are.
+ *
+ * Timers are set and canceled on the thread that runs eva_run(), other
+ * threads can set them from an event posted with
+ * [eva_post_event](@ref eva_post_event). Timers that are left when eva_run()
+ * returns are destroyed.
+ *
+ * @return The timer, or NULL if it could not be allocated.
+ */
+eva_timer *eva_set_timer(double delay_ms, double period_ms, eva_timer_fn fn,
+                         void *userdata);
+
+/**
+ * @brief Cancel a timer so it is not called again and destroy it.
+ *
+ * A one-shot timer can only be canceled until its callback returns. NULL is
+ * ignored.
+ */
+void eva_cancel_timer(eva_timer *timer);
+
+/**
+ * @brief Scroll the pixels inside a rectangle and request a frame for them.
+ *
+ * Moves the pixels of the framebuffer inside rect by dx, dy in place, see
+ * eva_draw_scroll(), and returns the area that was exposed by the move. Only
+ * the exposed area has to be redrawn, typically from a scroll callback:
+ *
+ * @code
+ * eva_rect strip = eva_scroll_region(view, 0, -rows * line_height);
+ * // Draw the new lines into strip, now or in the frame callback.
+ * @endcode
+ *
+ * A frame is requested for the rectangle. When nothing inside it is waiting
+ * to be presented the X11, Windows and headless backends move the pixels on
+ * screen as well and only upload the exposed area, the other backends upload
+ * the whole rectangle.
+ *
+ * With a [pipeline](@ref eva_set_pipeline) nothing is moved and the whole
+ * rectangle is returned, scroll the framebuffer passed to the frame callback
+ * with eva_draw_scroll() instead.
+ *
+ * @ingroup draw
+ */
+eva_rect eva_scroll_region(eva_rect rect, int32_t dx, int32_t dy);
+
+/**
+ * @brief An offscreen surface composited on top of the framebuffer.
+ *
+ * Layers hold content that changes independently of the rest of the window,
+ * e.g. a text cursor, a hover highlight or a tooltip. Each layer keeps its
+ * own pixels, which are only drawn when they change. Before a frame is
+ * presented eva composites the visible layers over the framebuffer, only
+ * where something changed.
+ *
+ * While any layer exists the [frame callback](@ref eva_frame_fn) draws into
+ * a cached copy of the framebuffer. Frames that only changed layers don't
+ * call it at all: the changed area is composited again from the cached copy.
+ *
+ * Layers are used from the thread that runs the event callbacks. They are
+ * not composited with a [pipeline](@ref eva_set_pipeline).
+ *
+ * @see @ref eva_layer_create
+ *
+ * @ingroup draw
+ */
+typedef struct eva_layer eva_layer;
+
+/**
+ * @brief Create a layer of w x h pixels.
+ *
+ * The layer starts out transparent and visible at 0, 0 with an opacity of 255
+ * and a z order of 0, on top of the layers created before it with the same z
+ * order.
+ *
+ * @return NULL if the pixels could not be allocated.
+ *
+ * @ingroup draw
+ */
+eva_layer *eva_layer_create(uint32_t w, uint32_t h);
+
+/**
+ * @brief Destroy a layer, uncovering the framebuffer below it.
+ *
+ * Layers that are left when [eva_run](@ref eva_run) returns are destroyed.
+ *
+ * @ingroup draw
+ */
+void eva_layer_destroy(eva_layer *layer);
+
+/**
+ * @brief The pixels of a layer.
+ *
+ * The pixels are BGRA8 with premultiplied alpha, like the source of
+ * eva_draw_blit(). They are kept between frames. After drawing into them
+ * call [eva_layer_invalidate](@ref eva_layer_invalidate) for what changed.
+ *
+ * @ingroup draw
+ */
+eva_framebuffer eva_layer_get_framebuffer(const eva_layer *layer);
+
+/**
+ * @brief Composite a rectangle of a layer again.
+ *
+ * The rectangle is in layer pixels and clipped to the layer. A frame is
+ * requested for the part of the window it covers.
+ *
+ * @ingroup draw
+ */
+void eva_layer_invalidate(eva_layer *layer, eva_rect rect);
+
+/**
+ * @brief Move the top left corner of a layer to x, y of the framebuffer.
+ *
+ * @ingroup draw
+ */
+void eva_layer_set_position(eva_layer *layer, int32_t x, int32_t y);
+
+/**
+ * @brief Fade a layer, 0 is invisible and 255 draws it as is.
+ *
+ * @ingroup draw
+ */
+void eva_layer_set_opacity(eva_layer *layer, uint8_t opacity);
+
+/**
+ * @brief Set the order layers are composited in, higher z is on top.
+ *
+ * @ingroup draw
+ */
+void eva_layer_set_z(eva_layer *layer, int32_t z);
+
+/**
+ * @brief Show or hide a layer.
+ *
+ * @ingroup draw
+ */
+void eva_layer_set_visible(eva_layer *layer, bool visible);
+
+/**
+ * @brief Draw at most one frame per display refresh.
+ *
+ * By default a frame is drawn at the end of every event that requested one.
+ * With coalescing enabled eva first handles every pending event and then
+ * draws a single frame for all of them, no more often than the display
+ * refreshes. This avoids drawing frames that would never be shown, e.g. when
+ * a high rate mouse sends many more move events than the display can show
+ * during a drag.
+ *
+ * Disabled by default.
+ *
+ * @ingroup draw
+ */
+void eva_set_coalesce_frames(bool coalesce);
+
+/**
+ * @brief Draw frames continuously at a steady rate.
+ *
+ * With a rate set the [frame callback](@ref eva_frame_fn) is called on a
+ * steady cadence without the application having to request frames. The
+ * rate is capped to the refresh rate of the display, pass
+ * @ref EVA_FRAME_RATE_DISPLAY to draw a frame for every display refresh. The
+ * headless backend paces frames with its clock instead of a display.
+ *
+ * Continuous frames present the whole framebuffer. Frames requested from
+ * event callbacks are folded into the next continuous frame, use
+ * [eva_get_frame_timing](@ref eva_get_frame_timing) to animate.
+ *
+ * Pass 0 to go back to drawing only requested frames, which is the default.
+ *
+ * @ingroup draw
+ */
+void eva_set_frame_rate(uint32_t hz);
+
+/**
+ * @brief The timing of the frame currently being drawn.
+ *
+ * Only meaningful when called from the
+ * [frame callback](@ref eva_frame_fn).
+ *
+ * @ingroup draw
+ */
+eva_frame_timing eva_get_frame_timing(void);
+
+/**
+ * @brief Render frames on a dedicated thread.
+ *
+ * With a pipeline the [frame callback](@ref eva_frame_fn) renders the next
+ * frame on a render thread into one of buffer_count framebuffers while the
+ * previous frame is presented, so rendering and presenting overlap instead
+ * of alternating. Each framebuffer is brought up to date with the last
+ * frame before it is rendered, so the frame callback sees the same
+ * persistent framebuffer as without a pipeline. A frame requested while the
+ * render thread is busy is drawn once it is done.
+ *
+ * The frame callback runs on the render thread while the event callbacks
+ * keep running on the main thread, the application has to synchronize the
+ * state they share. Only the frame callback may draw, writing to
+ * eva_get_framebuffer() from event callbacks isn't supported.
+ *
+ * buffer_count is clamped to [2, EVA_MAX_PIPELINE_BUFFERS], 3 allows one
+ * frame to wait for the display while the next is rendered. Pass 0 to render
+ * on the main thread, which is the default. Must be called before eva_run().
+ *
+ * @ingroup draw
+ */
+void eva_set_pipeline(uint32_t buffer_count);
+
+/**
+ * @brief Choose the format of the framebuffer the application draws into.
+ *
+ * With a compact format the [frame callback](@ref eva_frame_fn) and
+ * eva_get_framebuffer() see a framebuffer in that format, eva keeps the
+ * native one to itself and converts the damaged area into it with SIMD
+ * before every present. Monochrome and terminal style applications draw 2
+ * to 4 times fewer bytes this way. Must be called before eva_run().
+ *
+ * @ingroup draw
+ */
+void eva_set_pixel_format(eva_pixel_format format);
+
+/**
+ * @brief Set colors of the palette used by EVA_PIXEL_FORMAT_INDEXED8.
+ *
+ * Sets count entries starting at first, entries past 255 are ignored. The
+ * palette starts out as a gray ramp. Changing it doesn't change what is on
+ * screen until the affected area is presented again, request a frame after
+ * changing it. With a [pipeline](@ref eva_set_pipeline) only call this from
+ * the frame callback.
+ *
+ * @ingroup draw
+ */
+void eva_set_palette(const eva_pixel *colors, uint32_t first, uint32_t count);
+
+/**
+ * @brief Only present the parts of the framebuffer whose pixels changed.
+ *
+ * The framebuffer is split into 64x64 pixel tiles and the damaged ones are
+ * hashed with SIMD after every frame. Tiles that hash the same as when they
+ * were last presented are left out of the present and when none changed the
+ * present is skipped entirely. Helps applications that request more than
+ * they redraw, e.g. full frames for a blinking cursor, without changes to
+ * them. Backends present one rectangle, the bounding box of the changed
+ * tiles. Hashing reads the damaged area once, which is cheaper than
+ * uploading it. Off by default.
+ *
+ * @ingroup draw
+ */
+void eva_set_content_hashing(bool enabled);
+
+/**
+ * @brief Pad the framebuffer pitch to avoid cache set aliasing.
+ *
+ * Rows of the framebuffer always start on a 64 byte cache line. When the row
+ * stride is a multiple of 4 KB, e.g. for a 5120 pixel wide screen, every row
+ * maps to the same cache sets and drawing down a column evicts its own
+ * lines. With padding such pitches grow by one cache line. Off by default,
+ * must be called before eva_run().
+ *
+ * @ingroup draw
+ */
+void eva_set_framebuffer_padding(bool enabled);
+
+/**
+ * @brief Back the framebuffer with huge pages.
+ *
+ * A 5K framebuffer spans over 14000 regular 4 KB pages but only 29 huge 2 MB
+ * pages, which takes most of the TLB misses out of full frame fills and
+ * copies. Only has an effect on Linux, the other platforms use regular
+ * pages. Falls back to regular pages when the kernel has no huge pages
+ * available. Must be called before eva_run().
+ *
+ * @ingroup draw
+ */
+void eva_set_huge_pages(eva_huge_pages mode);
+
+/**
+ * @brief Statistics for the most recent frames.
+ *
+ * The returned buffer is owned by eva and updated after every frame, copy
+ * what is needed before returning to eva. Works the same with every backend
+ * so it can be fed into telemetry directly.
+ *
+ * @ingroup draw
+ */
+const eva_frame_stats *eva_get_frame_stats(void);
+
+/**
+ * @brief Record every event eva dispatches into a log at path.
+ *
+ * Mouse, scroll, key, text input and resize events are written with their
+ * time right before they are dispatched, along with every frame request. The
+ * log takes a few bytes per event and is written in blocks, so recording a
+ * session from the field costs next to nothing. It can be replayed through
+ * the same callbacks with eva_headless_replay() to get repeatable frame
+ * times, see eva_get_frame_stats().
+ *
+ * A recording already in progress is stopped first. Call it from the init
+ * callback to include the size of the window in the log.
+ *
+ * @return false if the file could not be created.
+ *
+ * @ingroup input
+ */
+bool eva_record_start(const char *path);
+
+/**
+ * @brief Stop recording and close the log. Also happens when eva_run()
+ * returns.
+ *
+ * @return false if the log could not be written completely.
+ *
+ * @ingroup input
+ */
+bool eva_record_stop(void);
+
+/**
+ * @brief File formats of eva_capture_start().
+ */
+typedef enum eva_capture_format {
+    /** A YUV4MPEG2 video, 4:4:4 at a nominal 60 Hz, that ffmpeg and most
+     * players read. Frames of another size than the first are cropped or
+     * padded. */
+    EVA_CAPTURE_Y4M,
+    /** Frames as raw rows of eva_pixel, one after another. path.csv indexes
+     * them with the frame number, its time in microseconds since the capture
+     * started, the byte offset and the size. */
+    EVA_CAPTURE_BGRA,
+    /** The next frame as a QOI image, see https://qoiformat.org. */
+    EVA_CAPTURE_QOI,
+    /** The next frame as an uncompressed PNG image. */
+    EVA_CAPTURE_PNG,
+} eva_capture_format;
+
+/**
+ * @brief Frames handled by the current or last capture.
+ *
+ * @see @ref eva_capture_get_stats
+ */
+typedef struct eva_capture_stats {
+    /** Frames written to the file. */
+    uint64_t frames;
+
+    /** Frames that were skipped because the encoder fell behind. */
+    uint64_t dropped;
+} eva_capture_stats;
+
+/**
+ * @brief Write the frames eva presents to a file.
+ *
+ * Each frame is copied once the frame callback is done and encoded on a
+ * background thread, so capturing doesn't hold up the event loop. Only what
+ * changed since a frame buffer was last used is copied. When the encoder
+ * falls behind by a few frames new ones are dropped instead of waited for,
+ * see eva_capture_get_stats(). The image formats capture only the next
+ * frame.
+ *
+ * A capture already in progress is stopped first.
+ *
+ * @return false if the file could not be created.
+ *
+ * @ingroup draw
+ */
+bool eva_capture_start(const char *path, eva_capture_format format);
+
+/**
+ * @brief Encode the frames that are left and close the file. Also happens
+ * when eva_run() returns.
+ *
+ * @return false if the file could not be written completely, or no image
+ * was captured.
+ *
+ * @ingroup draw
+ */
+bool eva_capture_stop(void);
+
+/**
+ * @brief Statistics of the current capture, or of the last one once it is
+ * stopped.
+ *
+ * @ingroup draw
+ */
+eva_capture_stats eva_capture_get_stats(void);
+
 // TODO: Formalizae the idea of content/client area vs window area
 uint32_t eva_get_window_width(void);
 uint32_t eva_get_window_height(void);
@@ -518,6 +1268,26 @@ void eva_set_cancel_quit_fn(eva_cancel_quit_fn cancel_quit_fn);
  */
 void eva_set_mouse_moved_fn(eva_mouse_moved_fn mouse_moved_fn);
 
+/**
+ * @brief Sets a function to be called with the pointer samples of a frame.
+ *
+ * Drawing and handwriting applications need every position the pointer
+ * went through, not one callback for each of them. The samples are
+ * collected as the window system reports them, including the positions it
+ * coalesced when it keeps them (on Windows), and handed over in one batch
+ * right before the next frame is drawn, or once the pending events are
+ * handled when no frame is waiting. Requesting a frame from the callback
+ * draws it right away.
+ *
+ * The mouse moved and mouse button callbacks are still called. Pass NULL to
+ * stop collecting samples.
+ *
+ * See @ref eva_pointer_batch_fn
+ *
+ * @ingroup input
+ */
+void eva_set_pointer_batch_fn(eva_pointer_batch_fn pointer_batch_fn);
+
 /** 
  * @brief Sets a function to be called scrolling takes place.
  *
@@ -559,6 +1329,58 @@ void eva_set_key_fn(eva_key_fn key_fn);
  */
 void eva_set_text_input_fn(eva_text_input_fn text_input_fn);
 
+/**
+ * @brief Sets a function to be called with text input as UTF-8.
+ *
+ * The same text as for the [UTF-16 callback](@ref eva_set_text_input_fn),
+ * which can be set as well, converted by eva instead of the application.
+ * Window systems that report UTF-8 (X11 and Wayland) hand it over as it is.
+ *
+ * See @ref eva_text_input_utf8_fn
+ *
+ * @ingroup input
+ */
+void eva_set_text_input_utf8_fn(eva_text_input_utf8_fn text_input_utf8_fn);
+
+/**
+ * @brief Get the input state at the start of the current frame.
+ *
+ * The state is taken right before the frame callback is called, so a frame
+ * can poll the keys and buttons it cares about instead of tracking them in
+ * event callbacks. It covers every event, whether or not a callback is set
+ * for it. From event callbacks it is the state at the start of the last
+ * frame.
+ *
+ * The state is kept until the next frame starts and can be read from the
+ * frame callback on any thread.
+ *
+ * See @ref eva_input_state
+ *
+ * @ingroup input
+ */
+const eva_input_state *eva_get_input_state(void);
+
+/**
+ * @brief Whether a key is held in an input state.
+ *
+ * @ingroup input
+ */
+bool eva_key_down(const eva_input_state *state, eva_key key);
+
+/**
+ * @brief Whether a key was pressed since the frame before an input state.
+ *
+ * @ingroup input
+ */
+bool eva_key_pressed(const eva_input_state *state, eva_key key);
+
+/**
+ * @brief Whether a key was released since the frame before an input state.
+ *
+ * @ingroup input
+ */
+bool eva_key_released(const eva_input_state *state, eva_key key);
+
 /** 
  * @brief Sets a function to be called when the window is resized.
  *
@@ -571,6 +1393,31 @@ void eva_set_text_input_fn(eva_text_input_fn text_input_fn);
  */
 void eva_set_window_resize_fn(eva_window_resize_fn window_resize_fn);
 
+/**
+ * @brief Draw frames in tiles spread across a pool of worker threads.
+ *
+ * When set the tile frame function replaces the
+ * [frame callback](@ref eva_frame_fn) passed to eva_run(). The framebuffer is
+ * split into tiles of tile_w x tile_h pixels and the callback is called once
+ * per tile from a pool with one thread per CPU core, the calling thread
+ * included. The frame is presented once all tiles are drawn.
+ *
+ * Only the tiles that touch the rectangles passed to
+ * [eva_request_frame_rect](@ref eva_request_frame_rect) are drawn.
+ *
+ * Pass 0 for tile_w or tile_h to use the default of 128x64 pixels, which fits
+ * in the L1/L2 cache of most CPUs. tile_w is rounded up to whole 64 byte
+ * cache lines of the [pixel format](@ref eva_set_pixel_format), 16 pixels
+ * of BGRA8 or 64 of GRAY8, so tiles never share a cache line. Pass NULL to
+ * go back to the single threaded frame callback.
+ *
+ * See @ref eva_tile_frame_fn
+ *
+ * @ingroup drawing
+ */
+void eva_set_tile_frame_fn(eva_tile_frame_fn tile_frame_fn,
+                           uint32_t tile_w, uint32_t tile_h);
+
 /**
  * Initialize the time subsystem.
  */
@@ -0,0 +1,209 @@
+#define _GNU_SOURCE // MAP_HUGETLB, MADV_HUGEPAGE
+
+#include "eva_internal.h"
+#include "eva_thread.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+// Mapped pixels start right at the mapping so they are page aligned. Their
+// lengths are kept on the side for eva_alloc_free(), pixels that aren't
+// listed come from the heap.
+typedef struct eva_alloc_map {
+    void                 *base;
+    size_t                size;
+    struct eva_alloc_map *next;
+} eva_alloc_map;
+
+typedef struct eva_alloc_ctx {
+    bool           padding;
+    eva_huge_pages huge_pages;
+
+#if defined(__linux__)
+    // Framebuffers are allocated and freed by more than one thread, rarely
+    // enough for a spin lock.
+    volatile uint32_t maps_lock;
+    eva_alloc_map    *maps;
+#endif
+} eva_alloc_ctx;
+
+static eva_alloc_ctx _alloc;
+
+void eva_set_framebuffer_padding(bool enabled)
+{
+    _alloc.padding = enabled;
+}
+
+void eva_set_huge_pages(eva_huge_pages mode)
+{
+    _alloc.huge_pages = mode;
+}
+
+eva_huge_pages eva_alloc_huge_pages(void)
+{
+    return _alloc.huge_pages;
+}
+
+uint32_t eva_alloc_pitch(uint32_t w)
+{
+    const uint32_t line_pixels = EVA_CACHE_LINE / sizeof(eva_pixel);
+
+    uint32_t pitch = (w + line_pixels - 1) / line_pixels * line_pixels;
+
+    // Rows a multiple of 4 KB apart map to the same cache sets, an extra
+    // line shifts every row onto different ones.
+    if (_alloc.padding && pitch != 0 &&
+        (pitch * sizeof(eva_pixel)) % 4096 == 0) {
+        pitch += line_pixels;
+    }
+    return pitch;
+}
+
+size_t eva_alloc_huge_size(size_t size)
+{
+    return (size + EVA_HUGE_PAGE_SIZE - 1) / EVA_HUGE_PAGE_SIZE *
+           EVA_HUGE_PAGE_SIZE;
+}
+
+#if defined(__linux__)
+static void lock_maps(void)
+{
+    while (eva_atomic_exchange_u32(&_alloc.maps_lock, 1) != 0) {
+    }
+}
+
+static void unlock_maps(void)
+{
+    eva_atomic_store_u32(&_alloc.maps_lock, 0);
+}
+
+// Maps size bytes, zeroed by the kernel as the pages are first touched
+// instead of all at once by memset().
+static void *map_pixels(size_t size, size_t *map_size)
+{
+    if (_alloc.huge_pages == EVA_HUGE_PAGES_OFF) {
+        void *base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) {
+            return NULL;
+        }
+        *map_size = size;
+        return base;
+    }
+
+    size_t huge_size = eva_alloc_huge_size(size);
+
+    if (_alloc.huge_pages == EVA_HUGE_PAGES_EXPLICIT) {
+        void *base = mmap(NULL, huge_size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (base != MAP_FAILED) {
+            *map_size = huge_size;
+            return base;
+        }
+        // No huge pages are reserved, try transparent ones instead.
+    }
+
+    // Transparent huge pages are only used for aligned 2 MB ranges, so map
+    // one page more than needed and trim the ends.
+    size_t   padded = huge_size + EVA_HUGE_PAGE_SIZE;
+    uint8_t *map    = mmap(NULL, padded, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    uintptr_t addr    = (uintptr_t)map;
+    uintptr_t aligned = (addr + EVA_HUGE_PAGE_SIZE - 1) &
+                        ~(uintptr_t)(EVA_HUGE_PAGE_SIZE - 1);
+    size_t head = aligned - addr;
+    size_t tail = padded - head - huge_size;
+    if (head) {
+        munmap(map, head);
+    }
+    if (tail) {
+        munmap((uint8_t *)aligned + huge_size, tail);
+    }
+
+    madvise((void *)aligned, huge_size, MADV_HUGEPAGE);
+    *map_size = huge_size;
+    return (void *)aligned;
+}
+#endif
+
+eva_pixel *eva_alloc_pixels(uint32_t pitch, uint32_t height)
+{
+    size_t size = (size_t)pitch * height * sizeof(eva_pixel);
+
+#if defined(__linux__)
+    // Smaller buffers fit in a few pages and aren't worth a mapping.
+    if (size >= EVA_HUGE_PAGE_SIZE) {
+        size_t map_size;
+        void  *base = map_pixels(size, &map_size);
+        eva_alloc_map *map = base ? malloc(sizeof(*map)) : NULL;
+        if (map) {
+            map->base = base;
+            map->size = map_size;
+            lock_maps();
+            map->next   = _alloc.maps;
+            _alloc.maps = map;
+            unlock_maps();
+            return base;
+        }
+        if (base) {
+            munmap(base, map_size);
+        }
+    }
+#endif
+
+    void *base;
+#if defined(_WIN32)
+    base = _aligned_malloc(size ? size : 1, EVA_CACHE_LINE);
+#else
+    if (posix_memalign(&base, EVA_CACHE_LINE, size ? size : 1) != 0) {
+        base = NULL;
+    }
+#endif
+    if (base == NULL) {
+        return NULL;
+    }
+    memset(base, 0, size);
+    return base;
+}
+
+void eva_alloc_free(eva_pixel *pixels)
+{
+    if (pixels == NULL) {
+        return;
+    }
+
+#if defined(__linux__)
+    eva_alloc_map *map = NULL;
+    lock_maps();
+    for (eva_alloc_map **link = &_alloc.maps; *link; link = &(*link)->next) {
+        if ((*link)->base == (void *)pixels) {
+            map   = *link;
+            *link = map->next;
+            break;
+        }
+    }
+    unlock_maps();
+
+    if (map) {
+        munmap(map->base, map->size);
+        free(map);
+        return;
+    }
+#endif
+
+#if defined(_WIN32)
+    _aligned_free(pixels);
+#else
+    free(pixels);
+#endif
+}
@@ -0,0 +1,50 @@
+#include "eva_internal.h"
+
+bool eva_frame_requested(eva_rect rect, bool pending)
+{
+    // Requests from other threads are handed to the event loop.
+    if (eva_post_request_frame(rect)) {
+        return false;
+    }
+
+    eva_stats_frame_requested(pending);
+    eva_layers_frame_requested();
+    eva_record_frame_request(rect);
+    return true;
+}
+
+void eva_frame_continuous(const eva_frame_pacer *pacer, bool *frame_requested,
+                          eva_rect *damage)
+{
+    // Continuous frames aren't requests of the application, they are
+    // neither recorded nor counted as coalesced.
+    if (pacer->interval) {
+        *frame_requested = true;
+        *damage          = EVA_RECT_FULL;
+    }
+}
+
+bool eva_frame_idle(const eva_frame_pacer *pacer, bool frame_requested)
+{
+    // Pointer samples wait for the frame that is coming, without one they
+    // are handed over now.
+    if (frame_requested || pacer->interval) {
+        return false;
+    }
+    eva_pointer_flush();
+    return true;
+}
+
+void eva_modules_shutdown(void)
+{
+    eva_tiles_shutdown();
+    eva_format_shutdown();
+    eva_layers_shutdown();
+    eva_hash_shutdown();
+    eva_timers_shutdown();
+    eva_pointer_shutdown();
+    eva_input_shutdown();
+    eva_text_input_shutdown();
+    eva_capture_stop();
+    eva_record_stop();
+}
@@ -0,0 +1,791 @@
+/**
+ * Benchmarks for the paths every frame goes through, at common display
+ * resolutions.
+ *
+ * The benchmarks run against the headless backend so they work on build
+ * machines without a display. Its present only records the damaged area, so
+ * frame times are the cost of eva's own frame path and present_copy times
+ * the copy between two framebuffers the shm backends do for a full frame;
+ * the windowed backends report their real present cost with
+ * eva_get_frame_stats().
+ *
+ * Results are printed as CSV, one measurement per line, so runs of two
+ * releases can be diffed or loaded into a spreadsheet:
+ *
+ *     benchmark,resolution,width,height,value,unit
+ *
+ * Usage: eva_bench [benchmark ...]
+ */
+
+#include "eva.h"
+#include "eva_draw.h"
+#include "eva_headless.h"
+#include "eva_internal.h"
+#include "eva_text.h"
+#include "eva_thread.h"
+#include "eva_trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_MIN_TIME_MS 300.0f
+#define BENCH_FRAMES      200
+#define BENCH_EVENTS      5000
+#define BENCH_RESIZES     100
+#define BENCH_POSTS       200000
+#define BENCH_TIMERS      100000
+#define BENCH_ZONES       1000000
+#define BENCH_RECORD_PATH "eva_bench.evarec"
+#define BENCH_TRACE_PATH  "eva_bench_trace.json"
+
+typedef struct bench_resolution {
+    const char *name;
+    uint32_t    w, h;
+} bench_resolution;
+
+static const bench_resolution resolutions[] = {
+    { "1080p", 1920, 1080 },
+    { "1440p", 2560, 1440 },
+    { "4k",    3840, 2160 },
+    { "5k",    5120, 2880 },
+};
+
+static const eva_pixel gray = { .b = 20, .g = 20, .r = 20, .a = 255 };
+static const eva_pixel red  = { .b = 0, .g = 0, .r = 255, .a = 255 };
+
+// Timestamps of the callback being measured, the first one starts the clock.
+typedef struct bench_marks {
+    uint64_t start;
+    uint64_t last;
+    uint32_t count;
+} bench_marks;
+
+static bench_marks _marks;
+
+static void mark(void)
+{
+    uint64_t now = eva_time_now();
+    if (_marks.count == 0) {
+        _marks.start = now;
+    }
+    _marks.last = now;
+    _marks.count++;
+}
+
+static double ns_per_mark(void)
+{
+    if (_marks.count < 2) {
+        return 0.0;
+    }
+    return (double)eva_time_ms(_marks.last - _marks.start) * 1e6 /
+           (double)(_marks.count - 1);
+}
+
+static void report(const char *benchmark, const bench_resolution *res,
+                   double value, const char *unit)
+{
+    printf("%s,%s,%u,%u,%.3f,%s\n",
+           benchmark, res->name, res->w, res->h, value, unit);
+    fflush(stdout);
+}
+
+static void fail(int32_t error_code, const char *error_string)
+{
+    fprintf(stderr, "eva_bench: %s (%d)\n", error_string, error_code);
+    exit(1);
+}
+
+// Runs a headless session of the given size. The events have to be posted
+// before, the session ends once they have all been dispatched.
+static void run_session(const bench_resolution *res, eva_frame_fn frame_fn)
+{
+    eva_headless_set_window_size(res->w, res->h, 1.0f, 1.0f);
+    eva_headless_set_screen_size(res->w, res->h);
+    memset(&_marks, 0, sizeof(_marks));
+
+    eva_run("eva_bench", frame_fn, fail);
+
+    eva_set_mouse_moved_fn(NULL);
+    eva_set_window_resize_fn(NULL);
+}
+
+static void frame_empty(const eva_framebuffer *fb)
+{
+    (void)fb;
+}
+
+static void frame_clear(const eva_framebuffer *fb)
+{
+    eva_draw_clear(fb, gray);
+}
+
+static void frame_clear_marked(const eva_framebuffer *fb)
+{
+    eva_draw_clear(fb, gray);
+    mark();
+}
+
+static void frame_marked(const eva_framebuffer *fb)
+{
+    (void)fb;
+    mark();
+}
+
+static void mouse_moved_marked(double x, double y)
+{
+    (void)x;
+    (void)y;
+    mark();
+}
+
+static void mouse_moved_request(double x, double y)
+{
+    eva_request_frame_rect((int32_t)x, (int32_t)y, 16, 16);
+}
+
+static void resize_marked(uint32_t w, uint32_t h)
+{
+    (void)w;
+    (void)h;
+    mark();
+    eva_request_frame();
+}
+
+static eva_framebuffer alloc_framebuffer(uint32_t w, uint32_t h)
+{
+    eva_framebuffer fb = {
+        .w = w,
+        .h = h,
+        .pitch = w,
+        .max_height = h,
+        .scale_x = 1.0f,
+        .scale_y = 1.0f,
+    };
+    fb.pixels = calloc((size_t)w * h, sizeof(eva_pixel));
+    if (!fb.pixels) {
+        fail(0, "Failed to allocate framebuffer");
+    }
+    return fb;
+}
+
+// A framebuffer allocated the way the backends allocate theirs.
+static eva_framebuffer alloc_eva_framebuffer(uint32_t w, uint32_t h)
+{
+    eva_framebuffer fb = {
+        .w = w,
+        .h = h,
+        .pitch = eva_alloc_pitch(w),
+        .max_height = h,
+        .scale_x = 1.0f,
+        .scale_y = 1.0f,
+    };
+    fb.pixels = eva_alloc_pixels(fb.pitch, fb.max_height);
+    if (!fb.pixels) {
+        fail(0, "Failed to allocate framebuffer");
+    }
+    return fb;
+}
+
+// Framebuffer memory written per second, in GB/s, by filling rect over and
+// over.
+static double fill_rate(const eva_framebuffer *fb, eva_rect rect)
+{
+    double bytes = (double)rect.w * rect.h * sizeof(eva_pixel);
+
+    // Warm up caches and the page tables.
+    eva_draw_fill_rect(fb, rect, red);
+
+    uint64_t iterations = 0;
+    uint64_t start = eva_time_now();
+    float elapsed_ms;
+    do {
+        eva_draw_fill_rect(fb, rect, iterations % 2 ? red : gray);
+        iterations++;
+        elapsed_ms = eva_time_since_ms(start);
+    } while (elapsed_ms < BENCH_MIN_TIME_MS);
+
+    return bytes * (double)iterations / (elapsed_ms / 1000.0) / 1e9;
+}
+
+// Framebuffer memory written per second by eva_draw_clear() and
+// eva_draw_fill_rect() over half the framebuffer.
+static void bench_fill(const bench_resolution *res)
+{
+    eva_framebuffer fb = alloc_framebuffer(res->w, res->h);
+    eva_rect full = { 0, 0, (int32_t)res->w, (int32_t)res->h };
+    eva_rect half = { 0, 0, (int32_t)res->w / 2, (int32_t)res->h };
+
+    report("clear",     res, fill_rate(&fb, full), "GB/s");
+    report("fill_rect", res, fill_rate(&fb, half), "GB/s");
+
+    free(fb.pixels);
+}
+
+typedef struct bench_alloc {
+    const char    *name;
+    bool           padding;
+    eva_huge_pages huge_pages;
+} bench_alloc;
+
+// The framebuffer allocations eva can make, compared against the plain
+// calloc() with pitch == width the backends used before.
+static const bench_alloc allocs[] = {
+    { "calloc",  false, EVA_HUGE_PAGES_OFF         },
+    { "aligned", false, EVA_HUGE_PAGES_OFF         },
+    { "padded",  true,  EVA_HUGE_PAGES_OFF         },
+    { "thp",     false, EVA_HUGE_PAGES_TRANSPARENT },
+    { "hugetlb", false, EVA_HUGE_PAGES_EXPLICIT    },
+};
+
+// Full frame fills into each kind of framebuffer allocation: the first one,
+// which faults the pages in, later ones, and a 16 pixel wide column that
+// walks down the rows and suffers most from cache set aliasing.
+static void bench_alloc_fill(const bench_resolution *res)
+{
+    eva_rect full   = { 0, 0, (int32_t)res->w, (int32_t)res->h };
+    eva_rect column = { 0, 0, 16, (int32_t)res->h };
+    char name[64];
+
+    for (size_t a = 0; a < sizeof(allocs) / sizeof(allocs[0]); a++) {
+        const bench_alloc *alloc = &allocs[a];
+        bool plain = a == 0;
+
+        eva_set_framebuffer_padding(alloc->padding);
+        eva_set_huge_pages(alloc->huge_pages);
+
+        eva_framebuffer fb = plain ?
+                             alloc_framebuffer(res->w, res->h) :
+                             alloc_eva_framebuffer(res->w, res->h);
+
+        uint64_t start = eva_time_now();
+        eva_draw_clear(&fb, gray);
+        double first_s = (double)eva_time_since_ms(start) / 1000.0;
+
+        snprintf(name, sizeof(name), "first_clear_%s", alloc->name);
+        report(name, res,
+               (double)res->w * res->h * sizeof(eva_pixel) / first_s / 1e9,
+               "GB/s");
+        snprintf(name, sizeof(name), "clear_%s", alloc->name);
+        report(name, res, fill_rate(&fb, full), "GB/s");
+        snprintf(name, sizeof(name), "column_%s", alloc->name);
+        report(name, res, fill_rate(&fb, column), "GB/s");
+
+        if (plain) {
+            free(fb.pixels);
+        } else {
+            eva_alloc_free(fb.pixels);
+        }
+    }
+
+    eva_set_framebuffer_padding(false);
+    eva_set_huge_pages(EVA_HUGE_PAGES_OFF);
+}
+
+// Copies a full frame row by row into another framebuffer, the way the
+// Wayland backend brings a buffer up to date with the one last presented.
+static double present_copy_ns(const bench_resolution *res)
+{
+    eva_framebuffer src = alloc_eva_framebuffer(res->w, res->h);
+    eva_framebuffer dst = alloc_eva_framebuffer(res->w, res->h);
+    eva_draw_clear(&src, gray);
+    eva_draw_clear(&dst, red);
+
+    uint64_t iterations = 0;
+    uint64_t start = eva_time_now();
+    float elapsed_ms;
+    do {
+        for (uint32_t j = 0; j < res->h; j++) {
+            size_t offset = (size_t)j * src.pitch;
+            memcpy(dst.pixels + offset, src.pixels + offset,
+                   res->w * sizeof(eva_pixel));
+        }
+        iterations++;
+        elapsed_ms = eva_time_since_ms(start);
+    } while (elapsed_ms < BENCH_MIN_TIME_MS);
+
+    eva_alloc_free(src.pixels);
+    eva_alloc_free(dst.pixels);
+    return (double)elapsed_ms * 1e6 / (double)iterations;
+}
+
+// A full frame that clears the framebuffer, from one frame to the next, the
+// parts of it recorded by eva_get_frame_stats() and the copy a present
+// takes. The headless present itself only records the damage, its duration
+// is always 0.
+static void bench_present(const bench_resolution *res)
+{
+    for (uint32_t i = 0; i < BENCH_FRAMES; i++) {
+        eva_headless_post_frame(0);
+    }
+    eva_headless_post_close(0);
+    run_session(res, frame_clear_marked);
+
+    const eva_frame_stats *stats = eva_get_frame_stats();
+    double frame_ms = 0.0;
+    double bytes    = 0.0;
+    for (uint32_t i = 0; i < stats->count; i++) {
+        const eva_frame_stat *frame =
+            &stats->frames[(stats->first + i) % EVA_FRAME_STATS_LEN];
+        frame_ms += eva_time_ms(frame->frame_duration);
+        bytes    += (double)frame->bytes_copied;
+    }
+    double n = stats->count ? (double)stats->count : 1.0;
+
+    report("frame",         res, ns_per_mark(),         "ns");
+    report("frame_fn",      res, frame_ms * 1e6 / n,    "ns");
+    report("present_copy",  res, present_copy_ns(res),  "ns");
+    report("present_bytes", res, bytes / n,             "bytes");
+}
+
+// Dispatching an input event to the application, without and with it
+// requesting a small frame in response, and while recording the session.
+static void bench_dispatch(const bench_resolution *res)
+{
+    for (uint32_t i = 0; i < BENCH_EVENTS; i++) {
+        eva_headless_post_mouse_moved(0, i % res->w, i % res->h);
+    }
+    eva_headless_post_close(0);
+    eva_set_mouse_moved_fn(mouse_moved_marked);
+    run_session(res, frame_empty);
+    report("dispatch", res, ns_per_mark(), "ns");
+
+    for (uint32_t i = 0; i < BENCH_EVENTS; i++) {
+        eva_headless_post_mouse_moved(0, i % res->w, i % res->h);
+    }
+    eva_headless_post_close(0);
+    eva_set_mouse_moved_fn(mouse_moved_request);
+    run_session(res, frame_marked);
+    report("event_to_frame", res, ns_per_mark(), "ns");
+
+    // The same with every event and frame request written to a log.
+    for (uint32_t i = 0; i < BENCH_EVENTS; i++) {
+        eva_headless_post_mouse_moved(0, i % res->w, i % res->h);
+    }
+    eva_headless_post_close(0);
+    if (!eva_record_start(BENCH_RECORD_PATH)) {
+        fail(0, "Failed to create " BENCH_RECORD_PATH);
+    }
+    eva_set_mouse_moved_fn(mouse_moved_request);
+    run_session(res, frame_marked);
+    remove(BENCH_RECORD_PATH);
+    report("event_to_frame_recorded", res, ns_per_mark(), "ns");
+}
+
+// Resizes and the full redraw they cause. The first run stays within the
+// framebuffer, the second grows past it so every resize reallocates it in
+// update_window() and faults the new pages in when it is cleared.
+static void bench_resize(const bench_resolution *res)
+{
+    for (uint32_t i = 0; i < BENCH_RESIZES; i++) {
+        eva_headless_post_resize(0, res->w - 1 - i % 2, res->h);
+    }
+    eva_headless_post_close(0);
+    eva_set_window_resize_fn(resize_marked);
+    run_session(res, frame_clear);
+    report("resize", res, ns_per_mark(), "ns");
+
+    for (uint32_t i = 0; i < BENCH_RESIZES; i++) {
+        eva_headless_post_resize(0, res->w + 1 + i, res->h);
+    }
+    eva_headless_post_close(0);
+    eva_set_window_resize_fn(resize_marked);
+    run_session(res, frame_clear);
+    report("resize_realloc", res, ns_per_mark(), "ns");
+}
+
+// Stands in for a font rasterizer: antialiased rings, with 4 x 4 samples per
+// pixel, whose size depends on the codepoint.
+static bool bench_rasterize(uint32_t codepoint, float size, float offset_x,
+                            eva_glyph *glyph, void *userdata)
+{
+    static uint8_t coverage[64 * 64];
+    (void)userdata;
+
+    if (codepoint == ' ') {
+        glyph->advance = size * 0.3f;
+        return true;
+    }
+
+    uint32_t w = (uint32_t)(size * 0.6f) + 1;
+    uint32_t h = (uint32_t)(size * 0.7f) + codepoint % 3;
+    w = w > 64 ? 64 : w;
+    h = h > 64 ? 64 : h;
+
+    float cx = (float)w / 2.0f + offset_x;
+    float cy = (float)h / 2.0f;
+    float r  = (float)(w < h ? w : h) / 2.0f;
+    for (uint32_t y = 0; y < h; y++) {
+        for (uint32_t x = 0; x < w; x++) {
+            uint32_t hits = 0;
+            for (uint32_t sy = 0; sy < 4; sy++) {
+                for (uint32_t sx = 0; sx < 4; sx++) {
+                    float dx = (float)x + (sx + 0.5f) / 4.0f - cx;
+                    float dy = (float)y + (sy + 0.5f) / 4.0f - cy;
+                    float d2 = dx * dx + dy * dy;
+                    hits += d2 <= r * r && d2 >= r * r * 0.4f;
+                }
+            }
+            coverage[y * 64 + x] = (uint8_t)(hits * 255 / 16);
+        }
+    }
+
+    glyph->w        = w;
+    glyph->h        = h;
+    glyph->pitch    = 64;
+    glyph->left     = 0;
+    glyph->top      = (int32_t)h;
+    glyph->advance  = (float)w + 1.5f;
+    glyph->coverage = coverage;
+    return true;
+}
+
+// Time per glyph to fill the framebuffer with lines of 16 pixel text,
+// rasterizing every glyph and drawing from the glyph cache.
+static void bench_text(const bench_resolution *res)
+{
+    static const char line[] =
+        "The quick brown fox jumps over the lazy dog, 0123456789 times. ";
+    const size_t len = sizeof(line) - 1;
+
+    eva_framebuffer fb = alloc_framebuffer(res->w, res->h);
+    eva_font *font = eva_font_create(bench_rasterize, NULL);
+    eva_pixel white = { 255, 255, 255, 255 };
+
+    static const struct {
+        const char *name;
+        size_t      cache_size;
+    } caches[] = {
+        { "text_uncached", 0 },
+        { "text_cached",   1 << 20 },
+    };
+
+    for (size_t c = 0; c < sizeof(caches) / sizeof(caches[0]); c++) {
+        eva_text_set_cache_size(caches[c].cache_size);
+
+        uint64_t glyphs = 0;
+        uint64_t start = eva_time_now();
+        float elapsed_ms;
+        do {
+            for (uint32_t y = 16; y < res->h; y += 20) {
+                float x = 0.0f;
+                while (x < (float)res->w) {
+                    x = eva_text_draw(&fb, font, 16.0f, x, (float)y, white,
+                                      line, len);
+                    glyphs += len;
+                }
+            }
+            elapsed_ms = eva_time_since_ms(start);
+        } while (elapsed_ms < BENCH_MIN_TIME_MS);
+
+        report(caches[c].name, res,
+               (double)elapsed_ms * 1e6 / (double)glyphs, "ns");
+    }
+
+    eva_text_cache_stats stats;
+    eva_text_get_cache_stats(&stats);
+    report("text_cache_hit_rate", res,
+           (double)stats.hits / (double)(stats.hits + stats.misses), "ratio");
+
+    eva_font_destroy(font);
+    eva_text_clear_cache();
+    free(fb.pixels);
+}
+
+typedef struct bench_producer {
+    eva_thread thread;
+    uint32_t   posts;
+    uint64_t   duration; // eva_time_now() ticks spent posting
+} bench_producer;
+
+static bench_producer _producers[16];
+static uint32_t       _producer_count;
+static uint32_t       _posts_left;
+
+static void posted_marked(void *userdata)
+{
+    (void)userdata;
+    mark();
+    if (--_posts_left == 0) {
+        eva_headless_post_close(0);
+    }
+}
+
+static void produce(void *arg)
+{
+    bench_producer *producer = arg;
+    uint64_t start = eva_time_now();
+    for (uint32_t i = 0; i < producer->posts; i++) {
+        if (!eva_post_event(posted_marked, NULL)) {
+            fail(0, "Failed to post an event");
+        }
+    }
+    producer->duration = eva_time_since(start);
+}
+
+static void start_producers(void)
+{
+    for (uint32_t i = 0; i < _producer_count; i++) {
+        if (!eva_thread_create(&_producers[i].thread, produce, &_producers[i])) {
+            fail(0, "Failed to create a producer thread");
+        }
+    }
+}
+
+// Events posted from worker threads while the event loop dispatches them,
+// with an increasing number of threads contending for the queue. post is the
+// time per event the loop dispatched, post_call what a call to
+// eva_post_event() cost the posting thread. Neither depends on the
+// resolution so they only run once.
+static void bench_post(const bench_resolution *res)
+{
+    if (res != &resolutions[0]) {
+        return;
+    }
+
+    static const uint32_t threads[] = { 1, 2, 4, 8, 16 };
+    for (size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+        _producer_count = threads[t];
+        _posts_left     = BENCH_POSTS / _producer_count * _producer_count;
+        for (uint32_t i = 0; i < _producer_count; i++) {
+            _producers[i].posts    = BENCH_POSTS / _producer_count;
+            _producers[i].duration = 0;
+        }
+
+        eva_headless_set_keep_alive(true);
+        eva_set_init_fn(start_producers);
+        run_session(res, frame_empty);
+        eva_set_init_fn(NULL);
+        eva_headless_set_keep_alive(false);
+
+        double call_ms = 0.0;
+        for (uint32_t i = 0; i < _producer_count; i++) {
+            eva_thread_join(_producers[i].thread);
+            call_ms += eva_time_ms(_producers[i].duration);
+        }
+
+        char name[32];
+        snprintf(name, sizeof(name), "post_%u_threads", _producer_count);
+        report(name, res, ns_per_mark(), "ns");
+        snprintf(name, sizeof(name), "post_call_%u_threads", _producer_count);
+        report(name, res, call_ms * 1e6 / (BENCH_POSTS / _producer_count * _producer_count), "ns");
+    }
+}
+
+static eva_timer *_timers[BENCH_TIMERS];
+static uint32_t   _timers_fired;
+
+static void timer_counted(eva_timer *timer, void *userdata)
+{
+    (void)timer;
+    (void)userdata;
+    _timers_fired++;
+}
+
+// Deadlines spread over a minute so the timers are on every level of the
+// timer wheel that a minute reaches.
+static void set_timers(uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        double delay_ms = (double)(i * 7919u % 60000u) + (double)(i % 8) / 8.0;
+        _timers[i] = eva_set_timer(delay_ms, 0.0, timer_counted, NULL);
+        if (!_timers[i]) {
+            fail(0, "Failed to set a timer");
+        }
+    }
+}
+
+// Setting, canceling and calling timers, with more and more of them. Calling
+// them runs on the virtual clock, which jumps from one deadline to the next
+// instead of sleeping, so timer_fire is the time per timer the event loop
+// spends on its own. None of them depend on the resolution so they only
+// run once.
+static void bench_timer(const bench_resolution *res)
+{
+    if (res != &resolutions[0]) {
+        return;
+    }
+
+    static const uint32_t counts[] = { 1000, 10000, BENCH_TIMERS };
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        uint32_t count = counts[c];
+        char name[32];
+
+        uint64_t start = eva_time_now();
+        set_timers(count);
+        float set_ms = eva_time_since_ms(start);
+
+        start = eva_time_now();
+        for (uint32_t i = 0; i < count; i++) {
+            eva_cancel_timer(_timers[i]);
+        }
+        float cancel_ms = eva_time_since_ms(start);
+
+        eva_headless_set_clock(EVA_HEADLESS_CLOCK_VIRTUAL);
+        set_timers(count);
+        _timers_fired = 0;
+
+        eva_headless_set_clock(EVA_HEADLESS_CLOCK_REAL);
+        start = eva_time_now();
+        eva_headless_set_clock(EVA_HEADLESS_CLOCK_VIRTUAL);
+        run_session(res, frame_empty);
+        eva_headless_set_clock(EVA_HEADLESS_CLOCK_REAL);
+        float fire_ms = eva_time_since_ms(start);
+
+        if (_timers_fired != count) {
+            fail(0, "Not every timer was called");
+        }
+
+        snprintf(name, sizeof(name), "timer_set_%u", count);
+        report(name, res, (double)set_ms * 1e6 / count, "ns");
+        snprintf(name, sizeof(name), "timer_cancel_%u", count);
+        report(name, res, (double)cancel_ms * 1e6 / count, "ns");
+        snprintf(name, sizeof(name), "timer_fire_%u", count);
+        report(name, res, (double)fire_ms * 1e6 / count, "ns");
+    }
+}
+
+static float time_zones(void)
+{
+    uint64_t start = eva_time_now();
+    for (uint32_t i = 0; i < BENCH_ZONES; i++) {
+        EVA_TRACE_BEGIN("bench");
+        EVA_TRACE_END();
+    }
+    return eva_time_since_ms(start);
+}
+
+// An empty zone while tracing is stopped and while it records, and writing
+// the full ring of one thread to a trace. trace_zone is mostly the two
+// cycle counter reads of the begin and the end. None of them depend on the
+// resolution so they only run once.
+static void bench_trace(const bench_resolution *res)
+{
+    if (res != &resolutions[0]) {
+        return;
+    }
+
+    float stopped_ms = time_zones();
+
+    eva_trace_start();
+    float zone_ms = time_zones();
+    eva_trace_stop();
+
+    uint64_t start = eva_time_now();
+    if (!eva_trace_write(BENCH_TRACE_PATH)) {
+        fail(0, "Failed to write " BENCH_TRACE_PATH);
+    }
+    float write_ms = eva_time_since_ms(start);
+    remove(BENCH_TRACE_PATH);
+
+    report("trace_zone_stopped", res, (double)stopped_ms * 1e6 / BENCH_ZONES, "ns");
+    report("trace_zone",         res, (double)zone_ms * 1e6 / BENCH_ZONES,    "ns");
+    report("trace_write",        res, (double)write_ms,                       "ms");
+}
+
+// UTF-16 text converted per second, in GB/s of UTF-16 read, for a chunk of
+// text input of ASCII, where whole runs are narrowed at once, and of CJK,
+// which is converted a character at a time. Doesn't depend on the
+// resolution so it only runs once.
+static double utf8_rate(const uint16_t *text, char *utf8)
+{
+    eva_utf16_to_utf8(text, EVA_TEXT_INPUT_CHUNK, utf8);
+
+    uint64_t iterations = 0;
+    uint64_t start = eva_time_now();
+    float elapsed_ms;
+    do {
+        eva_utf16_to_utf8(text, EVA_TEXT_INPUT_CHUNK, utf8);
+        iterations++;
+        elapsed_ms = eva_time_since_ms(start);
+    } while (elapsed_ms < BENCH_MIN_TIME_MS);
+
+    double bytes = (double)EVA_TEXT_INPUT_CHUNK * sizeof(uint16_t);
+    return bytes * (double)iterations / (elapsed_ms / 1000.0) / 1e9;
+}
+
+static void bench_utf8(const bench_resolution *res)
+{
+    if (res != &resolutions[0]) {
+        return;
+    }
+
+    uint16_t *text = malloc(EVA_TEXT_INPUT_CHUNK * sizeof(uint16_t));
+    char     *utf8 = malloc(EVA_TEXT_INPUT_CHUNK * 3);
+    if (!text || !utf8) {
+        fail(0, "Failed to allocate text");
+    }
+
+    for (uint32_t i = 0; i < EVA_TEXT_INPUT_CHUNK; i++) {
+        text[i] = (uint16_t)(i % 64 == 63 ? '\n' : ' ' + i % 95);
+    }
+    report("utf8_ascii", res, utf8_rate(text, utf8), "GB/s");
+
+    for (uint32_t i = 0; i < EVA_TEXT_INPUT_CHUNK; i++) {
+        text[i] = (uint16_t)(0x4E00 + i % 0x5000);
+    }
+    report("utf8_cjk", res, utf8_rate(text, utf8), "GB/s");
+
+    free(text);
+    free(utf8);
+}
+
+typedef struct bench_case {
+    const char *name;
+    void      (*run)(const bench_resolution *res);
+} bench_case;
+
+static const bench_case cases[] = {
+    { "fill",     bench_fill     },
+    { "present",  bench_present  },
+    { "dispatch", bench_dispatch },
+    { "resize",   bench_resize   },
+    { "alloc",    bench_alloc_fill },
+    { "text",     bench_text     },
+    { "post",     bench_post     },
+    { "timer",    bench_timer    },
+    { "trace",    bench_trace    },
+    { "utf8",     bench_utf8     },
+};
+
+static bool selected(const char *name, int argc, char **argv)
+{
+    if (argc < 2) {
+        return true;
+    }
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++) {
+        bool known = false;
+        for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+            known |= strcmp(argv[i], cases[c].name) == 0;
+        }
+        if (!known) {
+            fprintf(stderr, "Usage: %s [fill] [present] [dispatch] [resize] "
+                    "[alloc] [text] [post] [timer] [trace] [utf8]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    eva_headless_set_clock(EVA_HEADLESS_CLOCK_REAL);
+
+    printf("benchmark,resolution,width,height,value,unit\n");
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        if (!selected(cases[c].name, argc, argv)) {
+            continue;
+        }
+        for (size_t r = 0; r < sizeof(resolutions) / sizeof(resolutions[0]); r++) {
+            cases[c].run(&resolutions[r]);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,553 @@
+#include "eva_internal.h"
+#include "eva_draw.h"
+#include "eva_thread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Frames waiting to be encoded. When all of them are taken the frame is
+// dropped instead of waiting for the encoder.
+#define EVA_CAPTURE_QUEUE_LEN 4
+
+typedef struct eva_capture_slot {
+    eva_framebuffer fb;
+    eva_rect        stale;  // What changed since the slot was filled
+    uint64_t        frame;  // Sequence number of the frame it holds
+    uint64_t        time;   // Microseconds since the capture started
+    bool            queued; // Waiting for or being encoded
+} eva_capture_slot;
+
+typedef struct eva_capture_ctx {
+    bool               started;
+    bool               accepting; // Image formats only take one frame
+    eva_capture_format format;
+    FILE              *file;
+    FILE              *index;     // EVA_CAPTURE_BGRA only
+    uint64_t           start_time;
+
+    eva_thread thread;
+    eva_mutex  mutex;
+    eva_cond   work_cond; // Signalled when a frame is queued
+    bool       quit;
+
+    eva_capture_slot slots[EVA_CAPTURE_QUEUE_LEN];
+    uint32_t         head; // Next slot to fill
+    uint32_t         tail; // Next slot to encode
+    uint64_t         frame_count; // Frames seen, captured or dropped
+
+    // Only touched by the encoder.
+    bool     failed;
+    uint64_t offset;      // Bytes written to the raw stream
+    uint32_t y4m_w, y4m_h;
+    uint8_t *planes;      // Y, U and V of the Y4M frame
+
+    eva_capture_stats stats;
+} eva_capture_ctx;
+
+static eva_capture_ctx _capture;
+
+static void write_bytes(const void *data, size_t len)
+{
+    if (!_capture.failed && len &&
+        fwrite(data, 1, len, _capture.file) != len) {
+        _capture.failed = true;
+    }
+}
+
+// Y4M
+
+// 4:4:4 keeps the full color resolution of the framebuffer. BT.601 limited
+// range, which is what players assume without a color range tag.
+static void encode_y4m(const eva_framebuffer *fb)
+{
+    if (!_capture.planes) {
+        // The stream has the size of the first frame.
+        _capture.y4m_w  = fb->w;
+        _capture.y4m_h  = fb->h;
+        _capture.planes = malloc((size_t)fb->w * fb->h * 3);
+        if (!_capture.planes) {
+            _capture.failed = true;
+            return;
+        }
+
+        char header[96];
+        int len = snprintf(header, sizeof(header),
+                           "YUV4MPEG2 W%u H%u F60:1 Ip A1:1 C444\n",
+                           fb->w, fb->h);
+        write_bytes(header, (size_t)len);
+    }
+
+    uint32_t w      = _capture.y4m_w;
+    uint32_t h      = _capture.y4m_h;
+    size_t   plane  = (size_t)w * h;
+    uint8_t *y_out  = _capture.planes;
+    uint8_t *u_out  = _capture.planes + plane;
+    uint8_t *v_out  = _capture.planes + plane * 2;
+
+    // Later frames of another size are cropped or padded with black.
+    memset(y_out, 16, plane);
+    memset(u_out, 128, plane * 2);
+
+    uint32_t copy_w = fb->w < w ? fb->w : w;
+    uint32_t copy_h = fb->h < h ? fb->h : h;
+    for (uint32_t j = 0; j < copy_h; j++) {
+        const eva_pixel *p = fb->pixels + (size_t)j * fb->pitch;
+        size_t row = (size_t)j * w;
+        for (uint32_t i = 0; i < copy_w; i++) {
+            int32_t r = p[i].r, g = p[i].g, b = p[i].b;
+            y_out[row + i] = (uint8_t)((( 66 * r + 129 * g +  25 * b + 128) >> 8) + 16);
+            u_out[row + i] = (uint8_t)(((-38 * r -  74 * g + 112 * b + 128) >> 8) + 128);
+            v_out[row + i] = (uint8_t)(((112 * r -  94 * g -  18 * b + 128) >> 8) + 128);
+        }
+    }
+
+    write_bytes("FRAME\n", 6);
+    write_bytes(_capture.planes, plane * 3);
+}
+
+// Raw BGRA
+
+static void encode_bgra(const eva_framebuffer *fb, const eva_capture_slot *slot)
+{
+    for (uint32_t j = 0; j < fb->h; j++) {
+        write_bytes(fb->pixels + (size_t)j * fb->pitch, fb->w * sizeof(eva_pixel));
+    }
+
+    if (!_capture.failed &&
+        fprintf(_capture.index, "%llu,%llu,%llu,%u,%u\n",
+                (unsigned long long)slot->frame,
+                (unsigned long long)slot->time,
+                (unsigned long long)_capture.offset, fb->w, fb->h) < 0) {
+        _capture.failed = true;
+    }
+    _capture.offset += (uint64_t)fb->w * fb->h * sizeof(eva_pixel);
+}
+
+// QOI, see https://qoiformat.org. Written with 3 channels as the alpha of
+// the framebuffer isn't meaningful.
+
+static void put_u32_be(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static void encode_qoi(const eva_framebuffer *fb)
+{
+    // The worst case is a tag and 3 bytes for every pixel.
+    size_t   max = 14 + (size_t)fb->w * fb->h * 4 + 8;
+    uint8_t *out = malloc(max);
+    if (!out) {
+        _capture.failed = true;
+        return;
+    }
+
+    memcpy(out, "qoif", 4);
+    put_u32_be(out + 4, fb->w);
+    put_u32_be(out + 8, fb->h);
+    out[12] = 3; // RGB
+    out[13] = 0; // sRGB with linear alpha
+    size_t len = 14;
+
+    // Pixels are packed as in eva_pixel with an alpha of 255, so the empty
+    // entries never match.
+    uint32_t index[64];
+    uint8_t  pr = 0, pg = 0, pb = 0;
+    uint32_t run = 0;
+    memset(index, 0, sizeof(index));
+
+    for (uint32_t j = 0; j < fb->h; j++) {
+        const eva_pixel *p = fb->pixels + (size_t)j * fb->pitch;
+        for (uint32_t i = 0; i < fb->w; i++) {
+            uint8_t r = p[i].r, g = p[i].g, b = p[i].b;
+
+            if (r == pr && g == pg && b == pb) {
+                if (++run == 62) {
+                    out[len++] = (uint8_t)(0xc0 | (run - 1));
+                    run = 0;
+                }
+                continue;
+            }
+            if (run) {
+                out[len++] = (uint8_t)(0xc0 | (run - 1));
+                run = 0;
+            }
+
+            uint32_t packed = 0xff000000u | (uint32_t)r << 16 | (uint32_t)g << 8 | b;
+            uint32_t hash   = (r * 3u + g * 5u + b * 7u + 255u * 11u) % 64;
+            if (index[hash] == packed) {
+                out[len++] = (uint8_t)hash;
+            } else {
+                index[hash] = packed;
+
+                int8_t dr = (int8_t)(r - pr);
+                int8_t dg = (int8_t)(g - pg);
+                int8_t db = (int8_t)(b - pb);
+                int8_t dr_dg = (int8_t)(dr - dg);
+                int8_t db_dg = (int8_t)(db - dg);
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 &&
+                    db >= -2 && db <= 1) {
+                    out[len++] = (uint8_t)(0x40 | (dr + 2) << 4 |
+                                           (dg + 2) << 2 | (db + 2));
+                } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 &&
+                           db_dg >= -8 && db_dg <= 7) {
+                    out[len++] = (uint8_t)(0x80 | (dg + 32));
+                    out[len++] = (uint8_t)((dr_dg + 8) << 4 | (db_dg + 8));
+                } else {
+                    out[len++] = 0xfe;
+                    out[len++] = r;
+                    out[len++] = g;
+                    out[len++] = b;
+                }
+            }
+            pr = r;
+            pg = g;
+            pb = b;
+        }
+    }
+    if (run) {
+        out[len++] = (uint8_t)(0xc0 | (run - 1));
+    }
+
+    static const uint8_t end[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    memcpy(out + len, end, sizeof(end));
+    len += sizeof(end);
+
+    write_bytes(out, len);
+    free(out);
+}
+
+// PNG. Eva doesn't depend on zlib, the image data is stored in
+// uncompressed deflate blocks. Use QOI for small files.
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len)
+{
+    static uint32_t table[256];
+    if (table[1] == 0) {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) {
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            table[n] = c;
+        }
+    }
+
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void write_png_chunk(const char *type, const uint8_t *data, size_t len)
+{
+    uint8_t header[8];
+    put_u32_be(header, (uint32_t)len);
+    memcpy(header + 4, type, 4);
+
+    uint8_t crc[4];
+    put_u32_be(crc, crc32_update(crc32_update(0, header + 4, 4), data, len));
+
+    write_bytes(header, 8);
+    write_bytes(data, len);
+    write_bytes(crc, 4);
+}
+
+static void encode_png(const eva_framebuffer *fb)
+{
+    // Each row is a filter byte and RGB, split into stored blocks of at most
+    // 65535 bytes with a 5 byte header each.
+    size_t raw    = (size_t)fb->h * (1 + (size_t)fb->w * 3);
+    size_t blocks = raw / 65535 + 1;
+    size_t max    = 2 + raw + blocks * 5 + 4;
+    uint8_t *zlib = malloc(max);
+    uint8_t *rows = malloc(raw ? raw : 1);
+    if (!zlib || !rows) {
+        free(zlib);
+        free(rows);
+        _capture.failed = true;
+        return;
+    }
+
+    uint8_t *p = rows;
+    for (uint32_t j = 0; j < fb->h; j++) {
+        const eva_pixel *src = fb->pixels + (size_t)j * fb->pitch;
+        *p++ = 0; // No filter
+        for (uint32_t i = 0; i < fb->w; i++) {
+            *p++ = src[i].r;
+            *p++ = src[i].g;
+            *p++ = src[i].b;
+        }
+    }
+
+    size_t len = 0;
+    zlib[len++] = 0x78; // Deflate with a 32 KB window
+    zlib[len++] = 0x01;
+
+    uint32_t a = 1, b = 0; // Adler-32
+    size_t pos = 0;
+    do {
+        size_t n = raw - pos < 65535 ? raw - pos : 65535;
+        zlib[len++] = pos + n == raw; // Final block flag, stored
+        zlib[len++] = (uint8_t)n;
+        zlib[len++] = (uint8_t)(n >> 8);
+        zlib[len++] = (uint8_t)~n;
+        zlib[len++] = (uint8_t)(~n >> 8);
+        memcpy(zlib + len, rows + pos, n);
+        len += n;
+
+        for (size_t i = 0; i < n; i++) {
+            a += rows[pos + i];
+            b += a;
+            // Reducing every byte is slow, 5552 bytes can't overflow.
+            if ((i % 5552) == 5551) {
+                a %= 65521;
+                b %= 65521;
+            }
+        }
+        a %= 65521;
+        b %= 65521;
+        pos += n;
+    } while (pos < raw);
+    put_u32_be(zlib + len, b << 16 | a);
+    len += 4;
+
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    write_bytes(signature, sizeof(signature));
+
+    uint8_t ihdr[13];
+    put_u32_be(ihdr, fb->w);
+    put_u32_be(ihdr + 4, fb->h);
+    ihdr[8]  = 8; // Bits per channel
+    ihdr[9]  = 2; // RGB
+    ihdr[10] = 0; // Deflate
+    ihdr[11] = 0; // Adaptive filtering
+    ihdr[12] = 0; // Not interlaced
+    write_png_chunk("IHDR", ihdr, sizeof(ihdr));
+    write_png_chunk("IDAT", zlib, len);
+    write_png_chunk("IEND", NULL, 0);
+
+    free(rows);
+    free(zlib);
+}
+
+static void encode_thread(void *arg)
+{
+    (void)arg;
+
+    eva_mutex_lock(&_capture.mutex);
+    for (;;) {
+        eva_capture_slot *slot = &_capture.slots[_capture.tail];
+        while (!_capture.quit && !slot->queued) {
+            eva_cond_wait(&_capture.work_cond, &_capture.mutex);
+        }
+        // Everything queued is encoded before quitting.
+        if (!slot->queued) {
+            break;
+        }
+        eva_mutex_unlock(&_capture.mutex);
+
+        // A queued slot is never written by the main thread.
+        switch (_capture.format) {
+            case EVA_CAPTURE_Y4M:  encode_y4m(&slot->fb);        break;
+            case EVA_CAPTURE_BGRA: encode_bgra(&slot->fb, slot); break;
+            case EVA_CAPTURE_QOI:  encode_qoi(&slot->fb);        break;
+            case EVA_CAPTURE_PNG:  encode_png(&slot->fb);        break;
+        }
+
+        eva_mutex_lock(&_capture.mutex);
+        slot->queued  = false;
+        _capture.tail = (_capture.tail + 1) % EVA_CAPTURE_QUEUE_LEN;
+        _capture.stats.frames++;
+    }
+    eva_mutex_unlock(&_capture.mutex);
+}
+
+bool eva_capture_start(const char *path, eva_capture_format format)
+{
+    eva_capture_stop();
+
+    _capture.file = fopen(path, "wb");
+    if (!_capture.file) {
+        return false;
+    }
+
+    if (format == EVA_CAPTURE_BGRA) {
+        size_t len = strlen(path);
+        char  *index_path = malloc(len + 5);
+        if (index_path) {
+            memcpy(index_path, path, len);
+            memcpy(index_path + len, ".csv", 5);
+            _capture.index = fopen(index_path, "w");
+            free(index_path);
+        }
+        if (!_capture.index) {
+            fclose(_capture.file);
+            _capture.file = NULL;
+            return false;
+        }
+        fprintf(_capture.index, "frame,time_us,offset,width,height\n");
+    }
+
+    eva_mutex_init(&_capture.mutex);
+    eva_cond_init(&_capture.work_cond);
+    _capture.format     = format;
+    _capture.quit       = false;
+    _capture.failed     = false;
+    _capture.offset     = 0;
+    _capture.head        = 0;
+    _capture.tail        = 0;
+    _capture.frame_count = 0;
+    _capture.start_time = eva_time_now();
+    memset(&_capture.stats, 0, sizeof(_capture.stats));
+    for (uint32_t i = 0; i < EVA_CAPTURE_QUEUE_LEN; i++) {
+        _capture.slots[i].queued = false;
+    }
+
+    if (!eva_thread_create(&_capture.thread, encode_thread, NULL)) {
+        eva_cond_destroy(&_capture.work_cond);
+        eva_mutex_destroy(&_capture.mutex);
+        if (_capture.index) {
+            fclose(_capture.index);
+            _capture.index = NULL;
+        }
+        fclose(_capture.file);
+        _capture.file = NULL;
+        return false;
+    }
+
+    _capture.started   = true;
+    _capture.accepting = true;
+    return true;
+}
+
+bool eva_capture_stop(void)
+{
+    if (!_capture.started) {
+        return true;
+    }
+
+    eva_mutex_lock(&_capture.mutex);
+    _capture.quit = true;
+    eva_cond_signal(&_capture.work_cond);
+    eva_mutex_unlock(&_capture.mutex);
+    eva_thread_join(_capture.thread);
+
+    eva_cond_destroy(&_capture.work_cond);
+    eva_mutex_destroy(&_capture.mutex);
+
+    if (fclose(_capture.file) != 0) {
+        _capture.failed = true;
+    }
+    if (_capture.index && fclose(_capture.index) != 0) {
+        _capture.failed = true;
+    }
+    _capture.file  = NULL;
+    _capture.index = NULL;
+
+    for (uint32_t i = 0; i < EVA_CAPTURE_QUEUE_LEN; i++) {
+        eva_alloc_free(_capture.slots[i].fb.pixels);
+        memset(&_capture.slots[i], 0, sizeof(_capture.slots[i]));
+    }
+    free(_capture.planes);
+    _capture.planes    = NULL;
+    _capture.started   = false;
+    _capture.accepting = false;
+
+    // An image that was never written, e.g. of a session that ended right
+    // away.
+    bool image = _capture.format == EVA_CAPTURE_QOI ||
+                 _capture.format == EVA_CAPTURE_PNG;
+    if (image && _capture.stats.frames == 0) {
+        _capture.failed = true;
+    }
+    return !_capture.failed;
+}
+
+eva_capture_stats eva_capture_get_stats(void)
+{
+    if (!_capture.started) {
+        return _capture.stats;
+    }
+
+    eva_mutex_lock(&_capture.mutex);
+    eva_capture_stats stats = _capture.stats;
+    eva_mutex_unlock(&_capture.mutex);
+    return stats;
+}
+
+void eva_capture_invalidate(eva_rect rect)
+{
+    if (!_capture.accepting) {
+        return;
+    }
+
+    // Slots are only filled by the thread that draws frames, the same one
+    // that moves pixels outside of the damage.
+    for (uint32_t i = 0; i < EVA_CAPTURE_QUEUE_LEN; i++) {
+        _capture.slots[i].stale = rect_union(_capture.slots[i].stale, rect);
+    }
+}
+
+void eva_capture_frame(const eva_framebuffer *fb, eva_rect damage)
+{
+    if (!_capture.accepting) {
+        return;
+    }
+
+    // Every slot falls behind by what this frame changed, whether it is
+    // captured or dropped.
+    eva_capture_invalidate(rect_clip(damage, fb->w, fb->h));
+
+    uint64_t frame = _capture.frame_count++;
+
+    eva_mutex_lock(&_capture.mutex);
+    eva_capture_slot *slot = &_capture.slots[_capture.head];
+    bool free_slot = !slot->queued;
+    if (!free_slot) {
+        _capture.stats.dropped++;
+    }
+    eva_mutex_unlock(&_capture.mutex);
+    if (!free_slot) {
+        return;
+    }
+
+    if (slot->fb.w != fb->w || slot->fb.h != fb->h) {
+        eva_alloc_free(slot->fb.pixels);
+        memset(&slot->fb, 0, sizeof(slot->fb));
+        slot->fb.pixels = eva_alloc_pixels(eva_alloc_pitch(fb->w), fb->h);
+        if (!slot->fb.pixels) {
+            return;
+        }
+        slot->fb.w          = fb->w;
+        slot->fb.h          = fb->h;
+        slot->fb.pitch      = eva_alloc_pitch(fb->w);
+        slot->fb.max_height = fb->h;
+        slot->fb.scale_x    = fb->scale_x;
+        slot->fb.scale_y    = fb->scale_y;
+        slot->stale         = EVA_RECT_FULL;
+    }
+
+    // Only what changed since the slot was last filled has to be copied.
+    eva_rect copy = rect_clip(slot->stale, fb->w, fb->h);
+    if (!rect_is_empty(copy)) {
+        eva_draw_copy_rect(&slot->fb, copy.x, copy.y, fb, copy);
+    }
+    slot->stale = EVA_RECT_EMPTY;
+    slot->time  = (uint64_t)((double)eva_time_ms(eva_time_since(_capture.start_time)) * 1000.0);
+
+    eva_mutex_lock(&_capture.mutex);
+    slot->frame   = frame;
+    slot->queued  = true;
+    _capture.head = (_capture.head + 1) % EVA_CAPTURE_QUEUE_LEN;
+    eva_cond_signal(&_capture.work_cond);
+    eva_mutex_unlock(&_capture.mutex);
+
+    if (_capture.format == EVA_CAPTURE_QOI || _capture.format == EVA_CAPTURE_PNG) {
+        _capture.accepting = false;
+    }
+}
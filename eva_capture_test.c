@@ -0,0 +1,152 @@
+/**
+ * Checks that a raw BGRA capture matches the framebuffer of every frame it
+ * holds while the application scrolls, which moves pixels outside of the
+ * damage of a frame.
+ *
+ * Runs against the headless backend. Exits with 0 when every frame was
+ * captured and matches.
+ *
+ * Usage: eva_capture_test
+ */
+
+#include "eva.h"
+#include "eva_draw.h"
+#include "eva_headless.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TEST_W       256
+#define TEST_H       128
+#define TEST_SCROLLS 8
+#define TEST_LINE    8
+#define TEST_PATH    "eva_capture_test.bgra"
+
+// The framebuffer after each frame, indexed by frame number.
+static eva_pixel _frames[TEST_SCROLLS + 1][TEST_H][TEST_W];
+static uint32_t  _frame_count;
+static eva_rect  _strip;
+static bool      _failed;
+
+static void fail(int error_code, const char *error_message)
+{
+    fprintf(stderr, "Error %d: %s\n", error_code, error_message);
+    _failed = true;
+}
+
+static void frame(const eva_framebuffer *fb)
+{
+    if (_frame_count == 0) {
+        for (uint32_t j = 0; j < fb->h; j++) {
+            eva_pixel row = { (uint8_t)j, (uint8_t)(j * 2), 0, 255 };
+            eva_rect  line = { 0, (int32_t)j, (int32_t)fb->w, 1 };
+            eva_draw_fill_rect(fb, line, row);
+        }
+    } else {
+        eva_pixel color = { 0, 0, (uint8_t)(_frame_count * 30), 255 };
+        eva_draw_fill_rect(fb, _strip, color);
+    }
+
+    if (_frame_count <= TEST_SCROLLS && fb->w == TEST_W && fb->h == TEST_H) {
+        for (uint32_t j = 0; j < TEST_H; j++) {
+            memcpy(_frames[_frame_count][j], fb->pixels + (size_t)j * fb->pitch,
+                   TEST_W * sizeof(eva_pixel));
+        }
+    }
+    _frame_count++;
+}
+
+static void key(eva_key key, eva_input_action action, eva_mod_flags mod)
+{
+    (void)key;
+    (void)mod;
+    if (action == EVA_INPUT_PRESSED) {
+        // Lets the encoder catch up so every frame is captured and the
+        // slots are reused.
+        struct timespec wait = { 0, 1000000 };
+        while (eva_capture_get_stats().frames < _frame_count) {
+            nanosleep(&wait, NULL);
+        }
+
+        eva_rect all = { 0, 0, TEST_W, TEST_H };
+        _strip = eva_scroll_region(all, 0, -TEST_LINE);
+    }
+}
+
+// Compares every frame listed in the index with the framebuffer it was
+// captured from.
+static bool check_capture(void)
+{
+    FILE *data  = fopen(TEST_PATH, "rb");
+    FILE *index = fopen(TEST_PATH ".csv", "r");
+    if (!data || !index) {
+        fprintf(stderr, "Capture files missing\n");
+        return false;
+    }
+
+    static eva_pixel captured[TEST_H][TEST_W];
+    bool     ok      = true;
+    uint32_t checked = 0;
+    char     line[128];
+    fgets(line, sizeof(line), index); // Header
+    while (fgets(line, sizeof(line), index)) {
+        unsigned long long frame, time, offset;
+        unsigned w, h;
+        if (sscanf(line, "%llu,%llu,%llu,%u,%u", &frame, &time, &offset,
+                   &w, &h) != 5 || w != TEST_W || h != TEST_H ||
+            frame > TEST_SCROLLS) {
+            fprintf(stderr, "Unexpected index line: %s", line);
+            ok = false;
+            break;
+        }
+
+        if (fseek(data, (long)offset, SEEK_SET) != 0 ||
+            fread(captured, sizeof(captured), 1, data) != 1) {
+            fprintf(stderr, "Frame %llu is truncated\n", frame);
+            ok = false;
+            break;
+        }
+        if (memcmp(captured, _frames[frame], sizeof(captured)) != 0) {
+            fprintf(stderr, "Frame %llu doesn't match the framebuffer\n", frame);
+            ok = false;
+        }
+        checked++;
+    }
+
+    fclose(data);
+    fclose(index);
+    remove(TEST_PATH);
+    remove(TEST_PATH ".csv");
+
+    if (ok && checked != TEST_SCROLLS + 1) {
+        fprintf(stderr, "Only %u frames were captured\n", checked);
+        ok = false;
+    }
+    return ok;
+}
+
+int main(void)
+{
+    eva_headless_set_window_size(TEST_W, TEST_H, 1.0f, 1.0f);
+    eva_headless_set_screen_size(TEST_W, TEST_H);
+    eva_set_key_fn(key);
+
+    for (uint32_t i = 1; i <= TEST_SCROLLS; i++) {
+        eva_headless_post_key(i * 1000000ull, EVA_KEY_DOWN,
+                              EVA_INPUT_PRESSED, 0);
+    }
+
+    if (!eva_capture_start(TEST_PATH, EVA_CAPTURE_BGRA)) {
+        fprintf(stderr, "Failed to start the capture\n");
+        return 1;
+    }
+    eva_run("eva_capture_test", frame, fail);
+
+    if (_failed || _frame_count != TEST_SCROLLS + 1 || !check_capture()) {
+        return 1;
+    }
+    printf("%u frames match\n", _frame_count);
+    return 0;
+}
@@ -0,0 +1,1348 @@
+#include "eva_draw.h"
+#include "eva_internal.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define EVA_DRAW_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define EVA_TARGET_AVX2
+#else
+#define EVA_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+// NEON is part of the AArch64 baseline. 32 bit ARM uses the scalar code.
+#define EVA_DRAW_NEON
+#include <arm_neon.h>
+#endif
+
+// Fills larger than this bypass the cache with non-temporal stores. A frame
+// this large would evict everything else and is only read again by present.
+#define EVA_DRAW_STREAM_THRESHOLD (4 * 1024 * 1024)
+
+typedef void (*eva_fill_row_fn)(eva_pixel *dst, uint32_t n, uint32_t color,
+                                bool stream);
+typedef void (*eva_blend_row_fn)(eva_pixel *dst, const eva_pixel *src,
+                                 uint32_t n);
+typedef void (*eva_expand_row_fn)(eva_pixel *dst, const void *src, uint32_t n,
+                                  const eva_pixel *palette);
+typedef void (*eva_mask_row_fn)(eva_pixel *dst, const uint8_t *mask, uint32_t n,
+                                eva_pixel color);
+typedef void (*eva_hash_rows_fn)(uint64_t *acc, const uint8_t *data,
+                                 size_t pitch, uint32_t rows, size_t stripes);
+
+typedef struct eva_draw_kernels {
+    bool              initialized;
+    eva_draw_simd     simd;
+    eva_fill_row_fn   fill_row;
+    eva_blend_row_fn  blend_row;
+    eva_expand_row_fn expand_rgb565;
+    eva_expand_row_fn expand_indexed8;
+    eva_expand_row_fn expand_gray8;
+    eva_mask_row_fn   mask_row;
+    eva_hash_rows_fn  hash_rows;
+} eva_draw_kernels;
+
+static eva_draw_kernels _kernels;
+
+static inline uint32_t pixel_to_u32(eva_pixel p)
+{
+    uint32_t u;
+    memcpy(&u, &p, sizeof(u));
+    return u;
+}
+
+// Exact x / 255 rounded to nearest for x in [0, 255 * 255].
+static inline uint32_t div255(uint32_t x)
+{
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+// eva_draw_hash() works on 64 byte stripes of a row, spread over 8 64-bit
+// lanes the width of an AVX2 register pair. Each lane adds the product of
+// the high and low halves of its 8 bytes xored with a key and adds the bytes
+// to its neighbour, the multiply mixes and the add keeps the data in case
+// the product is 0. Stripes cycle through 4 offsets into the key and after
+// every 4th stripe and at the end of each row the lanes are scrambled, so
+// moving data around within a row changes the hash. The kernels have to
+// agree bit for bit, hashes are compared across eva_draw_set_simd() calls.
+#define EVA_HASH_STRIPE 64
+#define EVA_HASH_PRIME32 0x9E3779B1u
+
+static const uint64_t hash_key[11] = {
+    0x2cb0f69f4abea221ull, 0x9417034723148989ull, 0xdd555950609dfe03ull,
+    0xdbafb150deb12800ull, 0x7e789b2e6c442cb6ull, 0xf41e5636c7e4f8c4ull,
+    0x0959d150f8fba7e4ull, 0xa97316f13cdb9eeaull, 0x74cd8258f9520068ull,
+    0x55c74a62e116868bull, 0xd2f4c799a2023cbdull,
+};
+
+// Whether the lanes are scrambled after stripe s of a row, with the last 8
+// keys.
+static inline bool hash_scramble_after(size_t s, size_t stripes)
+{
+    return (s & 3) == 3 || s + 1 == stripes;
+}
+
+// scalar
+
+static void fill_row_scalar(eva_pixel *dst, uint32_t n, uint32_t color,
+                            bool stream)
+{
+    (void)stream;
+
+    uint32_t *d = (uint32_t *)dst;
+    for (uint32_t i = 0; i < n; i++) {
+        d[i] = color;
+    }
+}
+
+static void blend_row_scalar(eva_pixel *dst, const eva_pixel *src, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        eva_pixel s = src[i];
+        if (s.a == 255) {
+            dst[i] = s;
+        } else if (s.a != 0) {
+            uint32_t ia = 255u - s.a;
+            eva_pixel d = dst[i];
+            d.b = (uint8_t)(s.b + div255(d.b * ia));
+            d.g = (uint8_t)(s.g + div255(d.g * ia));
+            d.r = (uint8_t)(s.r + div255(d.r * ia));
+            d.a = (uint8_t)(s.a + div255(d.a * ia));
+            dst[i] = d;
+        }
+    }
+}
+
+static void expand_rgb565_scalar(eva_pixel *dst, const void *src, uint32_t n,
+                                 const eva_pixel *palette)
+{
+    (void)palette;
+
+    const uint16_t *s = src;
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t r = s[i] >> 11;
+        uint32_t g = (s[i] >> 5) & 63;
+        uint32_t b = s[i] & 31;
+        dst[i].b = (uint8_t)((b << 3) | (b >> 2));
+        dst[i].g = (uint8_t)((g << 2) | (g >> 4));
+        dst[i].r = (uint8_t)((r << 3) | (r >> 2));
+        dst[i].a = 255;
+    }
+}
+
+static void expand_indexed8_scalar(eva_pixel *dst, const void *src, uint32_t n,
+                                   const eva_pixel *palette)
+{
+    const uint8_t *s = src;
+    for (uint32_t i = 0; i < n; i++) {
+        dst[i] = palette[s[i]];
+    }
+}
+
+static void expand_gray8_scalar(eva_pixel *dst, const void *src, uint32_t n,
+                                const eva_pixel *palette)
+{
+    (void)palette;
+
+    const uint8_t *s = src;
+    uint32_t      *d = (uint32_t *)dst;
+    for (uint32_t i = 0; i < n; i++) {
+        d[i] = 0xff000000u | s[i] * 0x010101u;
+    }
+}
+
+// color has premultiplied alpha and is scaled by the coverage of each pixel
+// before it is blended like blend_row.
+static void mask_row_scalar(eva_pixel *dst, const uint8_t *mask, uint32_t n,
+                            eva_pixel color)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t m = mask[i];
+        if (m == 0) {
+            continue;
+        }
+        eva_pixel s = {
+            (uint8_t)div255(color.b * m),
+            (uint8_t)div255(color.g * m),
+            (uint8_t)div255(color.r * m),
+            (uint8_t)div255(color.a * m),
+        };
+        uint32_t ia = 255u - s.a;
+        eva_pixel d = dst[i];
+        d.b = (uint8_t)(s.b + div255(d.b * ia));
+        d.g = (uint8_t)(s.g + div255(d.g * ia));
+        d.r = (uint8_t)(s.r + div255(d.r * ia));
+        d.a = (uint8_t)(s.a + div255(d.a * ia));
+        dst[i] = d;
+    }
+}
+
+static void hash_rows_scalar(uint64_t *acc, const uint8_t *data, size_t pitch,
+                             uint32_t rows, size_t stripes)
+{
+    for (uint32_t y = 0; y < rows; y++, data += pitch) {
+        const uint8_t *p = data;
+        for (size_t s = 0; s < stripes; s++, p += EVA_HASH_STRIPE) {
+            const uint64_t *key = hash_key + (s & 3);
+            for (int i = 0; i < 8; i++) {
+                uint64_t v;
+                memcpy(&v, p + i * 8, sizeof(v));
+                uint64_t k = v ^ key[i];
+                acc[i ^ 1] += v;
+                acc[i] += (k & 0xffffffffu) * (k >> 32);
+            }
+
+            if (hash_scramble_after(s, stripes)) {
+                for (int i = 0; i < 8; i++) {
+                    uint64_t a = acc[i];
+                    a ^= a >> 47;
+                    a ^= hash_key[3 + i];
+                    acc[i] = a * EVA_HASH_PRIME32;
+                }
+            }
+        }
+    }
+}
+
+#if defined(EVA_DRAW_X86)
+
+// sse2
+
+static void fill_row_sse2(eva_pixel *dst, uint32_t n, uint32_t color,
+                          bool stream)
+{
+    uint32_t *d = (uint32_t *)dst;
+
+    // Align to 16 bytes. Pixels are 4 byte aligned so this always works out.
+    while (n > 0 && ((uintptr_t)d & 15)) {
+        *d++ = color;
+        n--;
+    }
+
+    __m128i c = _mm_set1_epi32((int)color);
+    if (stream) {
+        for (; n >= 16; n -= 16, d += 16) {
+            _mm_stream_si128((__m128i *)(d +  0), c);
+            _mm_stream_si128((__m128i *)(d +  4), c);
+            _mm_stream_si128((__m128i *)(d +  8), c);
+            _mm_stream_si128((__m128i *)(d + 12), c);
+        }
+    } else {
+        for (; n >= 16; n -= 16, d += 16) {
+            _mm_store_si128((__m128i *)(d +  0), c);
+            _mm_store_si128((__m128i *)(d +  4), c);
+            _mm_store_si128((__m128i *)(d +  8), c);
+            _mm_store_si128((__m128i *)(d + 12), c);
+        }
+    }
+    for (; n >= 4; n -= 4, d += 4) {
+        _mm_store_si128((__m128i *)d, c);
+    }
+    while (n--) {
+        *d++ = color;
+    }
+}
+
+static void blend_row_sse2(eva_pixel *dst, const eva_pixel *src, uint32_t n)
+{
+    const __m128i zero       = _mm_setzero_si128();
+    const __m128i alpha_mask = _mm_set1_epi32((int)0xff000000);
+    const __m128i c255       = _mm_set1_epi16(255);
+    const __m128i c128       = _mm_set1_epi16(128);
+
+    uint32_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i s  = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i sa = _mm_and_si128(s, alpha_mask);
+
+        // Fully opaque or fully transparent groups need no arithmetic.
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(sa, alpha_mask)) == 0xffff) {
+            _mm_storeu_si128((__m128i *)(dst + i), s);
+            continue;
+        }
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(sa, zero)) == 0xffff) {
+            continue;
+        }
+
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+
+        // Broadcast 255 - alpha to the four 16 bit channels of each pixel.
+        __m128i a  = _mm_srli_epi32(s, 24);
+        a          = _mm_or_si128(a, _mm_slli_epi32(a, 16));
+        __m128i ia = _mm_sub_epi16(c255, a);
+        __m128i ia_lo = _mm_unpacklo_epi32(ia, ia);
+        __m128i ia_hi = _mm_unpackhi_epi32(ia, ia);
+
+        __m128i d_lo = _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), ia_lo);
+        __m128i d_hi = _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), ia_hi);
+
+        d_lo = _mm_add_epi16(d_lo, c128);
+        d_hi = _mm_add_epi16(d_hi, c128);
+        d_lo = _mm_srli_epi16(_mm_add_epi16(d_lo, _mm_srli_epi16(d_lo, 8)), 8);
+        d_hi = _mm_srli_epi16(_mm_add_epi16(d_hi, _mm_srli_epi16(d_hi, 8)), 8);
+
+        d = _mm_adds_epu8(s, _mm_packus_epi16(d_lo, d_hi));
+        _mm_storeu_si128((__m128i *)(dst + i), d);
+    }
+
+    blend_row_scalar(dst + i, src + i, n - i);
+}
+
+// div255() of each 16 bit lane.
+static inline __m128i div255_sse2(__m128i x)
+{
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+static void mask_row_sse2(eva_pixel *dst, const uint8_t *mask, uint32_t n,
+                          eva_pixel color)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i c255 = _mm_set1_epi16(255);
+    const __m128i c    = _mm_unpacklo_epi8(_mm_set1_epi32((int)pixel_to_u32(color)),
+                                           zero);
+
+    uint32_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        uint32_t m4;
+        memcpy(&m4, mask + i, sizeof(m4));
+        if (m4 == 0) {
+            continue; // Most of a glyph's box is empty.
+        }
+
+        // Repeat the coverage of each pixel in its four 16 bit channels.
+        __m128i m = _mm_cvtsi32_si128((int)m4);
+        m = _mm_unpacklo_epi8(m, m);
+        m = _mm_unpacklo_epi16(m, m);
+        __m128i s_lo = div255_sse2(_mm_mullo_epi16(c, _mm_unpacklo_epi8(m, zero)));
+        __m128i s_hi = div255_sse2(_mm_mullo_epi16(c, _mm_unpackhi_epi8(m, zero)));
+
+        // Broadcast 255 - alpha of the scaled color to each channel.
+        __m128i ia_lo = _mm_sub_epi16(c255, _mm_shufflehi_epi16(
+                            _mm_shufflelo_epi16(s_lo, 0xff), 0xff));
+        __m128i ia_hi = _mm_sub_epi16(c255, _mm_shufflehi_epi16(
+                            _mm_shufflelo_epi16(s_hi, 0xff), 0xff));
+
+        __m128i d    = _mm_loadu_si128((const __m128i *)(dst + i));
+        __m128i d_lo = div255_sse2(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), ia_lo));
+        __m128i d_hi = div255_sse2(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), ia_hi));
+
+        d = _mm_packus_epi16(_mm_add_epi16(s_lo, d_lo), _mm_add_epi16(s_hi, d_hi));
+        _mm_storeu_si128((__m128i *)(dst + i), d);
+    }
+
+    mask_row_scalar(dst + i, mask + i, n - i, color);
+}
+
+// Widens the 5 and 6 bit channels of 8 RGB565 pixels to 8 bits, replicating
+// the top bits into the bottom ones like the scalar code.
+static inline void unpack_rgb565_sse2(__m128i v, __m128i *lo, __m128i *hi)
+{
+    const __m128i mask5 = _mm_set1_epi16(31);
+    const __m128i mask6 = _mm_set1_epi16(63);
+    const __m128i alpha = _mm_set1_epi16((short)0xff00);
+
+    __m128i r = _mm_srli_epi16(v, 11);
+    __m128i g = _mm_and_si128(_mm_srli_epi16(v, 5), mask6);
+    __m128i b = _mm_and_si128(v, mask5);
+    r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+    g = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+    b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+
+    __m128i bg = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+    __m128i ra = _mm_or_si128(r, alpha);
+    *lo = _mm_unpacklo_epi16(bg, ra);
+    *hi = _mm_unpackhi_epi16(bg, ra);
+}
+
+static void expand_rgb565_sse2(eva_pixel *dst, const void *src, uint32_t n,
+                               const eva_pixel *palette)
+{
+    const uint16_t *s = src;
+
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i lo, hi;
+        unpack_rgb565_sse2(_mm_loadu_si128((const __m128i *)(s + i)), &lo, &hi);
+        _mm_storeu_si128((__m128i *)(dst + i),     lo);
+        _mm_storeu_si128((__m128i *)(dst + i + 4), hi);
+    }
+
+    expand_rgb565_scalar(dst + i, s + i, n - i, palette);
+}
+
+static void expand_gray8_sse2(eva_pixel *dst, const void *src, uint32_t n,
+                              const eva_pixel *palette)
+{
+    const uint8_t *s     = src;
+    const __m128i  alpha = _mm_set1_epi8((char)0xff);
+
+    uint32_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v  = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i gg_lo = _mm_unpacklo_epi8(v, v);
+        __m128i gg_hi = _mm_unpackhi_epi8(v, v);
+        __m128i ga_lo = _mm_unpacklo_epi8(v, alpha);
+        __m128i ga_hi = _mm_unpackhi_epi8(v, alpha);
+        _mm_storeu_si128((__m128i *)(dst + i),      _mm_unpacklo_epi16(gg_lo, ga_lo));
+        _mm_storeu_si128((__m128i *)(dst + i + 4),  _mm_unpackhi_epi16(gg_lo, ga_lo));
+        _mm_storeu_si128((__m128i *)(dst + i + 8),  _mm_unpacklo_epi16(gg_hi, ga_hi));
+        _mm_storeu_si128((__m128i *)(dst + i + 12), _mm_unpackhi_epi16(gg_hi, ga_hi));
+    }
+
+    expand_gray8_scalar(dst + i, s + i, n - i, palette);
+}
+
+// The multiply of the scramble is split in two 32x32 bit multiplies.
+static inline __m128i hash_scramble_sse2(__m128i a, const uint64_t *key)
+{
+    const __m128i prime = _mm_set1_epi32((int)EVA_HASH_PRIME32);
+    a = _mm_xor_si128(a, _mm_srli_epi64(a, 47));
+    a = _mm_xor_si128(a, _mm_loadu_si128((const __m128i *)key));
+    __m128i lo = _mm_mul_epu32(a, prime);
+    __m128i hi = _mm_mul_epu32(_mm_srli_epi64(a, 32), prime);
+    return _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+}
+
+static void hash_rows_sse2(uint64_t *acc, const uint8_t *data, size_t pitch,
+                           uint32_t rows, size_t stripes)
+{
+    __m128i a[4];
+    for (int j = 0; j < 4; j++) {
+        a[j] = _mm_loadu_si128((const __m128i *)(acc + j * 2));
+    }
+
+    for (uint32_t y = 0; y < rows; y++, data += pitch) {
+        const uint8_t *p = data;
+        for (size_t s = 0; s < stripes; s++, p += EVA_HASH_STRIPE) {
+            const uint64_t *key = hash_key + (s & 3);
+            for (int j = 0; j < 4; j++) {
+                __m128i v  = _mm_loadu_si128((const __m128i *)(p + j * 16));
+                __m128i k  = _mm_xor_si128(v, _mm_loadu_si128((const __m128i *)(key + j * 2)));
+                __m128i pr = _mm_mul_epu32(k, _mm_shuffle_epi32(k, _MM_SHUFFLE(0, 3, 0, 1)));
+                __m128i sw = _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+                a[j] = _mm_add_epi64(a[j], _mm_add_epi64(pr, sw));
+            }
+
+            if (hash_scramble_after(s, stripes)) {
+                for (int j = 0; j < 4; j++) {
+                    a[j] = hash_scramble_sse2(a[j], hash_key + 3 + j * 2);
+                }
+            }
+        }
+    }
+
+    for (int j = 0; j < 4; j++) {
+        _mm_storeu_si128((__m128i *)(acc + j * 2), a[j]);
+    }
+}
+
+// avx2
+
+EVA_TARGET_AVX2
+static void fill_row_avx2(eva_pixel *dst, uint32_t n, uint32_t color,
+                          bool stream)
+{
+    // Streaming fills are bound by memory bandwidth and 256 bit
+    // non-temporal stores measured slower than 128 bit ones.
+    if (stream) {
+        fill_row_sse2(dst, n, color, stream);
+        return;
+    }
+
+    uint32_t *d = (uint32_t *)dst;
+
+    while (n > 0 && ((uintptr_t)d & 31)) {
+        *d++ = color;
+        n--;
+    }
+
+    __m256i c = _mm256_set1_epi32((int)color);
+    for (; n >= 32; n -= 32, d += 32) {
+        _mm256_store_si256((__m256i *)(d +  0), c);
+        _mm256_store_si256((__m256i *)(d +  8), c);
+        _mm256_store_si256((__m256i *)(d + 16), c);
+        _mm256_store_si256((__m256i *)(d + 24), c);
+    }
+    for (; n >= 8; n -= 8, d += 8) {
+        _mm256_store_si256((__m256i *)d, c);
+    }
+    while (n--) {
+        *d++ = color;
+    }
+}
+
+EVA_TARGET_AVX2
+static void blend_row_avx2(eva_pixel *dst, const eva_pixel *src, uint32_t n)
+{
+    const __m256i zero       = _mm256_setzero_si256();
+    const __m256i alpha_mask = _mm256_set1_epi32((int)0xff000000);
+    const __m256i c255       = _mm256_set1_epi16(255);
+    const __m256i c128       = _mm256_set1_epi16(128);
+
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i s  = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i sa = _mm256_and_si256(s, alpha_mask);
+
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(sa, alpha_mask)) == -1) {
+            _mm256_storeu_si256((__m256i *)(dst + i), s);
+            continue;
+        }
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(sa, zero)) == -1) {
+            continue;
+        }
+
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+
+        // The unpacks work within 128 bit lanes, the final pack undoes that.
+        __m256i a  = _mm256_srli_epi32(s, 24);
+        a          = _mm256_or_si256(a, _mm256_slli_epi32(a, 16));
+        __m256i ia = _mm256_sub_epi16(c255, a);
+        __m256i ia_lo = _mm256_unpacklo_epi32(ia, ia);
+        __m256i ia_hi = _mm256_unpackhi_epi32(ia, ia);
+
+        __m256i d_lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), ia_lo);
+        __m256i d_hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), ia_hi);
+
+        d_lo = _mm256_add_epi16(d_lo, c128);
+        d_hi = _mm256_add_epi16(d_hi, c128);
+        d_lo = _mm256_srli_epi16(_mm256_add_epi16(d_lo, _mm256_srli_epi16(d_lo, 8)), 8);
+        d_hi = _mm256_srli_epi16(_mm256_add_epi16(d_hi, _mm256_srli_epi16(d_hi, 8)), 8);
+
+        d = _mm256_adds_epu8(s, _mm256_packus_epi16(d_lo, d_hi));
+        _mm256_storeu_si256((__m256i *)(dst + i), d);
+    }
+
+    // The tail runs legacy SSE code, which stalls while the upper halves of
+    // the ymm registers are dirty. Compilers skip the vzeroupper before a
+    // tail call.
+    _mm256_zeroupper();
+    blend_row_sse2(dst + i, src + i, n - i);
+}
+
+EVA_TARGET_AVX2
+static void expand_rgb565_avx2(eva_pixel *dst, const void *src, uint32_t n,
+                               const eva_pixel *palette)
+{
+    const uint16_t *s     = src;
+    const __m256i   mask5 = _mm256_set1_epi16(31);
+    const __m256i   mask6 = _mm256_set1_epi16(63);
+    const __m256i   alpha = _mm256_set1_epi16((short)0xff00);
+
+    uint32_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+
+        __m256i r = _mm256_srli_epi16(v, 11);
+        __m256i g = _mm256_and_si256(_mm256_srli_epi16(v, 5), mask6);
+        __m256i b = _mm256_and_si256(v, mask5);
+        r = _mm256_or_si256(_mm256_slli_epi16(r, 3), _mm256_srli_epi16(r, 2));
+        g = _mm256_or_si256(_mm256_slli_epi16(g, 2), _mm256_srli_epi16(g, 4));
+        b = _mm256_or_si256(_mm256_slli_epi16(b, 3), _mm256_srli_epi16(b, 2));
+
+        __m256i bg = _mm256_or_si256(b, _mm256_slli_epi16(g, 8));
+        __m256i ra = _mm256_or_si256(r, alpha);
+
+        // The unpacks work within 128 bit lanes, put the pixels back in order.
+        __m256i lo = _mm256_unpacklo_epi16(bg, ra);
+        __m256i hi = _mm256_unpackhi_epi16(bg, ra);
+        _mm256_storeu_si256((__m256i *)(dst + i),
+                            _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i *)(dst + i + 8),
+                            _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+
+    _mm256_zeroupper(); // See blend_row_avx2().
+    expand_rgb565_sse2(dst + i, s + i, n - i, palette);
+}
+
+EVA_TARGET_AVX2
+static void expand_indexed8_avx2(eva_pixel *dst, const void *src, uint32_t n,
+                                 const eva_pixel *palette)
+{
+    const uint8_t *s = src;
+    const int     *p = (const int *)palette;
+
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(s + i)));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_i32gather_epi32(p, idx, 4));
+    }
+
+    expand_indexed8_scalar(dst + i, s + i, n - i, palette);
+}
+
+EVA_TARGET_AVX2
+static void expand_gray8_avx2(eva_pixel *dst, const void *src, uint32_t n,
+                              const eva_pixel *palette)
+{
+    const uint8_t *s     = src;
+    const __m256i  alpha = _mm256_set1_epi32((int)0xff000000);
+
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(s + i)));
+        v = _mm256_or_si256(v, _mm256_slli_epi32(v, 8));
+        v = _mm256_or_si256(v, _mm256_slli_epi32(v, 16));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_or_si256(v, alpha));
+    }
+
+    expand_gray8_scalar(dst + i, s + i, n - i, palette);
+}
+
+// div255() of each 16 bit lane.
+EVA_TARGET_AVX2
+static inline __m256i div255_avx2(__m256i x)
+{
+    x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+EVA_TARGET_AVX2
+static void mask_row_avx2(eva_pixel *dst, const uint8_t *mask, uint32_t n,
+                          eva_pixel color)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i c255 = _mm256_set1_epi16(255);
+    const __m256i c    = _mm256_unpacklo_epi8(
+                             _mm256_set1_epi32((int)pixel_to_u32(color)), zero);
+
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i m8 = _mm_loadl_epi64((const __m128i *)(mask + i));
+        if (_mm_cvtsi128_si32(m8) == 0 &&
+            _mm_cvtsi128_si32(_mm_srli_si128(m8, 4)) == 0) {
+            continue;
+        }
+
+        // Repeat the coverage of each pixel in its four bytes. The unpacks
+        // work within 128 bit lanes, the final pack undoes that.
+        __m256i m = _mm256_cvtepu8_epi32(m8);
+        m = _mm256_or_si256(m, _mm256_slli_epi32(m, 8));
+        m = _mm256_or_si256(m, _mm256_slli_epi32(m, 16));
+        __m256i s_lo = div255_avx2(_mm256_mullo_epi16(c, _mm256_unpacklo_epi8(m, zero)));
+        __m256i s_hi = div255_avx2(_mm256_mullo_epi16(c, _mm256_unpackhi_epi8(m, zero)));
+
+        __m256i ia_lo = _mm256_sub_epi16(c255, _mm256_shufflehi_epi16(
+                            _mm256_shufflelo_epi16(s_lo, 0xff), 0xff));
+        __m256i ia_hi = _mm256_sub_epi16(c255, _mm256_shufflehi_epi16(
+                            _mm256_shufflelo_epi16(s_hi, 0xff), 0xff));
+
+        __m256i d    = _mm256_loadu_si256((const __m256i *)(dst + i));
+        __m256i d_lo = div255_avx2(_mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), ia_lo));
+        __m256i d_hi = div255_avx2(_mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), ia_hi));
+
+        d = _mm256_packus_epi16(_mm256_add_epi16(s_lo, d_lo),
+                                _mm256_add_epi16(s_hi, d_hi));
+        _mm256_storeu_si256((__m256i *)(dst + i), d);
+    }
+
+    _mm256_zeroupper(); // See blend_row_avx2().
+    mask_row_sse2(dst + i, mask + i, n - i, color);
+}
+
+EVA_TARGET_AVX2
+static inline __m256i hash_scramble_avx2(__m256i a, const uint64_t *key)
+{
+    const __m256i prime = _mm256_set1_epi32((int)EVA_HASH_PRIME32);
+    a = _mm256_xor_si256(a, _mm256_srli_epi64(a, 47));
+    a = _mm256_xor_si256(a, _mm256_loadu_si256((const __m256i *)key));
+    __m256i lo = _mm256_mul_epu32(a, prime);
+    __m256i hi = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), prime);
+    return _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32));
+}
+
+// The same as hash_rows_sse2(), the shuffles swap lanes within each 128 bit
+// half which pairs them up the same way.
+EVA_TARGET_AVX2
+static void hash_rows_avx2(uint64_t *acc, const uint8_t *data, size_t pitch,
+                           uint32_t rows, size_t stripes)
+{
+    __m256i a[2];
+    for (int j = 0; j < 2; j++) {
+        a[j] = _mm256_loadu_si256((const __m256i *)(acc + j * 4));
+    }
+
+    for (uint32_t y = 0; y < rows; y++, data += pitch) {
+        const uint8_t *p = data;
+        for (size_t s = 0; s < stripes; s++, p += EVA_HASH_STRIPE) {
+            const uint64_t *key = hash_key + (s & 3);
+            for (int j = 0; j < 2; j++) {
+                __m256i v  = _mm256_loadu_si256((const __m256i *)(p + j * 32));
+                __m256i k  = _mm256_xor_si256(v, _mm256_loadu_si256((const __m256i *)(key + j * 4)));
+                __m256i pr = _mm256_mul_epu32(k, _mm256_shuffle_epi32(k, _MM_SHUFFLE(0, 3, 0, 1)));
+                __m256i sw = _mm256_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+                a[j] = _mm256_add_epi64(a[j], _mm256_add_epi64(pr, sw));
+            }
+
+            if (hash_scramble_after(s, stripes)) {
+                for (int j = 0; j < 2; j++) {
+                    a[j] = hash_scramble_avx2(a[j], hash_key + 3 + j * 4);
+                }
+            }
+        }
+    }
+
+    for (int j = 0; j < 2; j++) {
+        _mm256_storeu_si256((__m256i *)(acc + j * 4), a[j]);
+    }
+    _mm256_zeroupper(); // See blend_row_avx2().
+}
+
+static bool cpu_has_sse2(void)
+{
+#if defined(__x86_64__) || defined(_M_X64)
+    return true; // Part of the x86-64 baseline.
+#elif defined(_MSC_VER)
+    int regs[4];
+    __cpuid(regs, 1);
+    return (regs[3] & (1 << 26)) != 0;
+#else
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+
+static bool cpu_has_avx2(void)
+{
+#if defined(_MSC_VER)
+    int regs[4];
+    __cpuid(regs, 1);
+    bool osxsave = (regs[2] & (1 << 27)) != 0;
+    bool avx     = (regs[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx) {
+        return false;
+    }
+    // The OS has to save the ymm registers on context switches.
+    if ((_xgetbv(0) & 6) != 6) {
+        return false;
+    }
+    __cpuidex(regs, 7, 0);
+    return (regs[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#elif defined(EVA_DRAW_NEON)
+
+// neon
+
+static void fill_row_neon(eva_pixel *dst, uint32_t n, uint32_t color,
+                          bool stream)
+{
+    (void)stream;
+
+    uint32_t *d = (uint32_t *)dst;
+    uint32x4_t c = vdupq_n_u32(color);
+
+    for (; n >= 16; n -= 16, d += 16) {
+        vst1q_u32(d +  0, c);
+        vst1q_u32(d +  4, c);
+        vst1q_u32(d +  8, c);
+        vst1q_u32(d + 12, c);
+    }
+    for (; n >= 4; n -= 4, d += 4) {
+        vst1q_u32(d, c);
+    }
+    while (n--) {
+        *d++ = color;
+    }
+}
+
+static void blend_row_neon(eva_pixel *dst, const eva_pixel *src, uint32_t n)
+{
+    uint32_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        uint32x4_t s32 = vld1q_u32((const uint32_t *)(src + i));
+        uint32x4_t a32 = vshrq_n_u32(s32, 24);
+
+        uint32_t min_a = vminvq_u32(a32);
+        uint32_t max_a = vmaxvq_u32(a32);
+        if (min_a == 255) {
+            vst1q_u32((uint32_t *)(dst + i), s32);
+            continue;
+        }
+        if (max_a == 0) {
+            continue;
+        }
+
+        uint8x16_t s = vreinterpretq_u8_u32(s32);
+        uint8x16_t d = vld1q_u8((const uint8_t *)(dst + i));
+
+        // Broadcast 255 - alpha to the four channels of each pixel.
+        uint8x16_t ia = vmvnq_u8(vreinterpretq_u8_u32(vmulq_n_u32(a32, 0x01010101)));
+
+        uint16x8_t lo = vmull_u8(vget_low_u8(d),  vget_low_u8(ia));
+        uint16x8_t hi = vmull_u8(vget_high_u8(d), vget_high_u8(ia));
+
+        // (x + 128 + ((x + 128) >> 8)) >> 8
+        uint8x8_t lo8 = vrshrn_n_u16(vrsraq_n_u16(lo, lo, 8), 8);
+        uint8x8_t hi8 = vrshrn_n_u16(vrsraq_n_u16(hi, hi, 8), 8);
+
+        d = vqaddq_u8(s, vcombine_u8(lo8, hi8));
+        vst1q_u8((uint8_t *)(dst + i), d);
+    }
+
+    blend_row_scalar(dst + i, src + i, n - i);
+}
+
+static void expand_rgb565_neon(eva_pixel *dst, const void *src, uint32_t n,
+                               const eva_pixel *palette)
+{
+    const uint16_t *s = src;
+
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint16x8_t v = vld1q_u16(s + i);
+
+        // Shifting the channel to the top of a byte and inserting its top
+        // bits below replicates them like the scalar code.
+        uint8x8_t r = vshrn_n_u16(v, 8);
+        uint8x8_t g = vshrn_n_u16(v, 3);
+        uint8x8_t b = vmovn_u16(vshlq_n_u16(v, 3));
+
+        uint8x8x4_t px;
+        px.val[0] = vsri_n_u8(b, b, 5);
+        px.val[1] = vsri_n_u8(vand_u8(g, vdup_n_u8(0xfc)), g, 6);
+        px.val[2] = vsri_n_u8(vand_u8(r, vdup_n_u8(0xf8)), r, 5);
+        px.val[3] = vdup_n_u8(255);
+        vst4_u8((uint8_t *)(dst + i), px);
+    }
+
+    expand_rgb565_scalar(dst + i, s + i, n - i, palette);
+}
+
+static void expand_gray8_neon(eva_pixel *dst, const void *src, uint32_t n,
+                              const eva_pixel *palette)
+{
+    const uint8_t *s = src;
+
+    uint32_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        uint8x16x4_t px;
+        px.val[0] = vld1q_u8(s + i);
+        px.val[1] = px.val[0];
+        px.val[2] = px.val[0];
+        px.val[3] = vdupq_n_u8(255);
+        vst4q_u8((uint8_t *)(dst + i), px);
+    }
+
+    expand_gray8_scalar(dst + i, s + i, n - i, palette);
+}
+
+// (x + 128 + ((x + 128) >> 8)) >> 8
+static inline uint8x8_t div255_neon(uint16x8_t x)
+{
+    return vrshrn_n_u16(vrsraq_n_u16(x, x, 8), 8);
+}
+
+static void mask_row_neon(eva_pixel *dst, const uint8_t *mask, uint32_t n,
+                          eva_pixel color)
+{
+    const uint8x8_t cb = vdup_n_u8(color.b);
+    const uint8x8_t cg = vdup_n_u8(color.g);
+    const uint8x8_t cr = vdup_n_u8(color.r);
+    const uint8x8_t ca = vdup_n_u8(color.a);
+
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint8x8_t m = vld1_u8(mask + i);
+        if (vmaxv_u8(m) == 0) {
+            continue;
+        }
+
+        // The channels are deinterleaved, so each one is a plain vector.
+        uint8x8x4_t d = vld4_u8((const uint8_t *)(dst + i));
+        uint8x8_t sb = div255_neon(vmull_u8(cb, m));
+        uint8x8_t sg = div255_neon(vmull_u8(cg, m));
+        uint8x8_t sr = div255_neon(vmull_u8(cr, m));
+        uint8x8_t sa = div255_neon(vmull_u8(ca, m));
+        uint8x8_t ia = vmvn_u8(sa);
+
+        d.val[0] = vadd_u8(sb, div255_neon(vmull_u8(d.val[0], ia)));
+        d.val[1] = vadd_u8(sg, div255_neon(vmull_u8(d.val[1], ia)));
+        d.val[2] = vadd_u8(sr, div255_neon(vmull_u8(d.val[2], ia)));
+        d.val[3] = vadd_u8(sa, div255_neon(vmull_u8(d.val[3], ia)));
+        vst4_u8((uint8_t *)(dst + i), d);
+    }
+
+    mask_row_scalar(dst + i, mask + i, n - i, color);
+}
+
+static inline uint64x2_t hash_scramble_neon(uint64x2_t a, const uint64_t *key)
+{
+    const uint32x2_t prime = vdup_n_u32(EVA_HASH_PRIME32);
+    a = veorq_u64(a, vshrq_n_u64(a, 47));
+    a = veorq_u64(a, vld1q_u64(key));
+    uint64x2_t lo = vmull_u32(vmovn_u64(a), prime);
+    uint64x2_t hi = vmull_u32(vshrn_n_u64(a, 32), prime);
+    return vaddq_u64(lo, vshlq_n_u64(hi, 32));
+}
+
+static void hash_rows_neon(uint64_t *acc, const uint8_t *data, size_t pitch,
+                           uint32_t rows, size_t stripes)
+{
+    uint64x2_t a[4];
+    for (int j = 0; j < 4; j++) {
+        a[j] = vld1q_u64(acc + j * 2);
+    }
+
+    for (uint32_t y = 0; y < rows; y++, data += pitch) {
+        const uint8_t *p = data;
+        for (size_t s = 0; s < stripes; s++, p += EVA_HASH_STRIPE) {
+            const uint64_t *key = hash_key + (s & 3);
+            for (int j = 0; j < 4; j++) {
+                uint64x2_t v = vreinterpretq_u64_u8(vld1q_u8(p + j * 16));
+                uint64x2_t k = veorq_u64(v, vld1q_u64(key + j * 2));
+                a[j] = vaddq_u64(a[j], vextq_u64(v, v, 1));
+                a[j] = vmlal_u32(a[j], vmovn_u64(k), vshrn_n_u64(k, 32));
+            }
+
+            if (hash_scramble_after(s, stripes)) {
+                for (int j = 0; j < 4; j++) {
+                    a[j] = hash_scramble_neon(a[j], hash_key + 3 + j * 2);
+                }
+            }
+        }
+    }
+
+    for (int j = 0; j < 4; j++) {
+        vst1q_u64(acc + j * 2, a[j]);
+    }
+}
+
+#endif
+
+static bool select_kernels(eva_draw_simd simd)
+{
+    switch (simd) {
+        case EVA_DRAW_SIMD_NONE:
+            _kernels.fill_row        = fill_row_scalar;
+            _kernels.blend_row       = blend_row_scalar;
+            _kernels.expand_rgb565   = expand_rgb565_scalar;
+            _kernels.expand_indexed8 = expand_indexed8_scalar;
+            _kernels.expand_gray8    = expand_gray8_scalar;
+            _kernels.mask_row        = mask_row_scalar;
+            _kernels.hash_rows       = hash_rows_scalar;
+            break;
+#if defined(EVA_DRAW_X86)
+        case EVA_DRAW_SIMD_SSE2:
+            if (!cpu_has_sse2()) {
+                return false;
+            }
+            _kernels.fill_row        = fill_row_sse2;
+            _kernels.blend_row       = blend_row_sse2;
+            _kernels.expand_rgb565   = expand_rgb565_sse2;
+            _kernels.expand_indexed8 = expand_indexed8_scalar;
+            _kernels.expand_gray8    = expand_gray8_sse2;
+            _kernels.mask_row        = mask_row_sse2;
+            _kernels.hash_rows       = hash_rows_sse2;
+            break;
+        case EVA_DRAW_SIMD_AVX2:
+            if (!cpu_has_avx2()) {
+                return false;
+            }
+            _kernels.fill_row        = fill_row_avx2;
+            _kernels.blend_row       = blend_row_avx2;
+            _kernels.expand_rgb565   = expand_rgb565_avx2;
+            _kernels.expand_indexed8 = expand_indexed8_avx2;
+            _kernels.expand_gray8    = expand_gray8_avx2;
+            _kernels.mask_row        = mask_row_avx2;
+            _kernels.hash_rows       = hash_rows_avx2;
+            break;
+#elif defined(EVA_DRAW_NEON)
+        case EVA_DRAW_SIMD_NEON:
+            _kernels.fill_row        = fill_row_neon;
+            _kernels.blend_row       = blend_row_neon;
+            _kernels.expand_rgb565   = expand_rgb565_neon;
+            _kernels.expand_indexed8 = expand_indexed8_scalar;
+            _kernels.expand_gray8    = expand_gray8_neon;
+            _kernels.mask_row        = mask_row_neon;
+            _kernels.hash_rows       = hash_rows_neon;
+            break;
+#endif
+        default:
+            return false;
+    }
+
+    _kernels.simd        = simd;
+    _kernels.initialized = true;
+    return true;
+}
+
+static inline void init_kernels(void)
+{
+    if (_kernels.initialized) {
+        return;
+    }
+
+    if (!select_kernels(EVA_DRAW_SIMD_AVX2) &&
+        !select_kernels(EVA_DRAW_SIMD_SSE2) &&
+        !select_kernels(EVA_DRAW_SIMD_NEON)) {
+        select_kernels(EVA_DRAW_SIMD_NONE);
+    }
+}
+
+bool eva_draw_set_simd(eva_draw_simd simd)
+{
+    init_kernels();
+
+    eva_draw_kernels prev = _kernels;
+    if (!select_kernels(simd)) {
+        _kernels = prev;
+        return false;
+    }
+    return true;
+}
+
+eva_draw_simd eva_draw_get_simd(void)
+{
+    init_kernels();
+    return _kernels.simd;
+}
+
+// Fills of the compact formats are narrow enough for the compiler to
+// vectorize on its own.
+static void fill_compact(const eva_framebuffer *fb, eva_rect rect,
+                         eva_pixel color)
+{
+    if (fb->format == EVA_PIXEL_FORMAT_GRAY8) {
+        uint8_t gray = (uint8_t)((77u * color.r + 150u * color.g +
+                                  29u * color.b + 128u) >> 8);
+        for (int32_t y = 0; y < rect.h; y++) {
+            memset(framebuffer_at(fb, rect.x, rect.y + y), gray, (size_t)rect.w);
+        }
+    } else if (fb->format == EVA_PIXEL_FORMAT_RGB565) {
+        uint16_t c = (uint16_t)(((color.r >> 3) << 11) |
+                                ((color.g >> 2) << 5) |
+                                (color.b >> 3));
+        for (int32_t y = 0; y < rect.h; y++) {
+            uint16_t *row = (uint16_t *)framebuffer_at(fb, rect.x, rect.y + y);
+            for (int32_t x = 0; x < rect.w; x++) {
+                row[x] = c;
+            }
+        }
+    }
+}
+
+static void fill(const eva_framebuffer *fb, eva_rect rect, eva_pixel color)
+{
+    rect = rect_clip(rect, fb->w, fb->h);
+    if (rect_is_empty(rect)) {
+        return;
+    }
+
+    if (fb->format != EVA_PIXEL_FORMAT_BGRA8) {
+        fill_compact(fb, rect, color);
+        return;
+    }
+
+    init_kernels();
+
+    uint32_t c = pixel_to_u32(color);
+    size_t bytes = (size_t)rect.w * (size_t)rect.h * sizeof(eva_pixel);
+    bool stream = bytes >= EVA_DRAW_STREAM_THRESHOLD;
+
+    eva_pixel *row = fb->pixels + (size_t)rect.y * fb->pitch + (size_t)rect.x;
+
+    // Rows that span the whole pitch are contiguous, fill them in one go.
+    if (rect.x == 0 && (uint32_t)rect.w == fb->pitch) {
+        _kernels.fill_row(row, (uint32_t)rect.w * (uint32_t)rect.h, c, stream);
+    } else {
+        for (int32_t y = 0; y < rect.h; y++, row += fb->pitch) {
+            _kernels.fill_row(row, (uint32_t)rect.w, c, stream);
+        }
+    }
+
+#if defined(EVA_DRAW_X86)
+    if (stream) {
+        // Make the non-temporal stores visible before anyone reads them.
+        _mm_sfence();
+    }
+#endif
+}
+
+void eva_draw_clear(const eva_framebuffer *fb, eva_pixel color)
+{
+    eva_rect rect = { 0, 0, (int32_t)fb->w, (int32_t)fb->h };
+    fill(fb, rect, color);
+}
+
+void eva_draw_fill_rect(const eva_framebuffer *fb, eva_rect rect,
+                        eva_pixel color)
+{
+    fill(fb, rect, color);
+}
+
+void eva_draw_copy_rect(const eva_framebuffer *dst, int32_t dst_x, int32_t dst_y,
+                        const eva_framebuffer *src, eva_rect src_rect)
+{
+    if (src->format != dst->format) {
+        return;
+    }
+
+    // Clip against the source, then move the destination by the same amount.
+    int64_t dx = (int64_t)dst_x - src_rect.x;
+    int64_t dy = (int64_t)dst_y - src_rect.y;
+
+    src_rect = rect_clip(src_rect, src->w, src->h);
+    if (rect_is_empty(src_rect)) {
+        return;
+    }
+
+    eva_rect dst_rect = {
+        (int32_t)(src_rect.x + dx),
+        (int32_t)(src_rect.y + dy),
+        src_rect.w,
+        src_rect.h
+    };
+    dst_rect = rect_clip(dst_rect, dst->w, dst->h);
+    if (rect_is_empty(dst_rect)) {
+        return;
+    }
+
+    src_rect.x = (int32_t)(dst_rect.x - dx);
+    src_rect.y = (int32_t)(dst_rect.y - dy);
+
+    // Row copies are left to memmove, the C library already picks the best
+    // vector width for the CPU and handles overlapping rows.
+    size_t bpp        = pixel_format_size(dst->format);
+    size_t row_bytes  = (size_t)dst_rect.w * bpp;
+    size_t src_stride = (size_t)src->pitch * bpp;
+    size_t dst_stride = (size_t)dst->pitch * bpp;
+    const uint8_t *s = framebuffer_at(src, src_rect.x, src_rect.y);
+    uint8_t       *d = framebuffer_at(dst, dst_rect.x, dst_rect.y);
+
+    // Copy bottom up when moving down within the same buffer so rows are
+    // read before they are overwritten.
+    if (framebuffer_at(src, 0, 0) == framebuffer_at(dst, 0, 0) &&
+        dst_rect.y > src_rect.y) {
+        s += (size_t)(dst_rect.h - 1) * src_stride;
+        d += (size_t)(dst_rect.h - 1) * dst_stride;
+        for (int32_t y = 0; y < dst_rect.h; y++, s -= src_stride, d -= dst_stride) {
+            memmove(d, s, row_bytes);
+        }
+    } else {
+        for (int32_t y = 0; y < dst_rect.h; y++, s += src_stride, d += dst_stride) {
+            memmove(d, s, row_bytes);
+        }
+    }
+}
+
+eva_rect eva_draw_scroll(const eva_framebuffer *fb, eva_rect rect,
+                         int32_t dx, int32_t dy)
+{
+    rect = rect_clip(rect, fb->w, fb->h);
+    if (dx == 0 && dy == 0) {
+        return EVA_RECT_EMPTY;
+    }
+
+    eva_rect src = rect_scroll_source(rect, dx, dy);
+    if (rect_is_empty(src)) {
+        return rect;
+    }
+    eva_draw_copy_rect(fb, src.x + dx, src.y + dy, fb, src);
+
+    if (dx != 0 && dy != 0) {
+        return rect;
+    }
+    if (dy > 0) {
+        return (eva_rect){ rect.x, rect.y, rect.w, dy };
+    }
+    if (dy < 0) {
+        return (eva_rect){ rect.x, rect.y + rect.h + dy, rect.w, -dy };
+    }
+    if (dx > 0) {
+        return (eva_rect){ rect.x, rect.y, dx, rect.h };
+    }
+    return (eva_rect){ rect.x + rect.w + dx, rect.y, -dx, rect.h };
+}
+
+void eva_draw_blit(const eva_framebuffer *dst, int32_t x, int32_t y,
+                   const eva_framebuffer *src)
+{
+    eva_rect rect = { 0, 0, (int32_t)src->w, (int32_t)src->h };
+    eva_draw_blend_rect(dst, x, y, src, rect, 255);
+}
+
+void eva_draw_blend_rect(const eva_framebuffer *dst, int32_t dst_x, int32_t dst_y,
+                         const eva_framebuffer *src, eva_rect src_rect,
+                         uint8_t opacity)
+{
+    if (dst->format != EVA_PIXEL_FORMAT_BGRA8 ||
+        src->format != EVA_PIXEL_FORMAT_BGRA8 || opacity == 0) {
+        return;
+    }
+
+    // Clip against the source, then move the destination by the same amount.
+    int64_t dx = (int64_t)dst_x - src_rect.x;
+    int64_t dy = (int64_t)dst_y - src_rect.y;
+
+    src_rect = rect_clip(src_rect, src->w, src->h);
+    if (rect_is_empty(src_rect)) {
+        return;
+    }
+
+    eva_rect dst_rect = {
+        (int32_t)(src_rect.x + dx),
+        (int32_t)(src_rect.y + dy),
+        src_rect.w,
+        src_rect.h
+    };
+    dst_rect = rect_clip(dst_rect, dst->w, dst->h);
+    if (rect_is_empty(dst_rect)) {
+        return;
+    }
+
+    init_kernels();
+
+    const eva_pixel *s = src->pixels +
+                         (size_t)(dst_rect.y - dy) * src->pitch +
+                         (size_t)(dst_rect.x - dx);
+    eva_pixel *d = dst->pixels + (size_t)dst_rect.y * dst->pitch +
+                   (size_t)dst_rect.x;
+
+    if (opacity == 255) {
+        for (int32_t y = 0; y < dst_rect.h; y++, s += src->pitch, d += dst->pitch) {
+            _kernels.blend_row(d, s, (uint32_t)dst_rect.w);
+        }
+        return;
+    }
+
+    // Premultiplied pixels fade by scaling all four channels, a chunk at a
+    // time so the blend still runs on the vector kernel.
+    eva_pixel faded[256];
+    for (int32_t y = 0; y < dst_rect.h; y++, s += src->pitch, d += dst->pitch) {
+        for (uint32_t x = 0; x < (uint32_t)dst_rect.w; x += 256) {
+            uint32_t n = (uint32_t)dst_rect.w - x;
+            if (n > 256) {
+                n = 256;
+            }
+            for (uint32_t i = 0; i < n; i++) {
+                eva_pixel p = s[x + i];
+                faded[i].b = (uint8_t)div255(p.b * (uint32_t)opacity);
+                faded[i].g = (uint8_t)div255(p.g * (uint32_t)opacity);
+                faded[i].r = (uint8_t)div255(p.r * (uint32_t)opacity);
+                faded[i].a = (uint8_t)div255(p.a * (uint32_t)opacity);
+            }
+            _kernels.blend_row(d + x, faded, n);
+        }
+    }
+}
+
+void eva_draw_mask(const eva_framebuffer *fb, int32_t x, int32_t y,
+                   const uint8_t *mask, uint32_t w, uint32_t h,
+                   uint32_t mask_pitch, eva_pixel color)
+{
+    if (fb->format != EVA_PIXEL_FORMAT_BGRA8 || color.a == 0) {
+        return;
+    }
+
+    eva_rect rect = { x, y, (int32_t)w, (int32_t)h };
+    rect = rect_clip(rect, fb->w, fb->h);
+    if (rect_is_empty(rect)) {
+        return;
+    }
+
+    init_kernels();
+
+    eva_pixel premul = {
+        (uint8_t)div255(color.b * (uint32_t)color.a),
+        (uint8_t)div255(color.g * (uint32_t)color.a),
+        (uint8_t)div255(color.r * (uint32_t)color.a),
+        color.a,
+    };
+
+    const uint8_t *m = mask + (size_t)(rect.y - y) * mask_pitch +
+                       (size_t)(rect.x - x);
+    eva_pixel *d = fb->pixels + (size_t)rect.y * fb->pitch + (size_t)rect.x;
+
+    for (int32_t row = 0; row < rect.h; row++, m += mask_pitch, d += fb->pitch) {
+        _kernels.mask_row(d, m, (uint32_t)rect.w, premul);
+    }
+}
+
+void eva_draw_expand(const eva_framebuffer *dst, const eva_framebuffer *src,
+                     eva_rect rect, const eva_pixel *palette)
+{
+    if (dst->format != EVA_PIXEL_FORMAT_BGRA8) {
+        return;
+    }
+
+    rect = rect_clip(rect, src->w, src->h);
+    rect = rect_clip(rect, dst->w, dst->h);
+    if (rect_is_empty(rect)) {
+        return;
+    }
+
+    init_kernels();
+
+    eva_expand_row_fn expand_row;
+    switch (src->format) {
+        case EVA_PIXEL_FORMAT_RGB565:   expand_row = _kernels.expand_rgb565;   break;
+        case EVA_PIXEL_FORMAT_INDEXED8: expand_row = _kernels.expand_indexed8; break;
+        case EVA_PIXEL_FORMAT_GRAY8:    expand_row = _kernels.expand_gray8;    break;
+        default: return;
+    }
+    if (src->format == EVA_PIXEL_FORMAT_INDEXED8 && palette == NULL) {
+        return;
+    }
+
+    size_t src_stride = (size_t)src->pitch * pixel_format_size(src->format);
+    const uint8_t *s = framebuffer_at(src, rect.x, rect.y);
+    eva_pixel     *d = dst->pixels + (size_t)rect.y * dst->pitch + (size_t)rect.x;
+
+    for (int32_t row = 0; row < rect.h; row++, s += src_stride, d += dst->pitch) {
+        expand_row(d, s, (uint32_t)rect.w, palette);
+    }
+}
+
+uint64_t eva_draw_hash(const eva_framebuffer *fb, eva_rect rect)
+{
+    rect = rect_clip(rect, fb->w, fb->h);
+    init_kernels();
+
+    uint64_t acc[8];
+    memcpy(acc, hash_key, sizeof(acc));
+
+    if (!rect_is_empty(rect)) {
+        size_t pixel   = pixel_format_size(fb->format);
+        size_t pitch   = (size_t)fb->pitch * pixel;
+        size_t bytes   = (size_t)rect.w * pixel;
+        size_t stripes = bytes / EVA_HASH_STRIPE;
+        size_t tail    = bytes % EVA_HASH_STRIPE;
+        const uint8_t *row = framebuffer_at(fb, rect.x, rect.y);
+
+        _kernels.hash_rows(acc, row, pitch, (uint32_t)rect.h, stripes);
+
+        // What is left of each row is zero padded to a stripe of its own.
+        if (tail) {
+            uint8_t last[EVA_HASH_STRIPE] = { 0 };
+            for (int32_t y = 0; y < rect.h; y++, row += pitch) {
+                memcpy(last, row + stripes * EVA_HASH_STRIPE, tail);
+                _kernels.hash_rows(acc, last, 0, 1, 1);
+            }
+        }
+    }
+
+    // Fold the lanes and the size together and avalanche the result.
+    uint64_t h = ((uint64_t)(uint32_t)rect.w << 32 | (uint32_t)rect.h) ^
+                 0x9E3779B185EBCA87ull;
+    for (int i = 0; i < 8; i++) {
+        h ^= acc[i];
+        h = ((h << 27) | (h >> 37)) * 0x9E3779B185EBCA87ull + 0x85EBCA77C2B2AE63ull;
+    }
+    h ^= h >> 33;
+    h *= 0xC2B2AE3D27D4EB4Full;
+    h ^= h >> 29;
+    h *= 0x165667B19E3779F9ull;
+    h ^= h >> 32;
+    return h;
+}
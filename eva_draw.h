@@ -0,0 +1,166 @@
+#pragma once
+
+/**
+ * Drawing routines for the eva framebuffer.
+ *
+ * Every routine clips to the framebuffer, respects its pitch and only touches
+ * the pixels it draws. The routines draw into BGRA8 framebuffers, clears,
+ * fills and copies also work on the RGB565 and GRAY8
+ * [pixel formats](@ref eva_pixel_format) and copies on INDEXED8. The inner loops are implemented with SSE2, AVX2 or
+ * NEON when available, the best implementation supported by the CPU is picked
+ * the first time a routine is called. A portable scalar version is always
+ * available as a fallback.
+ */
+
+#include "eva.h"
+
+/**
+ * @brief Instruction sets the drawing routines can be implemented with.
+ *
+ * @see @ref eva_draw_set_simd
+ *
+ * @ingroup drawing
+ */
+typedef enum eva_draw_simd {
+    EVA_DRAW_SIMD_NONE,
+    EVA_DRAW_SIMD_SSE2,
+    EVA_DRAW_SIMD_AVX2,
+    EVA_DRAW_SIMD_NEON,
+} eva_draw_simd;
+
+/**
+ * @brief Fill the entire framebuffer (fb->w x fb->h) with a single color.
+ *
+ * @ingroup drawing
+ */
+void eva_draw_clear(const eva_framebuffer *fb, eva_pixel color);
+
+/**
+ * @brief Fill a rectangle with a single color.
+ *
+ * In the RGB565 and GRAY8 formats the color is converted to the format,
+ * GRAY8 uses its luma.
+ *
+ * @ingroup drawing
+ */
+void eva_draw_fill_rect(const eva_framebuffer *fb, eva_rect rect,
+                        eva_pixel color);
+
+/**
+ * @brief Copy a rectangle of pixels from one framebuffer to another.
+ *
+ * The source rectangle is clipped to the source framebuffer and the
+ * destination to the destination framebuffer. Source and destination may be
+ * the same framebuffer and the rectangles may overlap.
+ *
+ * @ingroup drawing
+ */
+void eva_draw_copy_rect(const eva_framebuffer *dst, int32_t dst_x, int32_t dst_y,
+                        const eva_framebuffer *src, eva_rect src_rect);
+
+/**
+ * @brief Move the pixels inside a rectangle by dx, dy.
+ *
+ * The rectangle is clipped to the framebuffer. Pixels moved past its edges
+ * are dropped, the area they leave behind keeps its old pixels and is
+ * returned so only it has to be redrawn. When both dx and dy are set the
+ * exposed area is L shaped and its bounding rectangle, the whole rect, is
+ * returned. Works on every pixel format.
+ *
+ * @see @ref eva_scroll_region
+ *
+ * @ingroup drawing
+ */
+eva_rect eva_draw_scroll(const eva_framebuffer *fb, eva_rect rect,
+                         int32_t dx, int32_t dy);
+
+/**
+ * @brief Alpha blend an image onto the framebuffer.
+ *
+ * The src image (src->w x src->h pixels, rows src->pitch pixels apart) is
+ * drawn with its top left corner at x, y. The source pixels are expected to
+ * have premultiplied alpha, i.e. dst = src + dst * (1 - src.a). Fully opaque
+ * and fully transparent spans take a fast path.
+ *
+ * Only the w, h, pitch and pixels fields of src are used so any image can be
+ * wrapped in an eva_framebuffer to be drawn.
+ *
+ * @ingroup drawing
+ */
+void eva_draw_blit(const eva_framebuffer *dst, int32_t x, int32_t y,
+                   const eva_framebuffer *src);
+
+/**
+ * @brief Alpha blend a rectangle of an image onto the framebuffer.
+ *
+ * The same as eva_draw_blit() for src_rect of src, drawn with its top left
+ * corner at dst_x, dst_y and clipped like eva_draw_copy_rect(). The source is
+ * faded by opacity first, 255 draws it as is.
+ *
+ * @ingroup drawing
+ */
+void eva_draw_blend_rect(const eva_framebuffer *dst, int32_t dst_x, int32_t dst_y,
+                         const eva_framebuffer *src, eva_rect src_rect,
+                         uint8_t opacity);
+
+/**
+ * @brief Blend a color through an 8 bit coverage mask.
+ *
+ * The w x h mask, rows mask_pitch bytes apart, is drawn with its top left
+ * corner at x, y. Each pixel is blended with color scaled by its coverage,
+ * 255 being fully covered. The color is not premultiplied. Uncovered spans
+ * are skipped, which makes this the fast path for glyphs, see eva_text.h.
+ *
+ * @ingroup drawing
+ */
+void eva_draw_mask(const eva_framebuffer *fb, int32_t x, int32_t y,
+                   const uint8_t *mask, uint32_t w, uint32_t h,
+                   uint32_t mask_pitch, eva_pixel color);
+
+/**
+ * @brief Convert a rectangle of a compact framebuffer to eva_pixel.
+ *
+ * Converts rect of src, which is in one of the compact
+ * [pixel formats](@ref eva_pixel_format), to the same rect of the BGRA8
+ * framebuffer dst. The rectangle is clipped to both. palette holds the 256
+ * colors of EVA_PIXEL_FORMAT_INDEXED8 and is ignored by the other formats.
+ * Converted pixels are opaque.
+ *
+ * @ingroup drawing
+ */
+void eva_draw_expand(const eva_framebuffer *dst, const eva_framebuffer *src,
+                     eva_rect rect, const eva_pixel *palette);
+
+/**
+ * @brief Hash the pixels inside a rectangle.
+ *
+ * The rectangle is clipped to the framebuffer. The hash only depends on the
+ * size of the clipped rectangle and its pixels, not on where it is, and is
+ * the same with every instruction set. Works on every pixel format. Meant
+ * for telling whether pixels changed, e.g. in tests, it is not a
+ * cryptographic hash.
+ *
+ * @see @ref eva_set_content_hashing
+ *
+ * @ingroup drawing
+ */
+uint64_t eva_draw_hash(const eva_framebuffer *fb, eva_rect rect);
+
+/**
+ * @brief Force the drawing routines to use a specific instruction set.
+ *
+ * Intended for testing and benchmarking.
+ *
+ * @return False if the instruction set is not supported by this CPU or build,
+ * in which case the current selection is kept.
+ *
+ * @ingroup drawing
+ */
+bool eva_draw_set_simd(eva_draw_simd simd);
+
+/**
+ * @brief The instruction set the drawing routines currently use.
+ *
+ * @ingroup drawing
+ */
+eva_draw_simd eva_draw_get_simd(void);
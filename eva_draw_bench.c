@@ -0,0 +1,344 @@
+/**
+ * Microbenchmark for the eva_draw routines.
+ *
+ * Every routine is run with each instruction set supported by the CPU and
+ * compared against the per-pixel loops the demo used to draw with. Results
+ * are reported in GB/s of framebuffer memory written. The rgb565, indexed8
+ * and gray8 cases expand a whole frame of a compact pixel format, mask blends
+ * a color through a coverage mask the size of the blit image and hash reads a
+ * whole frame.
+ *
+ * Usage: eva_draw_bench [width height]
+ */
+
+#include "eva.h"
+#include "eva_draw.h"
+#include "eva_headless.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_MIN_TIME_MS 300.0f
+
+typedef void (*bench_fn)(const eva_framebuffer *fb, const eva_framebuffer *img);
+
+static const char *simd_names[] = {
+    [EVA_DRAW_SIMD_NONE] = "scalar",
+    [EVA_DRAW_SIMD_SSE2] = "sse2",
+    [EVA_DRAW_SIMD_AVX2] = "avx2",
+    [EVA_DRAW_SIMD_NEON] = "neon",
+};
+
+static const eva_pixel gray = { .b = 20, .g = 20, .r = 20, .a = 255 };
+static const eva_pixel red  = { .b = 0, .g = 0, .r = 255, .a = 255 };
+
+// Compact framebuffers of the same size as the one drawn into, expanded
+// into it by the expand cases.
+static eva_framebuffer compact[EVA_PIXEL_FORMAT_GRAY8 + 1];
+static eva_pixel       palette[256];
+
+// Coverage of the mask case, glyph-like stripes with empty gaps.
+static uint8_t *mask;
+
+static eva_rect fill_area(const eva_framebuffer *fb)
+{
+    eva_rect r = { 10, 10, (int32_t)fb->w / 2, (int32_t)fb->h / 2 };
+    return r;
+}
+
+static void naive_clear(const eva_framebuffer *fb, const eva_framebuffer *img)
+{
+    (void)img;
+    for (uint32_t j = 0; j < fb->h; j++) {
+        for (uint32_t i = 0; i < fb->w; i++) {
+            fb->pixels[i + j * fb->pitch] = gray;
+        }
+    }
+}
+
+static void naive_fill_rect(const eva_framebuffer *fb, const eva_framebuffer *img)
+{
+    (void)img;
+    eva_rect r = fill_area(fb);
+    for (int32_t j = r.y; j < r.y + r.h; j++) {
+        for (int32_t i = r.x; i < r.x + r.w; i++) {
+            fb->pixels[i + j * fb->pitch] = red;
+        }
+    }
+}
+
+static void naive_blit(const eva_framebuffer *fb, const eva_framebuffer *img)
+{
+    for (uint32_t j = 0; j < img->h; j++) {
+        for (uint32_t i = 0; i < img->w; i++) {
+            eva_pixel s = img->pixels[i + j * img->pitch];
+            eva_pixel *d = &fb->pixels[i + j * fb->pitch];
+            uint32_t ia = 255u - s.a;
+            d->b = (uint8_t)(s.b + (d->b * ia + 127) / 255);
+            d->g = (uint8_t)(s.g + (d->g * ia + 127) / 255);
+            d->r = (uint8_t)(s.r + (d->r * ia + 127) / 255);
+            d->a = (uint8_t)(s.a + (d->a * ia + 127) / 255);
+        }
+    }
+}
+
+static void draw_clear(const eva_framebuffer *fb, const eva_framebuffer *img)
+{
+    (void)img;
+    eva_draw_clear(fb, gray);
+}
+
+static void draw_fill_rect(const eva_framebuffer *fb, const eva_framebuffer *img)
+{
+    (void)img;
+    eva_draw_fill_rect(fb, fill_area(fb), red);
+}
+
+static void draw_copy_rect(const eva_framebuffer *fb, const eva_framebuffer *img)
+{
+    (void)img;
+    // Scroll the framebuffer up by one row.
+    eva_rect r = { 0, 1, (int32_t)fb->w, (int32_t)fb->h - 1 };
+    eva_draw_copy_rect(fb, 0, 0, fb, r);
+}
+
+static void draw_blit(const eva_framebuffer *fb, const eva_framebuffer *img)
+{
+    eva_draw_blit(fb, 0, 0, img);
+}
+
+static void naive_mask(const eva_framebuffer *fb, const eva_framebuffer *img)
+{
+    for (uint32_t j = 0; j < img->h; j++) {
+        for (uint32_t i = 0; i < img->w; i++) {
+            uint32_t m = mask[i + j * img->w];
+            eva_pixel *d = &fb->pixels[i + j * fb->pitch];
+            uint32_t ia = 255u - m;
+            d->b = (uint8_t)((red.b * m + d->b * ia + 127) / 255);
+            d->g = (uint8_t)((red.g * m + d->g * ia + 127) / 255);
+            d->r = (uint8_t)((red.r * m + d->r * ia + 127) / 255);
+            d->a = (uint8_t)((red.a * m + d->a * ia + 127) / 255);
+        }
+    }
+}
+
+static void draw_mask(const eva_framebuffer *fb, const eva_framebuffer *img)
+{
+    eva_draw_mask(fb, 0, 0, mask, img->w, img->h, img->w, red);
+}
+
+// Keeps the hashes from being optimized away.
+static volatile uint64_t hash_sink;
+
+static void draw_hash(const eva_framebuffer *fb, const eva_framebuffer *img)
+{
+    (void)img;
+    eva_rect r = { 0, 0, (int32_t)fb->w, (int32_t)fb->h };
+    hash_sink = eva_draw_hash(fb, r);
+}
+
+static void expand(const eva_framebuffer *fb, eva_pixel_format format)
+{
+    eva_rect r = { 0, 0, (int32_t)fb->w, (int32_t)fb->h };
+    eva_draw_expand(fb, &compact[format], r, palette);
+}
+
+static void draw_rgb565(const eva_framebuffer *fb, const eva_framebuffer *img)
+{
+    (void)img;
+    expand(fb, EVA_PIXEL_FORMAT_RGB565);
+}
+
+static void draw_indexed8(const eva_framebuffer *fb, const eva_framebuffer *img)
+{
+    (void)img;
+    expand(fb, EVA_PIXEL_FORMAT_INDEXED8);
+}
+
+static void draw_gray8(const eva_framebuffer *fb, const eva_framebuffer *img)
+{
+    (void)img;
+    expand(fb, EVA_PIXEL_FORMAT_GRAY8);
+}
+
+static double bytes_clear(const eva_framebuffer *fb, const eva_framebuffer *img)
+{
+    (void)img;
+    return (double)fb->w * fb->h * sizeof(eva_pixel);
+}
+
+static double bytes_fill_rect(const eva_framebuffer *fb, const eva_framebuffer *img)
+{
+    (void)img;
+    eva_rect r = fill_area(fb);
+    return (double)r.w * r.h * sizeof(eva_pixel);
+}
+
+static double bytes_copy_rect(const eva_framebuffer *fb, const eva_framebuffer *img)
+{
+    (void)img;
+    return (double)fb->w * (fb->h - 1) * sizeof(eva_pixel);
+}
+
+static double bytes_blit(const eva_framebuffer *fb, const eva_framebuffer *img)
+{
+    (void)fb;
+    return (double)img->w * img->h * sizeof(eva_pixel);
+}
+
+typedef struct bench_case {
+    const char *name;
+    bench_fn    naive;
+    bench_fn    draw;
+    double    (*bytes)(const eva_framebuffer *fb, const eva_framebuffer *img);
+} bench_case;
+
+static const bench_case cases[] = {
+    { "clear",     naive_clear,     draw_clear,     bytes_clear     },
+    { "fill_rect", naive_fill_rect, draw_fill_rect, bytes_fill_rect },
+    { "copy_rect", NULL,            draw_copy_rect, bytes_copy_rect },
+    { "blit",      naive_blit,      draw_blit,      bytes_blit      },
+    { "rgb565",    NULL,            draw_rgb565,    bytes_clear     },
+    { "indexed8",  NULL,            draw_indexed8,  bytes_clear     },
+    { "gray8",     NULL,            draw_gray8,     bytes_clear     },
+    { "mask",      naive_mask,      draw_mask,      bytes_blit      },
+    { "hash",      NULL,            draw_hash,      bytes_clear     },
+};
+
+static double run(bench_fn fn, const eva_framebuffer *fb,
+                  const eva_framebuffer *img, double bytes)
+{
+    // Warm up caches and the page tables.
+    fn(fb, img);
+
+    uint64_t iterations = 0;
+    uint64_t start = eva_time_now();
+    float elapsed_ms;
+    do {
+        fn(fb, img);
+        iterations++;
+        elapsed_ms = eva_time_since_ms(start);
+    } while (elapsed_ms < BENCH_MIN_TIME_MS);
+
+    return bytes * (double)iterations / (elapsed_ms / 1000.0) / 1e9;
+}
+
+static eva_framebuffer alloc_framebuffer(uint32_t w, uint32_t h, uint32_t pitch)
+{
+    eva_framebuffer fb = {
+        .w = w,
+        .h = h,
+        .pitch = pitch,
+        .max_height = h,
+        .scale_x = 1.0f,
+        .scale_y = 1.0f,
+    };
+    fb.pixels = calloc((size_t)pitch * h, sizeof(eva_pixel));
+    if (!fb.pixels) {
+        fprintf(stderr, "Failed to allocate %ux%u framebuffer\n", w, h);
+        exit(1);
+    }
+    return fb;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t w = 1920;
+    uint32_t h = 1080;
+    if (argc == 3) {
+        w = (uint32_t)strtoul(argv[1], NULL, 10);
+        h = (uint32_t)strtoul(argv[2], NULL, 10);
+    }
+    if (w < 2 || h < 2) {
+        fprintf(stderr, "Usage: %s [width height]\n", argv[0]);
+        return 1;
+    }
+
+    eva_headless_set_clock(EVA_HEADLESS_CLOCK_REAL);
+
+    // Over-allocate the pitch like the backends do for a larger screen.
+    eva_framebuffer fb = alloc_framebuffer(w, h, w + w / 4);
+
+    // A half transparent, half opaque image with a transparent border.
+    eva_framebuffer img = alloc_framebuffer(w / 2, h / 2, w / 2);
+    for (uint32_t j = 0; j < img.h; j++) {
+        for (uint32_t i = 0; i < img.w; i++) {
+            eva_pixel *p = &img.pixels[i + j * img.pitch];
+            uint8_t a = i < img.w / 8 ? 0 : (j < img.h / 2 ? 128 : 255);
+            p->a = a;
+            p->r = (uint8_t)((i * a) / 255);
+            p->g = (uint8_t)((j * a) / 255);
+            p->b = a / 2;
+        }
+    }
+
+    // Gradients in every compact format for the expand cases.
+    for (int f = EVA_PIXEL_FORMAT_RGB565; f <= EVA_PIXEL_FORMAT_GRAY8; f++) {
+        uint32_t bpp = f == EVA_PIXEL_FORMAT_RGB565 ? 2 : 1;
+        uint8_t *data = malloc((size_t)w * h * bpp);
+        if (!data) {
+            fprintf(stderr, "Failed to allocate %ux%u framebuffer\n", w, h);
+            return 1;
+        }
+        for (size_t i = 0; i < (size_t)w * h * bpp; i++) {
+            data[i] = (uint8_t)(i * 7);
+        }
+        compact[f] = (eva_framebuffer){
+            .w = w, .h = h, .pitch = w, .max_height = h,
+            .format = (eva_pixel_format)f, .data = data,
+        };
+    }
+    mask = malloc((size_t)img.w * img.h);
+    if (!mask) {
+        fprintf(stderr, "Failed to allocate %ux%u mask\n", img.w, img.h);
+        return 1;
+    }
+    for (uint32_t j = 0; j < img.h; j++) {
+        for (uint32_t i = 0; i < img.w; i++) {
+            uint32_t x = i % 12;
+            mask[i + j * img.w] = x < 4 ? 0 : (x < 6 ? 128 : 255);
+        }
+    }
+
+    for (uint32_t i = 0; i < 256; i++) {
+        palette[i] = (eva_pixel){ (uint8_t)i, (uint8_t)(255 - i), (uint8_t)(i * 3), 255 };
+    }
+
+    eva_draw_simd best = eva_draw_get_simd();
+
+    printf("framebuffer %ux%u (pitch %u), GB/s written\n", w, h, fb.pitch);
+    printf("%-10s %8s", "routine", "naive");
+    for (int s = EVA_DRAW_SIMD_NONE; s <= EVA_DRAW_SIMD_NEON; s++) {
+        if (eva_draw_set_simd((eva_draw_simd)s)) {
+            printf(" %8s", simd_names[s]);
+        }
+    }
+    printf("\n");
+
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        const bench_case *bc = &cases[c];
+        double bytes = bc->bytes(&fb, &img);
+
+        printf("%-10s", bc->name);
+        if (bc->naive) {
+            printf(" %8.2f", run(bc->naive, &fb, &img, bytes));
+        } else {
+            printf(" %8s", "-");
+        }
+        for (int s = EVA_DRAW_SIMD_NONE; s <= EVA_DRAW_SIMD_NEON; s++) {
+            if (eva_draw_set_simd((eva_draw_simd)s)) {
+                printf(" %8.2f", run(bc->draw, &fb, &img, bytes));
+            }
+        }
+        printf("\n");
+    }
+
+    eva_draw_set_simd(best);
+    for (int f = EVA_PIXEL_FORMAT_RGB565; f <= EVA_PIXEL_FORMAT_GRAY8; f++) {
+        free(compact[f].data);
+    }
+    free(mask);
+    free(img.pixels);
+    free(fb.pixels);
+    return 0;
+}
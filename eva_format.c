@@ -0,0 +1,146 @@
+#include "eva_internal.h"
+#include "eva_draw.h"
+
+typedef struct eva_format_ctx {
+    eva_pixel_format format;
+    bool             palette_set;
+    eva_pixel        palette[256];
+
+    // The framebuffer the application draws into in a compact format, or in
+    // BGRA8 while there are layers. Only touched by the thread that draws
+    // frames.
+    eva_framebuffer fb;
+} eva_format_ctx;
+
+static eva_format_ctx _format;
+
+// Indexed framebuffers start out gray so they show something before the
+// application sets a palette.
+static void init_palette(void)
+{
+    if (_format.palette_set) {
+        return;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        eva_pixel gray = { (uint8_t)i, (uint8_t)i, (uint8_t)i, 255 };
+        _format.palette[i] = gray;
+    }
+    _format.palette_set = true;
+}
+
+void eva_set_pixel_format(eva_pixel_format format)
+{
+    _format.format = format;
+}
+
+void eva_set_palette(const eva_pixel *colors, uint32_t first, uint32_t count)
+{
+    init_palette();
+    for (uint32_t i = 0; i < count && first + i < 256; i++) {
+        _format.palette[first + i] = colors[i];
+    }
+}
+
+// True when the application draws straight into the native framebuffer.
+static bool is_native(void)
+{
+    return _format.format == EVA_PIXEL_FORMAT_BGRA8 && !eva_layers_active();
+}
+
+eva_framebuffer eva_format_view(const eva_framebuffer *fb)
+{
+    if (is_native()) {
+        // The cached framebuffer of the layers is gone with the last layer,
+        // the next one starts a new copy.
+        if (_format.fb.data && _format.fb.format == EVA_PIXEL_FORMAT_BGRA8) {
+            eva_format_shutdown();
+        }
+        return *fb;
+    }
+
+    // Rows start on a cache line like the native ones. The buffer follows
+    // the native allocation, so it only changes when that does.
+    uint32_t bpp   = pixel_format_size(_format.format);
+    uint32_t bytes = (fb->pitch * bpp + EVA_CACHE_LINE - 1) /
+                     EVA_CACHE_LINE * EVA_CACHE_LINE;
+    uint32_t pitch = bytes / bpp;
+    if (_format.fb.data == NULL ||
+        _format.fb.format != _format.format ||
+        _format.fb.pitch != pitch ||
+        _format.fb.max_height != fb->max_height) {
+
+        bool first = _format.fb.data == NULL;
+
+        eva_alloc_free(_format.fb.data);
+        _format.fb.data = eva_alloc_pixels(bytes / sizeof(eva_pixel),
+                                           fb->max_height);
+        _format.fb.format     = _format.format;
+        _format.fb.pitch      = _format.fb.data ? pitch : 0;
+        _format.fb.max_height = _format.fb.data ? fb->max_height : 0;
+
+        // The first layer takes over what the application drew so far, no
+        // layer has been composited into fb yet.
+        if (first && _format.format == EVA_PIXEL_FORMAT_BGRA8 &&
+            _format.fb.data) {
+            eva_framebuffer cache = *fb;
+            cache.pixels = _format.fb.data;
+            cache.pitch  = _format.fb.pitch;
+            eva_rect all = { 0, 0, (int32_t)fb->w, (int32_t)fb->h };
+            eva_draw_copy_rect(&cache, 0, 0, fb, all);
+        }
+    }
+
+    eva_framebuffer view = *fb;
+    view.pixels     = NULL;
+    view.format     = _format.format;
+    view.data       = _format.fb.data;
+    if (view.format == EVA_PIXEL_FORMAT_BGRA8) {
+        view.pixels = view.data;
+        view.data   = NULL;
+    }
+    view.pitch      = _format.fb.pitch;
+    view.max_height = _format.fb.max_height;
+    if (_format.fb.data == NULL) {
+        view.w = 0;
+        view.h = 0;
+    }
+    return view;
+}
+
+void eva_format_expand(const eva_framebuffer *fb, eva_rect damage)
+{
+    if (is_native() || _format.fb.data == NULL) {
+        return;
+    }
+
+    eva_framebuffer view = eva_format_view(fb);
+    damage = rect_clip(damage, fb->w, fb->h);
+    if (view.format == EVA_PIXEL_FORMAT_BGRA8) {
+        eva_draw_copy_rect(fb, damage.x, damage.y, &view, damage);
+    } else {
+        init_palette();
+        eva_draw_expand(fb, &view, damage, _format.palette);
+    }
+    eva_layers_composite(fb, damage);
+}
+
+eva_rect eva_format_scroll(const eva_framebuffer *fb, eva_rect rect,
+                           int32_t dx, int32_t dy)
+{
+    eva_framebuffer view = eva_format_view(fb);
+    eva_rect exposed = eva_draw_scroll(&view, rect, dx, dy);
+    if (view.pixels != fb->pixels) {
+        eva_draw_scroll(fb, rect, dx, dy);
+    }
+    eva_hash_invalidate(rect);
+    eva_capture_invalidate(rect);
+    return exposed;
+}
+
+void eva_format_shutdown(void)
+{
+    eva_alloc_free(_format.fb.data);
+    _format.fb.data       = NULL;
+    _format.fb.pitch      = 0;
+    _format.fb.max_height = 0;
+}
@@ -0,0 +1,116 @@
+#include "eva_internal.h"
+#include "eva_draw.h"
+
+#include <stdlib.h>
+
+// A row of a tile is 4 stripes of eva_draw_hash() in BGRA8.
+#define EVA_HASH_TILE 64
+
+typedef struct eva_hash_ctx {
+    bool enabled;
+
+    // The hash of each tile as it was last presented, 0 when unknown. Sized
+    // for a w x h framebuffer.
+    uint64_t *hashes;
+    uint32_t  w, h;
+    uint32_t  tiles_x, tiles_y;
+} eva_hash_ctx;
+
+static eva_hash_ctx _hash;
+
+void eva_set_content_hashing(bool enabled)
+{
+    _hash.enabled = enabled;
+    if (!enabled) {
+        eva_hash_shutdown();
+    }
+}
+
+// Forgets every tile when the size changed, they all count as changed then.
+static bool resize(uint32_t w, uint32_t h)
+{
+    if (_hash.hashes && _hash.w == w && _hash.h == h) {
+        return true;
+    }
+
+    free(_hash.hashes);
+    _hash.tiles_x = (w + EVA_HASH_TILE - 1) / EVA_HASH_TILE;
+    _hash.tiles_y = (h + EVA_HASH_TILE - 1) / EVA_HASH_TILE;
+    _hash.hashes  = calloc((size_t)_hash.tiles_x * _hash.tiles_y,
+                           sizeof(uint64_t));
+    _hash.w = _hash.hashes ? w : 0;
+    _hash.h = _hash.hashes ? h : 0;
+    return _hash.hashes != NULL;
+}
+
+eva_rect eva_hash_damage(const eva_framebuffer *fb, eva_rect damage)
+{
+    if (!_hash.enabled) {
+        return damage;
+    }
+
+    damage = rect_clip(damage, fb->w, fb->h);
+    if (rect_is_empty(damage) || !resize(fb->w, fb->h)) {
+        return damage;
+    }
+
+    eva_rect changed = EVA_RECT_EMPTY;
+    int32_t  tx0 = damage.x / EVA_HASH_TILE;
+    int32_t  ty0 = damage.y / EVA_HASH_TILE;
+    int32_t  tx1 = (damage.x + damage.w - 1) / EVA_HASH_TILE;
+    int32_t  ty1 = (damage.y + damage.h - 1) / EVA_HASH_TILE;
+    for (int32_t ty = ty0; ty <= ty1; ty++) {
+        for (int32_t tx = tx0; tx <= tx1; tx++) {
+            eva_rect tile = {
+                tx * EVA_HASH_TILE, ty * EVA_HASH_TILE,
+                EVA_HASH_TILE, EVA_HASH_TILE
+            };
+            eva_rect area = rect_intersect(tile, damage);
+
+            // Only the damaged part of a tile is hashed, pixels outside of it
+            // weren't presented. Where that part is in the tile goes into the
+            // hash so a different part never matches.
+            uint64_t hash = eva_draw_hash(fb, area) ^
+                            ((uint64_t)(area.x - tile.x) << 56 |
+                             (uint64_t)(area.y - tile.y) << 48);
+            if (hash == 0) {
+                hash = 1;
+            }
+
+            uint64_t *last = &_hash.hashes[(size_t)ty * _hash.tiles_x + (size_t)tx];
+            if (*last != hash) {
+                *last   = hash;
+                changed = rect_union(changed, area);
+            }
+        }
+    }
+    return changed;
+}
+
+void eva_hash_invalidate(eva_rect rect)
+{
+    rect = rect_clip(rect, _hash.w, _hash.h);
+    if (!_hash.hashes || rect_is_empty(rect)) {
+        return;
+    }
+
+    int32_t tx0 = rect.x / EVA_HASH_TILE;
+    int32_t ty0 = rect.y / EVA_HASH_TILE;
+    int32_t tx1 = (rect.x + rect.w - 1) / EVA_HASH_TILE;
+    int32_t ty1 = (rect.y + rect.h - 1) / EVA_HASH_TILE;
+    for (int32_t ty = ty0; ty <= ty1; ty++) {
+        for (int32_t tx = tx0; tx <= tx1; tx++) {
+            _hash.hashes[(size_t)ty * _hash.tiles_x + (size_t)tx] = 0;
+        }
+    }
+}
+
+void eva_hash_shutdown(void)
+{
+    free(_hash.hashes);
+    _hash.hashes  = NULL;
+    _hash.w       = 0;
+    _hash.h       = 0;
+    _hash.tiles_x = 0;
+    _hash.tiles_y = 0;
+}
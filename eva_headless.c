@@ -0,0 +1,1017 @@
+#define _GNU_SOURCE // ppoll, pipe2
+
+#include "eva.h"
+#include "eva_headless.h"
+#include "eva_internal.h"
+#include "eva_trace.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define EVA_HEADLESS_DEFAULT_WINDOW_W 1280
+#define EVA_HEADLESS_DEFAULT_WINDOW_H 720
+#define EVA_HEADLESS_DEFAULT_SCREEN_W 1920
+#define EVA_HEADLESS_DEFAULT_SCREEN_H 1080
+#define EVA_HEADLESS_DEFAULT_REFRESH_RATE 60
+
+typedef enum eva_headless_event_type {
+    EVA_HEADLESS_EVENT_MOUSE_MOVED,
+    EVA_HEADLESS_EVENT_MOUSE_BTN,
+    EVA_HEADLESS_EVENT_SCROLL,
+    EVA_HEADLESS_EVENT_KEY,
+    EVA_HEADLESS_EVENT_TEXT_INPUT,
+    EVA_HEADLESS_EVENT_RESIZE,
+    EVA_HEADLESS_EVENT_FRAME,
+    EVA_HEADLESS_EVENT_CLOSE,
+} eva_headless_event_type;
+
+typedef struct eva_headless_event {
+    eva_headless_event_type type;
+    uint64_t time;
+    bool     paced; // Waits for its time with the real clock as well
+
+    union {
+        struct {
+            double x, y;
+            eva_mouse_btn btn;
+            eva_input_action action;
+        } mouse;
+        struct {
+            double delta_x, delta_y;
+        } scroll;
+        struct {
+            eva_key key;
+            eva_input_action action;
+            eva_mod_flags mod;
+        } key;
+        struct {
+            uint16_t *utf16_text;
+            uint32_t len;
+            eva_mod_flags mod;
+        } text;
+        struct {
+            uint32_t w, h;
+        } resize;
+        eva_rect frame;
+    };
+} eva_headless_event;
+
+typedef struct eva_ctx {
+    eva_framebuffer framebuffer;
+    uint32_t window_width, window_height;
+    uint32_t screen_width, screen_height;
+
+    const char *window_title;
+    bool        quit_requested;
+    bool        quit_ordered;
+
+    eva_init_fn        init_fn;
+    eva_frame_fn       frame_fn;
+    eva_cleanup_fn     cleanup_fn;
+    eva_cancel_quit_fn cancel_quit_fn;
+    eva_fail_fn        fail_fn;
+
+    eva_mouse_moved_fn   mouse_moved_fn;
+    eva_mouse_btn_fn     mouse_btn_fn;
+    eva_scroll_fn        scroll_fn;
+    eva_key_fn           key_fn;
+    eva_window_resize_fn window_resize_fn;
+
+    // Pending events sorted by time. Events with the same time keep the
+    // order in which they were posted.
+    eva_headless_event *events;
+    uint32_t            events_head;
+    uint32_t            events_count;
+    uint32_t            events_capacity;
+
+    eva_headless_clock clock;
+    uint64_t           virtual_time;
+
+    eva_frame_pacer pacer;
+
+    // Written to by threads posting events, see wait_for_wake().
+    int  wake_fds[2];
+    bool keep_alive;
+
+    uint64_t frame_count;
+    eva_rect damage;      // Union of the rects requested for the next frame
+    eva_rect last_damage; // What the last present covered
+    bool     request_frame;
+    bool     coalesce_frames;
+} eva_ctx;
+
+static eva_ctx _ctx;
+
+static void update_window(void);
+static void handle_close(void);
+static void handle_resize(uint32_t w, uint32_t h);
+static void dispatch_event(const eva_headless_event *event);
+static void post_event(const eva_headless_event *event);
+static bool try_frame(void);
+static bool draw_frame(void);
+static bool wait_until(uint64_t time);
+static bool wait_for_wake(uint64_t timeout);
+static void wake_event_loop(void);
+static bool present_pipelined(void);
+static void present(eva_rect damage);
+
+void eva_run(const char     *window_title,
+             eva_frame_fn    frame_fn,
+             eva_fail_fn     fail_fn)
+{
+    assert(window_title);
+    assert(frame_fn);
+    assert(fail_fn);
+
+    eva_time_init();
+    eva_trace_set_thread_name("eva event loop");
+
+    _ctx.window_title = window_title;
+    _ctx.frame_fn     = frame_fn;
+    _ctx.fail_fn      = fail_fn;
+
+    // eva_run() may be called again once it returns, e.g. to run several
+    // sessions from one test or benchmark process.
+    _ctx.quit_requested = false;
+    _ctx.quit_ordered   = false;
+    _ctx.request_frame  = false;
+    _ctx.damage         = EVA_RECT_EMPTY;
+    _ctx.frame_count    = 0;
+
+    if (_ctx.pacer.refresh_interval == 0) {
+        eva_headless_set_refresh_rate(EVA_HEADLESS_DEFAULT_REFRESH_RATE);
+    }
+
+    update_window();
+    if (_ctx.framebuffer.pixels == NULL) {
+        _ctx.fail_fn(0, "Failed to allocate framebuffer");
+        return;
+    }
+
+    _ctx.wake_fds[0] = -1;
+    _ctx.wake_fds[1] = -1;
+    if (pipe2(_ctx.wake_fds, O_NONBLOCK | O_CLOEXEC) != 0) {
+        _ctx.wake_fds[0] = -1;
+        _ctx.wake_fds[1] = -1;
+    }
+    eva_post_start(_ctx.wake_fds[1] != -1 ? wake_event_loop : NULL);
+
+    eva_stats_reset();
+    if (_ctx.init_fn) {
+        _ctx.init_fn();
+    }
+
+    // Let the application fill it's framebuffer before the first present,
+    // the same as the windowed backends do before showing the window.
+    eva_stats_begin_frame();
+    pacer_begin_frame(&_ctx.pacer, eva_time_now());
+    eva_tiles_render(_ctx.frame_fn, &_ctx.framebuffer, EVA_RECT_FULL);
+    present(EVA_RECT_FULL);
+
+    eva_pipeline_start(NULL);
+
+    while (!_ctx.quit_ordered) {
+        // Frames finished by the render thread are presented before anything
+        // else happens.
+        present_pipelined();
+        eva_post_dispatch();
+        eva_timers_run(eva_time_now());
+
+        eva_frame_idle(&_ctx.pacer, _ctx.request_frame);
+        try_frame();
+
+        bool has_event = _ctx.events_head != _ctx.events_count;
+
+        // Replayed events wait until they are due, the rest are dispatched
+        // right away with the real clock.
+        uint64_t ready = 0;
+        if (has_event && _ctx.clock == EVA_HEADLESS_CLOCK_REAL &&
+            _ctx.events[_ctx.events_head].paced) {
+            ready = _ctx.events[_ctx.events_head].time;
+        }
+
+        // Timers are due at their time the same as frames, a frame that is
+        // due with them is drawn after they were called.
+        uint64_t frame_due = pacer_deadline(&_ctx.pacer, _ctx.coalesce_frames,
+                                            _ctx.request_frame);
+        uint64_t due = eva_timers_deadline();
+        due = frame_due < due ? frame_due : due;
+        if (due != UINT64_MAX) {
+            bool draw;
+            if (_ctx.clock == EVA_HEADLESS_CLOCK_REAL) {
+                // Frames don't wait for events that aren't due yet.
+                draw = !has_event || due <= eva_time_now() || due <= ready;
+            } else {
+                // The frame is drawn at its time, after every event that
+                // happens before it.
+                if (due < _ctx.virtual_time) {
+                    due = _ctx.virtual_time;
+                }
+                draw = !has_event || _ctx.events[_ctx.events_head].time > due;
+            }
+
+            if (draw) {
+                if (!wait_until(due)) {
+                    continue;
+                }
+                eva_timers_run(eva_time_now());
+                if (frame_due <= eva_time_now()) {
+                    eva_frame_continuous(&_ctx.pacer, &_ctx.request_frame,
+                                         &_ctx.damage);
+                    draw_frame();
+                }
+                continue;
+            }
+        }
+
+        if (!has_event) {
+            // Nothing can happen anymore without new events so a pending
+            // frame is the last thing left to do.
+            if (!draw_frame()) {
+                // Except for the frame on the render thread.
+                eva_pipeline_wait();
+                if (!present_pipelined()) {
+                    if (!_ctx.keep_alive || _ctx.wake_fds[0] == -1) {
+                        break;
+                    }
+                    wait_for_wake(UINT64_MAX);
+                }
+            }
+            continue;
+        }
+
+        if (ready > eva_time_now() && !wait_until(ready)) {
+            continue;
+        }
+
+        // Copy the event out of the queue as dispatching it can post new
+        // events which may grow the queue.
+        eva_headless_event event = _ctx.events[_ctx.events_head++];
+        if (_ctx.events_head == _ctx.events_count) {
+            _ctx.events_head  = 0;
+            _ctx.events_count = 0;
+        }
+
+        eva_headless_set_time(event.time);
+        EVA_TRACE_BEGIN("dispatch");
+        dispatch_event(&event);
+        EVA_TRACE_END();
+
+        if (event.type == EVA_HEADLESS_EVENT_TEXT_INPUT) {
+            free(event.text.utf16_text);
+        }
+    }
+
+    eva_pipeline_shutdown();
+    eva_post_stop();
+    if (_ctx.wake_fds[0] != -1) {
+        close(_ctx.wake_fds[0]);
+        close(_ctx.wake_fds[1]);
+    }
+
+    if (_ctx.cleanup_fn) {
+        _ctx.cleanup_fn();
+    }
+    eva_modules_shutdown();
+
+    for (uint32_t i = _ctx.events_head; i < _ctx.events_count; i++) {
+        if (_ctx.events[i].type == EVA_HEADLESS_EVENT_TEXT_INPUT) {
+            free(_ctx.events[i].text.utf16_text);
+        }
+    }
+    free(_ctx.events);
+    _ctx.events          = NULL;
+    _ctx.events_head     = 0;
+    _ctx.events_count    = 0;
+    _ctx.events_capacity = 0;
+
+    eva_alloc_free(_ctx.framebuffer.pixels);
+    _ctx.framebuffer.pixels     = NULL;
+    _ctx.framebuffer.pitch      = 0;
+    _ctx.framebuffer.max_height = 0;
+}
+
+void eva_request_frame(void)
+{
+    if (eva_frame_requested(EVA_RECT_FULL, _ctx.request_frame)) {
+        _ctx.request_frame = true;
+        _ctx.damage = EVA_RECT_FULL;
+    }
+}
+
+void eva_request_frame_rect(int32_t x, int32_t y, int32_t w, int32_t h)
+{
+    eva_rect rect = { x, y, w, h };
+    if (eva_frame_requested(rect, _ctx.request_frame)) {
+        _ctx.request_frame = true;
+        _ctx.damage = rect_union(_ctx.damage, rect);
+    }
+}
+
+eva_rect eva_scroll_region(eva_rect rect, int32_t dx, int32_t dy)
+{
+    rect = rect_clip(rect, _ctx.framebuffer.w, _ctx.framebuffer.h);
+    if (eva_pipeline_enabled() || rect_is_empty(rect)) {
+        eva_request_frame_rect(rect.x, rect.y, rect.w, rect.h);
+        return rect;
+    }
+
+    // Behaves like a window that moves the pixels on screen: only the
+    // exposed area is presented unless some of rect wasn't presented yet.
+    eva_rect exposed = eva_format_scroll(&_ctx.framebuffer, rect, dx, dy);
+    bool     moved   = rect_is_empty(rect_intersect(_ctx.damage, rect)) &&
+                       !eva_layers_overlap(rect);
+    eva_rect present = moved ? exposed : rect;
+    eva_request_frame_rect(present.x, present.y, present.w, present.h);
+    return exposed;
+}
+
+uint32_t eva_get_window_width(void)
+{
+    return _ctx.window_width;
+}
+
+uint32_t eva_get_window_height(void)
+{
+    return _ctx.window_height;
+}
+
+eva_framebuffer eva_get_framebuffer(void)
+{
+    return eva_format_view(&_ctx.framebuffer);
+}
+
+void eva_set_coalesce_frames(bool coalesce)
+{
+    _ctx.coalesce_frames = coalesce;
+}
+
+void eva_set_frame_rate(uint32_t hz)
+{
+    pacer_set_rate(&_ctx.pacer, hz);
+}
+
+eva_frame_timing eva_get_frame_timing(void)
+{
+    return _ctx.pacer.timing;
+}
+
+void eva_set_init_fn(eva_init_fn init_fn)
+{
+    _ctx.init_fn = init_fn;
+}
+
+void eva_set_cleanup_fn(eva_cleanup_fn cleanup_fn)
+{
+    _ctx.cleanup_fn = cleanup_fn;
+}
+
+void eva_set_cancel_quit_fn(eva_cancel_quit_fn cancel_quit_fn)
+{
+    _ctx.cancel_quit_fn = cancel_quit_fn;
+}
+
+void eva_set_mouse_moved_fn(eva_mouse_moved_fn mouse_moved_fn)
+{
+    _ctx.mouse_moved_fn = mouse_moved_fn;
+}
+
+void eva_set_mouse_btn_fn(eva_mouse_btn_fn mouse_btn_fn)
+{
+    _ctx.mouse_btn_fn = mouse_btn_fn;
+}
+
+void eva_set_scroll_fn(eva_scroll_fn scroll_fn)
+{
+    _ctx.scroll_fn = scroll_fn;
+}
+
+void eva_set_key_fn(eva_key_fn key_fn)
+{
+    _ctx.key_fn = key_fn;
+}
+
+void eva_set_window_resize_fn(eva_window_resize_fn window_resize_fn)
+{
+    _ctx.window_resize_fn = window_resize_fn;
+}
+
+void eva_headless_set_window_size(uint32_t w, uint32_t h,
+                                  float scale_x, float scale_y)
+{
+    _ctx.window_width          = w;
+    _ctx.window_height         = h;
+    _ctx.framebuffer.scale_x   = scale_x;
+    _ctx.framebuffer.scale_y   = scale_y;
+}
+
+void eva_headless_set_screen_size(uint32_t w, uint32_t h)
+{
+    _ctx.screen_width  = w;
+    _ctx.screen_height = h;
+}
+
+void eva_headless_set_refresh_rate(double hz)
+{
+    if (hz > 0.0) {
+        pacer_set_refresh(&_ctx.pacer, 1000000000ull,
+                          (uint64_t)(1000000000.0 / hz));
+    }
+}
+
+void eva_headless_set_clock(eva_headless_clock clock)
+{
+    _ctx.clock = clock;
+}
+
+void eva_headless_set_keep_alive(bool keep_alive)
+{
+    _ctx.keep_alive = keep_alive;
+}
+
+void eva_headless_set_time(uint64_t time)
+{
+    if (time > _ctx.virtual_time) {
+        _ctx.virtual_time = time;
+    }
+}
+
+void eva_headless_advance_time(uint64_t delta)
+{
+    _ctx.virtual_time += delta;
+}
+
+uint64_t eva_headless_get_frame_count(void)
+{
+    return _ctx.frame_count;
+}
+
+eva_rect eva_headless_get_present_rect(void)
+{
+    return _ctx.last_damage;
+}
+
+void eva_headless_post_mouse_moved(uint64_t time, double x, double y)
+{
+    eva_headless_event event = {
+        .type    = EVA_HEADLESS_EVENT_MOUSE_MOVED,
+        .time    = time,
+        .mouse.x = x,
+        .mouse.y = y,
+    };
+    post_event(&event);
+}
+
+void eva_headless_post_mouse_btn(uint64_t time, double x, double y,
+                                 eva_mouse_btn btn, eva_input_action action)
+{
+    eva_headless_event event = {
+        .type         = EVA_HEADLESS_EVENT_MOUSE_BTN,
+        .time         = time,
+        .mouse.x      = x,
+        .mouse.y      = y,
+        .mouse.btn    = btn,
+        .mouse.action = action,
+    };
+    post_event(&event);
+}
+
+void eva_headless_post_scroll(uint64_t time, double delta_x, double delta_y)
+{
+    eva_headless_event event = {
+        .type           = EVA_HEADLESS_EVENT_SCROLL,
+        .time           = time,
+        .scroll.delta_x = delta_x,
+        .scroll.delta_y = delta_y,
+    };
+    post_event(&event);
+}
+
+void eva_headless_post_key(uint64_t time, eva_key key, eva_input_action action,
+                           eva_mod_flags mod)
+{
+    eva_headless_event event = {
+        .type       = EVA_HEADLESS_EVENT_KEY,
+        .time       = time,
+        .key.key    = key,
+        .key.action = action,
+        .key.mod    = mod,
+    };
+    post_event(&event);
+}
+
+void eva_headless_post_text_input(uint64_t time,
+                                  const uint16_t *utf16_text, uint32_t len,
+                                  eva_mod_flags mod)
+{
+    if (len == 0) {
+        return;
+    }
+
+    // The caller's text only has to live until this call returns.
+    uint16_t *text = malloc(len * sizeof(uint16_t));
+    if (text == NULL) {
+        return;
+    }
+    memcpy(text, utf16_text, len * sizeof(uint16_t));
+
+    eva_headless_event event = {
+        .type            = EVA_HEADLESS_EVENT_TEXT_INPUT,
+        .time            = time,
+        .text.utf16_text = text,
+        .text.len        = len,
+        .text.mod        = mod,
+    };
+    post_event(&event);
+}
+
+void eva_headless_post_resize(uint64_t time, uint32_t w, uint32_t h)
+{
+    eva_headless_event event = {
+        .type     = EVA_HEADLESS_EVENT_RESIZE,
+        .time     = time,
+        .resize.w = w,
+        .resize.h = h,
+    };
+    post_event(&event);
+}
+
+void eva_headless_post_frame(uint64_t time)
+{
+    eva_headless_event event = {
+        .type  = EVA_HEADLESS_EVENT_FRAME,
+        .time  = time,
+        .frame = EVA_RECT_FULL,
+    };
+    post_event(&event);
+}
+
+void eva_headless_post_close(uint64_t time)
+{
+    eva_headless_event event = {
+        .type = EVA_HEADLESS_EVENT_CLOSE,
+        .time = time,
+    };
+    post_event(&event);
+}
+
+typedef struct eva_headless_replay_ctx {
+    uint64_t start;
+    uint32_t flags;
+} eva_headless_replay_ctx;
+
+static void replay_event(const eva_record_event *record, void *userdata)
+{
+    const eva_headless_replay_ctx *replay = userdata;
+
+    eva_headless_event event = {
+        .time  = replay->start + record->time,
+        .paced = (replay->flags & EVA_HEADLESS_REPLAY_REALTIME) != 0,
+    };
+    switch (record->type) {
+        case EVA_RECORD_MOUSE_MOVED:
+            event.type    = EVA_HEADLESS_EVENT_MOUSE_MOVED;
+            event.mouse.x = record->mouse.x;
+            event.mouse.y = record->mouse.y;
+            break;
+        case EVA_RECORD_MOUSE_BTN:
+            event.type         = EVA_HEADLESS_EVENT_MOUSE_BTN;
+            event.mouse.x      = record->mouse.x;
+            event.mouse.y      = record->mouse.y;
+            event.mouse.btn    = record->mouse.btn;
+            event.mouse.action = record->mouse.action;
+            break;
+        case EVA_RECORD_SCROLL:
+            event.type           = EVA_HEADLESS_EVENT_SCROLL;
+            event.scroll.delta_x = record->scroll.delta_x;
+            event.scroll.delta_y = record->scroll.delta_y;
+            break;
+        case EVA_RECORD_KEY:
+            event.type       = EVA_HEADLESS_EVENT_KEY;
+            event.key.key    = record->key.key;
+            event.key.action = record->key.action;
+            event.key.mod    = record->key.mod;
+            break;
+        case EVA_RECORD_TEXT_INPUT: {
+            uint32_t len = record->text.len;
+            if (len == 0) {
+                return;
+            }
+            uint16_t *text = malloc(len * sizeof(uint16_t));
+            if (text == NULL) {
+                return;
+            }
+            memcpy(text, record->text.utf16_text, len * sizeof(uint16_t));
+
+            event.type            = EVA_HEADLESS_EVENT_TEXT_INPUT;
+            event.text.utf16_text = text;
+            event.text.len        = len;
+            event.text.mod        = record->text.mod;
+            break;
+        }
+        case EVA_RECORD_RESIZE: {
+            // The log has the size in pixels.
+            float scale_x = _ctx.framebuffer.scale_x > 0.0f ? _ctx.framebuffer.scale_x : 1.0f;
+            float scale_y = _ctx.framebuffer.scale_y > 0.0f ? _ctx.framebuffer.scale_y : 1.0f;
+            event.type     = EVA_HEADLESS_EVENT_RESIZE;
+            event.resize.w = (uint32_t)(record->resize.w / scale_x);
+            event.resize.h = (uint32_t)(record->resize.h / scale_y);
+            break;
+        }
+        case EVA_RECORD_FRAME:
+            if (!(replay->flags & EVA_HEADLESS_REPLAY_FRAMES)) {
+                return;
+            }
+            event.type  = EVA_HEADLESS_EVENT_FRAME;
+            event.frame = record->frame;
+            break;
+        default:
+            return;
+    }
+    post_event(&event);
+}
+
+bool eva_headless_replay(const char *path, uint32_t flags)
+{
+    eva_headless_replay_ctx replay = {
+        .start = eva_time_now(),
+        .flags = flags,
+    };
+    return eva_record_read(path, replay_event, &replay);
+}
+
+static void update_window(void)
+{
+    if (_ctx.window_width == 0 || _ctx.window_height == 0) {
+        _ctx.window_width  = EVA_HEADLESS_DEFAULT_WINDOW_W;
+        _ctx.window_height = EVA_HEADLESS_DEFAULT_WINDOW_H;
+    }
+    if (_ctx.screen_width == 0 || _ctx.screen_height == 0) {
+        _ctx.screen_width  = EVA_HEADLESS_DEFAULT_SCREEN_W;
+        _ctx.screen_height = EVA_HEADLESS_DEFAULT_SCREEN_H;
+    }
+    if (_ctx.framebuffer.scale_x <= 0.0f || _ctx.framebuffer.scale_y <= 0.0f) {
+        _ctx.framebuffer.scale_x = 1.0f;
+        _ctx.framebuffer.scale_y = 1.0f;
+    }
+
+    _ctx.framebuffer.w = (uint32_t)(_ctx.window_width  * _ctx.framebuffer.scale_x);
+    _ctx.framebuffer.h = (uint32_t)(_ctx.window_height * _ctx.framebuffer.scale_y);
+
+    uint32_t capacity = _ctx.framebuffer.pitch * _ctx.framebuffer.max_height;
+    if (capacity == 0 ||
+        _ctx.framebuffer.w > _ctx.framebuffer.pitch ||
+        _ctx.framebuffer.h > _ctx.framebuffer.max_height) {
+        EVA_TRACE_BEGIN("update_window");
+
+        eva_alloc_free(_ctx.framebuffer.pixels);
+
+        // Make the framebuffer large enough to hold pixels for the entire
+        // virtual screen, the same as the windowed backends. This keeps
+        // resize behaviour (and cost) identical to a real window.
+        uint32_t screen_w = (uint32_t)(_ctx.screen_width  * _ctx.framebuffer.scale_x);
+        uint32_t screen_h = (uint32_t)(_ctx.screen_height * _ctx.framebuffer.scale_y);
+
+        _ctx.framebuffer.pitch = eva_alloc_pitch(_ctx.framebuffer.w > screen_w ?
+                                                 _ctx.framebuffer.w : screen_w);
+        _ctx.framebuffer.max_height = _ctx.framebuffer.h > screen_h ?
+                                      _ctx.framebuffer.h : screen_h;
+
+        _ctx.framebuffer.pixels = eva_alloc_pixels(_ctx.framebuffer.pitch,
+                                                   _ctx.framebuffer.max_height);
+        EVA_TRACE_END();
+    }
+}
+
+static void handle_close(void)
+{
+    // only give user-code a chance to intervene when eva_quit() wasn't already
+    // called
+    if (!_ctx.quit_ordered) {
+        // if window should be closed and event handling is enabled, give user
+        // code a chance to intervene via eva_cancel_quit()
+        _ctx.quit_requested = true;
+
+        if (_ctx.cancel_quit_fn) {
+            // See if the user code wants to cancel the quit sequence.
+            _ctx.quit_requested = !_ctx.cancel_quit_fn();
+        }
+
+        // user code hasn't intervened, quit the app
+        if (_ctx.quit_requested) {
+            _ctx.quit_ordered = true;
+        }
+    }
+}
+
+static void handle_resize(uint32_t w, uint32_t h)
+{
+    _ctx.window_width  = w;
+    _ctx.window_height = h;
+    update_window();
+    eva_record_resize(_ctx.framebuffer.w, _ctx.framebuffer.h);
+
+    if (_ctx.window_resize_fn) {
+        _ctx.window_resize_fn(_ctx.framebuffer.w, _ctx.framebuffer.h);
+    }
+
+    // A real window has to present everything again after a resize.
+    _ctx.damage = EVA_RECT_FULL;
+}
+
+static void dispatch_event(const eva_headless_event *event)
+{
+    switch (event->type) {
+        case EVA_HEADLESS_EVENT_MOUSE_MOVED:
+            // The event is due now, on the virtual clock too.
+            eva_input_mouse_moved(event->mouse.x, event->mouse.y);
+            eva_pointer_moved(event->mouse.x, event->mouse.y, eva_time_now());
+            if (_ctx.mouse_moved_fn) {
+                eva_record_mouse_moved(event->mouse.x, event->mouse.y);
+                _ctx.mouse_moved_fn(event->mouse.x, event->mouse.y);
+            }
+            break;
+        case EVA_HEADLESS_EVENT_MOUSE_BTN:
+            eva_input_mouse_btn(event->mouse.x, event->mouse.y, event->mouse.btn,
+                                event->mouse.action);
+            eva_pointer_button(event->mouse.x, event->mouse.y, event->mouse.btn,
+                               event->mouse.action, eva_time_now());
+            if (_ctx.mouse_btn_fn) {
+                eva_record_mouse_btn(event->mouse.x, event->mouse.y,
+                                     event->mouse.btn, event->mouse.action);
+                _ctx.mouse_btn_fn(event->mouse.x, event->mouse.y,
+                                  event->mouse.btn, event->mouse.action);
+            }
+            break;
+        case EVA_HEADLESS_EVENT_SCROLL:
+            eva_input_scroll(event->scroll.delta_x, event->scroll.delta_y);
+            if (_ctx.scroll_fn) {
+                eva_record_scroll(event->scroll.delta_x, event->scroll.delta_y);
+                _ctx.scroll_fn(event->scroll.delta_x, event->scroll.delta_y);
+            }
+            break;
+        case EVA_HEADLESS_EVENT_KEY:
+            eva_input_key(event->key.key, event->key.action, event->key.mod);
+            if (_ctx.key_fn) {
+                eva_record_key(event->key.key, event->key.action, event->key.mod);
+                _ctx.key_fn(event->key.key, event->key.action, event->key.mod);
+            }
+            break;
+        case EVA_HEADLESS_EVENT_TEXT_INPUT:
+            eva_text_input_utf16(event->text.utf16_text, event->text.len,
+                                 event->text.mod, true);
+            break;
+        case EVA_HEADLESS_EVENT_RESIZE:
+            // Window systems only report changes, e.g. the size a replay
+            // starts with is usually the current one.
+            if (event->resize.w != _ctx.window_width ||
+                event->resize.h != _ctx.window_height) {
+                handle_resize(event->resize.w, event->resize.h);
+            }
+            break;
+        case EVA_HEADLESS_EVENT_FRAME:
+            // Equivalent of the OS asking for the window to be redrawn, or of
+            // a replayed request of the application.
+            eva_layers_frame_requested();
+            _ctx.request_frame = true;
+            _ctx.damage = rect_union(_ctx.damage, event->frame);
+            break;
+        case EVA_HEADLESS_EVENT_CLOSE:
+            handle_close();
+            return;
+    }
+
+    try_frame();
+}
+
+static void post_event(const eva_headless_event *event)
+{
+    if (_ctx.events_count == _ctx.events_capacity && _ctx.events_head > 0) {
+        // Reclaim the space of already dispatched events before growing.
+        memmove(_ctx.events, _ctx.events + _ctx.events_head,
+                (_ctx.events_count - _ctx.events_head) * sizeof(eva_headless_event));
+        _ctx.events_count -= _ctx.events_head;
+        _ctx.events_head   = 0;
+    }
+
+    if (_ctx.events_count == _ctx.events_capacity) {
+        uint32_t capacity = _ctx.events_capacity ? _ctx.events_capacity * 2 : 64;
+        eva_headless_event *events = realloc(_ctx.events,
+                                             capacity * sizeof(eva_headless_event));
+        if (events == NULL) {
+            if (_ctx.fail_fn) {
+                _ctx.fail_fn(0, "Failed to grow the headless event queue");
+            }
+            return;
+        }
+        _ctx.events          = events;
+        _ctx.events_capacity = capacity;
+    }
+
+    // Insertion sort from the back. Events are almost always posted in time
+    // order so this is typically a plain append.
+    uint32_t i = _ctx.events_count;
+    while (i > _ctx.events_head && _ctx.events[i - 1].time > event->time) {
+        _ctx.events[i] = _ctx.events[i - 1];
+        i--;
+    }
+    _ctx.events[i] = *event;
+    _ctx.events_count++;
+}
+
+static bool try_frame(void)
+{
+    // Coalesced and continuous frames are drawn by the event loop.
+    if (pacer_owns_frames(&_ctx.pacer, _ctx.coalesce_frames)) {
+        return false;
+    }
+
+    EVA_TRACE_BEGIN("try_frame");
+    bool drawn = draw_frame();
+    EVA_TRACE_END();
+    return drawn;
+}
+
+static bool draw_frame(void)
+{
+    if (_ctx.request_frame) {
+        eva_input_begin_frame();
+        eva_pointer_flush();
+    }
+
+    if (_ctx.request_frame && eva_pipeline_enabled()) {
+        // The render thread has to finish the previous frame first.
+        while (!eva_pipeline_ready()) {
+            eva_pipeline_wait();
+            present_pipelined();
+        }
+
+        _ctx.request_frame = false;
+        pacer_begin_frame(&_ctx.pacer, eva_time_now());
+        eva_pipeline_submit(_ctx.frame_fn, &_ctx.framebuffer, _ctx.damage);
+        _ctx.damage = EVA_RECT_EMPTY;
+        return true;
+    }
+
+    if (_ctx.request_frame) {
+        _ctx.request_frame = false;
+        eva_stats_begin_frame();
+
+        // There is a chance that the frame_fn is not set and the application
+        // is just writing directly to the framebuffer in the event handlers
+        // and then requesting to draw with eva_request_frame(). In this case
+        // we still want to draw but don't have a frame function to call.
+        pacer_begin_frame(&_ctx.pacer, eva_time_now());
+        present(eva_tiles_render(_ctx.frame_fn, &_ctx.framebuffer, _ctx.damage));
+        _ctx.damage = EVA_RECT_EMPTY;
+        return true;
+    }
+
+    return false;
+}
+
+static bool present_pipelined(void)
+{
+    if (!eva_pipeline_frame_ready()) {
+        return false;
+    }
+
+    eva_rect damage;
+    eva_stats_begin_frame();
+    eva_pipeline_present(&_ctx.framebuffer, &damage);
+    present(damage);
+    return true;
+}
+
+static void present(eva_rect damage)
+{
+    // There is no display, the framebuffer is the final image. Only record
+    // what a windowed backend would have uploaded.
+    EVA_TRACE_BEGIN("present");
+    uint64_t start = eva_time_real_now();
+    _ctx.last_damage = rect_clip(damage,
+                                 _ctx.framebuffer.w, _ctx.framebuffer.h);
+    _ctx.frame_count++;
+    pacer_end_frame(&_ctx.pacer, eva_time_now());
+
+    eva_stats_add_present(eva_time_real_now() - start,
+                          (uint64_t)_ctx.last_damage.w *
+                          (uint64_t)_ctx.last_damage.h * sizeof(eva_pixel));
+    EVA_TRACE_END();
+    eva_stats_end_frame();
+}
+
+// False when an event posted from another thread cut the wait short.
+static bool wait_until(uint64_t time)
+{
+    if (_ctx.clock == EVA_HEADLESS_CLOCK_VIRTUAL) {
+        eva_headless_set_time(time);
+        return true;
+    }
+
+    if (_ctx.wake_fds[0] != -1) {
+        uint64_t now = eva_time_now();
+        while (now < time) {
+            if (wait_for_wake(time - now)) {
+                return false;
+            }
+            now = eva_time_now();
+        }
+        return true;
+    }
+
+    struct timespec ts = {
+        .tv_sec  = (time_t)(time / 1000000000ull),
+        .tv_nsec = (long)(time % 1000000000ull),
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+    return true;
+}
+
+// Sleeps for up to timeout nanoseconds, UINT64_MAX for no limit, and
+// returns true if another thread woke the loop.
+static bool wait_for_wake(uint64_t timeout)
+{
+    struct timespec  ts;
+    struct timespec *ts_ptr = NULL;
+    if (timeout != UINT64_MAX) {
+        ts.tv_sec  = (time_t)(timeout / 1000000000ull);
+        ts.tv_nsec = (long)(timeout % 1000000000ull);
+        ts_ptr     = &ts;
+    }
+
+    struct pollfd fd = { .fd = _ctx.wake_fds[0], .events = POLLIN };
+    if (ppoll(&fd, 1, ts_ptr, NULL) <= 0 || !(fd.revents & POLLIN)) {
+        return false;
+    }
+
+    char buffer[64];
+    while (read(_ctx.wake_fds[0], buffer, sizeof(buffer)) > 0) {
+    }
+    return true;
+}
+
+static void wake_event_loop(void)
+{
+    // Called from threads posting events. A full pipe already wakes the
+    // loop.
+    char byte = 0;
+    ssize_t written = write(_ctx.wake_fds[1], &byte, 1);
+    (void)written;
+}
+
+// time
+
+void eva_time_init(void)
+{
+    // No-op in headless mode, the virtual clock starts at zero.
+}
+
+uint64_t eva_time_now(void)
+{
+    if (_ctx.clock == EVA_HEADLESS_CLOCK_REAL) {
+        return eva_time_real_now();
+    }
+
+    return _ctx.virtual_time;
+}
+
+uint64_t eva_time_real_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t eva_time_frequency(void)
+{
+    return 1000000000ull;
+}
+
+uint64_t eva_time_since(uint64_t start)
+{
+    return eva_time_now() - start;
+}
+
+float eva_time_ms(uint64_t t)
+{
+    return t / 1000000.0f;
+}
+
+float eva_time_elapsed_ms(uint64_t start, uint64_t end)
+{
+    return eva_time_ms(end - start);
+}
+
+float eva_time_since_ms(uint64_t start)
+{
+    return eva_time_elapsed_ms(start, eva_time_now());
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+/**
+ * Control functions for the headless eva backend (eva_headless.c).
+ *
+ * The headless backend implements the full eva.h API without a window system.
+ * The framebuffer lives purely in memory and the application callbacks are
+ * called exactly as they would be by a windowed backend. Instead of reading
+ * events from an OS queue the headless backend reads them from a queue that
+ * is filled with the eva_headless_post_* functions below. Each posted event
+ * carries a virtual timestamp, the virtual clock is moved forward to that
+ * timestamp before the event is dispatched.
+ *
+ * eva_run() returns once the event queue is empty and no frame is pending
+ * (see eva_headless_set_keep_alive()), or once a posted close event was not
+ * cancelled by the application. In
+ * continuous mode (eva_set_frame_rate()) a frame is always pending, so only
+ * a close event or going back to a frame rate of 0 ends it. eva_run() can be
+ * called again after it returns to start a new session.
+ *
+ * Continuous frames are paced by the selected clock. With the virtual clock
+ * time jumps straight to the next frame, with the real clock eva sleeps
+ * until it is due.
+ *
+ * All times are in nanoseconds, the same unit returned by eva_time_now().
+ */
+
+#include "eva.h"
+
+/**
+ * @brief Selects where eva_time_now() gets its time from.
+ *
+ * The durations in eva_get_frame_stats() are read from the monotonic system
+ * clock with either, the virtual clock doesn't move while a frame is drawn.
+ *
+ * @ingroup headless
+ */
+typedef enum eva_headless_clock {
+    /* Time only moves when an event is dispatched or the clock is advanced. */
+    EVA_HEADLESS_CLOCK_VIRTUAL,
+    /* Time is read from the monotonic system clock. */
+    EVA_HEADLESS_CLOCK_REAL,
+} eva_headless_clock;
+
+/**
+ * @brief Set the size of the virtual window and its dpi scale.
+ *
+ * Must be called before eva_run(). Use eva_headless_post_resize() to resize
+ * the window once the application is running.
+ *
+ * @ingroup headless
+ */
+void eva_headless_set_window_size(uint32_t w, uint32_t h,
+                                  float scale_x, float scale_y);
+
+/**
+ * @brief Set the size of the virtual screen in pixels.
+ *
+ * The framebuffer is over-allocated to the screen size, exactly like the
+ * windowed backends do, so that resizes within the screen do not reallocate
+ * it. Must be called before eva_run().
+ *
+ * @ingroup headless
+ */
+void eva_headless_set_screen_size(uint32_t w, uint32_t h);
+
+/**
+ * @brief Set the refresh rate of the virtual display.
+ *
+ * Coalesced frames (see eva_set_coalesce_frames()) are drawn no more often
+ * than once per refresh interval and continuous frames (see
+ * eva_set_frame_rate()) are capped to it. Defaults to 60 Hz.
+ *
+ * @ingroup headless
+ */
+void eva_headless_set_refresh_rate(double hz);
+
+/**
+ * @brief Select the clock that drives eva_time_now().
+ *
+ * Defaults to @ref EVA_HEADLESS_CLOCK_VIRTUAL.
+ *
+ * @ingroup headless
+ */
+void eva_headless_set_clock(eva_headless_clock clock);
+
+/**
+ * @brief Wait for eva_post_event() when the session runs out of work.
+ *
+ * Instead of returning once the event queue is empty and no frame is
+ * pending, eva_run() sleeps until another thread posts an event. Post a
+ * close event, e.g. from a posted event, to end the session. Off by default.
+ *
+ * @ingroup headless
+ */
+void eva_headless_set_keep_alive(bool keep_alive);
+
+/**
+ * @brief Set the virtual clock to an absolute time. Time never moves
+ * backwards, earlier times are ignored.
+ *
+ * @ingroup headless
+ */
+void eva_headless_set_time(uint64_t time);
+
+/**
+ * @brief Move the virtual clock forward.
+ *
+ * @ingroup headless
+ */
+void eva_headless_advance_time(uint64_t delta);
+
+/**
+ * @brief The number of frames that have been presented so far.
+ *
+ * @ingroup headless
+ */
+uint64_t eva_headless_get_frame_count(void);
+
+/**
+ * @brief The part of the framebuffer covered by the last present.
+ *
+ * This is the clipped union of the rectangles passed to
+ * eva_request_frame_rect(), or the whole framebuffer when a full frame was
+ * requested.
+ *
+ * @ingroup headless
+ */
+eva_rect eva_headless_get_present_rect(void);
+
+/**
+ * @brief Queue input and window events for dispatch at the given virtual
+ * time.
+ *
+ * Events with the same time are dispatched in the order they were posted.
+ * Events may be posted before eva_run() or from within any callback.
+ *
+ * @ingroup headless
+ */
+void eva_headless_post_mouse_moved(uint64_t time, double x, double y);
+void eva_headless_post_mouse_btn(uint64_t time, double x, double y,
+                                 eva_mouse_btn btn, eva_input_action action);
+void eva_headless_post_scroll(uint64_t time, double delta_x, double delta_y);
+void eva_headless_post_key(uint64_t time, eva_key key, eva_input_action action,
+                           eva_mod_flags mod);
+void eva_headless_post_text_input(uint64_t time,
+                                  const uint16_t *utf16_text, uint32_t len,
+                                  eva_mod_flags mod);
+void eva_headless_post_resize(uint64_t time, uint32_t w, uint32_t h);
+void eva_headless_post_frame(uint64_t time);
+void eva_headless_post_close(uint64_t time);
+
+/**
+ * @brief Options for eva_headless_replay().
+ *
+ * @ingroup headless
+ */
+typedef enum eva_headless_replay_flags {
+    /* With the real clock, wait until each event is due like it was in the
+     * recording. Otherwise events are dispatched as fast as the application
+     * handles them. The virtual clock always uses the recorded times. */
+    EVA_HEADLESS_REPLAY_REALTIME = 1 << 0,
+    /* Post the recorded frame requests as well. The callbacks make their
+     * requests again during a replay, this is only needed for applications
+     * that request frames from elsewhere. */
+    EVA_HEADLESS_REPLAY_FRAMES   = 1 << 1,
+} eva_headless_replay_flags;
+
+/**
+ * @brief Queue the events of a log written by eva_record_start().
+ *
+ * The events are posted relative to the current time and dispatched through
+ * the same callbacks they were recorded from. Positions and sizes in the log
+ * are in framebuffer pixels, replay with a scale of 1 to get the framebuffer
+ * of the recording. Use the real clock to get frame times comparable with
+ * the recording from eva_get_frame_stats(), together with
+ * EVA_HEADLESS_REPLAY_REALTIME to also keep its pacing.
+ *
+ * @param flags A combination of eva_headless_replay_flags.
+ * @return false if the log could not be read.
+ *
+ * @ingroup headless
+ */
+bool eva_headless_replay(const char *path, uint32_t flags);
@@ -0,0 +1,116 @@
+#include "eva_internal.h"
+
+#include <string.h>
+
+typedef struct eva_input_ctx {
+    eva_input_state live;  // Up to date with the events handled so far
+    eva_input_state frame; // Taken at the start of the current frame
+} eva_input_ctx;
+
+static eva_input_ctx _input;
+
+static bool key_bit(const uint64_t *bits, eva_key key)
+{
+    if (key < 0 || key > EVA_KEY_LAST) {
+        return false;
+    }
+    return (bits[key / 64] >> (key % 64)) & 1;
+}
+
+const eva_input_state *eva_get_input_state(void)
+{
+    return &_input.frame;
+}
+
+bool eva_key_down(const eva_input_state *state, eva_key key)
+{
+    return key_bit(state->keys, key);
+}
+
+bool eva_key_pressed(const eva_input_state *state, eva_key key)
+{
+    return key_bit(state->keys_pressed, key);
+}
+
+bool eva_key_released(const eva_input_state *state, eva_key key)
+{
+    return key_bit(state->keys_released, key);
+}
+
+void eva_input_key(eva_key key, eva_input_action action, eva_mod_flags mod)
+{
+    _input.live.mod = mod;
+    if (key < 0 || key > EVA_KEY_LAST) {
+        return;
+    }
+
+    // Repeats of a held key are no new presses.
+    uint32_t word = (uint32_t)key / 64;
+    uint64_t bit  = (uint64_t)1 << (key % 64);
+    if (action == EVA_INPUT_PRESSED && !(_input.live.keys[word] & bit)) {
+        _input.live.keys[word]         |= bit;
+        _input.live.keys_pressed[word] |= bit;
+    } else if (action == EVA_INPUT_RELEASED && (_input.live.keys[word] & bit)) {
+        _input.live.keys[word]          &= ~bit;
+        _input.live.keys_released[word] |= bit;
+    }
+}
+
+void eva_input_mouse_moved(double x, double y)
+{
+    _input.live.mouse_x = x;
+    _input.live.mouse_y = y;
+}
+
+void eva_input_mouse_btn(double x, double y, eva_mouse_btn btn,
+                         eva_input_action action)
+{
+    _input.live.mouse_x = x;
+    _input.live.mouse_y = y;
+
+    uint32_t bit = 1u << btn;
+    if (action == EVA_INPUT_PRESSED && !(_input.live.mouse_btns & bit)) {
+        _input.live.mouse_btns         |= bit;
+        _input.live.mouse_btns_pressed |= bit;
+    } else if (action == EVA_INPUT_RELEASED && (_input.live.mouse_btns & bit)) {
+        _input.live.mouse_btns          &= ~bit;
+        _input.live.mouse_btns_released |= bit;
+    }
+}
+
+void eva_input_scroll(double delta_x, double delta_y)
+{
+    _input.live.scroll_x += delta_x;
+    _input.live.scroll_y += delta_y;
+}
+
+void eva_input_release_all(void)
+{
+    // The releases go to another window, everything that was held counts as
+    // released here.
+    for (uint32_t i = 0; i < EVA_INPUT_KEY_WORDS; i++) {
+        _input.live.keys_released[i] |= _input.live.keys[i];
+        _input.live.keys[i] = 0;
+    }
+    _input.live.mouse_btns_released |= _input.live.mouse_btns;
+    _input.live.mouse_btns = 0;
+    _input.live.mod        = 0;
+}
+
+void eva_input_begin_frame(void)
+{
+    _input.frame      = _input.live;
+    _input.frame.time = eva_time_now();
+
+    memset(_input.live.keys_pressed, 0, sizeof(_input.live.keys_pressed));
+    memset(_input.live.keys_released, 0, sizeof(_input.live.keys_released));
+    _input.live.mouse_btns_pressed  = 0;
+    _input.live.mouse_btns_released = 0;
+    _input.live.scroll_x = 0.0;
+    _input.live.scroll_y = 0.0;
+}
+
+void eva_input_shutdown(void)
+{
+    memset(&_input, 0, sizeof(_input));
+}
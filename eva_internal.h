@@ -0,0 +1,532 @@
+#pragma once
+
+/**
+ * Helpers shared between the eva backends. This is not part of the public
+ * API.
+ */
+
+#include "eva.h"
+
+#include <stddef.h>
+
+// A rectangle that covers any framebuffer, used to request a full present.
+#define EVA_RECT_FULL ((eva_rect){ 0, 0, INT32_MAX, INT32_MAX })
+#define EVA_RECT_EMPTY ((eva_rect){ 0, 0, 0, 0 })
+
+static inline bool rect_is_empty(eva_rect r)
+{
+    return r.w <= 0 || r.h <= 0;
+}
+
+// The smallest rectangle containing both a and b.
+static inline eva_rect rect_union(eva_rect a, eva_rect b)
+{
+    if (rect_is_empty(a)) {
+        return b;
+    }
+    if (rect_is_empty(b)) {
+        return a;
+    }
+
+    int64_t x0 = a.x < b.x ? a.x : b.x;
+    int64_t y0 = a.y < b.y ? a.y : b.y;
+    int64_t x1 = (int64_t)a.x + a.w > (int64_t)b.x + b.w ?
+                 (int64_t)a.x + a.w : (int64_t)b.x + b.w;
+    int64_t y1 = (int64_t)a.y + a.h > (int64_t)b.y + b.h ?
+                 (int64_t)a.y + a.h : (int64_t)b.y + b.h;
+
+    eva_rect r = {
+        .x = (int32_t)x0,
+        .y = (int32_t)y0,
+        .w = (int32_t)(x1 - x0 > INT32_MAX ? INT32_MAX : x1 - x0),
+        .h = (int32_t)(y1 - y0 > INT32_MAX ? INT32_MAX : y1 - y0),
+    };
+    return r;
+}
+
+// Clips a rectangle to a w x h framebuffer.
+static inline eva_rect rect_clip(eva_rect r, uint32_t w, uint32_t h)
+{
+    int64_t x0 = r.x < 0 ? 0 : r.x;
+    int64_t y0 = r.y < 0 ? 0 : r.y;
+    int64_t x1 = (int64_t)r.x + r.w;
+    int64_t y1 = (int64_t)r.y + r.h;
+    if (x1 > w) x1 = w;
+    if (y1 > h) y1 = h;
+
+    if (x1 <= x0 || y1 <= y0) {
+        return EVA_RECT_EMPTY;
+    }
+
+    eva_rect clipped = {
+        .x = (int32_t)x0,
+        .y = (int32_t)y0,
+        .w = (int32_t)(x1 - x0),
+        .h = (int32_t)(y1 - y0),
+    };
+    return clipped;
+}
+
+// Framebuffer memory (eva_alloc.c). Pixels are zeroed and every row starts
+// on a cache line when the pitch comes from eva_alloc_pitch(), which also
+// applies eva_set_framebuffer_padding(). On Linux buffers of a huge page or
+// more are mapped, page aligned, and backed by huge pages when
+// eva_set_huge_pages() asked for them.
+// The backends that share the framebuffer with the display server map it
+// themselves and only use the pitch and eva_alloc_huge_pages().
+#define EVA_CACHE_LINE     64
+#define EVA_HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+uint32_t       eva_alloc_pitch(uint32_t w);
+size_t         eva_alloc_huge_size(size_t size); // Rounded up to huge pages
+eva_huge_pages eva_alloc_huge_pages(void);
+eva_pixel     *eva_alloc_pixels(uint32_t pitch, uint32_t height);
+void           eva_alloc_free(eva_pixel *pixels);
+
+// The part of a that is also inside b.
+static inline eva_rect rect_intersect(eva_rect a, eva_rect b)
+{
+    if (rect_is_empty(a) || rect_is_empty(b)) {
+        return EVA_RECT_EMPTY;
+    }
+
+    int64_t x0 = a.x > b.x ? a.x : b.x;
+    int64_t y0 = a.y > b.y ? a.y : b.y;
+    int64_t x1 = (int64_t)a.x + a.w < (int64_t)b.x + b.w ?
+                 (int64_t)a.x + a.w : (int64_t)b.x + b.w;
+    int64_t y1 = (int64_t)a.y + a.h < (int64_t)b.y + b.h ?
+                 (int64_t)a.y + a.h : (int64_t)b.y + b.h;
+    if (x1 <= x0 || y1 <= y0) {
+        return EVA_RECT_EMPTY;
+    }
+
+    eva_rect r = {
+        .x = (int32_t)x0,
+        .y = (int32_t)y0,
+        .w = (int32_t)(x1 - x0),
+        .h = (int32_t)(y1 - y0),
+    };
+    return r;
+}
+
+// True when b lies entirely inside a. An empty b is inside anything.
+static inline bool rect_contains(eva_rect a, eva_rect b)
+{
+    if (rect_is_empty(b)) {
+        return true;
+    }
+    if (rect_is_empty(a)) {
+        return false;
+    }
+    return b.x >= a.x && b.y >= a.y &&
+           (int64_t)b.x + b.w <= (int64_t)a.x + a.w &&
+           (int64_t)b.y + b.h <= (int64_t)a.y + a.h;
+}
+
+// The part of rect that stays inside rect when it is moved by dx, dy, i.e.
+// the source of a scroll.
+static inline eva_rect rect_scroll_source(eva_rect rect, int32_t dx, int32_t dy)
+{
+    eva_rect moved = {
+        (int32_t)((int64_t)rect.x - dx),
+        (int32_t)((int64_t)rect.y - dy),
+        rect.w,
+        rect.h
+    };
+    return rect_intersect(rect, moved);
+}
+
+// Bytes per pixel of a pixel format.
+static inline uint32_t pixel_format_size(eva_pixel_format format)
+{
+    switch (format) {
+        case EVA_PIXEL_FORMAT_RGB565:   return 2;
+        case EVA_PIXEL_FORMAT_INDEXED8: return 1;
+        case EVA_PIXEL_FORMAT_GRAY8:    return 1;
+        default:                        return sizeof(eva_pixel);
+    }
+}
+
+// The first byte of pixel x, y, for any format.
+static inline uint8_t *framebuffer_at(const eva_framebuffer *fb,
+                                      int32_t x, int32_t y)
+{
+    uint8_t *base = fb->format == EVA_PIXEL_FORMAT_BGRA8 ?
+                    (uint8_t *)fb->pixels : (uint8_t *)fb->data;
+    return base + ((size_t)y * fb->pitch + (size_t)x) * pixel_format_size(fb->format);
+}
+
+// Frame statistics (eva_stats.c). The backends report the parts of each
+// frame as it is drawn, eva_get_frame_stats() hands them to the application.
+void eva_stats_reset(void);
+void eva_stats_frame_requested(bool pending);
+void eva_stats_begin_frame(void);
+void eva_stats_add_frame_fn(uint64_t duration);
+void eva_stats_add_dropped(uint32_t dropped);
+void eva_stats_add_wait(uint64_t duration);
+void eva_stats_add_present(uint64_t duration, uint64_t bytes);
+void eva_stats_end_frame(void);
+
+// Decides when the event loop draws a frame in continuous
+// (eva_set_frame_rate()) and coalesced (eva_set_coalesce_frames()) mode.
+// Times are in eva_time_now() units.
+typedef struct eva_frame_pacer {
+    uint32_t hz;               // Requested rate, 0 when frames are requested
+    uint64_t ticks_per_sec;    // eva_time_now() units per second
+    uint64_t refresh_interval; // Time between display refreshes, 0 if unknown
+    uint64_t interval;         // Time between continuous frames, 0 if off
+
+    uint64_t next_target;      // Target time of the next continuous frame
+    uint64_t last_target;
+    uint64_t last_present;
+
+    eva_frame_timing timing;   // Timing of the frame being drawn
+} eva_frame_pacer;
+
+static inline void pacer_update(eva_frame_pacer *p)
+{
+    if (p->hz == 0 || p->ticks_per_sec == 0) {
+        p->interval = 0;
+        return;
+    }
+
+    uint64_t interval = p->ticks_per_sec / p->hz;
+    if (interval < p->refresh_interval) {
+        interval = p->refresh_interval;
+    }
+    p->interval = interval ? interval : 1;
+}
+
+static inline void pacer_set_rate(eva_frame_pacer *p, uint32_t hz)
+{
+    p->hz          = hz;
+    p->next_target = 0; // The first continuous frame is due right away.
+    pacer_update(p);
+}
+
+static inline void pacer_set_refresh(eva_frame_pacer *p, uint64_t ticks_per_sec,
+                                     uint64_t refresh_interval)
+{
+    p->ticks_per_sec    = ticks_per_sec;
+    p->refresh_interval = refresh_interval;
+    pacer_update(p);
+}
+
+// True when frames are drawn by the event loop instead of at the end of the
+// event that requested them.
+static inline bool pacer_owns_frames(const eva_frame_pacer *p, bool coalesce)
+{
+    return coalesce || p->interval != 0;
+}
+
+// The time the event loop has to draw the next frame at, UINT64_MAX when it
+// has nothing to draw.
+static inline uint64_t pacer_deadline(const eva_frame_pacer *p, bool coalesce,
+                                      bool frame_requested)
+{
+    if (p->interval) {
+        return p->next_target;
+    }
+    if (coalesce && frame_requested) {
+        return p->last_present + p->refresh_interval;
+    }
+    return UINT64_MAX;
+}
+
+// Called right before the frame callback.
+static inline void pacer_begin_frame(eva_frame_pacer *p, uint64_t now)
+{
+    // Display driven callbacks jitter around the target, frames up to half
+    // an interval early still count as the next frame on the cadence.
+    uint64_t target = now;
+    if (p->interval && now + p->interval / 2 >= p->next_target) {
+        if (p->next_target != 0) {
+            // Stay on the cadence, skipping the frames that were missed.
+            uint64_t missed = now > p->next_target ?
+                              (now - p->next_target) / p->interval : 0;
+            target = p->next_target + missed * p->interval;
+            eva_stats_add_dropped((uint32_t)missed);
+        }
+        p->next_target = target + p->interval;
+    }
+
+    p->timing.target_time       = target;
+    p->timing.prev_target_time  = p->last_target;
+    p->timing.prev_present_time = p->last_present;
+}
+
+// Called once the frame was handed to the display.
+static inline void pacer_end_frame(eva_frame_pacer *p, uint64_t now)
+{
+    p->last_target  = p->timing.target_time;
+    p->last_present = now;
+}
+
+// Draws a frame through the tile pool when a tile frame function is set
+// (eva_tiles.c) and through frame_fn otherwise. Only the tiles touching
+// damage are drawn. With a compact pixel format the frame is drawn into the
+// compact framebuffer and damage is expanded into fb afterwards. Returns the
+// part of damage to present, see eva_hash_damage().
+eva_rect eva_tiles_render(eva_frame_fn frame_fn, const eva_framebuffer *fb,
+                          eva_rect damage);
+
+// The same as eva_tiles_render() without recording the duration in the frame
+// statistics, for the pipeline render thread.
+void eva_tiles_draw(eva_frame_fn frame_fn, const eva_framebuffer *fb,
+                    eva_rect damage);
+
+// Stops the tile worker threads, called once eva_run() is done.
+void eva_tiles_shutdown(void);
+
+// Compact pixel formats (eva_format.c). eva_format_view() returns the
+// framebuffer the application draws into for the native framebuffer fb,
+// which is fb itself unless eva_set_pixel_format() chose a compact format.
+// eva_format_expand() converts the damaged area of it into fb. Both are
+// called by eva_tiles_render() and eva_tiles_draw(), the backends only hand
+// the view out from eva_get_framebuffer().
+eva_framebuffer eva_format_view(const eva_framebuffer *fb);
+void eva_format_expand(const eva_framebuffer *fb, eva_rect damage);
+
+// Scrolls the framebuffer the application draws into and, for compact
+// formats, fb along with it so presenting only the exposed area, which is
+// returned as by eva_draw_scroll(), is enough.
+eva_rect eva_format_scroll(const eva_framebuffer *fb, eva_rect rect,
+                           int32_t dx, int32_t dy);
+
+// Frees the compact framebuffer, called once eva_run() is done.
+void eva_format_shutdown(void);
+
+// Layers (eva_layer.c). While eva_layers_active() the application draws into
+// a cached copy of the framebuffer, see eva_format_view(), and
+// eva_format_expand() composites the layers over the damaged area of each
+// frame. eva_layers_begin_frame() is false when only layers changed since the
+// last frame so the frame callback can be skipped. The backends call
+// eva_layers_frame_requested() whenever the application requests a frame.
+bool eva_layers_active(void);
+bool eva_layers_overlap(eva_rect rect);
+void eva_layers_frame_requested(void);
+bool eva_layers_begin_frame(eva_rect damage);
+void eva_layers_composite(const eva_framebuffer *fb, eva_rect damage);
+
+// Destroys the layers that are left, called once eva_run() is done.
+void eva_layers_shutdown(void);
+
+// Input recording (eva_record.c). While eva_record_start() is active the
+// backends report every event right before it is dispatched to the
+// application, along with every frame request, and eva_record.c appends it
+// to the log. The hooks do nothing otherwise. Resizes are recorded in
+// framebuffer pixels, like the mouse positions.
+void eva_record_mouse_moved(double x, double y);
+void eva_record_mouse_btn(double x, double y, eva_mouse_btn btn,
+                          eva_input_action action);
+void eva_record_scroll(double delta_x, double delta_y);
+void eva_record_key(eva_key key, eva_input_action action, eva_mod_flags mod);
+void eva_record_text_input(const uint16_t *utf16_text, uint32_t len,
+                           eva_mod_flags mod);
+void eva_record_resize(uint32_t w, uint32_t h);
+void eva_record_frame_request(eva_rect rect);
+
+typedef enum eva_record_type {
+    EVA_RECORD_MOUSE_MOVED,
+    EVA_RECORD_MOUSE_BTN,
+    EVA_RECORD_SCROLL,
+    EVA_RECORD_KEY,
+    EVA_RECORD_TEXT_INPUT,
+    EVA_RECORD_RESIZE,
+    EVA_RECORD_FRAME,
+} eva_record_type;
+
+// An event read back from a log. time is in nanoseconds since the recording
+// started.
+typedef struct eva_record_event {
+    eva_record_type type;
+    uint64_t        time;
+
+    union {
+        struct {
+            double x, y;
+            eva_mouse_btn btn;
+            eva_input_action action;
+        } mouse;
+        struct {
+            double delta_x, delta_y;
+        } scroll;
+        struct {
+            eva_key key;
+            eva_input_action action;
+            eva_mod_flags mod;
+        } key;
+        struct {
+            const uint16_t *utf16_text; // Only valid during the callback
+            uint32_t len;
+            eva_mod_flags mod;
+        } text;
+        struct {
+            uint32_t w, h;
+        } resize;
+        eva_rect frame;
+    };
+} eva_record_event;
+
+typedef void (*eva_record_read_fn)(const eva_record_event *event,
+                                   void *userdata);
+
+// Calls fn for every event of the log at path, in order. A log that ends in
+// the middle of an event is read up to it. False if the file can't be read
+// or isn't a log.
+bool eva_record_read(const char *path, eva_record_read_fn fn, void *userdata);
+
+// Frame capture (eva_capture.c). eva_tiles_render() and
+// eva_pipeline_present() hand every finished frame and what it changed to
+// eva_capture_frame(), which does nothing unless eva_capture_start() was
+// called. Areas that changed outside of the damage of a frame, e.g. by
+// eva_format_scroll(), are passed to eva_capture_invalidate() so every slot
+// copies them again.
+void eva_capture_frame(const eva_framebuffer *fb, eva_rect damage);
+void eva_capture_invalidate(eva_rect rect);
+
+// Content hashing (eva_hash.c). eva_hash_damage() narrows the damage of a
+// finished frame down to the tiles whose pixels changed since they were last
+// presented, all of damage unless eva_set_content_hashing() was enabled.
+// Areas that changed on screen behind its back, e.g. by a scroll the window
+// system did, are passed to eva_hash_invalidate() so they never match.
+eva_rect eva_hash_damage(const eva_framebuffer *fb, eva_rect damage);
+void eva_hash_invalidate(eva_rect rect);
+
+// Frees the tile hashes, called once eva_run() is done.
+void eva_hash_shutdown(void);
+
+// Events posted from other threads (eva_post.c). The backends call
+// eva_post_start() with a function that wakes their event loop from any
+// thread before init_fn, threads the application starts from it may post
+// right away. eva_post_dispatch() is called from the loop and
+// eva_post_stop() before the wakeup is torn down.
+// eva_post_request_frame() is called by eva_frame_requested(), on another
+// thread than the loop's it queues the request and returns true.
+void eva_post_start(void (*wake_fn)(void));
+void eva_post_stop(void);
+void eva_post_dispatch(void);
+bool eva_post_request_frame(eva_rect rect);
+
+// What every backend does around its frames (eva_backend.c).
+// eva_frame_requested() is called first thing by eva_request_frame() and
+// eva_request_frame_rect() with whether a frame is pending already. It
+// returns false when the request was handed to the event loop, otherwise it
+// was counted and recorded and the backend adds rect to its damage.
+// eva_frame_continuous() turns a due frame into a full one in continuous
+// mode. eva_frame_idle() is called once the pending events are handled and
+// returns true when it handed the pointer samples over because no frame is
+// coming. eva_modules_shutdown() is called after cleanup_fn once eva_run() is
+// done.
+bool eva_frame_requested(eva_rect rect, bool pending);
+void eva_frame_continuous(const eva_frame_pacer *pacer, bool *frame_requested,
+                          eva_rect *damage);
+bool eva_frame_idle(const eva_frame_pacer *pacer, bool frame_requested);
+void eva_modules_shutdown(void);
+
+// Timers (eva_timer.c). The backends sleep no longer than until
+// eva_timers_deadline(), UINT64_MAX when no timer is set, and call
+// eva_timers_run() from their event loop to call the timers that are due.
+// Backends that don't own their event loop set a schedule_fn, which is
+// called whenever a timer is set that is due before the previous deadline.
+// Timers are destroyed by eva_timers_shutdown() once eva_run() is done.
+uint64_t eva_timers_deadline(void);
+void     eva_timers_run(uint64_t now);
+void     eva_timers_set_schedule_fn(void (*schedule_fn)(uint64_t deadline));
+void     eva_timers_shutdown(void);
+
+// Pointer sample batches (eva_pointer.c). The backends pass every pointer
+// position the window system reports to eva_pointer_moved() while
+// eva_pointer_batching(), and every button change to eva_pointer_button(),
+// which keeps track of the held buttons. Millisecond timestamps of the window
+// system are converted with eva_pointer_time_ms(). eva_pointer_flush() hands
+// the samples to the application, the backends call it right before a frame
+// is drawn and, when no frame is waiting, once their pending events are
+// handled. eva_pointer_shutdown() frees them once eva_run() is done.
+bool     eva_pointer_batching(void);
+uint64_t eva_pointer_time_ms(uint32_t ms);
+void     eva_pointer_moved(double x, double y, uint64_t time);
+void     eva_pointer_button(double x, double y, eva_mouse_btn btn,
+                            eva_input_action action, uint64_t time);
+void     eva_pointer_flush(void);
+void     eva_pointer_shutdown(void);
+
+// Text input (eva_text_input.c). The backends pass the text the window
+// system reports to eva_text_input_utf16() or eva_text_input_utf8(), which
+// skip text starting with a control character, record it and hand it to the
+// application callbacks in chunks of EVA_TEXT_INPUT_CHUNK from buffers that
+// are reused from event to event. Text that has to be copied out of the
+// window system is copied a chunk at a time into eva_text_input_buffer()
+// and passed with first set only for the first chunk, the rest is dropped
+// when eva_text_input_utf16() returns false for it.
+// eva_text_input_shutdown() frees the buffers once eva_run() is done.
+bool      eva_text_input_wanted(void);
+uint16_t *eva_text_input_buffer(uint32_t len);
+bool      eva_text_input_utf16(const uint16_t *text, uint32_t len,
+                               eva_mod_flags mod, bool first);
+void      eva_text_input_utf8(const char *text, uint32_t len, eva_mod_flags mod);
+void      eva_text_input_shutdown(void);
+
+// Converts UTF-16 to UTF-8, dst has to hold 3 bytes per UTF-16 character.
+// Unpaired surrogates become U+FFFD. Returns the bytes written.
+uint32_t eva_utf16_to_utf8(const uint16_t *src, uint32_t len, char *dst);
+
+// Converts UTF-8 to UTF-16, dst has to hold a UTF-16 character per byte.
+// Invalid sequences, overlong encodings and encoded surrogates become
+// U+FFFD. Returns the characters written.
+uint32_t eva_utf8_to_utf16(const char *src, uint32_t len, uint16_t *dst);
+
+// The polled input state (eva_input.c). The backends report every key,
+// button, pointer move and scroll, whether or not the application set a
+// callback for it, and eva_input_release_all() when the window loses the
+// keyboard focus. eva_input_begin_frame() takes the snapshot
+// eva_get_input_state() returns, the backends call it right before a frame
+// starts, after a pipelined frame is done.
+void eva_input_key(eva_key key, eva_input_action action, eva_mod_flags mod);
+void eva_input_mouse_moved(double x, double y);
+void eva_input_mouse_btn(double x, double y, eva_mouse_btn btn,
+                         eva_input_action action);
+void eva_input_scroll(double delta_x, double delta_y);
+void eva_input_release_all(void);
+void eva_input_begin_frame(void);
+void eva_input_shutdown(void);
+
+// eva_time_now() units per second, implemented by each backend.
+uint64_t eva_time_frequency(void);
+
+// The time in eva_time_now() units read from the system clock, which the
+// durations of the frame statistics are measured with. The same as
+// eva_time_now() except for the virtual clock of the headless backend, where
+// the time doesn't move while a frame is drawn. Implemented by each backend.
+uint64_t eva_time_real_now(void);
+
+// Renders frames on a dedicated thread when eva_set_pipeline() is used
+// (eva_pipeline.c). The main thread submits a frame, the render thread draws
+// it into a free buffer and calls wake_fn, after which the main thread
+// copies the newest finished frame into the backend's framebuffer and
+// presents it as usual. eva_pipeline_start() does nothing unless
+// eva_set_pipeline() was called, eva_pipeline_enabled() is true once the
+// render thread runs.
+bool eva_pipeline_enabled(void);
+void eva_pipeline_start(void (*wake_fn)(void));
+void eva_pipeline_shutdown(void);
+
+// True when a frame can be submitted: the render thread is idle and a buffer
+// is free.
+bool eva_pipeline_ready(void);
+
+// Starts rendering a frame with the size of fb. The first frame and the first
+// after a resize start from the contents of fb.
+bool eva_pipeline_submit(eva_frame_fn frame_fn, const eva_framebuffer *fb,
+                         eva_rect damage);
+
+// True when a finished frame is waiting to be presented.
+bool eva_pipeline_frame_ready(void);
+
+// Copies the newest finished frame into fb and returns what it changed.
+// Older finished frames are skipped, their damage is included. Called
+// between eva_stats_begin_frame() and eva_stats_end_frame().
+bool eva_pipeline_present(const eva_framebuffer *fb, eva_rect *damage);
+
+// Blocks until the render thread is idle.
+void eva_pipeline_wait(void);
@@ -0,0 +1,268 @@
+#include "eva_internal.h"
+#include "eva_draw.h"
+
+#include <stdlib.h>
+
+struct eva_layer {
+    eva_framebuffer fb;
+
+    int32_t x, y;
+    int32_t z;
+    uint8_t opacity;
+    bool    visible;
+
+    eva_layer *next; // Next layer up
+};
+
+typedef struct eva_layers_ctx {
+    eva_layer *bottom; // Sorted by z, bottom to top
+    uint32_t   count;
+
+    eva_rect damage;          // Area the layers changed since the last frame
+    bool     frame_requested; // The application requested a frame as well
+    bool     requesting;      // A layer is requesting a frame
+} eva_layers_ctx;
+
+static eva_layers_ctx _layers;
+
+static eva_rect layer_rect(const eva_layer *layer)
+{
+    eva_rect rect = {
+        layer->x,
+        layer->y,
+        (int32_t)layer->fb.w,
+        (int32_t)layer->fb.h
+    };
+    return rect;
+}
+
+// Requests a frame for rect of the framebuffer without the frame callback
+// having to draw it.
+static void request_composite(eva_rect rect)
+{
+    if (rect_is_empty(rect)) {
+        return;
+    }
+
+    _layers.damage = rect_union(_layers.damage, rect);
+
+    _layers.requesting = true;
+    eva_request_frame_rect(rect.x, rect.y, rect.w, rect.h);
+    _layers.requesting = false;
+}
+
+static void request_layer(const eva_layer *layer)
+{
+    if (layer->visible && layer->opacity) {
+        request_composite(layer_rect(layer));
+    }
+}
+
+// Inserts the layer above the layers with the same or a lower z.
+static void link_layer(eva_layer *layer)
+{
+    eva_layer **link = &_layers.bottom;
+    while (*link && (*link)->z <= layer->z) {
+        link = &(*link)->next;
+    }
+    layer->next = *link;
+    *link = layer;
+}
+
+static void unlink_layer(eva_layer *layer)
+{
+    eva_layer **link = &_layers.bottom;
+    while (*link && *link != layer) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = layer->next;
+    }
+    layer->next = NULL;
+}
+
+eva_layer *eva_layer_create(uint32_t w, uint32_t h)
+{
+    eva_layer *layer = calloc(1, sizeof(*layer));
+    if (!layer) {
+        return NULL;
+    }
+
+    layer->fb.w          = w;
+    layer->fb.h          = h;
+    layer->fb.pitch      = eva_alloc_pitch(w);
+    layer->fb.max_height = h;
+    layer->fb.scale_x    = 1.0f;
+    layer->fb.scale_y    = 1.0f;
+    layer->fb.format     = EVA_PIXEL_FORMAT_BGRA8;
+    layer->fb.pixels     = eva_alloc_pixels(layer->fb.pitch, h);
+    if (!layer->fb.pixels) {
+        free(layer);
+        return NULL;
+    }
+
+    layer->opacity = 255;
+    layer->visible = true;
+
+    link_layer(layer);
+    _layers.count++;
+    return layer;
+}
+
+void eva_layer_destroy(eva_layer *layer)
+{
+    if (!layer) {
+        return;
+    }
+
+    request_layer(layer);
+    unlink_layer(layer);
+    _layers.count--;
+
+    eva_alloc_free(layer->fb.pixels);
+    free(layer);
+}
+
+eva_framebuffer eva_layer_get_framebuffer(const eva_layer *layer)
+{
+    return layer->fb;
+}
+
+void eva_layer_invalidate(eva_layer *layer, eva_rect rect)
+{
+    if (!layer->visible || !layer->opacity) {
+        return;
+    }
+
+    rect = rect_clip(rect, layer->fb.w, layer->fb.h);
+    rect.x += layer->x;
+    rect.y += layer->y;
+    request_composite(rect);
+}
+
+void eva_layer_set_position(eva_layer *layer, int32_t x, int32_t y)
+{
+    if (layer->x == x && layer->y == y) {
+        return;
+    }
+
+    request_layer(layer);
+    layer->x = x;
+    layer->y = y;
+    request_layer(layer);
+}
+
+void eva_layer_set_opacity(eva_layer *layer, uint8_t opacity)
+{
+    if (layer->opacity == opacity) {
+        return;
+    }
+
+    // Fading out has to uncover what was below.
+    request_layer(layer);
+    layer->opacity = opacity;
+    request_layer(layer);
+}
+
+void eva_layer_set_z(eva_layer *layer, int32_t z)
+{
+    if (layer->z == z) {
+        return;
+    }
+
+    unlink_layer(layer);
+    layer->z = z;
+    link_layer(layer);
+    request_layer(layer);
+}
+
+void eva_layer_set_visible(eva_layer *layer, bool visible)
+{
+    if (layer->visible == visible) {
+        return;
+    }
+
+    request_layer(layer);
+    layer->visible = visible;
+    request_layer(layer);
+}
+
+bool eva_layers_active(void)
+{
+    // Checked first, the render thread must not touch the layers.
+    if (eva_pipeline_enabled()) {
+        return false;
+    }
+    // The last layer stays active until the frame that uncovers it.
+    return _layers.count > 0 || !rect_is_empty(_layers.damage);
+}
+
+bool eva_layers_overlap(eva_rect rect)
+{
+    if (!eva_layers_active()) {
+        return false;
+    }
+    for (eva_layer *layer = _layers.bottom; layer; layer = layer->next) {
+        if (layer->visible && layer->opacity &&
+            !rect_is_empty(rect_intersect(layer_rect(layer), rect))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void eva_layers_frame_requested(void)
+{
+    if (!_layers.requesting) {
+        _layers.frame_requested = true;
+    }
+}
+
+bool eva_layers_begin_frame(eva_rect damage)
+{
+    if (!eva_layers_active()) {
+        return true;
+    }
+
+    // A frame that only changed layers is composited from the cached
+    // framebuffer as it is.
+    bool draw = _layers.frame_requested ||
+                !rect_contains(_layers.damage, damage);
+
+    _layers.frame_requested = false;
+    return draw;
+}
+
+void eva_layers_composite(const eva_framebuffer *fb, eva_rect damage)
+{
+    if (!eva_layers_active()) {
+        return;
+    }
+
+    damage = rect_clip(damage, fb->w, fb->h);
+    for (eva_layer *layer = _layers.bottom; layer; layer = layer->next) {
+        if (!layer->visible) {
+            continue;
+        }
+        eva_rect rect = rect_intersect(layer_rect(layer), damage);
+        if (rect_is_empty(rect)) {
+            continue;
+        }
+        eva_rect src = { rect.x - layer->x, rect.y - layer->y, rect.w, rect.h };
+        eva_draw_blend_rect(fb, rect.x, rect.y, &layer->fb, src, layer->opacity);
+    }
+    _layers.damage = EVA_RECT_EMPTY;
+}
+
+void eva_layers_shutdown(void)
+{
+    while (_layers.bottom) {
+        eva_layer *layer = _layers.bottom;
+        _layers.bottom = layer->next;
+        eva_alloc_free(layer->fb.pixels);
+        free(layer);
+    }
+    _layers.count           = 0;
+    _layers.damage          = EVA_RECT_EMPTY;
+    _layers.frame_requested = false;
+}
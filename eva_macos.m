@@ -1,4 +1,6 @@
 #include "eva.h"
+#include "eva_internal.h"
+#include "eva_trace.h"
 
 #include <stdbool.h>
 
@@ -6,6 +8,11 @@
 #import <MetalKit/MetalKit.h>
 
 static bool try_frame();
+static bool draw_frame();
+static void wake_event_loop(void);
+static void wake_posted(void);
+static void schedule_timers(uint64_t deadline);
+static void update_frame_rate(void);
 static bool create_shaders(void);
 static eva_key translate_key(uint32_t key);
 static eva_mod_flags translate_mod_flags(NSUInteger flags);
@@ -23,7 +30,7 @@ static void init_key_tables(void);
 @interface eva_view_delegate : NSViewController<MTKViewDelegate>
 @end
 
-#define EVA_MAX_MTL_BUFFERS 1
+#define EVA_MAX_MTL_BUFFERS 3
 typedef struct eva_ctx {
     eva_framebuffer framebuffer;
     uint32_t window_width, window_height;
@@ -47,8 +54,6 @@ typedef struct eva_ctx {
     int16_t    keycodes[256];
     int16_t    scancodes[EVA_KEY_LAST + 1];
 
-    eva_text_input_fn text_input_fn;
-
     eva_window_resize_fn window_resize_fn;
 
     id<MTLLibrary>              mtl_library;
@@ -57,12 +62,21 @@ typedef struct eva_ctx {
     id<MTLRenderPipelineState>  mtl_pipe_state;
 
     id<MTLTexture> mtl_textures[EVA_MAX_MTL_BUFFERS];
+    eva_rect       mtl_stale[EVA_MAX_MTL_BUFFERS]; // Changed since each upload
     int8_t         mtl_texture_index;
 
     dispatch_semaphore_t semaphore; // Used for syncing with CPU/GPU
 
+    dispatch_source_t timer_source; // Calls the eva timers from the main queue
+
+    // Hands pointer samples over once the run loop has handled its events.
+    CFRunLoopObserverRef pointer_observer;
+
     uint64_t start_time;
     bool request_frame;
+    bool coalesce_frames;
+    eva_frame_pacer pacer;
+    eva_rect damage; // Union of the rects not yet uploaded to the texture
 } eva_ctx;
 
 // The percentage of the texture width / height that are actually in use.
@@ -96,6 +110,7 @@ void eva_run(const char     *window_title,
              eva_fail_fn     fail_fn)
 {
     _ctx.start_time = eva_time_now();
+    eva_trace_set_thread_name("eva event loop");
 
     _ctx.window_title = window_title;
     _ctx.frame_fn     = frame_fn;
@@ -111,7 +126,32 @@ void eva_run(const char     *window_title,
 
 void eva_request_frame(void)
 {
-    _ctx.request_frame = true;
+    if (eva_frame_requested(EVA_RECT_FULL, _ctx.request_frame)) {
+        _ctx.request_frame = true;
+        _ctx.damage = EVA_RECT_FULL;
+    }
+}
+
+void eva_request_frame_rect(int32_t x, int32_t y, int32_t w, int32_t h)
+{
+    eva_rect rect = { x, y, w, h };
+    if (eva_frame_requested(rect, _ctx.request_frame)) {
+        _ctx.request_frame = true;
+        _ctx.damage = rect_union(_ctx.damage, rect);
+    }
+}
+
+eva_rect eva_scroll_region(eva_rect rect, int32_t dx, int32_t dy)
+{
+    // The compositor can't move what it shows, the whole rectangle is
+    // uploaded again.
+    rect = rect_clip(rect, _ctx.framebuffer.w, _ctx.framebuffer.h);
+    eva_rect exposed = rect;
+    if (!eva_pipeline_enabled()) {
+        exposed = eva_format_scroll(&_ctx.framebuffer, rect, dx, dy);
+    }
+    eva_request_frame_rect(rect.x, rect.y, rect.w, rect.h);
+    return exposed;
 }
 
 uint32_t eva_get_window_width(void)
@@ -126,7 +166,23 @@ uint32_t eva_get_window_height(void)
 
 eva_framebuffer eva_get_framebuffer(void)
 {
-    return _ctx.framebuffer;
+    return eva_format_view(&_ctx.framebuffer);
+}
+
+void eva_set_coalesce_frames(bool coalesce)
+{
+    _ctx.coalesce_frames = coalesce;
+}
+
+void eva_set_frame_rate(uint32_t hz)
+{
+    pacer_set_rate(&_ctx.pacer, hz);
+    update_frame_rate();
+}
+
+eva_frame_timing eva_get_frame_timing(void)
+{
+    return _ctx.pacer.timing;
 }
 
 void eva_set_init_fn(eva_init_fn init_fn)
@@ -164,11 +220,6 @@ void eva_set_key_fn(eva_key_fn key_fn)
     _ctx.key_fn = key_fn;
 }
 
-void eva_set_text_input_fn(eva_text_input_fn text_input_fn)
-{
-    _ctx.text_input_fn = text_input_fn;
-}
-
 void eva_set_window_resize_fn(eva_window_resize_fn window_resize_fn)
 {
     _ctx.window_resize_fn = window_resize_fn;
@@ -190,16 +241,22 @@ static void update_window(void)
     _ctx.framebuffer.scale_y = (float)(backing_bounds.size.height /
                                        content_bounds.size.height);
 
+    // Parts of the textures that were outside of the old size have never
+    // been uploaded, so the next draw has to upload everything.
+    _ctx.damage = EVA_RECT_FULL;
+    for (size_t i = 0; i < EVA_MAX_MTL_BUFFERS; ++i) {
+        _ctx.mtl_stale[i] = EVA_RECT_FULL;
+    }
+
     uint32_t capacity = _ctx.framebuffer.pitch * _ctx.framebuffer.max_height;
     if (capacity == 0 ||
         _ctx.framebuffer.w > _ctx.framebuffer.pitch ||
         _ctx.framebuffer.h > _ctx.framebuffer.max_height) {
+        EVA_TRACE_BEGIN("update_window");
 
         // If this is happening before the first frame then there will be
-        // no pixels yet 
-        if (_ctx.framebuffer.pixels != nil) {
-            free(_ctx.framebuffer.pixels);
-        }
+        // no pixels yet, which eva_alloc_free() ignores.
+        eva_alloc_free(_ctx.framebuffer.pixels);
 
         // Make the framebuffer large enough to hold pixels for the entire
         // screen. This makes it unnecessary to reallocate the framebuffer
@@ -207,11 +264,11 @@ static void update_window(void)
         // moving to a higher resolution monitor.
         NSRect screen_frame = NSScreen.mainScreen.frame;
         NSRect scaled_frame = [_app_window convertRectToBacking:screen_frame];
-        _ctx.framebuffer.pitch      = (uint32_t)scaled_frame.size.width;
+        _ctx.framebuffer.pitch      = eva_alloc_pitch((uint32_t)scaled_frame.size.width);
         _ctx.framebuffer.max_height = (uint32_t)scaled_frame.size.height;
 
-        uint32_t size = _ctx.framebuffer.pitch * _ctx.framebuffer.max_height;
-        _ctx.framebuffer.pixels = calloc((size_t)size, sizeof(eva_pixel));
+        _ctx.framebuffer.pixels = eva_alloc_pixels(_ctx.framebuffer.pitch,
+                                                   _ctx.framebuffer.max_height);
 
         // Recreate the metal textures that the framebuffer gets written into.
         MTLTextureDescriptor *texture_desc
@@ -228,6 +285,7 @@ static void update_window(void)
             }
             _ctx.mtl_textures[i] = [_ctx.mtl_device newTextureWithDescriptor:texture_desc];
         }
+        EVA_TRACE_END();
     }
 }
 
@@ -273,6 +331,7 @@ static void update_window(void)
     _app_view = [[eva_view alloc] init];
     _app_view.device = _ctx.mtl_device;
     _app_view.enableSetNeedsDisplay = NO;
+    update_frame_rate();
     [_app_view updateTrackingAreas];
     eva_view_delegate *viewController = [[eva_view_delegate alloc] init];
     _app_view.delegate = viewController;
@@ -281,9 +340,49 @@ static void update_window(void)
     [_app_window center];
     [_app_window makeKeyAndOrderFront:_app_view];
 
+    eva_post_start(wake_posted);
+
+    // The run loop is the application's, timers are called by a dispatch
+    // timer that is moved to the earliest deadline whenever it changes.
+    _ctx.timer_source = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0,
+                                               DISPATCH_TIMER_STRICT,
+                                               dispatch_get_main_queue());
+    dispatch_source_set_event_handler(_ctx.timer_source, ^{
+        eva_timers_run(eva_time_now());
+        schedule_timers(eva_timers_deadline());
+        try_frame();
+    });
+    eva_timers_set_schedule_fn(schedule_timers);
+    schedule_timers(eva_timers_deadline());
+    dispatch_resume(_ctx.timer_source);
+
+    eva_stats_reset();
     if (_ctx.init_fn) {
         _ctx.init_fn();
     }
+    eva_pipeline_start(wake_event_loop);
+
+    // The run loop is about to sleep once every event it had is handled,
+    // which is when the pointer samples are handed over if no frame is
+    // coming. AppKit folds mouse moves into one while the application is
+    // busy, which stops while samples are batched.
+    _ctx.pointer_observer = CFRunLoopObserverCreateWithHandler(
+        NULL, kCFRunLoopBeforeWaiting, true, 0,
+        ^(CFRunLoopObserverRef observer, CFRunLoopActivity activity) {
+            (void)observer;
+            (void)activity;
+            if (NSEvent.isMouseCoalescingEnabled == eva_pointer_batching()) {
+                NSEvent.mouseCoalescingEnabled = !eva_pointer_batching();
+            }
+            if (eva_frame_idle(&_ctx.pacer, _ctx.request_frame)) {
+                if (try_frame()) {
+                    [_app_view draw];
+                }
+            }
+        });
+    CFRunLoopAddObserver(CFRunLoopGetMain(), _ctx.pointer_observer,
+                         kCFRunLoopCommonModes);
+
     // Assign view to window which will initiate a draw for the first frame.
     _app_window.contentView = _app_view;
 
@@ -317,9 +416,15 @@ static void update_window(void)
         }
     }
     if (_ctx.quit_ordered) {
+        eva_pipeline_shutdown();
+        eva_post_stop();
+        dispatch_source_cancel(_ctx.timer_source);
+        CFRunLoopObserverInvalidate(_ctx.pointer_observer);
+        CFRelease(_ctx.pointer_observer);
         if (_ctx.cleanup_fn) {
             _ctx.cleanup_fn();
         }
+        eva_modules_shutdown();
         return YES;
     } else {
         return NO;
@@ -329,6 +434,7 @@ static void update_window(void)
 - (void)windowDidResize:(NSNotification *)notification
 {
     update_window();
+    eva_record_resize(_ctx.framebuffer.w, _ctx.framebuffer.h);
 
     _ctx.window_resize_fn(_ctx.framebuffer.w, _ctx.framebuffer.h);
 
@@ -337,6 +443,11 @@ static void update_window(void)
     }
 }
 
+- (void)windowDidChangeScreen:(NSNotification *)notification
+{
+    update_frame_rate();
+}
+
 - (void)windowDidMiniaturize:(NSNotification *)notification
 {
     update_window();
@@ -346,6 +457,11 @@ static void update_window(void)
 {
     update_window();
 }
+
+- (void)windowDidResignKey:(NSNotification *)notification
+{
+    eva_input_release_all();
+}
 @end
 
 @implementation eva_view
@@ -367,6 +483,7 @@ static void update_window(void)
 - (void)viewDidChangeBackingProperties
 {
     update_window();
+    eva_record_resize(_ctx.framebuffer.w, _ctx.framebuffer.h);
 
     _ctx.window_resize_fn(_ctx.framebuffer.w, _ctx.framebuffer.h);
 
@@ -418,102 +535,87 @@ static void update_window(void)
 {
 }
 
-- (void)mouseDown:(NSEvent *)event
+- (NSPoint)framebufferPoint:(NSEvent *)event
+{
+    NSPoint location = [event locationInWindow];
+    NSPoint mouse_pos = [self convertPoint:location fromView:nil];
+    mouse_pos = [self convertPointToBacking:mouse_pos];
+    mouse_pos.y = _ctx.framebuffer.h - mouse_pos.y;
+    return mouse_pos;
+}
+- (void)mouseButton:(NSEvent *)event
+             button:(eva_mouse_btn)btn
+             action:(eva_input_action)action
 {
+    NSPoint mouse_pos = [self framebufferPoint:event];
+    eva_input_mouse_btn(mouse_pos.x, mouse_pos.y, btn, action);
+    eva_pointer_button(mouse_pos.x, mouse_pos.y, btn, action,
+                       (uint64_t)(event.timestamp * 1e9));
+
     if (_ctx.mouse_btn_fn) {
-        NSPoint location = [event locationInWindow];
-        NSPoint mouse_pos = [self convertPoint:location fromView:nil];
-        mouse_pos = [self convertPointToBacking:mouse_pos];
-        mouse_pos.y = _ctx.framebuffer.h - mouse_pos.y;
-        _ctx.mouse_btn_fn(mouse_pos.x, mouse_pos.y,
-                          EVA_MOUSE_BTN_LEFT, EVA_INPUT_PRESSED);
+        eva_record_mouse_btn(mouse_pos.x, mouse_pos.y, btn, action);
+        _ctx.mouse_btn_fn(mouse_pos.x, mouse_pos.y, btn, action);
         if (try_frame()) {
             [self draw];
         }
     }
 }
+- (void)mouseDown:(NSEvent *)event
+{
+    EVA_TRACE_BEGIN("dispatch");
+    [self mouseButton:event button:EVA_MOUSE_BTN_LEFT action:EVA_INPUT_PRESSED];
+    EVA_TRACE_END();
+}
 - (void)mouseUp:(NSEvent *)event
 {
-    if (_ctx.mouse_btn_fn) {
-        NSPoint location = [event locationInWindow];
-        NSPoint mouse_pos = [self convertPoint:location fromView:nil];
-        mouse_pos = [self convertPointToBacking:mouse_pos];
-        mouse_pos.y = _ctx.framebuffer.h - mouse_pos.y;
-        _ctx.mouse_btn_fn(mouse_pos.x, mouse_pos.y,
-                          EVA_MOUSE_BTN_LEFT, EVA_INPUT_RELEASED);
-        if (try_frame()) {
-            [self draw];
-        }
-    }
+    EVA_TRACE_BEGIN("dispatch");
+    [self mouseButton:event button:EVA_MOUSE_BTN_LEFT action:EVA_INPUT_RELEASED];
+    EVA_TRACE_END();
 }
 - (void)rightMouseDown:(NSEvent *)event
 {
-    if (_ctx.mouse_btn_fn) {
-        NSPoint location = [event locationInWindow];
-        NSPoint mouse_pos = [self convertPoint:location fromView:nil];
-        mouse_pos = [self convertPointToBacking:mouse_pos];
-        mouse_pos.y = _ctx.framebuffer.h - mouse_pos.y;
-        _ctx.mouse_btn_fn(mouse_pos.x, mouse_pos.y,
-                          EVA_MOUSE_BTN_RIGHT, EVA_INPUT_PRESSED);
-        if (try_frame()) {
-            [self draw];
-        }
-    }
+    EVA_TRACE_BEGIN("dispatch");
+    [self mouseButton:event button:EVA_MOUSE_BTN_RIGHT action:EVA_INPUT_PRESSED];
+    EVA_TRACE_END();
 }
 - (void)rightMouseUp:(NSEvent *)event
 {
-    if (_ctx.mouse_btn_fn) {
-        NSPoint location = [event locationInWindow];
-        NSPoint mouse_pos = [self convertPoint:location fromView:nil];
-        mouse_pos = [self convertPointToBacking:mouse_pos];
-        mouse_pos.y = _ctx.framebuffer.h - mouse_pos.y;
-        _ctx.mouse_btn_fn(mouse_pos.x, mouse_pos.y,
-                          EVA_MOUSE_BTN_RIGHT, EVA_INPUT_RELEASED);
-        if (try_frame()) {
-            [self draw];
-        }
-    }
+    EVA_TRACE_BEGIN("dispatch");
+    [self mouseButton:event button:EVA_MOUSE_BTN_RIGHT action:EVA_INPUT_RELEASED];
+    EVA_TRACE_END();
 }
 - (void)otherMouseDown:(NSEvent *)event
 {
-    if (_ctx.mouse_btn_fn) {
-        NSPoint location = [event locationInWindow];
-        NSPoint mouse_pos = [self convertPoint:location fromView:nil];
-        mouse_pos = [self convertPointToBacking:mouse_pos];
-        mouse_pos.y = _ctx.framebuffer.h - mouse_pos.y;
-        _ctx.mouse_btn_fn(mouse_pos.x, mouse_pos.y,
-                          EVA_MOUSE_BTN_MIDDLE, EVA_INPUT_PRESSED);
-        if (try_frame()) {
-            [self draw];
-        }
-    }
+    EVA_TRACE_BEGIN("dispatch");
+    [self mouseButton:event button:EVA_MOUSE_BTN_MIDDLE action:EVA_INPUT_PRESSED];
+    EVA_TRACE_END();
 }
 - (void)otherMouseUp:(NSEvent *)event
 {
-    if (_ctx.mouse_btn_fn) {
-        NSPoint location = [event locationInWindow];
-        NSPoint mouse_pos = [self convertPoint:location fromView:nil];
-        mouse_pos = [self convertPointToBacking:mouse_pos];
-        mouse_pos.y = _ctx.framebuffer.h - mouse_pos.y;
-        _ctx.mouse_btn_fn(mouse_pos.x, mouse_pos.y,
-                          EVA_MOUSE_BTN_MIDDLE, EVA_INPUT_RELEASED);
-        if (try_frame()) {
-            [self draw];
-        }
-    }
+    EVA_TRACE_BEGIN("dispatch");
+    [self mouseButton:event button:EVA_MOUSE_BTN_MIDDLE action:EVA_INPUT_RELEASED];
+    EVA_TRACE_END();
 }
 - (void)mouseMoved:(NSEvent *)event
 {
+    EVA_TRACE_BEGIN("dispatch");
+    NSPoint mouse_pos = [self framebufferPoint:event];
+    eva_input_mouse_moved(mouse_pos.x, mouse_pos.y);
+
+    // Event timestamps count seconds of CLOCK_UPTIME_RAW, the same clock as
+    // eva_time_now().
+    if (eva_pointer_batching()) {
+        eva_pointer_moved(mouse_pos.x, mouse_pos.y,
+                          (uint64_t)(event.timestamp * 1e9));
+    }
     if (_ctx.mouse_moved_fn) {
-        NSPoint location = [event locationInWindow];
-        NSPoint mouse_pos = [self convertPoint:location fromView:nil];
-        mouse_pos = [self convertPointToBacking:mouse_pos];
-        mouse_pos.y = _ctx.framebuffer.h - mouse_pos.y;
+        eva_record_mouse_moved(mouse_pos.x, mouse_pos.y);
         _ctx.mouse_moved_fn(mouse_pos.x, mouse_pos.y);
         if (try_frame()) {
             [self draw];
         }
     }
+    EVA_TRACE_END();
 }
 - (void)mouseDragged:(NSEvent *)event
 {
@@ -525,6 +627,7 @@ static void update_window(void)
 }
 - (void)scrollWheel:(NSEvent *)event
 {
+    EVA_TRACE_BEGIN("dispatch");
     double delta_x = [event scrollingDeltaX];
     double delta_y = [event scrollingDeltaY];
 
@@ -535,19 +638,27 @@ static void update_window(void)
     }
 
     if (fabs(delta_x) > 0.0 || fabs(delta_y) > 0.0) {
-        _ctx.scroll_fn(delta_x, delta_y);
+        eva_input_scroll(delta_x, delta_y);
+        if (_ctx.scroll_fn) {
+            eva_record_scroll(delta_x, delta_y);
+            _ctx.scroll_fn(delta_x, delta_y);
+        }
     }
     
     if (try_frame()) {
         [self draw];
     }
+    EVA_TRACE_END();
 }
 - (void)keyDown:(NSEvent *)event
 {
+    EVA_TRACE_BEGIN("dispatch");
     eva_key key = translate_key([event keyCode]);
     eva_mod_flags mods = translate_mod_flags([event modifierFlags]);
+    eva_input_key(key, EVA_INPUT_PRESSED, mods);
 
     if (_ctx.key_fn) {
+        eva_record_key(key, EVA_INPUT_PRESSED, mods);
         _ctx.key_fn(key, EVA_INPUT_PRESSED, mods);
     }
 
@@ -557,19 +668,24 @@ static void update_window(void)
     if (try_frame()) {
         [self draw];
     }
+    EVA_TRACE_END();
 }
 - (void)keyUp:(NSEvent *)event
 {
+    EVA_TRACE_BEGIN("dispatch");
     eva_key key = translate_key([event keyCode]);
     eva_mod_flags mods = translate_mod_flags([event modifierFlags]);
+    eva_input_key(key, EVA_INPUT_RELEASED, mods);
 
     if (_ctx.key_fn) {
+        eva_record_key(key, EVA_INPUT_RELEASED, mods);
         _ctx.key_fn(key, EVA_INPUT_RELEASED, mods);
     }
 
     if (try_frame()) {
         [self draw];
     }
+    EVA_TRACE_END();
 }
 - (void)flagsChanged:(NSEvent *)event
 {
@@ -638,7 +754,7 @@ static const NSRange kEmptyRange = { NSNotFound, 0 };
 
 - (void)insertText:(id)string replacementRange:(NSRange)replacementRange
 {
-    if (_ctx.text_input_fn) {
+    if (eva_text_input_wanted()) {
         NSString* characters;
         NSEvent* event = [NSApp currentEvent];
         eva_mod_flags mods = translate_mod_flags([event modifierFlags]);
@@ -648,17 +764,31 @@ static const NSRange kEmptyRange = { NSNotFound, 0 };
         else
             characters = (NSString*) string;
 
-        uint32_t len = (uint32_t)[characters length];
-        uint16_t *buffer = malloc(len * sizeof(uint16_t));
-        [characters getCharacters:buffer range:NSMakeRange(0, len)];
+        // A large paste is copied out a chunk at a time into the same
+        // buffer, keeping surrogate pairs together.
+        NSUInteger len = [characters length];
+        NSUInteger offset = 0;
+        while (offset < len) {
+            NSUInteger count = len - offset;
+            if (count > EVA_TEXT_INPUT_CHUNK) {
+                count = EVA_TEXT_INPUT_CHUNK;
+                if (CFStringIsSurrogateHighCharacter(
+                        [characters characterAtIndex:offset + count - 1])) {
+                    count--;
+                }
+            }
 
-        uint16_t c = buffer[0];
-        if (c < 32 || (c > 126 && c < 160)) {
-            return;
+            uint16_t *buffer = eva_text_input_buffer((uint32_t)count);
+            if (buffer == NULL) {
+                break;
+            }
+            [characters getCharacters:buffer range:NSMakeRange(offset, count)];
+            if (!eva_text_input_utf16(buffer, (uint32_t)count, mods, offset == 0)) {
+                break;
+            }
+            offset += count;
         }
 
-        _ctx.text_input_fn(buffer, len, mods);
-
         if (try_frame()) {
             [self draw];
         }
@@ -674,14 +804,38 @@ static const NSRange kEmptyRange = { NSNotFound, 0 };
 @end
 @implementation eva_view_delegate
 - (void) drawInMTKView:(nonnull MTKView *) view {
-    //uint64_t start = eva_time_now();
+    // The view calls this once per display refresh, or at the continuous
+    // frame rate, after the events of the current run loop pass have been
+    // handled.
+    if (_ctx.pacer.interval || _ctx.coalesce_frames) {
+        eva_frame_continuous(&_ctx.pacer, &_ctx.request_frame, &_ctx.damage);
+        draw_frame();
+    }
+
+    // Without the pipeline the frame was drawn into the framebuffer already,
+    // with it the newest frame the render thread finished is copied in.
+    eva_rect damage = _ctx.damage;
+    if (eva_pipeline_enabled()) {
+        damage = EVA_RECT_EMPTY;
+        if (eva_pipeline_frame_ready()) {
+            eva_stats_begin_frame();
+            eva_pipeline_present(&_ctx.framebuffer, &damage);
+        }
+    } else {
+        _ctx.damage = EVA_RECT_EMPTY;
+    }
 
     // Wait to ensure only MaxBuffersInFlight number of frames are getting proccessed
     // by any stage in the Metal pipeline (App, Metal, Drivers, GPU, etc)
     // If we don't wait here there is a chance our framebuffer will be changing
     // while a draw is reading from it which results in a partially filled
     // framebuffer being rendered.
+    EVA_TRACE_BEGIN("present");
+    uint64_t wait_start = eva_time_now();
     dispatch_semaphore_wait(_ctx.semaphore, DISPATCH_TIME_FOREVER);
+    eva_stats_add_wait(eva_time_since(wait_start));
+
+    uint64_t present_start = eva_time_now();
 
     _ctx.mtl_texture_index = (_ctx.mtl_texture_index + 1) % EVA_MAX_MTL_BUFFERS;
 
@@ -700,17 +854,32 @@ static const NSRange kEmptyRange = { NSNotFound, 0 };
         dispatch_semaphore_signal(block_sema);
     }];
 
-    // Copy the bytes from our data object into the texture
-    MTLRegion region = {
-        { 0, 0, 0 },
-        { _ctx.framebuffer.w, _ctx.framebuffer.h, 1 }
-    };
-    uint32_t bytes_per_row = _ctx.framebuffer.pitch * sizeof(eva_pixel);
-    id<MTLTexture> texture = _ctx.mtl_textures[_ctx.mtl_texture_index];
-    [texture replaceRegion:region 
-               mipmapLevel:0 
-                 withBytes:_ctx.framebuffer.pixels 
-               bytesPerRow:bytes_per_row];
+    // Copy the changed bytes from our data object into the texture. The
+    // texture keeps everything outside of the damaged area from its previous
+    // upload, which may be a few frames old when there are several of them.
+    int8_t index = _ctx.mtl_texture_index;
+    for (int8_t i = 0; i < EVA_MAX_MTL_BUFFERS; ++i) {
+        _ctx.mtl_stale[i] = rect_union(_ctx.mtl_stale[i], damage);
+    }
+    eva_rect upload = rect_clip(_ctx.mtl_stale[index],
+                                _ctx.framebuffer.w, _ctx.framebuffer.h);
+    _ctx.mtl_stale[index] = EVA_RECT_EMPTY;
+
+    id<MTLTexture> texture = _ctx.mtl_textures[index];
+    if (!rect_is_empty(upload)) {
+        MTLRegion region = {
+            { (NSUInteger)upload.x, (NSUInteger)upload.y, 0 },
+            { (NSUInteger)upload.w, (NSUInteger)upload.h, 1 }
+        };
+        uint32_t bytes_per_row = _ctx.framebuffer.pitch * sizeof(eva_pixel);
+        eva_pixel *bytes = _ctx.framebuffer.pixels +
+                           (size_t)upload.y * _ctx.framebuffer.pitch +
+                           (size_t)upload.x;
+        [texture replaceRegion:region
+                   mipmapLevel:0
+                     withBytes:bytes
+                   bytesPerRow:bytes_per_row];
+    }
 
     eva_uniforms uniforms = {
         .tex_scale_x = _ctx.framebuffer.w / (float)_ctx.framebuffer.pitch,
@@ -746,8 +915,20 @@ static const NSRange kEmptyRange = { NSNotFound, 0 };
 
     // Finalize rendering here & push the command buffer to the GPU
     [cmd_buf commit];
-
-    //printf("drawRect %.1fms\n", eva_time_since_ms(start));
+    pacer_end_frame(&_ctx.pacer, eva_time_now());
+
+    // Redraws without a new frame aren't recorded, the stats functions
+    // ignore them when no frame has begun.
+    eva_stats_add_present(eva_time_since(present_start),
+                          (uint64_t)upload.w * (uint64_t)upload.h * sizeof(eva_pixel));
+    EVA_TRACE_END();
+    eva_stats_end_frame();
+
+    // The render thread draws the next frame while this one is on its way
+    // to the display.
+    if (eva_pipeline_enabled()) {
+        draw_frame();
+    }
 }
 - (void) mtkView:(nonnull MTKView *)view drawableSizeWillChange:(CGSize)size {
 	(void)view;
@@ -769,6 +950,16 @@ uint64_t eva_time_now(void)
     return clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
 }
 
+uint64_t eva_time_real_now(void)
+{
+    return eva_time_now();
+}
+
+uint64_t eva_time_frequency(void)
+{
+    return 1000000000ull;
+}
+
 uint64_t eva_time_since(uint64_t start)
 {
     return eva_time_now() - start;
@@ -789,18 +980,113 @@ float eva_time_since_ms(uint64_t start)
     return eva_time_elapsed_ms(start, eva_time_now());
 }
 
+static void update_frame_rate(void)
+{
+    NSInteger refresh_rate = 60;
+    if (@available(macOS 12.0, *)) {
+        if (_app_window.screen.maximumFramesPerSecond > 0) {
+            refresh_rate = _app_window.screen.maximumFramesPerSecond;
+        }
+    }
+    pacer_set_refresh(&_ctx.pacer, 1000000000ull,
+                      1000000000ull / (uint64_t)refresh_rate);
+
+    // The view's display link drives continuous frames.
+    if (_app_view != nil) {
+        NSInteger fps = refresh_rate;
+        if (_ctx.pacer.hz != 0 && _ctx.pacer.hz < (uint32_t)refresh_rate) {
+            fps = (NSInteger)_ctx.pacer.hz;
+        }
+        _app_view.preferredFramesPerSecond = fps;
+    }
+}
+
+// Called on the render thread when a frame is finished. Coalesced and
+// continuous frames are presented by the next display refresh, other frames
+// right away.
+static void wake_event_loop(void)
+{
+    dispatch_async(dispatch_get_main_queue(), ^{
+        if (!pacer_owns_frames(&_ctx.pacer, _ctx.coalesce_frames)) {
+            [_app_view draw];
+        }
+    });
+}
+
 static bool try_frame()
 {
+    // Coalesced and continuous frames are drawn from drawInMTKView.
+    if (pacer_owns_frames(&_ctx.pacer, _ctx.coalesce_frames)) {
+        return false;
+    }
+
+    EVA_TRACE_BEGIN("try_frame");
+    bool drawn = draw_frame();
+    EVA_TRACE_END();
+    return drawn;
+}
+
+// Called by threads posting events, the main queue is drained by the
+// application's run loop.
+static void wake_posted(void)
+{
+    dispatch_async(dispatch_get_main_queue(), ^{
+        eva_post_dispatch();
+        try_frame();
+    });
+}
+
+// Moves the dispatch timer to the deadline of the earliest eva timer.
+static void schedule_timers(uint64_t deadline)
+{
+    if (deadline == UINT64_MAX) {
+        dispatch_source_set_timer(_ctx.timer_source, DISPATCH_TIME_FOREVER,
+                                  DISPATCH_TIME_FOREVER, 0);
+        return;
+    }
+
+    // dispatch_time() counts mach_absolute_time(), which stops during sleep
+    // like CLOCK_UPTIME_RAW.
+    uint64_t now   = eva_time_now();
+    int64_t  delay = deadline > now ? (int64_t)(deadline - now) : 0;
+    dispatch_source_set_timer(_ctx.timer_source,
+                              dispatch_time(DISPATCH_TIME_NOW, delay),
+                              DISPATCH_TIME_FOREVER, 0);
+}
+
+static bool draw_frame()
+{
+    // The input state is taken and pointer samples go out right before the
+    // frame, so what the application requests from them is drawn with it.
+    if (_ctx.request_frame && (!eva_pipeline_enabled() || eva_pipeline_ready())) {
+        eva_input_begin_frame();
+        eva_pointer_flush();
+    }
+
+    if (_ctx.request_frame && eva_pipeline_enabled()) {
+        // Submitted once the render thread is done with the previous frame,
+        // drawInMTKView presents it when it is finished.
+        if (eva_pipeline_ready()) {
+            _ctx.request_frame = false;
+            pacer_begin_frame(&_ctx.pacer, eva_time_now());
+            eva_pipeline_submit(_ctx.frame_fn, &_ctx.framebuffer, _ctx.damage);
+            _ctx.damage = EVA_RECT_EMPTY;
+        }
+        return false;
+    }
+
     if (_ctx.request_frame) {
         _ctx.request_frame = false;
 
+        // The frame is finished by drawInMTKView once it has been uploaded.
+        eva_stats_begin_frame();
+
         // There is a chance that the frame_fn is not set and the application
         // is just writing directly to the framebuffer in the event handlers
         // and then requesting to draw with eva_request_frame(). In this case
         // we still want to draw but don't have a frame function to call.
-        if (_ctx.frame_fn) {
-            _ctx.frame_fn(&_ctx.framebuffer);
-        }
+        pacer_begin_frame(&_ctx.pacer, eva_time_now());
+        _ctx.damage = eva_tiles_render(_ctx.frame_fn, &_ctx.framebuffer, _ctx.damage);
 
         return true;
     }
@@ -0,0 +1,366 @@
+#include "eva_internal.h"
+#include "eva_draw.h"
+#include "eva_thread.h"
+#include "eva_trace.h"
+
+#include <stdlib.h>
+
+typedef enum eva_pipeline_state {
+    EVA_PIPELINE_FREE,
+    EVA_PIPELINE_RENDERING,
+    EVA_PIPELINE_READY,     // Rendered, waiting to be presented
+} eva_pipeline_state;
+
+typedef struct eva_pipeline_buffer {
+    eva_framebuffer    fb;
+    eva_pipeline_state state;
+    uint64_t           frame;    // Sequence number of the frame it holds
+    eva_rect           damage;   // What that frame changed
+    eva_rect           stale;    // What changed since then
+    uint64_t           duration; // How long the frame callback took
+} eva_pipeline_buffer;
+
+typedef struct eva_pipeline {
+    uint32_t buffer_count; // 0 when rendering on the main thread
+    bool     started;
+    void   (*wake_fn)(void);
+
+    eva_thread thread;
+    eva_mutex  mutex;
+    eva_cond   work_cond; // Signalled when a frame is submitted
+    eva_cond   idle_cond; // Signalled when the render thread finishes one
+    bool       quit;
+
+    eva_pipeline_buffer  buffers[EVA_MAX_PIPELINE_BUFFERS];
+    eva_pipeline_buffer *newest;    // The last buffer rendered
+    eva_pipeline_buffer *rendering; // The buffer being rendered
+    uint64_t             frame_count;
+
+    // The frame being rendered, only changed while the render thread is
+    // idle.
+    eva_frame_fn frame_fn;
+    eva_rect     copy;   // Pixels to bring up to date from source first
+    const eva_framebuffer *source;
+} eva_pipeline;
+
+static eva_pipeline _pipeline;
+
+void eva_set_pipeline(uint32_t buffer_count)
+{
+    if (_pipeline.started) {
+        return;
+    }
+    if (buffer_count == 1) {
+        buffer_count = 2;
+    }
+    if (buffer_count > EVA_MAX_PIPELINE_BUFFERS) {
+        buffer_count = EVA_MAX_PIPELINE_BUFFERS;
+    }
+    _pipeline.buffer_count = buffer_count;
+}
+
+bool eva_pipeline_enabled(void)
+{
+    return _pipeline.started;
+}
+
+static void render_thread(void *arg)
+{
+    (void)arg;
+
+    eva_trace_set_thread_name("eva render");
+
+    eva_mutex_lock(&_pipeline.mutex);
+    for (;;) {
+        while (!_pipeline.quit && !_pipeline.rendering) {
+            eva_cond_wait(&_pipeline.work_cond, &_pipeline.mutex);
+        }
+        if (_pipeline.quit) {
+            break;
+        }
+        eva_pipeline_buffer *buffer = _pipeline.rendering;
+        eva_mutex_unlock(&_pipeline.mutex);
+
+        // The source is the previous frame, which is only ever read while
+        // it waits to be presented.
+        if (!rect_is_empty(_pipeline.copy)) {
+            eva_draw_copy_rect(&buffer->fb, _pipeline.copy.x, _pipeline.copy.y,
+                               _pipeline.source, _pipeline.copy);
+        }
+
+        uint64_t start = eva_time_real_now();
+        eva_tiles_draw(_pipeline.frame_fn, &buffer->fb, buffer->damage);
+        buffer->duration = eva_time_real_now() - start;
+
+        eva_mutex_lock(&_pipeline.mutex);
+        buffer->state       = EVA_PIPELINE_READY;
+        _pipeline.rendering = NULL;
+        eva_cond_broadcast(&_pipeline.idle_cond);
+
+        if (_pipeline.wake_fn) {
+            eva_mutex_unlock(&_pipeline.mutex);
+            _pipeline.wake_fn();
+            eva_mutex_lock(&_pipeline.mutex);
+        }
+    }
+    eva_mutex_unlock(&_pipeline.mutex);
+}
+
+void eva_pipeline_start(void (*wake_fn)(void))
+{
+    if (_pipeline.buffer_count == 0 || _pipeline.started) {
+        return;
+    }
+
+    eva_mutex_init(&_pipeline.mutex);
+    eva_cond_init(&_pipeline.work_cond);
+    eva_cond_init(&_pipeline.idle_cond);
+    _pipeline.wake_fn     = wake_fn;
+    _pipeline.quit        = false;
+    _pipeline.newest      = NULL;
+    _pipeline.rendering   = NULL;
+    _pipeline.frame_count = 0;
+
+    if (!eva_thread_create(&_pipeline.thread, render_thread, NULL)) {
+        // Render on the main thread instead.
+        eva_cond_destroy(&_pipeline.idle_cond);
+        eva_cond_destroy(&_pipeline.work_cond);
+        eva_mutex_destroy(&_pipeline.mutex);
+        _pipeline.buffer_count = 0;
+        return;
+    }
+    _pipeline.started = true;
+}
+
+void eva_pipeline_shutdown(void)
+{
+    if (!_pipeline.started) {
+        return;
+    }
+
+    eva_mutex_lock(&_pipeline.mutex);
+    _pipeline.quit = true;
+    eva_cond_signal(&_pipeline.work_cond);
+    eva_mutex_unlock(&_pipeline.mutex);
+    eva_thread_join(_pipeline.thread);
+
+    for (uint32_t i = 0; i < EVA_MAX_PIPELINE_BUFFERS; i++) {
+        eva_alloc_free(_pipeline.buffers[i].fb.pixels);
+        _pipeline.buffers[i].fb.pixels = NULL;
+        _pipeline.buffers[i].state     = EVA_PIPELINE_FREE;
+    }
+
+    eva_cond_destroy(&_pipeline.idle_cond);
+    eva_cond_destroy(&_pipeline.work_cond);
+    eva_mutex_destroy(&_pipeline.mutex);
+    _pipeline.started = false;
+}
+
+static eva_pipeline_buffer *free_buffer(void)
+{
+    // The newest buffer needs no copy at all.
+    if (_pipeline.newest && _pipeline.newest->state == EVA_PIPELINE_FREE) {
+        return _pipeline.newest;
+    }
+    for (uint32_t i = 0; i < _pipeline.buffer_count; i++) {
+        if (_pipeline.buffers[i].state == EVA_PIPELINE_FREE) {
+            return &_pipeline.buffers[i];
+        }
+    }
+    return NULL;
+}
+
+bool eva_pipeline_ready(void)
+{
+    if (!_pipeline.started) {
+        return false;
+    }
+
+    eva_mutex_lock(&_pipeline.mutex);
+    bool ready = !_pipeline.rendering && free_buffer() != NULL;
+    eva_mutex_unlock(&_pipeline.mutex);
+    return ready;
+}
+
+// Matches the buffers to the size of fb. Only called while the render thread
+// is idle.
+static bool resize_buffers(const eva_framebuffer *fb)
+{
+    eva_pipeline_buffer *first = &_pipeline.buffers[0];
+    if (first->fb.pixels &&
+        first->fb.pitch == fb->pitch &&
+        first->fb.max_height == fb->max_height) {
+
+        // Resizes within the allocation only change the size of the free
+        // buffers, finished frames keep the size they were rendered at.
+        for (uint32_t i = 0; i < _pipeline.buffer_count; i++) {
+            eva_pipeline_buffer *buffer = &_pipeline.buffers[i];
+            if (buffer->state == EVA_PIPELINE_FREE) {
+                eva_pixel *pixels = buffer->fb.pixels;
+                buffer->fb        = *fb;
+                buffer->fb.pixels = pixels;
+            }
+        }
+        return true;
+    }
+
+    // The frames waiting to be presented were rendered for the old size and
+    // the application redraws everything after a resize anyway.
+    bool allocated = true;
+    for (uint32_t i = 0; i < _pipeline.buffer_count; i++) {
+        eva_pipeline_buffer *buffer = &_pipeline.buffers[i];
+        eva_alloc_free(buffer->fb.pixels);
+        buffer->fb        = *fb;
+        buffer->fb.pixels = eva_alloc_pixels(fb->pitch, fb->max_height);
+        buffer->state     = EVA_PIPELINE_FREE;
+        buffer->stale     = EVA_RECT_FULL;
+        allocated = allocated && buffer->fb.pixels;
+    }
+    _pipeline.newest = NULL;
+
+    if (!allocated) {
+        for (uint32_t i = 0; i < _pipeline.buffer_count; i++) {
+            eva_alloc_free(_pipeline.buffers[i].fb.pixels);
+            _pipeline.buffers[i].fb.pixels = NULL;
+        }
+    }
+    return allocated;
+}
+
+bool eva_pipeline_submit(eva_frame_fn frame_fn, const eva_framebuffer *fb,
+                         eva_rect damage)
+{
+    if (!_pipeline.started) {
+        return false;
+    }
+
+    eva_mutex_lock(&_pipeline.mutex);
+    if (_pipeline.rendering || !resize_buffers(fb)) {
+        eva_mutex_unlock(&_pipeline.mutex);
+        return false;
+    }
+
+    eva_pipeline_buffer *buffer = free_buffer();
+    if (buffer == NULL) {
+        eva_mutex_unlock(&_pipeline.mutex);
+        return false;
+    }
+
+    damage = rect_clip(damage, buffer->fb.w, buffer->fb.h);
+
+    // Bring the buffer up to date with the last frame. Without one the
+    // framebuffer the backend presented last is the last frame, it's copied
+    // here as the backend owns it.
+    _pipeline.copy   = EVA_RECT_EMPTY;
+    _pipeline.source = NULL;
+    if (_pipeline.newest == NULL) {
+        eva_rect all = { 0, 0, (int32_t)buffer->fb.w, (int32_t)buffer->fb.h };
+        eva_draw_copy_rect(&buffer->fb, 0, 0, fb, all);
+    } else if (_pipeline.newest != buffer) {
+        _pipeline.copy   = rect_clip(buffer->stale, buffer->fb.w, buffer->fb.h);
+        _pipeline.source = &_pipeline.newest->fb;
+    }
+
+    for (uint32_t i = 0; i < _pipeline.buffer_count; i++) {
+        eva_pipeline_buffer *other = &_pipeline.buffers[i];
+        other->stale = other == buffer ? EVA_RECT_EMPTY :
+                                         rect_union(other->stale, damage);
+    }
+
+    buffer->state  = EVA_PIPELINE_RENDERING;
+    buffer->frame  = _pipeline.frame_count++;
+    buffer->damage = damage;
+
+    _pipeline.frame_fn  = frame_fn;
+    _pipeline.newest    = buffer;
+    _pipeline.rendering = buffer;
+    eva_cond_signal(&_pipeline.work_cond);
+    eva_mutex_unlock(&_pipeline.mutex);
+    return true;
+}
+
+bool eva_pipeline_frame_ready(void)
+{
+    if (!_pipeline.started) {
+        return false;
+    }
+
+    eva_mutex_lock(&_pipeline.mutex);
+    bool ready = false;
+    for (uint32_t i = 0; i < _pipeline.buffer_count; i++) {
+        ready |= _pipeline.buffers[i].state == EVA_PIPELINE_READY;
+    }
+    eva_mutex_unlock(&_pipeline.mutex);
+    return ready;
+}
+
+bool eva_pipeline_present(const eva_framebuffer *fb, eva_rect *damage)
+{
+    if (!_pipeline.started) {
+        return false;
+    }
+
+    eva_mutex_lock(&_pipeline.mutex);
+    eva_pipeline_buffer *frame = NULL;
+    eva_rect changed = EVA_RECT_EMPTY;
+    uint32_t skipped = 0;
+    for (uint32_t i = 0; i < _pipeline.buffer_count; i++) {
+        eva_pipeline_buffer *buffer = &_pipeline.buffers[i];
+        if (buffer->state != EVA_PIPELINE_READY) {
+            continue;
+        }
+        changed = rect_union(changed, buffer->damage);
+        if (frame == NULL || buffer->frame > frame->frame) {
+            frame = buffer;
+        }
+        skipped++;
+    }
+
+    // The newest frame includes everything the older ones drew.
+    for (uint32_t i = 0; i < _pipeline.buffer_count; i++) {
+        eva_pipeline_buffer *buffer = &_pipeline.buffers[i];
+        if (buffer->state == EVA_PIPELINE_READY && buffer != frame) {
+            buffer->state = EVA_PIPELINE_FREE;
+        }
+    }
+    eva_mutex_unlock(&_pipeline.mutex);
+
+    if (frame == NULL) {
+        return false;
+    }
+
+    // A ready buffer is never rendered to, it can be read without the lock.
+    changed = rect_clip(changed, fb->w < frame->fb.w ? fb->w : frame->fb.w,
+                                 fb->h < frame->fb.h ? fb->h : frame->fb.h);
+    if (!rect_is_empty(changed)) {
+        uint64_t start = eva_time_real_now();
+        eva_draw_copy_rect(fb, changed.x, changed.y, &frame->fb, changed);
+        eva_stats_add_present(eva_time_real_now() - start,
+                              (uint64_t)changed.w * (uint64_t)changed.h * sizeof(eva_pixel));
+    }
+
+    eva_stats_add_frame_fn(frame->duration);
+    eva_stats_add_dropped(skipped - 1);
+    changed = eva_hash_damage(fb, changed);
+    eva_capture_frame(fb, changed);
+
+    eva_mutex_lock(&_pipeline.mutex);
+    frame->state = EVA_PIPELINE_FREE;
+    eva_mutex_unlock(&_pipeline.mutex);
+
+    *damage = changed;
+    return true;
+}
+
+void eva_pipeline_wait(void)
+{
+    if (!_pipeline.started) {
+        return;
+    }
+
+    eva_mutex_lock(&_pipeline.mutex);
+    while (_pipeline.rendering) {
+        eva_cond_wait(&_pipeline.idle_cond, &_pipeline.mutex);
+    }
+    eva_mutex_unlock(&_pipeline.mutex);
+}
@@ -0,0 +1,150 @@
+#include "eva_internal.h"
+
+#include <stdlib.h>
+
+// Samples beyond this many between two frames replace the last one, so a
+// loop that stops drawing can't make the batch grow without bounds.
+#define EVA_POINTER_MAX_SAMPLES 65536
+
+// How long the earliest base of the window system's clock is collected
+// before it replaces the current one, which lets the mapping follow the two
+// clocks drifting apart.
+#define EVA_POINTER_WINDOW_MS 1000
+
+typedef struct eva_pointer_ctx {
+    eva_pointer_batch_fn batch_fn;
+
+    eva_pointer_sample *samples;
+    uint32_t            count;
+    uint32_t            capacity;
+    uint32_t            buttons; // Held buttons, also while not batching
+
+    // Maps the millisecond timestamps of the window system onto
+    // eva_time_now(). Their clock starts at an unknown time, base is where
+    // it would be if the event that was handled the fastest took no time.
+    bool     clock_known;
+    uint32_t last_ms;
+    int64_t  ms;          // last_ms extended to 64 bits, 0 at the first one
+    uint64_t base;        // eva_time_now() at ms 0
+    uint64_t window_base; // base of the events of the current window
+    uint64_t window_start;
+} eva_pointer_ctx;
+
+static eva_pointer_ctx _pointer;
+
+void eva_set_pointer_batch_fn(eva_pointer_batch_fn pointer_batch_fn)
+{
+    _pointer.batch_fn = pointer_batch_fn;
+    _pointer.count    = 0;
+}
+
+bool eva_pointer_batching(void)
+{
+    return _pointer.batch_fn != NULL;
+}
+
+uint64_t eva_pointer_time_ms(uint32_t ms)
+{
+    uint64_t now = eva_time_now();
+    if (!_pointer.clock_known) {
+        _pointer.clock_known  = true;
+        _pointer.last_ms      = ms;
+        _pointer.ms           = 0;
+        _pointer.base         = now;
+        _pointer.window_base  = now;
+        _pointer.window_start = now;
+        return now;
+    }
+
+    // The timestamps wrap after 49 days and events can arrive slightly out
+    // of order, so only the difference to the last one counts.
+    _pointer.ms += (int32_t)(ms - _pointer.last_ms);
+    _pointer.last_ms = ms;
+
+    uint64_t frequency = eva_time_frequency();
+    uint64_t ticks     = (uint64_t)(_pointer.ms * (int64_t)frequency / 1000);
+    uint64_t base      = now - ticks;
+
+    // An earlier base is taken right away. A later one, when the clocks
+    // drift apart, once it was the earliest for a whole window.
+    if (base < _pointer.base) {
+        _pointer.base = base;
+    }
+    if (base < _pointer.window_base) {
+        _pointer.window_base = base;
+    }
+    if (now - _pointer.window_start >= frequency * EVA_POINTER_WINDOW_MS / 1000) {
+        _pointer.base         = _pointer.window_base;
+        _pointer.window_base  = base;
+        _pointer.window_start = now;
+    }
+
+    return _pointer.base + ticks;
+}
+
+static void add_sample(double x, double y, uint64_t time)
+{
+    if (_pointer.count == _pointer.capacity) {
+        uint32_t capacity = _pointer.capacity ? _pointer.capacity * 2 : 256;
+        eva_pointer_sample *samples = NULL;
+        if (capacity <= EVA_POINTER_MAX_SAMPLES) {
+            samples = realloc(_pointer.samples, capacity * sizeof(*samples));
+        }
+        if (samples) {
+            _pointer.samples  = samples;
+            _pointer.capacity = capacity;
+        } else if (_pointer.count > 0) {
+            _pointer.count--;
+        } else {
+            return;
+        }
+    }
+
+    eva_pointer_sample *sample = &_pointer.samples[_pointer.count++];
+    sample->x       = x;
+    sample->y       = y;
+    sample->buttons = _pointer.buttons;
+    sample->time    = time;
+}
+
+void eva_pointer_moved(double x, double y, uint64_t time)
+{
+    if (_pointer.batch_fn) {
+        add_sample(x, y, time);
+    }
+}
+
+void eva_pointer_button(double x, double y, eva_mouse_btn btn,
+                        eva_input_action action, uint64_t time)
+{
+    uint32_t bit = 1u << btn;
+    if (action == EVA_INPUT_PRESSED) {
+        _pointer.buttons |= bit;
+    } else {
+        _pointer.buttons &= ~bit;
+    }
+
+    if (_pointer.batch_fn) {
+        add_sample(x, y, time);
+    }
+}
+
+void eva_pointer_flush(void)
+{
+    if (_pointer.count == 0 || !_pointer.batch_fn) {
+        return;
+    }
+
+    _pointer.batch_fn(_pointer.samples, _pointer.count);
+    _pointer.count = 0;
+}
+
+void eva_pointer_shutdown(void)
+{
+    free(_pointer.samples);
+    _pointer.samples     = NULL;
+    _pointer.count       = 0;
+    _pointer.capacity    = 0;
+    _pointer.buttons     = 0;
+    _pointer.clock_known = false;
+}
@@ -0,0 +1,205 @@
+#include "eva_internal.h"
+#include "eva_thread.h"
+
+#include <stdlib.h>
+
+// Posted events form an intrusive MPSC queue (Vyukov). Producers swap
+// themselves in as the head with one atomic exchange and then link the
+// previous head to them, the event loop pops from the tail. Between those
+// two steps the queue looks cut off at the producer.
+typedef struct eva_post_node {
+    void       *volatile next;
+    eva_post_fn fn;       // NULL for a frame request
+    void       *userdata;
+    eva_rect    rect;     // Of a frame request
+} eva_post_node;
+
+typedef struct eva_post_ctx {
+    void          *volatile head; // Last pushed, shared with the producers
+    eva_post_node *tail;          // Next to pop, only touched by the loop
+    eva_post_node  stub;          // Keeps the queue from ever being empty
+
+    // A full frame was requested from another thread. Full requests skip
+    // the queue, it would only hold copies of them.
+    volatile uint32_t frame_requested;
+
+    // Set by the producer that wakes the loop, so only the first of a burst
+    // does, and cleared by the loop before it drains the queue. Stays set
+    // while eva_run() isn't running.
+    volatile uint32_t wake_pending;
+
+    // Guards wake_fn against eva_post_stop() so no producer calls into a
+    // backend that is shutting down.
+    eva_mutex mutex;
+    bool      mutex_initialized;
+    void    (*wake_fn)(void);
+
+    volatile uint32_t running;
+    eva_thread_id     loop_thread; // Of eva_run()
+} eva_post_ctx;
+
+static eva_post_ctx _post = {
+    .head         = &_post.stub,
+    .tail         = &_post.stub,
+    .wake_pending = 1,
+};
+
+static void push(eva_post_node *node)
+{
+    node->next = NULL;
+    eva_post_node *prev = eva_atomic_exchange_ptr(&_post.head, node);
+    eva_atomic_store_ptr(&prev->next, node);
+}
+
+static void wake(void)
+{
+    if (eva_atomic_exchange_u32(&_post.wake_pending, 1) != 0) {
+        return;
+    }
+
+    eva_mutex_lock(&_post.mutex);
+    if (_post.wake_fn) {
+        _post.wake_fn();
+    }
+    eva_mutex_unlock(&_post.mutex);
+}
+
+bool eva_post_event(eva_post_fn fn, void *userdata)
+{
+    eva_post_node *node = malloc(sizeof(*node));
+    if (!node) {
+        return false;
+    }
+    node->fn       = fn;
+    node->userdata = userdata;
+    node->rect     = EVA_RECT_EMPTY;
+
+    push(node);
+    wake();
+    return true;
+}
+
+bool eva_post_request_frame(eva_rect rect)
+{
+    if (!eva_atomic_load_u32(&_post.running) ||
+        eva_thread_is(eva_thread_current(), _post.loop_thread)) {
+        return false;
+    }
+
+    bool full = rect.x == 0 && rect.y == 0 &&
+                rect.w == INT32_MAX && rect.h == INT32_MAX;
+    eva_post_node *node = full ? NULL : malloc(sizeof(*node));
+    if (node) {
+        node->fn       = NULL;
+        node->userdata = NULL;
+        node->rect     = rect;
+        push(node);
+    } else {
+        // Out of memory the whole frame is requested instead.
+        eva_atomic_store_u32(&_post.frame_requested, 1);
+    }
+    wake();
+    return true;
+}
+
+void eva_post_start(void (*wake_fn)(void))
+{
+    if (!_post.mutex_initialized) {
+        eva_mutex_init(&_post.mutex);
+        _post.mutex_initialized = true;
+    }
+
+    eva_mutex_lock(&_post.mutex);
+    _post.wake_fn = wake_fn;
+    eva_mutex_unlock(&_post.mutex);
+
+    _post.loop_thread = eva_thread_current();
+    eva_atomic_store_u32(&_post.running, 1);
+
+    // Producers wake the loop from here on. What was posted before is
+    // called on its first iteration.
+    eva_atomic_exchange_u32(&_post.wake_pending, 0);
+    wake();
+}
+
+void eva_post_stop(void)
+{
+    if (!eva_atomic_load_u32(&_post.running)) {
+        return;
+    }
+    eva_atomic_store_u32(&_post.running, 0);
+
+    eva_atomic_exchange_u32(&_post.wake_pending, 1);
+    eva_mutex_lock(&_post.mutex);
+    _post.wake_fn = NULL;
+    eva_mutex_unlock(&_post.mutex);
+}
+
+static void run(eva_post_node *node)
+{
+    if (node->fn) {
+        node->fn(node->userdata);
+    } else {
+        eva_request_frame_rect(node->rect.x, node->rect.y,
+                               node->rect.w, node->rect.h);
+    }
+}
+
+void eva_post_dispatch(void)
+{
+    // Anything posted from here on wakes the loop again. Most iterations
+    // have nothing posted, they only read the flag.
+    if (eva_atomic_load_u32(&_post.wake_pending)) {
+        eva_atomic_exchange_u32(&_post.wake_pending, 0);
+    }
+
+    if (eva_atomic_exchange_u32(&_post.frame_requested, 0)) {
+        eva_request_frame();
+    }
+
+    // Most iterations have nothing posted either. The head can't tell, it
+    // is the stub as well while a producer links the node in front of it.
+    if (_post.tail == &_post.stub &&
+        !eva_atomic_load_ptr(&_post.stub.next)) {
+        return;
+    }
+
+    // Events posted by the events called here wait for the next iteration,
+    // so one that keeps posting itself can't starve the loop. last only
+    // bounds the nodes popped here.
+    eva_post_node *last = eva_atomic_load_ptr(&_post.head);
+
+    for (;;) {
+        eva_post_node *tail = _post.tail;
+        eva_post_node *next = eva_atomic_load_ptr(&tail->next);
+        if (tail == &_post.stub) {
+            // Whatever is behind a stub that was last was posted later.
+            if (!next || tail == last) {
+                return;
+            }
+            _post.tail = next;
+            tail = next;
+            next = eva_atomic_load_ptr(&tail->next);
+        }
+
+        if (!next && tail == eva_atomic_load_ptr(&_post.head)) {
+            // tail is the only node left, put the stub behind it so it can
+            // be popped.
+            push(&_post.stub);
+            next = eva_atomic_load_ptr(&tail->next);
+        }
+        if (!next) {
+            // A producer is between its two steps. It wakes the loop for the
+            // rest once it is done.
+            return;
+        }
+
+        bool done = tail == last;
+        _post.tail = next;
+        run(tail);
+        free(tail);
+        if (done) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,374 @@
+#include "eva_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The log starts with EVA_RECORD_MAGIC followed by one record per event:
+// a type byte, the microseconds since the previous record as a varint and
+// the payload of the type. Coordinates are 32-bit floats, which hold the
+// whole and 1/256 pixel positions the window systems report exactly, and
+// everything else is a varint. Multi-byte values are little endian.
+#define EVA_RECORD_MAGIC     "EVAREC\x01\x00"
+#define EVA_RECORD_MAGIC_LEN 8
+
+// Records are buffered and written in blocks.
+#define EVA_RECORD_BUFFER_SIZE 4096
+
+// The largest record without text: type, time and four 5 byte varints.
+#define EVA_RECORD_MAX_SIZE 32
+
+typedef struct eva_record_ctx {
+    FILE    *file;
+    bool     failed;    // A write failed, the log is incomplete
+    uint64_t last_time; // eva_time_now() of the previous record
+
+    uint8_t  buffer[EVA_RECORD_BUFFER_SIZE];
+    uint32_t len;
+} eva_record_ctx;
+
+static eva_record_ctx _record;
+
+static void flush(void)
+{
+    if (_record.len &&
+        fwrite(_record.buffer, 1, _record.len, _record.file) != _record.len) {
+        _record.failed = true;
+    }
+    _record.len = 0;
+}
+
+static void put_byte(uint8_t b)
+{
+    _record.buffer[_record.len++] = b;
+}
+
+static void put_varint(uint64_t v)
+{
+    while (v >= 0x80) {
+        put_byte((uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    put_byte((uint8_t)v);
+}
+
+// Signed values are zigzag encoded so small negative numbers stay short.
+static void put_svarint(int32_t v)
+{
+    put_varint(((uint32_t)v << 1) ^ (uint32_t)(v >> 31));
+}
+
+static void put_float(double v)
+{
+    float    f = (float)v;
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    for (int i = 0; i < 4; i++) {
+        put_byte((uint8_t)(u >> (i * 8)));
+    }
+}
+
+// Starts a record of at most EVA_RECORD_MAX_SIZE bytes. False when nothing
+// is being recorded.
+static bool begin(eva_record_type type)
+{
+    if (!_record.file) {
+        return false;
+    }
+    if (_record.len + EVA_RECORD_MAX_SIZE > EVA_RECORD_BUFFER_SIZE) {
+        flush();
+    }
+
+    // eva_time_now() units differ between the backends, the log always
+    // uses microseconds.
+    uint64_t now = eva_time_now();
+    double   us  = (double)eva_time_ms(now - _record.last_time) * 1000.0;
+    _record.last_time = now;
+
+    put_byte((uint8_t)type);
+    put_varint((uint64_t)(us + 0.5));
+    return true;
+}
+
+bool eva_record_start(const char *path)
+{
+    eva_record_stop();
+
+    _record.file = fopen(path, "wb");
+    if (!_record.file) {
+        return false;
+    }
+    _record.failed    = false;
+    _record.last_time = eva_time_now();
+
+    memcpy(_record.buffer, EVA_RECORD_MAGIC, EVA_RECORD_MAGIC_LEN);
+    _record.len = EVA_RECORD_MAGIC_LEN;
+
+    // The size of the window the recording starts with, if there is one
+    // yet.
+    eva_framebuffer fb = eva_get_framebuffer();
+    if (fb.w && fb.h) {
+        eva_record_resize(fb.w, fb.h);
+    }
+    return true;
+}
+
+bool eva_record_stop(void)
+{
+    if (!_record.file) {
+        return true;
+    }
+
+    flush();
+    if (fclose(_record.file) != 0) {
+        _record.failed = true;
+    }
+    _record.file = NULL;
+    return !_record.failed;
+}
+
+void eva_record_mouse_moved(double x, double y)
+{
+    if (begin(EVA_RECORD_MOUSE_MOVED)) {
+        put_float(x);
+        put_float(y);
+    }
+}
+
+void eva_record_mouse_btn(double x, double y, eva_mouse_btn btn,
+                          eva_input_action action)
+{
+    if (begin(EVA_RECORD_MOUSE_BTN)) {
+        put_float(x);
+        put_float(y);
+        put_byte((uint8_t)btn);
+        put_byte((uint8_t)action);
+    }
+}
+
+void eva_record_scroll(double delta_x, double delta_y)
+{
+    if (begin(EVA_RECORD_SCROLL)) {
+        put_float(delta_x);
+        put_float(delta_y);
+    }
+}
+
+void eva_record_key(eva_key key, eva_input_action action, eva_mod_flags mod)
+{
+    if (begin(EVA_RECORD_KEY)) {
+        put_varint((uint32_t)key);
+        put_byte((uint8_t)action);
+        put_byte((uint8_t)mod);
+    }
+}
+
+void eva_record_text_input(const uint16_t *utf16_text, uint32_t len,
+                           eva_mod_flags mod)
+{
+    if (!begin(EVA_RECORD_TEXT_INPUT)) {
+        return;
+    }
+    put_byte((uint8_t)mod);
+    put_varint(len);
+
+    for (uint32_t i = 0; i < len; i++) {
+        if (_record.len + 2 > EVA_RECORD_BUFFER_SIZE) {
+            flush();
+        }
+        put_byte((uint8_t)utf16_text[i]);
+        put_byte((uint8_t)(utf16_text[i] >> 8));
+    }
+}
+
+void eva_record_resize(uint32_t w, uint32_t h)
+{
+    if (begin(EVA_RECORD_RESIZE)) {
+        put_varint(w);
+        put_varint(h);
+    }
+}
+
+void eva_record_frame_request(eva_rect rect)
+{
+    if (!begin(EVA_RECORD_FRAME)) {
+        return;
+    }
+
+    bool full = rect.x == 0 && rect.y == 0 &&
+                rect.w == INT32_MAX && rect.h == INT32_MAX;
+    put_byte(full);
+    if (!full) {
+        put_svarint(rect.x);
+        put_svarint(rect.y);
+        put_svarint(rect.w);
+        put_svarint(rect.h);
+    }
+}
+
+// Reading
+
+typedef struct eva_record_reader {
+    const uint8_t *data;
+    size_t         len;
+    size_t         pos;
+    bool           failed; // Read past the end
+} eva_record_reader;
+
+static uint8_t get_byte(eva_record_reader *r)
+{
+    if (r->pos >= r->len) {
+        r->failed = true;
+        return 0;
+    }
+    return r->data[r->pos++];
+}
+
+static uint64_t get_varint(eva_record_reader *r)
+{
+    uint64_t v = 0;
+    for (uint32_t shift = 0; shift < 64; shift += 7) {
+        uint8_t b = get_byte(r);
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            return v;
+        }
+    }
+    r->failed = true;
+    return 0;
+}
+
+static int32_t get_svarint(eva_record_reader *r)
+{
+    uint32_t v = (uint32_t)get_varint(r);
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static double get_float(eva_record_reader *r)
+{
+    uint32_t u = 0;
+    for (int i = 0; i < 4; i++) {
+        u |= (uint32_t)get_byte(r) << (i * 8);
+    }
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+bool eva_record_read(const char *path, eva_record_read_fn fn, void *userdata)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+
+    // Logs are read in one go, they are a few bytes per event.
+    uint8_t *data = NULL;
+    size_t   len  = 0;
+    size_t   cap  = 0;
+    for (;;) {
+        if (len == cap) {
+            cap = cap ? cap * 2 : 65536;
+            uint8_t *grown = realloc(data, cap);
+            if (!grown) {
+                free(data);
+                fclose(file);
+                return false;
+            }
+            data = grown;
+        }
+        size_t n = fread(data + len, 1, cap - len, file);
+        len += n;
+        if (n == 0) {
+            break;
+        }
+    }
+    bool ok = !ferror(file);
+    fclose(file);
+
+    ok = ok && len >= EVA_RECORD_MAGIC_LEN &&
+         memcmp(data, EVA_RECORD_MAGIC, EVA_RECORD_MAGIC_LEN) == 0;
+
+    eva_record_reader r = { data, len, EVA_RECORD_MAGIC_LEN, false };
+    uint16_t *text = NULL;
+    uint64_t  time = 0;
+
+    while (ok && r.pos < r.len) {
+        eva_record_event event;
+        memset(&event, 0, sizeof(event));
+        event.type = (eva_record_type)get_byte(&r);
+        time += get_varint(&r) * 1000;
+        event.time = time;
+
+        switch (event.type) {
+            case EVA_RECORD_MOUSE_MOVED:
+                event.mouse.x = get_float(&r);
+                event.mouse.y = get_float(&r);
+                break;
+            case EVA_RECORD_MOUSE_BTN:
+                event.mouse.x      = get_float(&r);
+                event.mouse.y      = get_float(&r);
+                event.mouse.btn    = (eva_mouse_btn)get_byte(&r);
+                event.mouse.action = (eva_input_action)get_byte(&r);
+                break;
+            case EVA_RECORD_SCROLL:
+                event.scroll.delta_x = get_float(&r);
+                event.scroll.delta_y = get_float(&r);
+                break;
+            case EVA_RECORD_KEY:
+                event.key.key    = (eva_key)get_varint(&r);
+                event.key.action = (eva_input_action)get_byte(&r);
+                event.key.mod    = (eva_mod_flags)get_byte(&r);
+                break;
+            case EVA_RECORD_TEXT_INPUT: {
+                event.text.mod = (eva_mod_flags)get_byte(&r);
+                uint64_t n = get_varint(&r);
+                if (n > (r.len - r.pos) / 2) {
+                    r.failed = true;
+                    break;
+                }
+                free(text);
+                text = malloc((size_t)n * sizeof(uint16_t) + 1);
+                if (!text) {
+                    r.failed = true;
+                    break;
+                }
+                for (uint64_t i = 0; i < n; i++) {
+                    uint16_t lo = get_byte(&r);
+                    text[i] = (uint16_t)(lo | get_byte(&r) << 8);
+                }
+                event.text.utf16_text = text;
+                event.text.len        = (uint32_t)n;
+                break;
+            }
+            case EVA_RECORD_RESIZE:
+                event.resize.w = (uint32_t)get_varint(&r);
+                event.resize.h = (uint32_t)get_varint(&r);
+                break;
+            case EVA_RECORD_FRAME:
+                if (get_byte(&r)) {
+                    event.frame = EVA_RECT_FULL;
+                } else {
+                    event.frame.x = get_svarint(&r);
+                    event.frame.y = get_svarint(&r);
+                    event.frame.w = get_svarint(&r);
+                    event.frame.h = get_svarint(&r);
+                }
+                break;
+            default:
+                r.failed = true;
+                break;
+        }
+
+        // A log that was cut off, e.g. by a crash, is replayed up to the
+        // last complete event.
+        if (r.failed) {
+            break;
+        }
+        fn(&event, userdata);
+    }
+
+    free(text);
+    free(data);
+    return ok;
+}
@@ -0,0 +1,97 @@
+#include "eva_internal.h"
+
+#include <string.h>
+
+typedef struct eva_stats_ctx {
+    eva_frame_stats stats;
+
+    uint32_t       coalesced; // Requests made while a frame was pending
+    uint32_t       dropped;   // Continuous frames skipped since the last frame
+    bool           open;      // A frame has begun but isn't finished yet
+    eva_frame_stat current;
+} eva_stats_ctx;
+
+static eva_stats_ctx _stats;
+
+const eva_frame_stats *eva_get_frame_stats(void)
+{
+    return &_stats.stats;
+}
+
+void eva_stats_reset(void)
+{
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+void eva_stats_frame_requested(bool pending)
+{
+    if (pending) {
+        _stats.coalesced++;
+    }
+}
+
+void eva_stats_begin_frame(void)
+{
+    // A frame that was never presented, e.g. while the window is hidden, is
+    // still recorded.
+    if (_stats.open) {
+        eva_stats_end_frame();
+    }
+
+    memset(&_stats.current, 0, sizeof(_stats.current));
+    _stats.current.frame      = _stats.stats.frame_count;
+    _stats.current.start_time = eva_time_now();
+    _stats.current.coalesced  = _stats.coalesced;
+    _stats.current.dropped    = _stats.dropped;
+    _stats.coalesced = 0;
+    _stats.dropped   = 0;
+    _stats.open      = true;
+}
+
+void eva_stats_add_frame_fn(uint64_t duration)
+{
+    if (_stats.open) {
+        _stats.current.frame_duration += duration;
+    }
+}
+
+void eva_stats_add_dropped(uint32_t dropped)
+{
+    _stats.dropped += dropped;
+}
+
+void eva_stats_add_wait(uint64_t duration)
+{
+    if (_stats.open) {
+        _stats.current.wait_duration += duration;
+    }
+}
+
+void eva_stats_add_present(uint64_t duration, uint64_t bytes)
+{
+    if (_stats.open) {
+        _stats.current.present_duration += duration;
+        _stats.current.bytes_copied     += bytes;
+    }
+}
+
+void eva_stats_end_frame(void)
+{
+    if (!_stats.open) {
+        return;
+    }
+    _stats.open = false;
+
+    eva_frame_stats *stats = &_stats.stats;
+    uint32_t index = (stats->first + stats->count) % EVA_FRAME_STATS_LEN;
+    if (stats->count < EVA_FRAME_STATS_LEN) {
+        stats->count++;
+    } else {
+        stats->first = (stats->first + 1) % EVA_FRAME_STATS_LEN;
+    }
+    stats->frames[index] = _stats.current;
+
+    stats->frame_count++;
+    stats->coalesced_count += _stats.current.coalesced;
+    stats->dropped_count   += _stats.current.dropped;
+}
@@ -0,0 +1,519 @@
+#include "eva_text.h"
+#include "eva_draw.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define EVA_TEXT_DEFAULT_CACHE_SIZE ((size_t)1 << 20)
+#define EVA_TEXT_ATLAS_WIDTH        1024u
+#define EVA_TEXT_SHELF_ROUND        4u   // Shelf heights are multiples of this
+#define EVA_TEXT_NO_SHELF           UINT16_MAX
+
+// A glyph in the cache. Glyphs without pixels, e.g. spaces, only keep their
+// advance and have no shelf.
+typedef struct eva_glyph_entry {
+    uint32_t font;      // 0 marks an empty slot
+    uint32_t codepoint;
+    uint32_t size;      // In 1/64 pixels
+    uint16_t offset;    // Subpixel step
+    uint16_t shelf;
+    uint16_t x, y;      // Position in the atlas
+    uint16_t w, h;
+    int16_t  left, top;
+    float    advance;
+} eva_glyph_entry;
+
+// A row of the atlas that glyphs of about the same height are packed into
+// from left to right.
+typedef struct eva_shelf {
+    uint16_t y, h;
+    uint16_t used;      // Pixels taken from the left
+    uint64_t last_used; // Clock of the last draw that used one of its glyphs
+} eva_shelf;
+
+struct eva_font {
+    uint32_t         id;
+    eva_rasterize_fn rasterize;
+    void            *userdata;
+};
+
+typedef struct eva_text_ctx {
+    size_t cache_size;
+    bool   cache_size_set;
+
+    uint8_t *atlas;
+    uint32_t atlas_w, atlas_h;
+    uint32_t shelves_bottom; // First atlas row not used by a shelf
+
+    eva_shelf *shelves;
+    uint32_t   shelf_count;
+    uint32_t   shelf_capacity;
+
+    // Open addressing with linear probing, glyph_count stays below
+    // max_glyphs to keep the probes short.
+    eva_glyph_entry *table;
+    uint32_t         table_size; // A power of two
+    uint32_t         glyph_count;
+    uint32_t         max_glyphs;
+
+    uint64_t clock;
+    uint32_t next_font;
+
+    eva_text_cache_stats stats;
+} eva_text_ctx;
+
+static eva_text_ctx _text;
+
+static uint32_t hash_glyph(uint32_t font, uint32_t codepoint, uint32_t size,
+                           uint32_t offset)
+{
+    uint32_t h = font * 0x9e3779b1u ^ codepoint * 0x85ebca6bu ^
+                 size * 0xc2b2ae35u ^ offset * 0x27d4eb2fu;
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    h ^= h >> 12;
+    return h;
+}
+
+static uint32_t entry_slot(const eva_glyph_entry *e)
+{
+    return hash_glyph(e->font, e->codepoint, e->size, e->offset) &
+           (_text.table_size - 1);
+}
+
+// Allocates the atlas and the index lazily, so fonts that are never drawn
+// cost nothing. The index gets an eighth of the budget, the atlas and its
+// shelves the rest.
+static bool init_cache(void)
+{
+    if (_text.atlas) {
+        return true;
+    }
+
+    size_t budget = _text.cache_size_set ? _text.cache_size :
+                                           EVA_TEXT_DEFAULT_CACHE_SIZE;
+    if (budget < 4096) {
+        return false;
+    }
+
+    uint32_t table_size = 16;
+    while ((size_t)table_size * 2 * sizeof(eva_glyph_entry) <= budget / 8) {
+        table_size *= 2;
+    }
+
+    size_t atlas_bytes = budget - (size_t)table_size * sizeof(eva_glyph_entry);
+    uint32_t atlas_w = EVA_TEXT_ATLAS_WIDTH;
+    while (atlas_w > 64 && (size_t)atlas_w * atlas_w > atlas_bytes) {
+        atlas_w /= 2;
+    }
+
+    // The shelves, one for every EVA_TEXT_SHELF_ROUND rows and one more, come
+    // out of the same bytes as the rows.
+    size_t atlas_h = (atlas_bytes - sizeof(eva_shelf)) * EVA_TEXT_SHELF_ROUND /
+                     ((size_t)atlas_w * EVA_TEXT_SHELF_ROUND + sizeof(eva_shelf));
+    if (atlas_h > UINT16_MAX) {
+        atlas_h = UINT16_MAX;
+    }
+
+    _text.atlas   = malloc((size_t)atlas_w * atlas_h);
+    _text.table   = calloc(table_size, sizeof(eva_glyph_entry));
+    _text.shelves = malloc((atlas_h / EVA_TEXT_SHELF_ROUND + 1) * sizeof(eva_shelf));
+    if (!_text.atlas || !_text.table || !_text.shelves) {
+        eva_text_clear_cache();
+        return false;
+    }
+
+    _text.atlas_w        = atlas_w;
+    _text.atlas_h        = (uint32_t)atlas_h;
+    _text.shelf_capacity = (uint32_t)(atlas_h / EVA_TEXT_SHELF_ROUND + 1);
+    _text.table_size     = table_size;
+    _text.max_glyphs     = table_size / 4 * 3;
+    return true;
+}
+
+static eva_glyph_entry *find_entry(uint32_t font, uint32_t codepoint,
+                                   uint32_t size, uint32_t offset)
+{
+    uint32_t mask = _text.table_size - 1;
+    uint32_t i = hash_glyph(font, codepoint, size, offset) & mask;
+    for (; _text.table[i].font; i = (i + 1) & mask) {
+        eva_glyph_entry *e = &_text.table[i];
+        if (e->font == font && e->codepoint == codepoint &&
+            e->size == size && e->offset == offset) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+// Removes slot i and moves the entries after it back so every entry stays
+// reachable from its home slot.
+static void remove_slot(uint32_t i)
+{
+    uint32_t mask = _text.table_size - 1;
+    uint32_t j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (!_text.table[j].font) {
+            break;
+        }
+        // Entries whose home slot lies cyclically in (i, j] stay put.
+        uint32_t home = entry_slot(&_text.table[j]);
+        bool stays = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+        if (stays) {
+            continue;
+        }
+        _text.table[i] = _text.table[j];
+        i = j;
+    }
+    _text.table[i].font = 0;
+    _text.glyph_count--;
+}
+
+// Removes every entry a predicate matches. A slot is checked again after a
+// removal since remove_slot() may have moved another entry into it.
+static void remove_entries(bool (*match)(const eva_glyph_entry *e, uint32_t arg),
+                           uint32_t arg)
+{
+    for (uint32_t i = 0; i < _text.table_size; i++) {
+        while (_text.table[i].font && match(&_text.table[i], arg)) {
+            remove_slot(i);
+        }
+    }
+}
+
+static bool on_shelf(const eva_glyph_entry *e, uint32_t shelf)
+{
+    return e->shelf == shelf;
+}
+
+static bool of_font(const eva_glyph_entry *e, uint32_t font)
+{
+    return e->font == font;
+}
+
+static void evict_shelf(uint32_t shelf)
+{
+    remove_entries(on_shelf, shelf);
+    _text.shelves[shelf].used = 0;
+    _text.stats.evictions++;
+}
+
+// The least recently used shelf at least h pixels high that holds glyphs,
+// EVA_TEXT_NO_SHELF if there is none.
+static uint32_t lru_shelf(uint32_t h)
+{
+    uint32_t lru = EVA_TEXT_NO_SHELF;
+    for (uint32_t i = 0; i < _text.shelf_count; i++) {
+        const eva_shelf *s = &_text.shelves[i];
+        if (s->h < h || !s->used) {
+            continue;
+        }
+        if (lru == EVA_TEXT_NO_SHELF ||
+            s->last_used < _text.shelves[lru].last_used) {
+            lru = i;
+        }
+    }
+    return lru;
+}
+
+// Finds room for a w x h glyph, evicting glyphs if the atlas is full.
+// Returns false if the glyph can never fit.
+static bool place_glyph(uint32_t w, uint32_t h, uint32_t *shelf, uint32_t *x)
+{
+    uint32_t shelf_h = (h + EVA_TEXT_SHELF_ROUND - 1) / EVA_TEXT_SHELF_ROUND *
+                       EVA_TEXT_SHELF_ROUND;
+    if (w > _text.atlas_w || shelf_h > _text.atlas_h) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < _text.shelf_count; i++) {
+        eva_shelf *s = &_text.shelves[i];
+        if (s->h == shelf_h && s->used + w <= _text.atlas_w) {
+            *shelf = i;
+            *x = s->used;
+            return true;
+        }
+    }
+
+    uint32_t i;
+    if (_text.shelves_bottom + shelf_h <= _text.atlas_h) {
+        i = _text.shelf_count++;
+        _text.shelves[i].y = (uint16_t)_text.shelves_bottom;
+        _text.shelves[i].h = (uint16_t)shelf_h;
+        _text.shelves[i].used = 0;
+        _text.shelves_bottom += shelf_h;
+    } else {
+        i = lru_shelf(shelf_h);
+        if (i == EVA_TEXT_NO_SHELF) {
+            // Only lower shelves are left, start over with an empty atlas.
+            _text.stats.evictions += _text.shelf_count;
+            memset(_text.table, 0, _text.table_size * sizeof(eva_glyph_entry));
+            _text.glyph_count    = 0;
+            _text.shelf_count    = 1;
+            _text.shelves_bottom = shelf_h;
+            i = 0;
+            _text.shelves[0].y = 0;
+            _text.shelves[0].h = (uint16_t)shelf_h;
+            _text.shelves[0].used = 0;
+        } else {
+            evict_shelf(i);
+        }
+    }
+
+    *shelf = i;
+    *x = 0;
+    return true;
+}
+
+// Copies a freshly rasterized glyph into the cache. Glyphs that don't fit
+// are drawn straight from the rasterizer's bitmap instead.
+static void cache_glyph(uint32_t font, uint32_t codepoint, uint32_t size,
+                        uint32_t offset, const eva_glyph *glyph)
+{
+    if (glyph->w > UINT16_MAX || glyph->h > UINT16_MAX ||
+        glyph->left < INT16_MIN || glyph->left > INT16_MAX ||
+        glyph->top < INT16_MIN || glyph->top > INT16_MAX) {
+        return;
+    }
+
+    if (_text.glyph_count >= _text.max_glyphs) {
+        uint32_t lru = lru_shelf(0);
+        if (lru == EVA_TEXT_NO_SHELF) {
+            return;
+        }
+        evict_shelf(lru);
+    }
+
+    uint32_t shelf = EVA_TEXT_NO_SHELF;
+    uint32_t x = 0;
+    bool has_pixels = glyph->w && glyph->h;
+    if (has_pixels && !place_glyph(glyph->w, glyph->h, &shelf, &x)) {
+        return;
+    }
+
+    eva_glyph_entry e = {
+        .font      = font,
+        .codepoint = codepoint,
+        .size      = size,
+        .offset    = (uint16_t)offset,
+        .shelf     = (uint16_t)shelf,
+        .x         = (uint16_t)x,
+        .w         = (uint16_t)(has_pixels ? glyph->w : 0),
+        .h         = (uint16_t)(has_pixels ? glyph->h : 0),
+        .left      = (int16_t)glyph->left,
+        .top       = (int16_t)glyph->top,
+        .advance   = glyph->advance,
+    };
+
+    if (has_pixels) {
+        eva_shelf *s = &_text.shelves[shelf];
+        e.y = s->y;
+        s->used = (uint16_t)(s->used + glyph->w);
+        s->last_used = _text.clock;
+
+        uint8_t *dst = _text.atlas + (size_t)e.y * _text.atlas_w + e.x;
+        for (uint32_t row = 0; row < glyph->h; row++) {
+            memcpy(dst + (size_t)row * _text.atlas_w,
+                   glyph->coverage + (size_t)row * glyph->pitch, glyph->w);
+        }
+    }
+
+    uint32_t mask = _text.table_size - 1;
+    uint32_t i = hash_glyph(font, codepoint, size, offset) & mask;
+    while (_text.table[i].font) {
+        i = (i + 1) & mask;
+    }
+    _text.table[i] = e;
+    _text.glyph_count++;
+}
+
+// The glyph for a codepoint, from the cache when possible.
+static bool get_glyph(eva_font *font, uint32_t codepoint, uint32_t size,
+                      uint32_t offset, eva_glyph *glyph)
+{
+    bool cached = init_cache();
+    if (cached) {
+        const eva_glyph_entry *e = find_entry(font->id, codepoint, size, offset);
+        if (e) {
+            _text.stats.hits++;
+            if (e->shelf != EVA_TEXT_NO_SHELF) {
+                _text.shelves[e->shelf].last_used = _text.clock;
+            }
+            glyph->w        = e->w;
+            glyph->h        = e->h;
+            glyph->pitch    = _text.atlas_w;
+            glyph->left     = e->left;
+            glyph->top      = e->top;
+            glyph->advance  = e->advance;
+            glyph->coverage = _text.atlas + (size_t)e->y * _text.atlas_w + e->x;
+            return true;
+        }
+    }
+
+    _text.stats.misses++;
+    memset(glyph, 0, sizeof(*glyph));
+    float offset_x = (float)offset / EVA_TEXT_SUBPIXEL_STEPS;
+    if (!font->rasterize(codepoint, (float)size / 64.0f, offset_x, glyph,
+                         font->userdata)) {
+        return false;
+    }
+    if (!glyph->coverage) {
+        glyph->w = 0;
+        glyph->h = 0;
+    }
+
+    if (cached) {
+        cache_glyph(font->id, codepoint, size, offset, glyph);
+    }
+    return true;
+}
+
+// Decodes one codepoint, returns the number of bytes used. Invalid
+// sequences decode to U+FFFD.
+static size_t decode_utf8(const uint8_t *s, size_t len, uint32_t *codepoint)
+{
+    uint32_t c = s[0];
+    size_t   n;
+    uint32_t min;
+    if (c < 0x80) {
+        *codepoint = c;
+        return 1;
+    } else if ((c & 0xe0) == 0xc0) {
+        n = 2; c &= 0x1f; min = 0x80;
+    } else if ((c & 0xf0) == 0xe0) {
+        n = 3; c &= 0x0f; min = 0x800;
+    } else if ((c & 0xf8) == 0xf0) {
+        n = 4; c &= 0x07; min = 0x10000;
+    } else {
+        *codepoint = 0xfffd;
+        return 1;
+    }
+
+    for (size_t i = 1; i < n; i++) {
+        if (i >= len || (s[i] & 0xc0) != 0x80) {
+            *codepoint = 0xfffd;
+            return i;
+        }
+        c = (c << 6) | (s[i] & 0x3f);
+    }
+
+    if (c < min || c > 0x10ffff || (c >= 0xd800 && c <= 0xdfff)) {
+        c = 0xfffd;
+    }
+    *codepoint = c;
+    return n;
+}
+
+// floorf() without libm, pen positions are well within int32_t.
+static float floor_px(float v)
+{
+    float f = (float)(int32_t)v;
+    return f > v ? f - 1.0f : f;
+}
+
+// Draws the text into fb, or only measures it if fb is NULL.
+static float draw_text(const eva_framebuffer *fb, eva_font *font, float size,
+                       float x, float y, eva_pixel color,
+                       const char *text, size_t len)
+{
+    uint32_t size_q   = size > 0.0f ? (uint32_t)(size * 64.0f + 0.5f) : 0;
+    int32_t  baseline = (int32_t)floor_px(y + 0.5f);
+
+    _text.clock++;
+
+    float pen = x;
+    for (size_t i = 0; i < len;) {
+        uint32_t codepoint;
+        i += decode_utf8((const uint8_t *)text + i, len - i, &codepoint);
+
+        float    pixel  = floor_px(pen);
+        uint32_t offset = (uint32_t)((pen - pixel) * EVA_TEXT_SUBPIXEL_STEPS + 0.5f);
+        if (offset == EVA_TEXT_SUBPIXEL_STEPS) {
+            pixel += 1.0f;
+            offset = 0;
+        }
+
+        eva_glyph glyph;
+        if (!get_glyph(font, codepoint, size_q, offset, &glyph)) {
+            continue;
+        }
+        if (fb && glyph.w && glyph.h) {
+            eva_draw_mask(fb, (int32_t)pixel + glyph.left, baseline - glyph.top,
+                          glyph.coverage, glyph.w, glyph.h, glyph.pitch, color);
+        }
+        pen += glyph.advance;
+    }
+    return pen;
+}
+
+eva_font *eva_font_create(eva_rasterize_fn rasterize, void *userdata)
+{
+    eva_font *font = calloc(1, sizeof(*font));
+    if (!font) {
+        return NULL;
+    }
+    font->id        = ++_text.next_font;
+    font->rasterize = rasterize;
+    font->userdata  = userdata;
+    return font;
+}
+
+void eva_font_destroy(eva_font *font)
+{
+    if (!font) {
+        return;
+    }
+    if (_text.table) {
+        remove_entries(of_font, font->id);
+    }
+    free(font);
+}
+
+float eva_text_draw(const eva_framebuffer *fb, eva_font *font, float size,
+                    float x, float y, eva_pixel color,
+                    const char *text, size_t len)
+{
+    return draw_text(fb, font, size, x, y, color, text, len);
+}
+
+float eva_text_measure(eva_font *font, float size, const char *text, size_t len)
+{
+    eva_pixel none = { 0, 0, 0, 0 };
+    return draw_text(NULL, font, size, 0.0f, 0.0f, none, text, len);
+}
+
+void eva_text_set_cache_size(size_t bytes)
+{
+    eva_text_clear_cache();
+    _text.cache_size     = bytes;
+    _text.cache_size_set = true;
+}
+
+void eva_text_clear_cache(void)
+{
+    free(_text.atlas);
+    free(_text.table);
+    free(_text.shelves);
+    _text.atlas          = NULL;
+    _text.table          = NULL;
+    _text.shelves        = NULL;
+    _text.atlas_w        = 0;
+    _text.atlas_h        = 0;
+    _text.shelves_bottom = 0;
+    _text.shelf_count    = 0;
+    _text.shelf_capacity = 0;
+    _text.table_size     = 0;
+    _text.glyph_count    = 0;
+    _text.max_glyphs     = 0;
+    memset(&_text.stats, 0, sizeof(_text.stats));
+}
+
+void eva_text_get_cache_stats(eva_text_cache_stats *stats)
+{
+    *stats = _text.stats;
+    stats->glyphs = _text.glyph_count;
+    stats->bytes  = (size_t)_text.atlas_w * _text.atlas_h +
+                    (size_t)_text.table_size * sizeof(eva_glyph_entry) +
+                    (size_t)_text.shelf_capacity * sizeof(eva_shelf);
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+/**
+ * Text drawing with a glyph cache.
+ *
+ * Eva doesn't parse fonts itself, glyphs come from a rasterizer the
+ * application provides, e.g. stb_truetype or FreeType. Each glyph is
+ * rasterized once per size and subpixel offset into a coverage atlas and
+ * drawn from there with eva_draw_mask() afterwards.
+ *
+ * The atlas is packed into shelves of similar height. When it is full the
+ * least recently used shelf is evicted along with its glyphs, so the cache
+ * never grows past [its size](@ref eva_text_set_cache_size).
+ *
+ * The cache is shared by all fonts and is not thread safe, text must be drawn
+ * from one thread at a time, e.g. not from a tile frame function.
+ */
+
+#include "eva.h"
+
+#include <stddef.h>
+
+/**
+ * @brief Horizontal positions a glyph is rasterized at within a pixel.
+ *
+ * Pen positions are rounded to the nearest 1/EVA_TEXT_SUBPIXEL_STEPS of a
+ * pixel.
+ *
+ * @ingroup drawing
+ */
+#define EVA_TEXT_SUBPIXEL_STEPS 4
+
+/**
+ * @brief A rasterized glyph.
+ *
+ * coverage holds h rows of w bytes, pitch bytes apart, 255 being fully
+ * covered. It only has to stay valid until the rasterizer is called again.
+ *
+ * @ingroup drawing
+ */
+typedef struct eva_glyph {
+    uint32_t       w, h;
+    uint32_t       pitch;
+    int32_t        left;    // Pixels from the pen position to the bitmap
+    int32_t        top;     // Pixels from the baseline up to the bitmap
+    float          advance; // Pixels the pen moves to the next glyph
+    const uint8_t *coverage;
+} eva_glyph;
+
+/**
+ * @brief Rasterizes a glyph for the glyph cache.
+ *
+ * Fills in glyph for the codepoint at size pixels per em, shifted right by
+ * offset_x, a fraction of a pixel. Returns false if the font has no glyph
+ * for the codepoint, it is skipped then.
+ *
+ * @ingroup drawing
+ */
+typedef bool (*eva_rasterize_fn)(uint32_t codepoint, float size, float offset_x,
+                                 eva_glyph *glyph, void *userdata);
+
+/**
+ * @brief A font, i.e. a rasterizer and its glyphs in the cache.
+ *
+ * @ingroup drawing
+ */
+typedef struct eva_font eva_font;
+
+/**
+ * @brief Statistics of the glyph cache.
+ *
+ * @see @ref eva_text_get_cache_stats
+ *
+ * @ingroup drawing
+ */
+typedef struct eva_text_cache_stats {
+    uint64_t hits;      // Glyphs drawn from the atlas
+    uint64_t misses;    // Glyphs that had to be rasterized
+    uint64_t evictions; // Shelves evicted to make room
+    uint32_t glyphs;    // Glyphs in the cache
+    size_t   bytes;     // Memory used by the atlas and its index
+} eva_text_cache_stats;
+
+/**
+ * @brief Create a font that rasterizes its glyphs with rasterize.
+ *
+ * @return NULL if it could not be allocated.
+ *
+ * @ingroup drawing
+ */
+eva_font *eva_font_create(eva_rasterize_fn rasterize, void *userdata);
+
+/**
+ * @brief Destroy a font and remove its glyphs from the cache.
+ *
+ * @ingroup drawing
+ */
+void eva_font_destroy(eva_font *font);
+
+/**
+ * @brief Draw UTF-8 text.
+ *
+ * Draws len bytes of text with the pen starting at x on the baseline y.
+ * Invalid UTF-8 is drawn as U+FFFD.
+ *
+ * @return The pen position after the last glyph.
+ *
+ * @ingroup drawing
+ */
+float eva_text_draw(const eva_framebuffer *fb, eva_font *font, float size,
+                    float x, float y, eva_pixel color,
+                    const char *text, size_t len);
+
+/**
+ * @brief The advance of UTF-8 text, without drawing it.
+ *
+ * @ingroup drawing
+ */
+float eva_text_measure(eva_font *font, float size, const char *text, size_t len);
+
+/**
+ * @brief Limit the memory of the glyph cache.
+ *
+ * The atlas, its shelves and the glyph index together stay within bytes.
+ * The default is 1 MB, which holds a few thousand glyphs of body text. The
+ * cache is cleared. With 0 glyphs are rasterized every time they are drawn.
+ *
+ * @ingroup drawing
+ */
+void eva_text_set_cache_size(size_t bytes);
+
+/**
+ * @brief Remove all glyphs from the cache and free its memory.
+ *
+ * @ingroup drawing
+ */
+void eva_text_clear_cache(void);
+
+/**
+ * @brief Statistics of the glyph cache since it was last cleared.
+ *
+ * @ingroup drawing
+ */
+void eva_text_get_cache_stats(eva_text_cache_stats *stats);
@@ -0,0 +1,286 @@
+#include "eva_internal.h"
+
+#include <stdlib.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define EVA_TEXT_INPUT_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define EVA_TEXT_INPUT_NEON
+#include <arm_neon.h>
+#endif
+
+typedef struct eva_text_input_ctx {
+    eva_text_input_fn      utf16_fn;
+    eva_text_input_utf8_fn utf8_fn;
+
+    // Reused from event to event. Text is handed over in chunks, so neither
+    // grows past a chunk.
+    uint16_t *utf16;
+    uint32_t  utf16_capacity; // In UTF-16 characters
+    char     *utf8;
+    uint32_t  utf8_capacity;  // In bytes
+} eva_text_input_ctx;
+
+static eva_text_input_ctx _text_input;
+
+void eva_set_text_input_fn(eva_text_input_fn text_input_fn)
+{
+    _text_input.utf16_fn = text_input_fn;
+}
+
+void eva_set_text_input_utf8_fn(eva_text_input_utf8_fn text_input_utf8_fn)
+{
+    _text_input.utf8_fn = text_input_utf8_fn;
+}
+
+bool eva_text_input_wanted(void)
+{
+    return _text_input.utf16_fn || _text_input.utf8_fn;
+}
+
+static bool reserve(void **buffer, uint32_t *capacity, uint32_t count,
+                    size_t size)
+{
+    if (count <= *capacity) {
+        return true;
+    }
+
+    void *grown = realloc(*buffer, (size_t)count * size);
+    if (!grown) {
+        return false;
+    }
+    *buffer   = grown;
+    *capacity = count;
+    return true;
+}
+
+uint16_t *eva_text_input_buffer(uint32_t len)
+{
+    if (len > EVA_TEXT_INPUT_CHUNK ||
+        !reserve((void **)&_text_input.utf16, &_text_input.utf16_capacity,
+                 EVA_TEXT_INPUT_CHUNK, sizeof(uint16_t))) {
+        return NULL;
+    }
+    return _text_input.utf16;
+}
+
+// Control characters are reported as key events.
+static bool is_control(uint32_t c)
+{
+    return c < 32 || (c > 126 && c < 160);
+}
+
+// Writes one code point, at most 3 bytes for anything below U+10000.
+static uint32_t put_utf8(char *dst, uint32_t cp)
+{
+    unsigned char *d = (unsigned char *)dst;
+    if (cp < 0x80) {
+        d[0] = (unsigned char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        d[0] = (unsigned char)(0xC0 | (cp >> 6));
+        d[1] = (unsigned char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        d[0] = (unsigned char)(0xE0 | (cp >> 12));
+        d[1] = (unsigned char)(0x80 | ((cp >> 6) & 0x3F));
+        d[2] = (unsigned char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    d[0] = (unsigned char)(0xF0 | (cp >> 18));
+    d[1] = (unsigned char)(0x80 | ((cp >> 12) & 0x3F));
+    d[2] = (unsigned char)(0x80 | ((cp >> 6) & 0x3F));
+    d[3] = (unsigned char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+uint32_t eva_utf16_to_utf8(const uint16_t *src, uint32_t len, char *dst)
+{
+    uint32_t i = 0;
+    uint32_t n = 0;
+    while (i < len) {
+        // Runs of ASCII, most of what is typed or pasted, are narrowed 16
+        // characters at a time.
+#if defined(EVA_TEXT_INPUT_SSE2)
+        const __m128i high = _mm_set1_epi16((short)0xFF80);
+        while (i + 16 <= len) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+            __m128i b = _mm_loadu_si128((const __m128i *)(src + i + 8));
+            __m128i non_ascii = _mm_and_si128(_mm_or_si128(a, b), high);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(non_ascii, _mm_setzero_si128())) != 0xFFFF) {
+                break;
+            }
+            _mm_storeu_si128((__m128i *)(dst + n), _mm_packus_epi16(a, b));
+            i += 16;
+            n += 16;
+        }
+#elif defined(EVA_TEXT_INPUT_NEON)
+        while (i + 16 <= len) {
+            uint16x8_t a = vld1q_u16(src + i);
+            uint16x8_t b = vld1q_u16(src + i + 8);
+            if (vmaxvq_u16(vorrq_u16(a, b)) >= 0x80) {
+                break;
+            }
+            vst1q_u8((uint8_t *)(dst + n), vcombine_u8(vmovn_u16(a), vmovn_u16(b)));
+            i += 16;
+            n += 16;
+        }
+#endif
+
+        // The rest one character at a time, up to the next ASCII run.
+        // Surrogates without their other half become U+FFFD.
+        uint32_t end = i + 16 < len ? i + 16 : len;
+        while (i < end) {
+            uint32_t cp = src[i++];
+            if (cp >= 0xD800 && cp < 0xE000) {
+                if (cp < 0xDC00 && i < len && src[i] >= 0xDC00 && src[i] < 0xE000) {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (src[i++] - 0xDC00);
+                } else {
+                    cp = 0xFFFD;
+                }
+            }
+            n += put_utf8(dst + n, cp);
+        }
+    }
+    return n;
+}
+
+uint32_t eva_utf8_to_utf16(const char *src, uint32_t len, uint16_t *dst)
+{
+    const unsigned char *s = (const unsigned char *)src;
+    uint32_t n = 0;
+    uint32_t i = 0;
+
+    while (i < len) {
+        uint32_t cp;
+        uint32_t min;
+        int extra;
+        unsigned char c = s[i++];
+
+        if (c < 0x80)                { cp = c;        extra = 0; min = 0;       }
+        else if ((c & 0xE0) == 0xC0) { cp = c & 0x1F; extra = 1; min = 0x80;    }
+        else if ((c & 0xF0) == 0xE0) { cp = c & 0x0F; extra = 2; min = 0x800;   }
+        else if ((c & 0xF8) == 0xF0) { cp = c & 0x07; extra = 3; min = 0x10000; }
+        else                         { cp = 0xFFFD;   extra = 0; min = 0;       }
+
+        while (extra > 0 && i < len && (s[i] & 0xC0) == 0x80) {
+            cp = (cp << 6) | (s[i++] & 0x3F);
+            extra--;
+        }
+
+        // Overlong encodings and encoded surrogates are rejected the same as
+        // by decode_utf8() in eva_text.c.
+        if (extra > 0 || cp < min || cp > 0x10FFFF ||
+            (cp >= 0xD800 && cp < 0xE000)) {
+            cp = 0xFFFD;
+        }
+
+        if (cp >= 0x10000) {
+            cp -= 0x10000;
+            dst[n++] = (uint16_t)(0xD800 + (cp >> 10));
+            dst[n++] = (uint16_t)(0xDC00 + (cp & 0x3FF));
+        } else {
+            dst[n++] = (uint16_t)cp;
+        }
+    }
+
+    return n;
+}
+
+// Hands a chunk over to the application in both encodings it asked for.
+static void deliver(const uint16_t *utf16, uint32_t utf16_len,
+                    const char *utf8, uint32_t utf8_len, eva_mod_flags mod)
+{
+    if (_text_input.utf16_fn && utf16) {
+        eva_record_text_input(utf16, utf16_len, mod);
+        _text_input.utf16_fn(utf16, utf16_len, mod);
+    }
+    if (_text_input.utf8_fn && utf8) {
+        if (!_text_input.utf16_fn && utf16) {
+            eva_record_text_input(utf16, utf16_len, mod);
+        }
+        _text_input.utf8_fn(utf8, utf8_len, mod);
+    }
+}
+
+bool eva_text_input_utf16(const uint16_t *text, uint32_t len, eva_mod_flags mod,
+                          bool first)
+{
+    if (len == 0 || !eva_text_input_wanted() || (first && is_control(text[0]))) {
+        return false;
+    }
+
+    while (len > 0) {
+        // Surrogate pairs stay in one chunk.
+        uint32_t n = len < EVA_TEXT_INPUT_CHUNK ? len : EVA_TEXT_INPUT_CHUNK;
+        if (n < len && text[n - 1] >= 0xD800 && text[n - 1] < 0xDC00) {
+            n--;
+        }
+
+        char    *utf8     = NULL;
+        uint32_t utf8_len = 0;
+        if (_text_input.utf8_fn &&
+            reserve((void **)&_text_input.utf8, &_text_input.utf8_capacity,
+                    EVA_TEXT_INPUT_CHUNK * 3, 1)) {
+            utf8     = _text_input.utf8;
+            utf8_len = eva_utf16_to_utf8(text, n, utf8);
+        }
+        deliver(text, n, utf8, utf8_len, mod);
+
+        text += n;
+        len  -= n;
+    }
+    return true;
+}
+
+void eva_text_input_utf8(const char *text, uint32_t len, eva_mod_flags mod)
+{
+    if (len == 0 || !eva_text_input_wanted()) {
+        return;
+    }
+
+    // C1 control characters are encoded as C2 80 to C2 9F.
+    const unsigned char *s = (const unsigned char *)text;
+    if (is_control(s[0]) || (s[0] == 0xC2 && len > 1 && s[1] < 0xA0)) {
+        return;
+    }
+
+    while (len > 0) {
+        // Sequences stay in one chunk.
+        uint32_t n = len < EVA_TEXT_INPUT_CHUNK ? len : EVA_TEXT_INPUT_CHUNK;
+        if (n < len) {
+            uint32_t start = n;
+            while (start > n - 3 && (s[start] & 0xC0) == 0x80) {
+                start--;
+            }
+            n = start > 0 ? start : n;
+        }
+
+        // Recording keeps UTF-16, so it is decoded even for the UTF-8
+        // callback.
+        uint16_t *utf16     = NULL;
+        uint32_t  utf16_len = 0;
+        if (reserve((void **)&_text_input.utf16, &_text_input.utf16_capacity,
+                    EVA_TEXT_INPUT_CHUNK, sizeof(uint16_t))) {
+            utf16     = _text_input.utf16;
+            utf16_len = eva_utf8_to_utf16((const char *)s, n, utf16);
+        }
+        deliver(utf16, utf16_len, (const char *)s, n, mod);
+
+        s   += n;
+        len -= n;
+    }
+}
+
+void eva_text_input_shutdown(void)
+{
+    free(_text_input.utf16);
+    free(_text_input.utf8);
+    _text_input.utf16          = NULL;
+    _text_input.utf16_capacity = 0;
+    _text_input.utf8           = NULL;
+    _text_input.utf8_capacity  = 0;
+}
@@ -0,0 +1,277 @@
+/**
+ * Checks the UTF-16 and UTF-8 conversions of text input: the vectorized
+ * ASCII runs of eva_utf16_to_utf8() against a character at a time encoder,
+ * the invalid sequences eva_utf8_to_utf16() rejects and that text handed
+ * over in chunks never splits a surrogate pair or a UTF-8 sequence.
+ *
+ * Runs without eva_run(). Exits with 0 when every check passes.
+ *
+ * Usage: eva_text_input_test
+ */
+
+#include "eva.h"
+#include "eva_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_MAX_LEN 80 // Covers several runs of 16 characters
+#define TEST_LEN     (EVA_TEXT_INPUT_CHUNK * 2 + 64)
+
+static uint16_t _utf16[TEST_LEN];
+static char     _utf8[TEST_LEN * 3];
+static uint16_t _received16[TEST_LEN];
+static char     _received8[TEST_LEN * 3];
+static uint32_t _received_len;
+static uint32_t _chunks;
+static bool     _failed;
+
+static void fail(const char *message, uint32_t a, uint32_t b)
+{
+    fprintf(stderr, "%s (%u, %u)\n", message, a, b);
+    _failed = true;
+}
+
+// One character at a time, the way eva_utf16_to_utf8() handles anything
+// that isn't an ASCII run.
+static uint32_t scalar_utf16_to_utf8(const uint16_t *src, uint32_t len,
+                                     unsigned char *dst)
+{
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        uint32_t cp = src[i];
+        if (cp >= 0xD800 && cp < 0xE000) {
+            if (cp < 0xDC00 && i + 1 < len && src[i + 1] >= 0xDC00 &&
+                src[i + 1] < 0xE000) {
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (src[++i] - 0xDC00);
+            } else {
+                cp = 0xFFFD;
+            }
+        }
+
+        if (cp < 0x80) {
+            dst[n++] = (unsigned char)cp;
+        } else if (cp < 0x800) {
+            dst[n++] = (unsigned char)(0xC0 | (cp >> 6));
+            dst[n++] = (unsigned char)(0x80 | (cp & 0x3F));
+        } else if (cp < 0x10000) {
+            dst[n++] = (unsigned char)(0xE0 | (cp >> 12));
+            dst[n++] = (unsigned char)(0x80 | ((cp >> 6) & 0x3F));
+            dst[n++] = (unsigned char)(0x80 | (cp & 0x3F));
+        } else {
+            dst[n++] = (unsigned char)(0xF0 | (cp >> 18));
+            dst[n++] = (unsigned char)(0x80 | ((cp >> 12) & 0x3F));
+            dst[n++] = (unsigned char)(0x80 | ((cp >> 6) & 0x3F));
+            dst[n++] = (unsigned char)(0x80 | (cp & 0x3F));
+        }
+    }
+    return n;
+}
+
+// ASCII with one non-ASCII character, or surrogate pair, at every offset of
+// every length, so it lands before, in and after each 16 character run.
+static void check_ascii_runs(void)
+{
+    static const uint16_t others[][2] = {
+        { 0x00E9, 0 },      // 2 bytes
+        { 0x0080, 0 },      // The first one that isn't ASCII
+        { 0x20AC, 0 },      // 3 bytes
+        { 0xD83D, 0xDE00 }, // Surrogate pair
+        { 0xDE00, 0 },      // Unpaired low surrogate
+        { 0xD83D, 0 },      // Unpaired high surrogate
+    };
+
+    uint16_t      src[TEST_MAX_LEN];
+    char          simd[TEST_MAX_LEN * 3];
+    unsigned char scalar[TEST_MAX_LEN * 3];
+    for (uint32_t len = 0; len <= TEST_MAX_LEN; len++) {
+        for (uint32_t o = 0; o < sizeof(others) / sizeof(others[0]); o++) {
+            for (uint32_t at = 0; at <= len; at++) {
+                for (uint32_t i = 0; i < len; i++) {
+                    src[i] = (uint16_t)(' ' + (i % 95));
+                }
+                if (at < len) {
+                    src[at] = others[o][0];
+                    if (others[o][1] && at + 1 < len) {
+                        src[at + 1] = others[o][1];
+                    }
+                }
+
+                uint32_t n        = eva_utf16_to_utf8(src, len, simd);
+                uint32_t expected = scalar_utf16_to_utf8(src, len, scalar);
+                if (n != expected || memcmp(simd, scalar, n) != 0) {
+                    fail("UTF-8 doesn't match the scalar encoder", len, at);
+                    return;
+                }
+            }
+        }
+    }
+}
+
+typedef struct utf8_case {
+    const char *utf8;
+    uint16_t    utf16[3];
+    uint32_t    len;
+} utf8_case;
+
+static void check_utf8_validation(void)
+{
+    static const utf8_case cases[] = {
+        { "\x41",             { 0x0041 },         1 },
+        { "\xC3\xA9",         { 0x00E9 },         1 },
+        { "\xED\x9F\xBF",     { 0xD7FF },         1 }, // Last before surrogates
+        { "\xEE\x80\x80",     { 0xE000 },         1 }, // First after them
+        { "\xF0\x9F\x98\x80", { 0xD83D, 0xDE00 }, 2 },
+        { "\xF4\x8F\xBF\xBF", { 0xDBFF, 0xDFFF }, 2 }, // U+10FFFF
+
+        // Overlong encodings.
+        { "\xC0\xAF",         { 0xFFFD },         1 },
+        { "\xC1\xBF",         { 0xFFFD },         1 },
+        { "\xE0\x80\xAF",     { 0xFFFD },         1 },
+        { "\xE0\x9F\xBF",     { 0xFFFD },         1 },
+        { "\xF0\x80\x80\xAF", { 0xFFFD },         1 },
+        { "\xF0\x8F\xBF\xBF", { 0xFFFD },         1 },
+
+        // Encoded surrogates.
+        { "\xED\xA0\x80",     { 0xFFFD },         1 },
+        { "\xED\xAF\xBF",     { 0xFFFD },         1 },
+        { "\xED\xB0\x80",     { 0xFFFD },         1 },
+        { "\xED\xBF\xBF",     { 0xFFFD },         1 },
+
+        // Past U+10FFFF, lead bytes that don't exist and truncation.
+        { "\xF4\x90\x80\x80", { 0xFFFD },         1 },
+        { "\xF8",             { 0xFFFD },         1 },
+        { "\xFF",             { 0xFFFD },         1 },
+        { "\x80",             { 0xFFFD },         1 },
+        { "\xE2\x82",         { 0xFFFD },         1 },
+        { "\xE2\x82\x41",     { 0xFFFD, 0x0041 }, 2 },
+    };
+
+    for (uint32_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        uint16_t dst[8];
+        uint32_t n = eva_utf8_to_utf16(cases[c].utf8,
+                                       (uint32_t)strlen(cases[c].utf8), dst);
+        if (n != cases[c].len ||
+            memcmp(dst, cases[c].utf16, n * sizeof(uint16_t)) != 0) {
+            fail("Unexpected UTF-16 for case", c, n);
+        }
+    }
+}
+
+static void received_utf16(const uint16_t *text, uint32_t len,
+                           eva_mod_flags mod)
+{
+    (void)mod;
+    if (len == 0 || len > EVA_TEXT_INPUT_CHUNK) {
+        fail("Chunk has an unexpected length", _chunks, len);
+    }
+    if (text[0] >= 0xDC00 && text[0] < 0xE000) {
+        fail("Chunk starts with a low surrogate", _chunks, _received_len);
+    }
+    if (text[len - 1] >= 0xD800 && text[len - 1] < 0xDC00) {
+        fail("Chunk ends with a high surrogate", _chunks, _received_len);
+    }
+    if (_received_len + len <= TEST_LEN) {
+        memcpy(_received16 + _received_len, text, len * sizeof(uint16_t));
+    }
+    _received_len += len;
+    _chunks++;
+}
+
+static void received_utf8(const char *text, uint32_t len, eva_mod_flags mod)
+{
+    (void)mod;
+    const unsigned char *s = (const unsigned char *)text;
+    if (len == 0 || len > EVA_TEXT_INPUT_CHUNK) {
+        fail("Chunk has an unexpected length", _chunks, len);
+    }
+    if ((s[0] & 0xC0) == 0x80) {
+        fail("Chunk starts inside a sequence", _chunks, _received_len);
+    }
+
+    // Every chunk decodes without a replacement character on its own.
+    static uint16_t decoded[EVA_TEXT_INPUT_CHUNK];
+    uint32_t n = eva_utf8_to_utf16(text, len, decoded);
+    for (uint32_t i = 0; i < n; i++) {
+        if (decoded[i] == 0xFFFD) {
+            fail("Chunk splits a sequence", _chunks, _received_len);
+            break;
+        }
+    }
+
+    if (_received_len + len <= sizeof(_received8)) {
+        memcpy(_received8 + _received_len, text, len);
+    }
+    _received_len += len;
+    _chunks++;
+}
+
+// Puts a surrogate pair, and its UTF-8 sequence, across every position of
+// the first chunk boundary.
+static void check_chunks(void)
+{
+    eva_set_text_input_fn(received_utf16);
+    for (uint32_t shift = 0; shift < 4; shift++) {
+        uint32_t len = 0;
+        while (len < TEST_LEN - 1) {
+            uint32_t at = EVA_TEXT_INPUT_CHUNK - 2 + shift;
+            if (len == at) {
+                _utf16[len++] = 0xD83D;
+                _utf16[len++] = 0xDE00;
+            } else {
+                _utf16[len++] = (uint16_t)('a' + len % 26);
+            }
+        }
+
+        _received_len = 0;
+        _chunks       = 0;
+        eva_text_input_utf16(_utf16, len, 0, true);
+        if (_received_len != len ||
+            memcmp(_received16, _utf16, len * sizeof(uint16_t)) != 0) {
+            fail("UTF-16 chunks don't add up to the text", shift, _received_len);
+        }
+    }
+    eva_set_text_input_fn(NULL);
+
+    eva_set_text_input_utf8_fn(received_utf8);
+    static const char *sequences[] = { "\xC3\xA9", "\xE2\x82\xAC",
+                                       "\xF0\x9F\x98\x80" };
+    for (uint32_t q = 0; q < sizeof(sequences) / sizeof(sequences[0]); q++) {
+        uint32_t seq_len = (uint32_t)strlen(sequences[q]);
+        for (uint32_t shift = 0; shift < seq_len + 1; shift++) {
+            uint32_t len = 0;
+            uint32_t at  = EVA_TEXT_INPUT_CHUNK - seq_len + shift;
+            while (len < TEST_LEN - 4) {
+                if (len == at) {
+                    memcpy(_utf8 + len, sequences[q], seq_len);
+                    len += seq_len;
+                } else {
+                    _utf8[len++] = (char)('a' + len % 26);
+                }
+            }
+
+            _received_len = 0;
+            _chunks       = 0;
+            eva_text_input_utf8(_utf8, len, 0);
+            if (_received_len != len || memcmp(_received8, _utf8, len) != 0) {
+                fail("UTF-8 chunks don't add up to the text", q, shift);
+            }
+        }
+    }
+    eva_set_text_input_utf8_fn(NULL);
+}
+
+int main(void)
+{
+    check_ascii_runs();
+    check_utf8_validation();
+    check_chunks();
+    eva_text_input_shutdown();
+
+    if (_failed) {
+        return 1;
+    }
+    printf("Text input conversions match\n");
+    return 0;
+}
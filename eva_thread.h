@@ -0,0 +1,321 @@
+#pragma once
+
+/**
+ * Minimal threading primitives shared by the eva modules that use worker
+ * threads. Wraps pthreads and Win32. This is not part of the public API.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Called by eva_thread_entry() when a thread started with eva_thread_create()
+// is done, see eva_trace.c.
+void eva_trace_thread_exit(void);
+
+#if defined(_WIN32)
+
+#include <Windows.h>
+
+#define EVA_THREAD_LOCAL __declspec(thread)
+
+typedef CRITICAL_SECTION   eva_mutex;
+typedef CONDITION_VARIABLE eva_cond;
+typedef HANDLE             eva_thread;
+
+typedef void (*eva_thread_fn)(void *arg);
+
+typedef struct eva_thread_start {
+    eva_thread_fn fn;
+    void         *arg;
+} eva_thread_start;
+
+static inline void eva_mutex_init(eva_mutex *m)    { InitializeCriticalSection(m); }
+static inline void eva_mutex_destroy(eva_mutex *m) { DeleteCriticalSection(m); }
+static inline void eva_mutex_lock(eva_mutex *m)    { EnterCriticalSection(m); }
+static inline void eva_mutex_unlock(eva_mutex *m)  { LeaveCriticalSection(m); }
+
+static inline void eva_cond_init(eva_cond *c)      { InitializeConditionVariable(c); }
+static inline void eva_cond_destroy(eva_cond *c)   { (void)c; }
+static inline void eva_cond_signal(eva_cond *c)    { WakeConditionVariable(c); }
+static inline void eva_cond_broadcast(eva_cond *c) { WakeAllConditionVariable(c); }
+static inline void eva_cond_wait(eva_cond *c, eva_mutex *m)
+{
+    SleepConditionVariableCS(c, m, INFINITE);
+}
+
+static inline DWORD WINAPI eva_thread_entry(LPVOID param)
+{
+    eva_thread_start start = *(eva_thread_start *)param;
+    HeapFree(GetProcessHeap(), 0, param);
+    start.fn(start.arg);
+    eva_trace_thread_exit();
+    return 0;
+}
+
+static inline bool eva_thread_create(eva_thread *t, eva_thread_fn fn, void *arg)
+{
+    eva_thread_start *start = HeapAlloc(GetProcessHeap(), 0, sizeof(*start));
+    if (!start) {
+        return false;
+    }
+    start->fn  = fn;
+    start->arg = arg;
+
+    *t = CreateThread(NULL, 0, eva_thread_entry, start, 0, NULL);
+    if (!*t) {
+        HeapFree(GetProcessHeap(), 0, start);
+        return false;
+    }
+    return true;
+}
+
+static inline void eva_thread_join(eva_thread t)
+{
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+}
+
+typedef DWORD eva_thread_id;
+
+static inline eva_thread_id eva_thread_current(void) { return GetCurrentThreadId(); }
+static inline bool eva_thread_is(eva_thread_id a, eva_thread_id b) { return a == b; }
+
+static inline uint32_t eva_cpu_count(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (uint32_t)info.dwNumberOfProcessors : 1;
+}
+
+static inline uint32_t eva_atomic_load_u32(volatile uint32_t *p)
+{
+    return (uint32_t)InterlockedCompareExchange((volatile LONG *)p, 0, 0);
+}
+
+// Without ordering, for flags polled on hot paths. Aligned 32 bit reads are
+// atomic on every Windows target.
+static inline uint32_t eva_atomic_load_relaxed_u32(volatile uint32_t *p)
+{
+    return *p;
+}
+
+// Without ordering, for data published by a release store after it. Readers
+// that race with the writer have to check if what they read was torn.
+static inline uint64_t eva_atomic_load_relaxed_u64(volatile uint64_t *p)
+{
+    return *p;
+}
+
+static inline void eva_atomic_store_relaxed_u64(volatile uint64_t *p, uint64_t v)
+{
+    *p = v;
+}
+
+static inline void *eva_atomic_load_relaxed_ptr(void *volatile *p)
+{
+    return *p;
+}
+
+static inline void eva_atomic_store_relaxed_ptr(void *volatile *p, void *v)
+{
+    *p = v;
+}
+
+// Orders the loads before the fence before the loads and stores after it.
+static inline void eva_atomic_fence_acquire(void)
+{
+    MemoryBarrier();
+}
+
+// Orders the loads and stores before the fence before the stores after it.
+static inline void eva_atomic_fence_release(void)
+{
+    MemoryBarrier();
+}
+
+static inline void eva_atomic_store_u32(volatile uint32_t *p, uint32_t v)
+{
+    InterlockedExchange((volatile LONG *)p, (LONG)v);
+}
+
+// Returns the value before the addition.
+static inline uint32_t eva_atomic_fetch_add_u32(volatile uint32_t *p, uint32_t v)
+{
+    return (uint32_t)InterlockedExchangeAdd((volatile LONG *)p, (LONG)v);
+}
+
+// Returns the value before the exchange.
+static inline uint32_t eva_atomic_exchange_u32(volatile uint32_t *p, uint32_t v)
+{
+    return (uint32_t)InterlockedExchange((volatile LONG *)p, (LONG)v);
+}
+
+static inline void *eva_atomic_load_ptr(void *volatile *p)
+{
+    return InterlockedCompareExchangePointer(p, NULL, NULL);
+}
+
+static inline void eva_atomic_store_ptr(void *volatile *p, void *v)
+{
+    InterlockedExchangePointer(p, v);
+}
+
+// Returns the value before the exchange.
+static inline void *eva_atomic_exchange_ptr(void *volatile *p, void *v)
+{
+    return InterlockedExchangePointer(p, v);
+}
+
+#else
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define EVA_THREAD_LOCAL __thread
+
+typedef pthread_mutex_t eva_mutex;
+typedef pthread_cond_t  eva_cond;
+typedef pthread_t       eva_thread;
+
+typedef void (*eva_thread_fn)(void *arg);
+
+typedef struct eva_thread_start {
+    eva_thread_fn fn;
+    void         *arg;
+} eva_thread_start;
+
+static inline void eva_mutex_init(eva_mutex *m)    { pthread_mutex_init(m, NULL); }
+static inline void eva_mutex_destroy(eva_mutex *m) { pthread_mutex_destroy(m); }
+static inline void eva_mutex_lock(eva_mutex *m)    { pthread_mutex_lock(m); }
+static inline void eva_mutex_unlock(eva_mutex *m)  { pthread_mutex_unlock(m); }
+
+static inline void eva_cond_init(eva_cond *c)      { pthread_cond_init(c, NULL); }
+static inline void eva_cond_destroy(eva_cond *c)   { pthread_cond_destroy(c); }
+static inline void eva_cond_signal(eva_cond *c)    { pthread_cond_signal(c); }
+static inline void eva_cond_broadcast(eva_cond *c) { pthread_cond_broadcast(c); }
+static inline void eva_cond_wait(eva_cond *c, eva_mutex *m)
+{
+    pthread_cond_wait(c, m);
+}
+
+static inline void *eva_thread_entry(void *param)
+{
+    eva_thread_start start = *(eva_thread_start *)param;
+    free(param);
+    start.fn(start.arg);
+    eva_trace_thread_exit();
+    return NULL;
+}
+
+static inline bool eva_thread_create(eva_thread *t, eva_thread_fn fn, void *arg)
+{
+    eva_thread_start *start = malloc(sizeof(*start));
+    if (!start) {
+        return false;
+    }
+    start->fn  = fn;
+    start->arg = arg;
+
+    if (pthread_create(t, NULL, eva_thread_entry, start) != 0) {
+        free(start);
+        return false;
+    }
+    return true;
+}
+
+static inline void eva_thread_join(eva_thread t)
+{
+    pthread_join(t, NULL);
+}
+
+typedef pthread_t eva_thread_id;
+
+static inline eva_thread_id eva_thread_current(void) { return pthread_self(); }
+static inline bool eva_thread_is(eva_thread_id a, eva_thread_id b) { return pthread_equal(a, b) != 0; }
+
+static inline uint32_t eva_cpu_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (uint32_t)n : 1;
+}
+
+static inline uint32_t eva_atomic_load_u32(volatile uint32_t *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+// Without ordering, for flags polled on hot paths.
+static inline uint32_t eva_atomic_load_relaxed_u32(volatile uint32_t *p)
+{
+    return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+// Without ordering, for data published by a release store after it. Readers
+// that race with the writer have to check if what they read was torn.
+static inline uint64_t eva_atomic_load_relaxed_u64(volatile uint64_t *p)
+{
+    return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static inline void eva_atomic_store_relaxed_u64(volatile uint64_t *p, uint64_t v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELAXED);
+}
+
+static inline void *eva_atomic_load_relaxed_ptr(void *volatile *p)
+{
+    return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static inline void eva_atomic_store_relaxed_ptr(void *volatile *p, void *v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELAXED);
+}
+
+// Orders the loads before the fence before the loads and stores after it.
+static inline void eva_atomic_fence_acquire(void)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+}
+
+// Orders the loads and stores before the fence before the stores after it.
+static inline void eva_atomic_fence_release(void)
+{
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void eva_atomic_store_u32(volatile uint32_t *p, uint32_t v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+// Returns the value before the addition.
+static inline uint32_t eva_atomic_fetch_add_u32(volatile uint32_t *p, uint32_t v)
+{
+    return __atomic_fetch_add(p, v, __ATOMIC_ACQ_REL);
+}
+
+// Returns the value before the exchange.
+static inline uint32_t eva_atomic_exchange_u32(volatile uint32_t *p, uint32_t v)
+{
+    return __atomic_exchange_n(p, v, __ATOMIC_ACQ_REL);
+}
+
+static inline void *eva_atomic_load_ptr(void *volatile *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void eva_atomic_store_ptr(void *volatile *p, void *v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+// Returns the value before the exchange.
+static inline void *eva_atomic_exchange_ptr(void *volatile *p, void *v)
+{
+    return __atomic_exchange_n(p, v, __ATOMIC_ACQ_REL);
+}
+
+#endif
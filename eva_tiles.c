@@ -0,0 +1,240 @@
+#include "eva_internal.h"
+#include "eva_thread.h"
+#include "eva_trace.h"
+
+#include <stdlib.h>
+
+// The default tile is 128x64 pixels, 32 KB that stay in L1/L2 while a tile
+// is drawn.
+#define EVA_DEFAULT_TILE_W 128
+#define EVA_DEFAULT_TILE_H 64
+
+typedef struct eva_tile_pool {
+    eva_tile_frame_fn fn;
+    uint32_t          tile_w, tile_h; // As set, see frame_tile_w
+
+    bool        started;
+    eva_thread *threads;
+    uint32_t    thread_count;
+
+    eva_mutex mutex;
+    eva_cond  work_cond;  // Signalled when a frame is ready to be drawn
+    eva_cond  done_cond;  // Signalled when the last worker finishes a frame
+    uint64_t  generation; // Incremented for every frame
+    uint32_t  busy;       // Workers still drawing the current frame
+    bool      quit;
+
+    // The frame being drawn, only changed while no worker is busy.
+    const eva_framebuffer *fb;
+    uint32_t               frame_tile_w;
+    uint32_t               first_tx, first_ty;
+    uint32_t               tiles_x;
+    uint32_t               tile_count;
+    volatile uint32_t      next_tile;
+} eva_tile_pool;
+
+static eva_tile_pool _pool;
+
+static void draw_tiles(void)
+{
+    const eva_framebuffer *fb = _pool.fb;
+
+    for (;;) {
+        uint32_t i = eva_atomic_fetch_add_u32(&_pool.next_tile, 1);
+        if (i >= _pool.tile_count) {
+            break;
+        }
+
+        uint32_t x = (_pool.first_tx + i % _pool.tiles_x) * _pool.frame_tile_w;
+        uint32_t y = (_pool.first_ty + i / _pool.tiles_x) * _pool.tile_h;
+        eva_rect rect = {
+            .x = (int32_t)x,
+            .y = (int32_t)y,
+            .w = (int32_t)(fb->w - x < _pool.frame_tile_w ? fb->w - x : _pool.frame_tile_w),
+            .h = (int32_t)(fb->h - y < _pool.tile_h ? fb->h - y : _pool.tile_h),
+        };
+
+        eva_framebuffer tile = *fb;
+        tile.w          = (uint32_t)rect.w;
+        tile.h          = (uint32_t)rect.h;
+        tile.max_height = (uint32_t)rect.h;
+        if (fb->format == EVA_PIXEL_FORMAT_BGRA8) {
+            tile.pixels = fb->pixels + (size_t)y * fb->pitch + x;
+        } else {
+            tile.data   = framebuffer_at(fb, rect.x, rect.y);
+        }
+
+        EVA_TRACE_BEGIN("tile");
+        _pool.fn(&tile, rect);
+        EVA_TRACE_END();
+    }
+}
+
+static void worker(void *arg)
+{
+    (void)arg;
+
+    eva_trace_set_thread_name("eva tile worker");
+    uint64_t seen = 0;
+
+    eva_mutex_lock(&_pool.mutex);
+    for (;;) {
+        while (!_pool.quit && _pool.generation == seen) {
+            eva_cond_wait(&_pool.work_cond, &_pool.mutex);
+        }
+        if (_pool.quit) {
+            break;
+        }
+        seen = _pool.generation;
+        eva_mutex_unlock(&_pool.mutex);
+
+        draw_tiles();
+
+        eva_mutex_lock(&_pool.mutex);
+        if (--_pool.busy == 0) {
+            eva_cond_signal(&_pool.done_cond);
+        }
+    }
+    eva_mutex_unlock(&_pool.mutex);
+}
+
+static void start_pool(void)
+{
+    eva_mutex_init(&_pool.mutex);
+    eva_cond_init(&_pool.work_cond);
+    eva_cond_init(&_pool.done_cond);
+    _pool.generation = 0;
+    _pool.busy       = 0;
+    _pool.quit       = false;
+
+    // The calling thread draws tiles too so one worker less is needed.
+    uint32_t count = eva_cpu_count() - 1;
+    _pool.thread_count = 0;
+    _pool.threads = count ? calloc(count, sizeof(eva_thread)) : NULL;
+    if (_pool.threads) {
+        for (uint32_t i = 0; i < count; i++) {
+            if (!eva_thread_create(&_pool.threads[i], worker, NULL)) {
+                break;
+            }
+            _pool.thread_count++;
+        }
+    }
+
+    _pool.started = true;
+}
+
+void eva_set_tile_frame_fn(eva_tile_frame_fn tile_frame_fn,
+                           uint32_t tile_w, uint32_t tile_h)
+{
+    if (tile_w == 0) {
+        tile_w = EVA_DEFAULT_TILE_W;
+    }
+    if (tile_h == 0) {
+        tile_h = EVA_DEFAULT_TILE_H;
+    }
+
+    _pool.fn     = tile_frame_fn;
+    _pool.tile_w = tile_w;
+    _pool.tile_h = tile_h;
+}
+
+static void draw(eva_frame_fn frame_fn, const eva_framebuffer *fb,
+                 eva_rect damage)
+{
+    if (!_pool.fn) {
+        if (frame_fn) {
+            frame_fn(fb);
+        }
+        return;
+    }
+
+    // Only the tiles touching the damaged area are drawn.
+    damage = rect_clip(damage, fb->w, fb->h);
+    if (rect_is_empty(damage)) {
+        return;
+    }
+
+    if (!_pool.started) {
+        start_pool();
+    }
+
+    // Tile widths are rounded to whole cache lines of the pixel format so
+    // neighbouring tiles never write to the same line.
+    uint32_t align  = EVA_CACHE_LINE / pixel_format_size(fb->format);
+    uint32_t tile_w = (_pool.tile_w + align - 1) / align * align;
+
+    uint32_t tx0 = (uint32_t)damage.x / tile_w;
+    uint32_t ty0 = (uint32_t)damage.y / _pool.tile_h;
+    uint32_t tx1 = ((uint32_t)(damage.x + damage.w) + tile_w - 1) / tile_w;
+    uint32_t ty1 = ((uint32_t)(damage.y + damage.h) + _pool.tile_h - 1) / _pool.tile_h;
+
+    eva_mutex_lock(&_pool.mutex);
+    _pool.fb           = fb;
+    _pool.frame_tile_w = tile_w;
+    _pool.first_tx     = tx0;
+    _pool.first_ty     = ty0;
+    _pool.tiles_x      = tx1 - tx0;
+    _pool.tile_count   = (tx1 - tx0) * (ty1 - ty0);
+    eva_atomic_store_u32(&_pool.next_tile, 0);
+    _pool.busy = _pool.thread_count;
+    _pool.generation++;
+    eva_cond_broadcast(&_pool.work_cond);
+    eva_mutex_unlock(&_pool.mutex);
+
+    draw_tiles();
+
+    // Present only once every tile is finished.
+    eva_mutex_lock(&_pool.mutex);
+    while (_pool.busy > 0) {
+        eva_cond_wait(&_pool.done_cond, &_pool.mutex);
+    }
+    eva_mutex_unlock(&_pool.mutex);
+}
+
+void eva_tiles_draw(eva_frame_fn frame_fn, const eva_framebuffer *fb,
+                    eva_rect damage)
+{
+    eva_framebuffer view = eva_format_view(fb);
+    if (eva_layers_begin_frame(damage)) {
+        EVA_TRACE_BEGIN("frame_fn");
+        draw(frame_fn, &view, damage);
+        EVA_TRACE_END();
+    }
+    eva_format_expand(fb, damage);
+}
+
+eva_rect eva_tiles_render(eva_frame_fn frame_fn, const eva_framebuffer *fb,
+                          eva_rect damage)
+{
+    uint64_t start = eva_time_real_now();
+    eva_tiles_draw(frame_fn, fb, damage);
+    eva_stats_add_frame_fn(eva_time_real_now() - start);
+
+    damage = eva_hash_damage(fb, damage);
+    eva_capture_frame(fb, damage);
+    return damage;
+}
+
+void eva_tiles_shutdown(void)
+{
+    if (!_pool.started) {
+        return;
+    }
+
+    eva_mutex_lock(&_pool.mutex);
+    _pool.quit = true;
+    eva_cond_broadcast(&_pool.work_cond);
+    eva_mutex_unlock(&_pool.mutex);
+
+    for (uint32_t i = 0; i < _pool.thread_count; i++) {
+        eva_thread_join(_pool.threads[i]);
+    }
+    free(_pool.threads);
+    _pool.threads      = NULL;
+    _pool.thread_count = 0;
+
+    eva_cond_destroy(&_pool.done_cond);
+    eva_cond_destroy(&_pool.work_cond);
+    eva_mutex_destroy(&_pool.mutex);
+    _pool.started = false;
+}
@@ -0,0 +1,374 @@
+#include "eva_internal.h"
+
+#include <stdlib.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Timers are kept in a hierarchical timing wheel. Time is cut into steps of
+// half a millisecond up to one. Each level of the wheel has EVA_TIMER_SLOTS
+// slots, a slot of level 0 is one step long and a slot of every other level
+// as long as a turn of the level below. A timer goes into the lowest level
+// whose turn reaches its deadline and moves down once the wheel gets to the
+// start of its slot, so setting and canceling a timer are O(1) and a timer
+// is moved at most EVA_TIMER_LEVELS - 1 times. Timers keep their exact
+// deadline, the wheel only decides when to look at them.
+#define EVA_TIMER_LEVEL_BITS 6
+#define EVA_TIMER_SLOTS      (1 << EVA_TIMER_LEVEL_BITS) // A bit each in a uint64_t
+#define EVA_TIMER_LEVELS     5
+
+// The wheel turns once in 2^30 steps, more than 6 days. Timers further out
+// wait in the last slot that is reached and go in again from there.
+#define EVA_TIMER_SPAN ((uint64_t)1 << (EVA_TIMER_LEVELS * EVA_TIMER_LEVEL_BITS))
+
+struct eva_timer {
+    eva_timer  *next;
+    eva_timer **link;  // The pointer to this timer, NULL while it isn't linked
+    uint8_t     level;
+    uint8_t     slot;
+
+    uint64_t     deadline; // eva_time_now() units
+    uint64_t     period;   // 0 for a one-shot timer
+    eva_timer_fn fn;
+    void        *userdata;
+};
+
+typedef struct eva_timers_ctx {
+    eva_timer *slots[EVA_TIMER_LEVELS][EVA_TIMER_SLOTS];
+    uint64_t   occupied[EVA_TIMER_LEVELS]; // A bit for each slot with timers
+    uint32_t   count;                      // Timers that weren't destroyed
+
+    uint64_t frequency; // eva_time_now() units per second, 0 until first used
+    uint32_t shift;     // A step is 2^shift eva_time_now() units
+    uint64_t step;      // The wheel has turned past all steps before this one
+
+    uint64_t next;       // Earliest deadline, UINT64_MAX without timers
+    bool     next_known; // Looked up again when false
+
+    eva_timer *firing;          // The timer whose callback runs
+    bool       firing_canceled; // It was canceled by its callback
+
+    void (*schedule_fn)(uint64_t deadline);
+} eva_timers_ctx;
+
+static eva_timers_ctx _timers;
+
+static uint32_t lowest_bit(uint64_t v)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, v);
+    return (uint32_t)index;
+#else
+    return (uint32_t)__builtin_ctzll(v);
+#endif
+}
+
+// The slots of a level that hold timers, rotated so that slot first is bit 0.
+static uint64_t occupied_from(uint32_t level, uint32_t first)
+{
+    uint64_t bits = _timers.occupied[level];
+    return first ? bits >> first | bits << (EVA_TIMER_SLOTS - first) : bits;
+}
+
+static void unlink_timer(eva_timer *timer)
+{
+    *timer->link = timer->next;
+    if (timer->next) {
+        timer->next->link = timer->link;
+    }
+    timer->link = NULL;
+
+    if (!_timers.slots[timer->level][timer->slot]) {
+        _timers.occupied[timer->level] &= ~((uint64_t)1 << timer->slot);
+    }
+}
+
+static void link_timer(eva_timer *timer)
+{
+    uint64_t due = timer->deadline >> _timers.shift;
+    if (due < _timers.step) {
+        due = _timers.step;
+    }
+    if (due - _timers.step >= EVA_TIMER_SPAN) {
+        due = _timers.step + EVA_TIMER_SPAN - 1;
+    }
+
+    uint32_t level = 0;
+    while (level + 1 < EVA_TIMER_LEVELS &&
+           due - _timers.step >= (uint64_t)1 << ((level + 1) * EVA_TIMER_LEVEL_BITS)) {
+        level++;
+    }
+    uint32_t slot = (uint32_t)(due >> (level * EVA_TIMER_LEVEL_BITS)) &
+                    (EVA_TIMER_SLOTS - 1);
+
+    eva_timer **head = &_timers.slots[level][slot];
+    timer->next  = *head;
+    timer->link  = head;
+    timer->level = (uint8_t)level;
+    timer->slot  = (uint8_t)slot;
+    if (*head) {
+        (*head)->link = &timer->next;
+    }
+    *head = timer;
+
+    _timers.occupied[level] |= (uint64_t)1 << slot;
+}
+
+// Takes the timers out of a slot. They can still be canceled while they are
+// on the returned list.
+static void take_slot(uint32_t level, uint32_t slot, eva_timer **list)
+{
+    *list = _timers.slots[level][slot];
+    _timers.slots[level][slot] = NULL;
+    _timers.occupied[level] &= ~((uint64_t)1 << slot);
+    if (*list) {
+        (*list)->link = list;
+    }
+}
+
+// The first step after the current one at which the wheel has something to
+// do: call the timers of a level 0 slot or move a slot of a higher level
+// down.
+static uint64_t next_step(void)
+{
+    uint64_t next = UINT64_MAX;
+    for (uint32_t level = 0; level < EVA_TIMER_LEVELS; level++) {
+        uint32_t shift = level * EVA_TIMER_LEVEL_BITS;
+        uint64_t first = (_timers.step >> shift) + 1;
+        uint64_t bits  = occupied_from(level, (uint32_t)first & (EVA_TIMER_SLOTS - 1));
+        if (bits) {
+            uint64_t step = (first + lowest_bit(bits)) << shift;
+            next = step < next ? step : next;
+        }
+    }
+    return next;
+}
+
+// Moves the slots that start at the current step down the wheel, top level
+// first as its timers may end up in the slot of the level below.
+static void cascade(void)
+{
+    for (uint32_t level = EVA_TIMER_LEVELS - 1; level > 0; level--) {
+        uint32_t shift = level * EVA_TIMER_LEVEL_BITS;
+        if (_timers.step & (((uint64_t)1 << shift) - 1)) {
+            continue;
+        }
+
+        eva_timer *list;
+        take_slot(level, (uint32_t)(_timers.step >> shift) & (EVA_TIMER_SLOTS - 1),
+                  &list);
+        while (list) {
+            eva_timer *timer = list;
+            unlink_timer(timer);
+            link_timer(timer);
+        }
+    }
+}
+
+static void call(eva_timer *timer, uint64_t now)
+{
+    _timers.firing          = timer;
+    _timers.firing_canceled = false;
+    timer->fn(timer, timer->userdata);
+    _timers.firing = NULL;
+
+    if (_timers.firing_canceled || timer->period == 0) {
+        free(timer);
+        _timers.count--;
+        return;
+    }
+
+    // Periods that were missed, e.g. while the application was busy, are
+    // skipped instead of calling the timer for each of them.
+    timer->deadline += timer->period;
+    if (timer->deadline <= now) {
+        timer->deadline += ((now - timer->deadline) / timer->period + 1) *
+                           timer->period;
+    }
+    link_timer(timer);
+}
+
+// Calls the timers of the current step that are due at now. Timers set by
+// the callbacks go into the slot again, even if they are due already.
+static void fire(uint64_t now)
+{
+    eva_timer *list;
+    take_slot(0, (uint32_t)_timers.step & (EVA_TIMER_SLOTS - 1), &list);
+    while (list) {
+        eva_timer *timer = list;
+        unlink_timer(timer);
+        if (timer->deadline > now) {
+            link_timer(timer);
+        } else {
+            call(timer, now);
+        }
+    }
+}
+
+static void init(void)
+{
+    if (_timers.frequency) {
+        return;
+    }
+
+    // Steps are the largest power of 2 that fits into a millisecond.
+    _timers.frequency = eva_time_frequency();
+    _timers.shift     = 0;
+    while (((uint64_t)2 << _timers.shift) <= _timers.frequency / 1000) {
+        _timers.shift++;
+    }
+    _timers.next       = UINT64_MAX;
+    _timers.next_known = true;
+}
+
+// Milliseconds in eva_time_now() units.
+static uint64_t ms_to_time(double ms)
+{
+    if (!(ms > 0.0)) {
+        return 0;
+    }
+    double time = ms * (double)_timers.frequency / 1000.0 + 0.5;
+    return time < (double)(UINT64_MAX / 2) ? (uint64_t)time : UINT64_MAX / 2;
+}
+
+eva_timer *eva_set_timer(double delay_ms, double period_ms, eva_timer_fn fn,
+                         void *userdata)
+{
+    init();
+
+    eva_timer *timer = calloc(1, sizeof(*timer));
+    if (!timer) {
+        return NULL;
+    }
+
+    uint64_t now = eva_time_now();
+    if (_timers.count == 0) {
+        // Nothing was left on the wheel to keep it turning.
+        _timers.step = now >> _timers.shift;
+    }
+    _timers.count++;
+
+    timer->deadline = now + ms_to_time(delay_ms);
+    timer->fn       = fn;
+    timer->userdata = userdata;
+    if (period_ms > 0.0) {
+        timer->period = ms_to_time(period_ms);
+        timer->period = timer->period ? timer->period : 1;
+    }
+    link_timer(timer);
+
+    if (_timers.next_known && timer->deadline < _timers.next) {
+        _timers.next = timer->deadline;
+        if (_timers.schedule_fn) {
+            _timers.schedule_fn(timer->deadline);
+        }
+    }
+    return timer;
+}
+
+void eva_cancel_timer(eva_timer *timer)
+{
+    if (!timer) {
+        return;
+    }
+    if (timer == _timers.firing) {
+        _timers.firing_canceled = true;
+        return;
+    }
+
+    if (timer->deadline == _timers.next) {
+        _timers.next_known = false;
+    }
+    unlink_timer(timer);
+    free(timer);
+    _timers.count--;
+}
+
+void eva_timers_set_schedule_fn(void (*schedule_fn)(uint64_t deadline))
+{
+    _timers.schedule_fn = schedule_fn;
+}
+
+uint64_t eva_timers_deadline(void)
+{
+    if (_timers.next_known) {
+        return _timers.next;
+    }
+
+    // Within a level the slots are in the order of their deadlines starting
+    // at the current step, so only the first slot with timers of each level
+    // has to be searched. Higher levels can hold earlier timers than lower
+    // ones, they were set before the wheel got closer to them.
+    uint64_t next = UINT64_MAX;
+    for (uint32_t level = 0; level < EVA_TIMER_LEVELS; level++) {
+        uint32_t shift = level * EVA_TIMER_LEVEL_BITS;
+        uint64_t first = (_timers.step >> shift) + (level ? 1 : 0);
+        uint64_t bits  = occupied_from(level, (uint32_t)first & (EVA_TIMER_SLOTS - 1));
+        if (!bits) {
+            continue;
+        }
+
+        uint64_t block = first + lowest_bit(bits);
+        if (((block << shift) << _timers.shift) >= next) {
+            continue;
+        }
+        for (eva_timer *timer = _timers.slots[level][block & (EVA_TIMER_SLOTS - 1)];
+             timer; timer = timer->next) {
+            next = timer->deadline < next ? timer->deadline : next;
+        }
+    }
+
+    _timers.next       = next;
+    _timers.next_known = true;
+    return next;
+}
+
+void eva_timers_run(uint64_t now)
+{
+    if (_timers.count == 0) {
+        return;
+    }
+
+    uint64_t now_step = now >> _timers.shift;
+    for (;;) {
+        fire(now);
+
+        // Timers the callbacks set that are due already are called by the
+        // next call, so one that keeps setting itself can't hold the event
+        // loop up.
+        uint64_t current = (uint64_t)1 << (_timers.step & (EVA_TIMER_SLOTS - 1));
+        if (_timers.step >= now_step || _timers.count == 0 ||
+            (_timers.occupied[0] & current)) {
+            break;
+        }
+
+        // Steps without anything to do are skipped, the wheel only stops
+        // where a slot has timers.
+        uint64_t step = next_step();
+        _timers.step = step < now_step ? step : now_step;
+        cascade();
+    }
+    _timers.next_known = false;
+}
+
+void eva_timers_shutdown(void)
+{
+    for (uint32_t level = 0; level < EVA_TIMER_LEVELS; level++) {
+        for (uint32_t slot = 0; slot < EVA_TIMER_SLOTS; slot++) {
+            eva_timer *timer = _timers.slots[level][slot];
+            while (timer) {
+                eva_timer *next = timer->next;
+                free(timer);
+                timer = next;
+            }
+            _timers.slots[level][slot] = NULL;
+        }
+        _timers.occupied[level] = 0;
+    }
+    _timers.count       = 0;
+    _timers.next        = UINT64_MAX;
+    _timers.next_known  = true;
+    _timers.schedule_fn = NULL;
+}
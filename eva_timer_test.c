@@ -0,0 +1,249 @@
+/**
+ * Checks the timing wheel on the virtual clock of the headless backend:
+ * timers of every level cascade down and fire in the order of their
+ * deadlines at exactly their time, eva_timers_deadline() finds the earliest
+ * timer whichever level it is on, and timers canceled while timers are
+ * firing are never called.
+ *
+ * Drives the wheel the way the event loop does, without eva_run(). Exits
+ * with 0 when every check passes.
+ *
+ * Usage: eva_timer_test
+ */
+
+#include "eva.h"
+#include "eva_headless.h"
+#include "eva_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TEST_MS         1000000ull // Virtual clock units per millisecond
+#define TEST_MAX_FIRES  64
+
+typedef struct test_timer {
+    const char *name;
+    double      delay_ms;
+    double      period_ms;
+    eva_timer  *timer;
+    eva_timer  *cancel;       // Canceled by this timer's callback
+    uint32_t    cancel_after; // Cancels itself on this call, 0 never
+    uint32_t    calls;
+} test_timer;
+
+typedef struct test_fire {
+    const char *name;
+    uint64_t    time;
+} test_fire;
+
+static test_fire _fires[TEST_MAX_FIRES];
+static uint32_t  _fire_count;
+static uint64_t  _base;
+static bool      _failed;
+
+static void fail(const char *message, const char *name, uint64_t time)
+{
+    fprintf(stderr, "%s: %s at %.3f ms\n", message, name,
+            (double)(time - _base) / TEST_MS);
+    _failed = true;
+}
+
+static void fired(eva_timer *timer, void *userdata)
+{
+    test_timer *t = userdata;
+    t->calls++;
+    if (_fire_count < TEST_MAX_FIRES) {
+        _fires[_fire_count].name = t->name;
+        _fires[_fire_count].time = eva_time_now();
+    }
+    _fire_count++;
+
+    if (t->cancel) {
+        eva_cancel_timer(t->cancel);
+        t->cancel = NULL;
+    }
+    if (t->calls == t->cancel_after) {
+        eva_cancel_timer(timer);
+    }
+}
+
+static void set_timers(test_timer *timers, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        timers[i].timer = eva_set_timer(timers[i].delay_ms, timers[i].period_ms,
+                                        fired, &timers[i]);
+    }
+}
+
+// Moves the virtual clock from one deadline to the next up to until and
+// calls the timers that are due, like the headless event loop does. A
+// deadline at which no timer is called would hang the loop.
+static void run_until(uint64_t until)
+{
+    for (;;) {
+        uint64_t due = eva_timers_deadline();
+        if (due == UINT64_MAX || due > until) {
+            break;
+        }
+        uint32_t fire_count = _fire_count;
+        eva_headless_set_time(due);
+        eva_timers_run(due);
+        if (_fire_count == fire_count && eva_timers_deadline() == due) {
+            fail("Nothing was called at the deadline", "", due);
+            break;
+        }
+    }
+    eva_headless_set_time(until);
+    eva_timers_run(until);
+}
+
+// Compares the timers called since the last check with the expected ones.
+static void check_fires(const test_fire *expected, uint32_t count)
+{
+    if (_fire_count != count) {
+        fprintf(stderr, "%u timers were called instead of %u\n", _fire_count,
+                count);
+        _failed = true;
+    }
+    for (uint32_t i = 0; i < count && i < _fire_count; i++) {
+        uint64_t time = _base + expected[i].time;
+        if (_fires[i].name != expected[i].name || _fires[i].time != time) {
+            fail("Expected", expected[i].name, time);
+            fail("Called", _fires[i].name, _fires[i].time);
+        }
+    }
+    _fire_count = 0;
+}
+
+static void check_deadline(uint64_t expected, const char *name)
+{
+    uint64_t deadline = eva_timers_deadline();
+    if (deadline != expected) {
+        fail("Deadline isn't the one of", name, deadline);
+    }
+}
+
+// Timers on every level of the wheel, set out of order, move down level by
+// level and fire in the order of their deadlines.
+static void check_cascade(void)
+{
+    _base = eva_time_now();
+    static test_timer timers[] = {
+        { .name = "level 4",   .delay_ms = 3.0 * 3600.0 * 1000.0 },
+        { .name = "level 2",   .delay_ms = 3000.0 },
+        { .name = "level 3",   .delay_ms = 200000.0 },
+        { .name = "level 0",   .delay_ms = 1.0 },
+        { .name = "level 2+1", .delay_ms = 3001.0 },
+        { .name = "past span", .delay_ms = 7.0 * 24.0 * 3600.0 * 1000.0 },
+        { .name = "level 1",   .delay_ms = 50.0 },
+        { .name = "level 3+5", .delay_ms = 200005.0 },
+        { .name = "level 4+1", .delay_ms = 3.0 * 3600.0 * 1000.0 + 1.0 },
+    };
+    set_timers(timers, sizeof(timers) / sizeof(timers[0]));
+    check_deadline(_base + TEST_MS, timers[3].name);
+
+    run_until(_base + 8ull * 24 * 3600 * 1000 * TEST_MS);
+    const test_fire expected[] = {
+        { timers[3].name, 1 * TEST_MS },
+        { timers[6].name, 50 * TEST_MS },
+        { timers[1].name, 3000 * TEST_MS },
+        { timers[4].name, 3001 * TEST_MS },
+        { timers[2].name, 200000 * TEST_MS },
+        { timers[7].name, 200005 * TEST_MS },
+        { timers[0].name, 3ull * 3600 * 1000 * TEST_MS },
+        { timers[8].name, (3ull * 3600 * 1000 + 1) * TEST_MS },
+        { timers[5].name, 7ull * 24 * 3600 * 1000 * TEST_MS },
+    };
+    check_fires(expected, sizeof(expected) / sizeof(expected[0]));
+    check_deadline(UINT64_MAX, "no timer");
+}
+
+// A timer set long before it is due can be on a higher level of the wheel
+// than one set later that is due after it, eva_timers_deadline() finds it
+// there. Steps are 2^19 ns, the wheel starts on a level 2 slot so that early
+// goes into the next slot of level 2, 4096 steps in, and stays there while
+// late goes into level 1.
+static void check_deadline_levels(void)
+{
+    uint64_t level_2_slot = (uint64_t)1 << (19 + 2 * 6);
+    _base = (eva_time_now() / level_2_slot + 1) * level_2_slot;
+    eva_headless_set_time(_base);
+
+    static test_timer early = { .name = "set early", .delay_ms = 2153.0 };
+    static test_timer tick  = { .name = "tick",      .delay_ms = 2096.0 };
+    set_timers(&early, 1);
+    set_timers(&tick, 1);
+    check_deadline(_base + 2096 * TEST_MS, tick.name);
+
+    run_until(_base + 2096 * TEST_MS);
+    static test_timer late = { .name = "set late", .delay_ms = 87.0 };
+    set_timers(&late, 1);
+    check_deadline(_base + 2153 * TEST_MS, early.name);
+
+    run_until(_base + 3000 * TEST_MS);
+    const test_fire expected[] = {
+        { tick.name,  2096 * TEST_MS },
+        { early.name, 2153 * TEST_MS },
+        { late.name,  2183 * TEST_MS },
+    };
+    check_fires(expected, sizeof(expected) / sizeof(expected[0]));
+}
+
+// Timers canceled by a callback, while the timers of their slot are being
+// called or before the wheel gets to them, are never called.
+static void check_cancel_while_firing(void)
+{
+    _base = eva_time_now();
+    static test_timer timers[] = {
+        { .name = "first",         .delay_ms = 10.0 },
+        { .name = "second",        .delay_ms = 10.0 },
+        { .name = "cancels later", .delay_ms = 30.0 },
+        { .name = "later",         .delay_ms = 40.0 },
+        { .name = "cancels far",   .delay_ms = 35.0 },
+        { .name = "far",           .delay_ms = 5000.0 },
+        { .name = "periodic",      .delay_ms = 6.0, .period_ms = 5.0,
+          .cancel_after = 3 },
+    };
+    set_timers(timers, sizeof(timers) / sizeof(timers[0]));
+
+    // Whichever of first and second is called first cancels the other, both
+    // are in the same slot. Later is on level 1 and far on level 2.
+    timers[0].cancel = timers[1].timer;
+    timers[1].cancel = timers[0].timer;
+    timers[2].cancel = timers[3].timer;
+    timers[4].cancel = timers[5].timer;
+
+    run_until(_base + 10000 * TEST_MS);
+    if (timers[0].calls + timers[1].calls != 1) {
+        fail("Both timers of a slot were called", timers[1].name,
+             _base + 10 * TEST_MS);
+    }
+
+    const test_fire expected[] = {
+        { timers[6].name, 6 * TEST_MS },
+        { timers[0].calls ? timers[0].name : timers[1].name, 10 * TEST_MS },
+        { timers[6].name, 11 * TEST_MS },
+        { timers[6].name, 16 * TEST_MS },
+        { timers[2].name, 30 * TEST_MS },
+        { timers[4].name, 35 * TEST_MS },
+    };
+    check_fires(expected, sizeof(expected) / sizeof(expected[0]));
+    check_deadline(UINT64_MAX, "no timer");
+}
+
+int main(void)
+{
+    eva_headless_set_clock(EVA_HEADLESS_CLOCK_VIRTUAL);
+    eva_headless_set_time(1000 * TEST_MS);
+
+    check_cascade();
+    check_deadline_levels();
+    check_cancel_while_firing();
+    eva_timers_shutdown();
+
+    if (_failed) {
+        return 1;
+    }
+    printf("Timers fired in order\n");
+    return 0;
+}
@@ -0,0 +1,338 @@
+#include "eva_trace.h"
+#include "eva_internal.h"
+#include "eva_thread.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86) || defined(_M_ARM64))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Zones nested deeper than this are counted but never recorded.
+#define EVA_TRACE_MAX_DEPTH 64
+
+// A begin of a zone, or an end when name is NULL.
+typedef struct eva_trace_event {
+    volatile uint64_t time; // In ticks, see read_ticks()
+    void    *volatile name;
+} eva_trace_event;
+
+// Only the thread that owns a ring writes to it. It publishes every event by
+// moving head past it, eva_trace_write() copies the events behind head and
+// drops the ones that were overwritten while it did.
+typedef struct eva_trace_ring {
+    eva_trace_event   events[EVA_TRACE_RING_SIZE];
+    volatile uint32_t head;     // Events recorded, wraps around
+    uint32_t          start;    // Head when the thread took the ring over
+    uint32_t          open;     // Zones begun and not ended yet, recorded or not
+    uint64_t          recorded; // Bit per open zone whose begin was recorded
+
+    uint32_t    id;    // The thread id in traces
+    const char *name;
+    bool        owned; // False once the thread is done, the ring is reused
+
+    struct eva_trace_ring *next;
+} eva_trace_ring;
+
+typedef struct eva_trace_ctx {
+    volatile uint32_t active;
+    uint64_t          start_ticks;
+    uint64_t          start_ns; // Of clock_ns(), to calibrate the ticks
+
+    // Guards the list of rings, which only grows while eva runs.
+    eva_mutex       mutex;
+    bool            mutex_initialized;
+    eva_trace_ring *rings;
+    uint32_t        ring_count;
+} eva_trace_ctx;
+
+static eva_trace_ctx _trace;
+
+static EVA_THREAD_LOCAL eva_trace_ring *_ring;
+static EVA_THREAD_LOCAL const char     *_thread_name;
+
+// Monotonic wall clock time in nanoseconds. eva_time_now() can't be used to
+// calibrate the ticks, the headless backend may run it on a virtual clock.
+static uint64_t clock_ns(void)
+{
+#if defined(_WIN32)
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// The constant rate counter of the CPU, which is read in a few cycles
+// instead of the tens of nanoseconds a clock call takes. Converted to time
+// once the trace is written.
+static inline uint64_t read_ticks(void)
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    return __rdtsc();
+#elif defined(_MSC_VER) && defined(_M_ARM64)
+    return (uint64_t)_ReadStatusReg(ARM64_CNTVCT);
+#elif defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    return clock_ns();
+#endif
+}
+
+// The ring of a thread that recorded nothing so far, a ring of a thread that
+// is done when there is one.
+static eva_trace_ring *acquire_ring(void)
+{
+    eva_mutex_lock(&_trace.mutex);
+    eva_trace_ring *ring = _trace.rings;
+    while (ring && ring->owned) {
+        ring = ring->next;
+    }
+    if (!ring) {
+        ring = calloc(1, sizeof(*ring));
+        if (ring) {
+            ring->id     = ++_trace.ring_count;
+            ring->next   = _trace.rings;
+            _trace.rings = ring;
+        }
+    }
+    if (ring) {
+        // The events of the thread that had the ring before aren't written
+        // under the name of this one.
+        ring->owned = true;
+        ring->start = ring->head;
+        ring->open     = 0;
+        ring->recorded = 0;
+        ring->name     = _thread_name;
+    }
+    eva_mutex_unlock(&_trace.mutex);
+
+    _ring = ring;
+    return ring;
+}
+
+static void record(eva_trace_ring *ring, const char *name)
+{
+    uint32_t head = ring->head;
+    eva_trace_event *event = &ring->events[head & (EVA_TRACE_RING_SIZE - 1)];
+
+    // The event overwrites the oldest one, readers have to see the head that
+    // drops it before they can see any of the new event. Free on x86.
+    eva_atomic_fence_release();
+    eva_atomic_store_relaxed_u64(&event->time, read_ticks());
+    eva_atomic_store_relaxed_ptr(&event->name, (void *)name);
+    eva_atomic_store_u32(&ring->head, head + 1);
+}
+
+void eva_trace_begin(const char *name)
+{
+    // Once a thread has a ring, zones begun while tracing is stopped are
+    // counted as well so their ends don't close a zone that was recorded.
+    bool active = eva_atomic_load_relaxed_u32(&_trace.active) != 0;
+    eva_trace_ring *ring = _ring;
+    if (!ring) {
+        if (!active) {
+            return;
+        }
+        ring = acquire_ring();
+        if (!ring) {
+            return;
+        }
+    }
+
+    uint32_t depth = ring->open++;
+    if (depth >= EVA_TRACE_MAX_DEPTH) {
+        return;
+    }
+    uint64_t bit = (uint64_t)1 << depth;
+    if (active) {
+        ring->recorded |= bit;
+        record(ring, name);
+    } else {
+        ring->recorded &= ~bit;
+    }
+}
+
+void eva_trace_end(void)
+{
+    // Zones begun while tracing are ended even once it stopped. Ends of
+    // zones begun before the ring existed find no zone open.
+    eva_trace_ring *ring = _ring;
+    if (!ring || !ring->open) {
+        return;
+    }
+
+    uint32_t depth = --ring->open;
+    if (depth < EVA_TRACE_MAX_DEPTH && (ring->recorded >> depth & 1)) {
+        record(ring, NULL);
+    }
+}
+
+void eva_trace_start(void)
+{
+    if (!_trace.mutex_initialized) {
+        eva_mutex_init(&_trace.mutex);
+        _trace.mutex_initialized = true;
+    }
+    _trace.start_ns    = clock_ns();
+    _trace.start_ticks = read_ticks();
+    eva_atomic_store_u32(&_trace.active, 1);
+}
+
+void eva_trace_stop(void)
+{
+    eva_atomic_store_u32(&_trace.active, 0);
+}
+
+void eva_trace_set_thread_name(const char *name)
+{
+    _thread_name = name;
+    if (_ring) {
+        eva_mutex_lock(&_trace.mutex);
+        _ring->name = name;
+        eva_mutex_unlock(&_trace.mutex);
+    }
+}
+
+void eva_trace_thread_exit(void)
+{
+    if (_ring) {
+        eva_mutex_lock(&_trace.mutex);
+        _ring->owned = false;
+        eva_mutex_unlock(&_trace.mutex);
+        _ring = NULL;
+    }
+    _thread_name = NULL;
+}
+
+// Writes a string as a JSON string.
+static void write_string(FILE *file, const char *s)
+{
+    fputc('"', file);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fprintf(file, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(file, "\\u%04x", c);
+        } else {
+            fputc(c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+// Writes the events of one ring, returns the number written.
+static uint32_t write_ring(FILE *file, eva_trace_ring *ring,
+                           eva_trace_event *copy, double us_per_tick,
+                           bool comma)
+{
+    uint32_t written = 0;
+
+    if (ring->name) {
+        fprintf(file, "%s{\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+                "\"name\":\"thread_name\",\"args\":{\"name\":",
+                comma ? ",\n" : "", ring->id);
+        write_string(file, ring->name);
+        fprintf(file, "}}");
+        comma = true;
+        written++;
+    }
+
+    uint32_t head  = eva_atomic_load_u32(&ring->head);
+    uint32_t count = head - ring->start;
+    count = count < EVA_TRACE_RING_SIZE ? count : EVA_TRACE_RING_SIZE;
+    uint32_t first = head - count;
+    for (uint32_t i = 0; i < count; i++) {
+        eva_trace_event *event = &ring->events[(first + i) & (EVA_TRACE_RING_SIZE - 1)];
+        copy[i].time = eva_atomic_load_relaxed_u64(&event->time);
+        copy[i].name = eva_atomic_load_relaxed_ptr(&event->name);
+    }
+
+    // The thread may have written over the oldest events in the meantime,
+    // including the one after the new head it is writing right now.
+    eva_atomic_fence_acquire();
+    uint32_t after = eva_atomic_load_u32(&ring->head);
+    uint32_t skip  = 0;
+    if (after - first >= EVA_TRACE_RING_SIZE) {
+        skip = after - first - EVA_TRACE_RING_SIZE + 1;
+        skip = skip < count ? skip : count;
+    }
+
+    // Ends whose begin was overwritten or recorded before the trace started
+    // are dropped so every zone that is written is complete.
+    uint32_t depth = 0;
+    for (uint32_t i = skip; i < count; i++) {
+        const eva_trace_event *event = &copy[i];
+        if (event->time < _trace.start_ticks || (!event->name && depth == 0)) {
+            continue;
+        }
+        double ts = (double)(event->time - _trace.start_ticks) * us_per_tick;
+
+        if (event->name) {
+            fprintf(file, "%s{\"ph\":\"B\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"name\":",
+                    comma ? ",\n" : "", ring->id, ts);
+            write_string(file, event->name);
+            fputc('}', file);
+            depth++;
+        } else {
+            fprintf(file, "%s{\"ph\":\"E\",\"pid\":1,\"tid\":%u,\"ts\":%.3f}",
+                    comma ? ",\n" : "", ring->id, ts);
+            depth--;
+        }
+        comma = true;
+        written++;
+    }
+    return written;
+}
+
+bool eva_trace_write(const char *path)
+{
+    if (!_trace.mutex_initialized) {
+        return false;
+    }
+
+    eva_trace_event *copy = malloc(sizeof(eva_trace_event) * EVA_TRACE_RING_SIZE);
+    FILE *file = copy ? fopen(path, "w") : NULL;
+    if (!file) {
+        free(copy);
+        return false;
+    }
+
+    // The rate of the ticks is measured against the clock since the trace
+    // started, over at least 10 ms.
+    uint64_t ns, ticks;
+    do {
+        ns    = clock_ns();
+        ticks = read_ticks();
+    } while (ns - _trace.start_ns < 10000000u);
+    double us_per_tick = ticks > _trace.start_ticks ?
+                         (double)(ns - _trace.start_ns) / 1000.0 /
+                         (double)(ticks - _trace.start_ticks) : 0.0;
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    uint32_t written = 0;
+    eva_mutex_lock(&_trace.mutex);
+    for (eva_trace_ring *ring = _trace.rings; ring; ring = ring->next) {
+        written += write_ring(file, ring, copy, us_per_tick, written != 0);
+    }
+    eva_mutex_unlock(&_trace.mutex);
+    fprintf(file, "\n]}\n");
+
+    free(copy);
+    bool ok = !ferror(file);
+    return fclose(file) == 0 && ok;
+}
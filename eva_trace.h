@@ -0,0 +1,100 @@
+#pragma once
+
+/**
+ * A trace profiler for finding out where the time of a frame went.
+ *
+ * Zones of code are marked with EVA_TRACE_BEGIN() and EVA_TRACE_END(). While
+ * tracing is [started](@ref eva_trace_start) every thread records its zones
+ * into a ring buffer of its own that keeps the last EVA_TRACE_RING_SIZE
+ * begins and ends, so a trace can be saved with eva_trace_write() whenever
+ * something interesting happened, e.g. right after a frame took too long.
+ * Traces are written in the Chrome trace event format, which
+ * chrome://tracing and https://ui.perfetto.dev open.
+ *
+ * eva marks its own phases the same way: event dispatch, try_frame, the
+ * frame function and its tiles, present and framebuffer reallocations.
+ *
+ * Recording the begin or the end of a zone reads the cycle counter of the
+ * CPU and takes a few stores into the ring of the thread, without locks.
+ * The counter is converted to time when the trace is written, in
+ * microseconds since eva_trace_start(). While tracing is
+ * stopped a zone only loads a flag and, on threads that recorded before,
+ * keeps count of how deeply zones are nested. Defining EVA_TRACE_DISABLED
+ * compiles the zones of a file out entirely.
+ */
+
+#include "eva.h"
+
+/**
+ * @brief Begins and ends of zones each thread keeps.
+ *
+ * @ingroup trace
+ */
+#define EVA_TRACE_RING_SIZE 32768
+
+#if defined(EVA_TRACE_DISABLED)
+#define EVA_TRACE_BEGIN(name) ((void)0)
+#define EVA_TRACE_END()       ((void)0)
+#else
+
+/**
+ * @brief Begin a zone called name on the calling thread.
+ *
+ * Zones nest and have to be ended on the thread they were begun on. The name
+ * is kept by pointer, it has to stay valid until the trace is written, e.g.
+ * a string literal.
+ *
+ * @ingroup trace
+ */
+#define EVA_TRACE_BEGIN(name) eva_trace_begin(name)
+
+/**
+ * @brief End the zone begun last on the calling thread.
+ *
+ * @ingroup trace
+ */
+#define EVA_TRACE_END() eva_trace_end()
+
+#endif
+
+/**
+ * @brief Start recording zones.
+ *
+ * Only zones begun from here on are written to a trace.
+ *
+ * @ingroup trace
+ */
+void eva_trace_start(void);
+
+/**
+ * @brief Stop recording zones. Zones that were begun are still ended.
+ *
+ * @ingroup trace
+ */
+void eva_trace_stop(void);
+
+/**
+ * @brief Write the zones the threads recorded since eva_trace_start() to a
+ * Chrome trace JSON file.
+ *
+ * Can be called from any thread while tracing, the threads keep recording.
+ * Zones that are still open are written without an end.
+ *
+ * @return false if the file could not be written.
+ *
+ * @ingroup trace
+ */
+bool eva_trace_write(const char *path);
+
+/**
+ * @brief Name the calling thread in traces.
+ *
+ * The name is kept by pointer like zone names. Threads without a name show
+ * up by number.
+ *
+ * @ingroup trace
+ */
+void eva_trace_set_thread_name(const char *name);
+
+void eva_trace_begin(const char *name);
+void eva_trace_end(void);
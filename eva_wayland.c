@@ -0,0 +1,1526 @@
+#define _GNU_SOURCE // memfd_create, ppoll, pipe2, MADV_HUGEPAGE
+
+#include "eva.h"
+#include "eva_internal.h"
+#include "eva_trace.h"
+
+#include <wayland-client.h>
+#include <xkbcommon/xkbcommon.h>
+#include "xdg-shell-client-protocol.h"
+
+#include <linux/input-event-codes.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define EVA_DEFAULT_REFRESH_RATE 60
+
+static void update_window(void);
+static bool create_pool(void);
+static void destroy_pool(void);
+static void handle_close(void);
+static bool try_frame(void);
+static bool frame_ready(void);
+static int wait_for_events(void);
+static void draw_frame(void);
+static void submit_frame(void);
+static void wake_event_loop(void);
+static eva_key translate_key(uint32_t key);
+static eva_mod_flags translate_mod_flags(void);
+static void init_key_tables(void);
+
+#define EVA_MAX_WL_BUFFERS 2
+#define EVA_MAX_WL_OUTPUTS 8
+
+// One buffer of the shm pool. The compositor owns the buffer from the moment
+// it is committed until it sends the release event, eva never writes into it
+// in between.
+typedef struct eva_wl_buffer {
+    struct wl_buffer *buffer;
+    eva_pixel        *pixels;
+    uint32_t          w, h;
+    eva_rect          stale; // Changed since this buffer was last presented
+    bool              busy;
+} eva_wl_buffer;
+
+typedef struct eva_wl_output {
+    struct wl_output *output;
+    int32_t           scale;
+    uint32_t          w, h;
+    uint32_t          refresh; // mHz, 0 if unknown
+} eva_wl_output;
+
+typedef struct eva_ctx {
+    eva_framebuffer framebuffer;
+    uint32_t window_width, window_height;
+
+    const char *window_title;
+    bool        quit_requested;
+    bool        quit_ordered;
+
+    eva_init_fn        init_fn;
+    eva_frame_fn       frame_fn;
+    eva_cleanup_fn     cleanup_fn;
+    eva_cancel_quit_fn cancel_quit_fn;
+    eva_fail_fn        fail_fn;
+
+    eva_mouse_moved_fn   mouse_moved_fn;
+    eva_mouse_btn_fn     mouse_btn_fn;
+    eva_scroll_fn        scroll_fn;
+    eva_key_fn           key_fn;
+    int16_t              keycodes[256];
+    eva_window_resize_fn window_resize_fn;
+
+    struct wl_display    *display;
+    struct wl_registry   *registry;
+    struct wl_compositor *compositor;
+    struct wl_shm        *shm;
+    struct wl_seat       *seat;
+    struct wl_pointer    *pointer;
+    struct wl_keyboard   *keyboard;
+    struct xdg_wm_base   *wm_base;
+    struct wl_surface    *surface;
+    struct xdg_surface   *xdg_surface;
+    struct xdg_toplevel  *xdg_toplevel;
+
+    eva_wl_output outputs[EVA_MAX_WL_OUTPUTS];
+    uint32_t      output_count;
+    int32_t       scale;
+
+    struct xkb_context *xkb_context;
+    struct xkb_keymap  *xkb_keymap;
+    struct xkb_state   *xkb_state;
+
+    double mouse_x, mouse_y;
+
+    // Buffer release events are dispatched on their own queue so eva can
+    // block on them without dispatching input events in the middle of a
+    // frame. This is the Wayland equivalent of the Metal semaphore.
+    struct wl_event_queue *buffer_queue;
+    struct wl_shm_pool    *pool;
+    eva_pixel             *pool_data;
+    size_t                 pool_size;
+    eva_wl_buffer          buffers[EVA_MAX_WL_BUFFERS];
+    eva_wl_buffer         *front; // Most recently committed buffer
+    eva_wl_buffer         *back;  // Brought up to date for the next frame
+
+    // Frames are only drawn when the compositor signals it is ready for
+    // one, requests made in between are folded into the next frame.
+    struct wl_callback *frame_callback;
+
+    eva_rect damage; // Union of the rects requested for the next frame
+
+    bool configured;
+    bool request_frame;
+    bool coalesce_frames;
+
+    eva_frame_pacer pacer;
+
+    // The pipeline render thread writes to the pipe once a frame is ready.
+    int wake_fds[2];
+} eva_ctx;
+
+static eva_ctx _ctx;
+
+static eva_wl_buffer *prepare_buffer(void);
+
+static const struct wl_registry_listener     registry_listener;
+static const struct wl_output_listener       output_listener;
+static const struct wl_surface_listener      surface_listener;
+static const struct wl_seat_listener         seat_listener;
+static const struct wl_pointer_listener      pointer_listener;
+static const struct wl_keyboard_listener     keyboard_listener;
+static const struct wl_buffer_listener       buffer_listener;
+static const struct wl_callback_listener     frame_listener;
+static const struct xdg_wm_base_listener     wm_base_listener;
+static const struct xdg_surface_listener     xdg_surface_listener;
+static const struct xdg_toplevel_listener    xdg_toplevel_listener;
+
+void eva_run(const char     *window_title,
+             eva_frame_fn    frame_fn,
+             eva_fail_fn     fail_fn)
+{
+    assert(window_title);
+    assert(frame_fn);
+    assert(fail_fn);
+
+    eva_time_init();
+    eva_trace_set_thread_name("eva event loop");
+
+    _ctx.window_title = window_title;
+    _ctx.frame_fn     = frame_fn;
+    _ctx.fail_fn      = fail_fn;
+    _ctx.scale        = 1;
+
+    init_key_tables();
+
+    _ctx.display = wl_display_connect(NULL);
+    if (_ctx.display == NULL) {
+        _ctx.fail_fn(0, "Failed to connect to wayland display");
+        return;
+    }
+
+    _ctx.buffer_queue = wl_display_create_queue(_ctx.display);
+    _ctx.xkb_context  = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+
+    _ctx.registry = wl_display_get_registry(_ctx.display);
+    wl_registry_add_listener(_ctx.registry, &registry_listener, NULL);
+
+    // First roundtrip binds the globals, the second receives the initial
+    // output modes and scales.
+    wl_display_roundtrip(_ctx.display);
+    wl_display_roundtrip(_ctx.display);
+
+    if (!_ctx.compositor || !_ctx.shm || !_ctx.wm_base) {
+        _ctx.fail_fn(0, "Wayland compositor is missing required globals");
+        wl_display_disconnect(_ctx.display);
+        return;
+    }
+
+    _ctx.surface = wl_compositor_create_surface(_ctx.compositor);
+    wl_surface_add_listener(_ctx.surface, &surface_listener, NULL);
+
+    _ctx.xdg_surface = xdg_wm_base_get_xdg_surface(_ctx.wm_base, _ctx.surface);
+    xdg_surface_add_listener(_ctx.xdg_surface, &xdg_surface_listener, NULL);
+
+    _ctx.xdg_toplevel = xdg_surface_get_toplevel(_ctx.xdg_surface);
+    xdg_toplevel_add_listener(_ctx.xdg_toplevel, &xdg_toplevel_listener, NULL);
+    xdg_toplevel_set_title(_ctx.xdg_toplevel, window_title);
+    xdg_toplevel_set_app_id(_ctx.xdg_toplevel, window_title);
+
+    // Until the compositor suggests a size use 80% of the screen, the same
+    // as the other backends.
+    uint32_t screen_w = 1280;
+    uint32_t screen_h = 720;
+    if (_ctx.output_count > 0 && _ctx.outputs[0].w && _ctx.outputs[0].h) {
+        screen_w = _ctx.outputs[0].w / (uint32_t)_ctx.outputs[0].scale;
+        screen_h = _ctx.outputs[0].h / (uint32_t)_ctx.outputs[0].scale;
+    }
+    _ctx.window_width  = (uint32_t)(screen_w * 0.8f);
+    _ctx.window_height = (uint32_t)(screen_h * 0.8f);
+
+    update_window();
+    if (_ctx.framebuffer.pixels == NULL) {
+        _ctx.fail_fn(0, "Failed to create wayland shm pool");
+        return;
+    }
+
+    _ctx.wake_fds[0] = -1;
+    _ctx.wake_fds[1] = -1;
+    if (pipe2(_ctx.wake_fds, O_NONBLOCK | O_CLOEXEC) != 0) {
+        _ctx.wake_fds[0] = -1;
+        _ctx.wake_fds[1] = -1;
+    }
+    eva_post_start(_ctx.wake_fds[1] != -1 ? wake_event_loop : NULL);
+
+    eva_stats_reset();
+    if (_ctx.init_fn) {
+        _ctx.init_fn();
+    }
+
+    // The first frame is drawn in response to the initial configure. Commit
+    // without a buffer to ask the compositor for it.
+    _ctx.request_frame = true;
+    wl_surface_commit(_ctx.surface);
+
+    pacer_set_refresh(&_ctx.pacer, 1000000000ull,
+                      1000000000ull / EVA_DEFAULT_REFRESH_RATE);
+
+    if (_ctx.wake_fds[1] != -1) {
+        eva_pipeline_start(wake_event_loop);
+    }
+
+    while (!_ctx.quit_ordered) {
+        if (wait_for_events() == -1) {
+            break;
+        }
+        eva_post_dispatch();
+        eva_timers_run(eva_time_now());
+
+        eva_frame_idle(&_ctx.pacer, _ctx.request_frame);
+
+        // Present what the render thread finished, then render a frame
+        // that was requested while it was busy, by a posted event or by a
+        // timer.
+        if (eva_pipeline_enabled() && frame_ready()) {
+            draw_frame();
+        }
+        try_frame();
+
+        // Every event read from the compositor has been handled, draw one
+        // frame for all of them.
+        uint64_t due = pacer_deadline(&_ctx.pacer, _ctx.coalesce_frames,
+                                      _ctx.request_frame);
+        if (!_ctx.quit_ordered && eva_time_now() >= due) {
+            eva_frame_continuous(&_ctx.pacer, &_ctx.request_frame,
+                                 &_ctx.damage);
+            if (eva_pipeline_enabled()) {
+                submit_frame();
+            } else if (frame_ready()) {
+                draw_frame();
+            }
+        }
+    }
+
+    eva_pipeline_shutdown();
+    eva_post_stop();
+    if (_ctx.wake_fds[0] != -1) {
+        close(_ctx.wake_fds[0]);
+        close(_ctx.wake_fds[1]);
+    }
+
+    if (_ctx.cleanup_fn) {
+        _ctx.cleanup_fn();
+    }
+    eva_modules_shutdown();
+
+    if (_ctx.frame_callback) {
+        wl_callback_destroy(_ctx.frame_callback);
+    }
+    destroy_pool();
+
+    if (_ctx.keyboard)     wl_keyboard_destroy(_ctx.keyboard);
+    if (_ctx.pointer)      wl_pointer_destroy(_ctx.pointer);
+    if (_ctx.xkb_state)    xkb_state_unref(_ctx.xkb_state);
+    if (_ctx.xkb_keymap)   xkb_keymap_unref(_ctx.xkb_keymap);
+    xkb_context_unref(_ctx.xkb_context);
+
+    xdg_toplevel_destroy(_ctx.xdg_toplevel);
+    xdg_surface_destroy(_ctx.xdg_surface);
+    wl_surface_destroy(_ctx.surface);
+    wl_event_queue_destroy(_ctx.buffer_queue);
+    wl_display_disconnect(_ctx.display);
+}
+
+void eva_request_frame(void)
+{
+    if (eva_frame_requested(EVA_RECT_FULL, _ctx.request_frame)) {
+        _ctx.request_frame = true;
+        _ctx.damage = EVA_RECT_FULL;
+    }
+}
+
+void eva_request_frame_rect(int32_t x, int32_t y, int32_t w, int32_t h)
+{
+    eva_rect rect = { x, y, w, h };
+    if (eva_frame_requested(rect, _ctx.request_frame)) {
+        _ctx.request_frame = true;
+        _ctx.damage = rect_union(_ctx.damage, rect);
+    }
+}
+
+eva_rect eva_scroll_region(eva_rect rect, int32_t dx, int32_t dy)
+{
+    // The compositor can't move what it shows, the whole rectangle is
+    // uploaded again. The pixels are moved in the buffer of the next frame,
+    // the last one committed may still be read by the compositor.
+    rect = rect_clip(rect, _ctx.framebuffer.w, _ctx.framebuffer.h);
+    eva_rect exposed = rect;
+    if (!eva_pipeline_enabled() && !rect_is_empty(rect) && prepare_buffer()) {
+        exposed = eva_format_scroll(&_ctx.framebuffer, rect, dx, dy);
+    }
+    eva_request_frame_rect(rect.x, rect.y, rect.w, rect.h);
+    return exposed;
+}
+
+uint32_t eva_get_window_width(void)
+{
+    return _ctx.window_width;
+}
+
+uint32_t eva_get_window_height(void)
+{
+    return _ctx.window_height;
+}
+
+eva_framebuffer eva_get_framebuffer(void)
+{
+    // Applications may draw into it outside of the frame callback, which
+    // has to go into the buffer of the next frame like a scroll does.
+    if (_ctx.pool) {
+        prepare_buffer();
+    }
+    return eva_format_view(&_ctx.framebuffer);
+}
+
+void eva_set_coalesce_frames(bool coalesce)
+{
+    _ctx.coalesce_frames = coalesce;
+}
+
+void eva_set_frame_rate(uint32_t hz)
+{
+    pacer_set_rate(&_ctx.pacer, hz);
+}
+
+eva_frame_timing eva_get_frame_timing(void)
+{
+    return _ctx.pacer.timing;
+}
+
+void eva_set_init_fn(eva_init_fn init_fn)
+{
+    _ctx.init_fn = init_fn;
+}
+
+void eva_set_cleanup_fn(eva_cleanup_fn cleanup_fn)
+{
+    _ctx.cleanup_fn = cleanup_fn;
+}
+
+void eva_set_cancel_quit_fn(eva_cancel_quit_fn cancel_quit_fn)
+{
+    _ctx.cancel_quit_fn = cancel_quit_fn;
+}
+
+void eva_set_mouse_moved_fn(eva_mouse_moved_fn mouse_moved_fn)
+{
+    _ctx.mouse_moved_fn = mouse_moved_fn;
+}
+
+void eva_set_mouse_btn_fn(eva_mouse_btn_fn mouse_btn_fn)
+{
+    _ctx.mouse_btn_fn = mouse_btn_fn;
+}
+
+void eva_set_scroll_fn(eva_scroll_fn scroll_fn)
+{
+    _ctx.scroll_fn = scroll_fn;
+}
+
+void eva_set_key_fn(eva_key_fn key_fn)
+{
+    _ctx.key_fn = key_fn;
+}
+
+void eva_set_window_resize_fn(eva_window_resize_fn window_resize_fn)
+{
+    _ctx.window_resize_fn = window_resize_fn;
+}
+
+static void update_window(void)
+{
+    _ctx.framebuffer.w = _ctx.window_width  * (uint32_t)_ctx.scale;
+    _ctx.framebuffer.h = _ctx.window_height * (uint32_t)_ctx.scale;
+
+    _ctx.framebuffer.scale_x = (float)_ctx.scale;
+    _ctx.framebuffer.scale_y = (float)_ctx.scale;
+
+    uint32_t capacity = _ctx.framebuffer.pitch * _ctx.framebuffer.max_height;
+    if (capacity == 0 ||
+        _ctx.framebuffer.w > _ctx.framebuffer.pitch ||
+        _ctx.framebuffer.h > _ctx.framebuffer.max_height) {
+        EVA_TRACE_BEGIN("update_window");
+
+        destroy_pool();
+
+        // Make the buffers large enough to hold pixels for the largest
+        // output. This makes it unnecessary to reallocate the pool when the
+        // window is resized. It should only need to be resized when moving
+        // to a higher resolution output.
+        uint32_t screen_w = 0;
+        uint32_t screen_h = 0;
+        for (uint32_t i = 0; i < _ctx.output_count; i++) {
+            if (_ctx.outputs[i].w > screen_w) screen_w = _ctx.outputs[i].w;
+            if (_ctx.outputs[i].h > screen_h) screen_h = _ctx.outputs[i].h;
+        }
+
+        _ctx.framebuffer.pitch = eva_alloc_pitch(_ctx.framebuffer.w > screen_w ?
+                                                 _ctx.framebuffer.w : screen_w);
+        _ctx.framebuffer.max_height = _ctx.framebuffer.h > screen_h ?
+                                      _ctx.framebuffer.h : screen_h;
+
+        if (!create_pool()) {
+            _ctx.framebuffer.pitch      = 0;
+            _ctx.framebuffer.max_height = 0;
+        }
+        EVA_TRACE_END();
+    }
+}
+
+static bool create_pool(void)
+{
+    size_t buffer_size = (size_t)_ctx.framebuffer.pitch *
+                         _ctx.framebuffer.max_height * sizeof(eva_pixel);
+    size_t pool_size = buffer_size * EVA_MAX_WL_BUFFERS;
+
+    int fd = -1;
+    if (eva_alloc_huge_pages() == EVA_HUGE_PAGES_EXPLICIT &&
+        pool_size >= EVA_HUGE_PAGE_SIZE) {
+        fd = memfd_create("eva-shm", MFD_CLOEXEC | MFD_HUGETLB);
+        if (fd >= 0) {
+            pool_size = eva_alloc_huge_size(pool_size);
+        }
+    }
+    if (fd < 0) {
+        fd = memfd_create("eva-shm", MFD_CLOEXEC);
+    }
+    if (fd < 0) {
+        return false;
+    }
+    if (ftruncate(fd, (off_t)pool_size) < 0) {
+        close(fd);
+        return false;
+    }
+
+    void *data = mmap(NULL, pool_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    // The pool is shmem, which only uses transparent huge pages when
+    // /sys/kernel/mm/transparent_hugepage/shmem_enabled allows it.
+    if (eva_alloc_huge_pages() != EVA_HUGE_PAGES_OFF) {
+        madvise(data, pool_size, MADV_HUGEPAGE);
+    }
+
+    // The compositor maps the fd itself, so it can be closed right away.
+    _ctx.pool = wl_shm_create_pool(_ctx.shm, fd, (int32_t)pool_size);
+    close(fd);
+
+    _ctx.pool_data = data;
+    _ctx.pool_size = pool_size;
+
+    for (size_t i = 0; i < EVA_MAX_WL_BUFFERS; ++i) {
+        _ctx.buffers[i].pixels = (eva_pixel *)((uint8_t *)data + i * buffer_size);
+        _ctx.buffers[i].buffer = NULL;
+        _ctx.buffers[i].stale  = EVA_RECT_FULL;
+        _ctx.buffers[i].busy   = false;
+    }
+
+    _ctx.front  = NULL;
+    _ctx.back   = NULL;
+    _ctx.damage = EVA_RECT_FULL;
+    _ctx.framebuffer.pixels = _ctx.buffers[0].pixels;
+
+    // Nothing is on screen from the new buffers yet.
+    eva_hash_invalidate(EVA_RECT_FULL);
+    return true;
+}
+
+static void destroy_pool(void)
+{
+    if (_ctx.pool == NULL) {
+        return;
+    }
+
+    // Buffers still held by the compositor are destroyed as well, the
+    // compositor keeps its own mapping of the pool until it is done.
+    for (size_t i = 0; i < EVA_MAX_WL_BUFFERS; ++i) {
+        if (_ctx.buffers[i].buffer) {
+            wl_buffer_destroy(_ctx.buffers[i].buffer);
+        }
+        _ctx.buffers[i].buffer = NULL;
+        _ctx.buffers[i].pixels = NULL;
+        _ctx.buffers[i].busy   = false;
+    }
+
+    wl_shm_pool_destroy(_ctx.pool);
+    munmap(_ctx.pool_data, _ctx.pool_size);
+
+    _ctx.pool      = NULL;
+    _ctx.pool_data = NULL;
+    _ctx.pool_size = 0;
+    _ctx.front     = NULL;
+    _ctx.back      = NULL;
+    _ctx.framebuffer.pixels = NULL;
+}
+
+static eva_wl_buffer *acquire_buffer(void)
+{
+    // Releases read by the main loop are queued but not dispatched yet.
+    wl_display_dispatch_queue_pending(_ctx.display, _ctx.buffer_queue);
+
+    for (;;) {
+        for (size_t i = 0; i < EVA_MAX_WL_BUFFERS; ++i) {
+            eva_wl_buffer *buffer = &_ctx.buffers[i];
+            if (!buffer->busy && buffer->pixels) {
+                return buffer;
+            }
+        }
+
+        // Every buffer is still being read by the compositor. Block until
+        // one is released, only buffer events are dispatched while waiting.
+        uint64_t start = eva_time_now();
+        int result = wl_display_dispatch_queue(_ctx.display, _ctx.buffer_queue);
+        eva_stats_add_wait(eva_time_since(start));
+        if (result == -1) {
+            return NULL;
+        }
+    }
+}
+
+static void copy_rect(eva_pixel *dst, const eva_pixel *src, eva_rect rect)
+{
+    for (int32_t y = rect.y; y < rect.y + rect.h; ++y) {
+        size_t offset = (size_t)y * _ctx.framebuffer.pitch + (size_t)rect.x;
+        memcpy(dst + offset, src + offset, (size_t)rect.w * sizeof(eva_pixel));
+    }
+}
+
+// Acquires the buffer the next frame is drawn into and makes it the
+// framebuffer. It stays the same until that frame is committed.
+static eva_wl_buffer *prepare_buffer(void)
+{
+    if (_ctx.back) {
+        return _ctx.back;
+    }
+
+    eva_wl_buffer *buffer = acquire_buffer();
+    if (buffer == NULL) {
+        return NULL;
+    }
+
+    // Applications expect the framebuffer to keep its contents between
+    // frames, so bring this buffer up to date with the last one presented.
+    // Only the pixels that changed since it was last presented are copied.
+    if (_ctx.front && _ctx.front != buffer) {
+        eva_rect stale = rect_clip(buffer->stale, _ctx.framebuffer.w,
+                                   _ctx.framebuffer.h);
+        if (!rect_is_empty(stale)) {
+            uint64_t start = eva_time_now();
+            copy_rect(buffer->pixels, _ctx.front->pixels, stale);
+            eva_stats_add_present(eva_time_since(start),
+                                  (uint64_t)stale.w * (uint64_t)stale.h * sizeof(eva_pixel));
+        }
+    }
+    buffer->stale = EVA_RECT_EMPTY;
+    _ctx.framebuffer.pixels = buffer->pixels;
+    _ctx.back = buffer;
+    return buffer;
+}
+
+static void draw_frame(void)
+{
+    eva_stats_begin_frame();
+
+    // The connection failed while waiting for a buffer. The frame is still
+    // recorded with the time it waited.
+    eva_wl_buffer *buffer = prepare_buffer();
+    if (buffer == NULL) {
+        eva_stats_end_frame();
+        return;
+    }
+
+    uint32_t w = _ctx.framebuffer.w;
+    uint32_t h = _ctx.framebuffer.h;
+
+    // wl_buffers have a fixed size, recreate them after a resize. The pool
+    // itself is large enough for any size up to the pitch and max height.
+    if (buffer->buffer == NULL || buffer->w != w || buffer->h != h) {
+        if (buffer->buffer) {
+            wl_buffer_destroy(buffer->buffer);
+        }
+        int32_t offset = (int32_t)((uint8_t *)buffer->pixels -
+                                   (uint8_t *)_ctx.pool_data);
+        buffer->buffer = wl_shm_pool_create_buffer(_ctx.pool, offset,
+                                                   (int32_t)w, (int32_t)h,
+                                                   (int32_t)(_ctx.framebuffer.pitch * sizeof(eva_pixel)),
+                                                   WL_SHM_FORMAT_XRGB8888);
+        wl_proxy_set_queue((struct wl_proxy *)buffer->buffer, _ctx.buffer_queue);
+        wl_buffer_add_listener(buffer->buffer, &buffer_listener, buffer);
+        buffer->w = w;
+        buffer->h = h;
+    }
+
+    eva_rect damage;
+    if (eva_pipeline_enabled()) {
+        // The frame was rendered on the render thread, only copy it in.
+        eva_pipeline_present(&_ctx.framebuffer, &damage);
+    } else {
+        // The input state is taken and pointer samples go out right before
+        // the frame, so what the application requests from them is drawn
+        // with it.
+        eva_input_begin_frame();
+        eva_pointer_flush();
+        _ctx.request_frame = false;
+
+        // There is a chance that the frame_fn is not set and the application
+        // is just writing directly to the framebuffer in the event handlers
+        // and then requesting to draw with eva_request_frame(). In this case
+        // we still want to draw but don't have a frame function to call.
+        pacer_begin_frame(&_ctx.pacer, eva_time_now());
+        damage = eva_tiles_render(_ctx.frame_fn, &_ctx.framebuffer, _ctx.damage);
+        _ctx.damage = EVA_RECT_EMPTY;
+    }
+
+    EVA_TRACE_BEGIN("present");
+    uint64_t start = eva_time_now();
+    uint32_t version = wl_proxy_get_version((struct wl_proxy *)_ctx.surface);
+    if (version >= 3) {
+        wl_surface_set_buffer_scale(_ctx.surface, _ctx.scale);
+    }
+
+    // When nothing changed, e.g. content hashing found every tile the same,
+    // the buffer matches the front one and stays unused. The commit still
+    // asks for a frame callback to pace the next frame.
+    damage = rect_clip(damage, w, h);
+    if (!rect_is_empty(damage)) {
+        wl_surface_attach(_ctx.surface, buffer->buffer, 0, 0);
+
+        // Tell the compositor which pixels changed so it only uploads those.
+        if (version >= 4) {
+            wl_surface_damage_buffer(_ctx.surface, damage.x, damage.y,
+                                     damage.w, damage.h);
+        } else {
+            wl_surface_damage(_ctx.surface, 0, 0, INT32_MAX, INT32_MAX);
+        }
+
+        // The other buffers are now behind by the damaged area.
+        for (size_t i = 0; i < EVA_MAX_WL_BUFFERS; ++i) {
+            if (&_ctx.buffers[i] != buffer) {
+                _ctx.buffers[i].stale = rect_union(_ctx.buffers[i].stale, damage);
+            }
+        }
+    }
+
+    _ctx.frame_callback = wl_surface_frame(_ctx.surface);
+    wl_callback_add_listener(_ctx.frame_callback, &frame_listener, NULL);
+
+    wl_surface_commit(_ctx.surface);
+    wl_display_flush(_ctx.display);
+
+    if (!rect_is_empty(damage)) {
+        buffer->busy = true;
+        _ctx.front   = buffer;
+        _ctx.back    = NULL;
+    }
+    pacer_end_frame(&_ctx.pacer, eva_time_now());
+
+    // The compositor reads the damaged pixels out of the buffer.
+    eva_stats_add_present(eva_time_since(start),
+                          (uint64_t)damage.w * (uint64_t)damage.h * sizeof(eva_pixel));
+    EVA_TRACE_END();
+    eva_stats_end_frame();
+}
+
+static bool frame_ready(void)
+{
+    // Wait for the compositor to ask for the next frame. Any requests made
+    // until then are folded into that one frame.
+    if (!_ctx.configured || _ctx.frame_callback) {
+        return false;
+    }
+
+    // With a pipeline the frame is rendered without waiting for the
+    // compositor, only presenting it has to wait.
+    return eva_pipeline_enabled() ? eva_pipeline_frame_ready() :
+                                    _ctx.request_frame;
+}
+
+static void submit_frame(void)
+{
+    if (!_ctx.request_frame || !_ctx.configured || !eva_pipeline_ready()) {
+        return;
+    }
+
+    eva_input_begin_frame();
+    eva_pointer_flush();
+    _ctx.request_frame = false;
+    pacer_begin_frame(&_ctx.pacer, eva_time_now());
+    eva_pipeline_submit(_ctx.frame_fn, &_ctx.framebuffer, _ctx.damage);
+    _ctx.damage = EVA_RECT_EMPTY;
+}
+
+static void wake_event_loop(void)
+{
+    // Called from the render thread and threads posting events. A full
+    // pipe already wakes the loop.
+    char byte = 0;
+    ssize_t written = write(_ctx.wake_fds[1], &byte, 1);
+    (void)written;
+}
+
+static int wait_for_events(void)
+{
+    while (wl_display_prepare_read(_ctx.display) != 0) {
+        if (wl_display_dispatch_pending(_ctx.display) == -1) {
+            return -1;
+        }
+    }
+    wl_display_flush(_ctx.display);
+
+    // Block until the compositor sends something, or until the event loop
+    // has a frame to draw or a timer to call. While a frame callback is
+    // pending the frame can't be drawn anyway, the callback wakes the loop
+    // up. With a pipeline the render thread wakes the loop instead.
+    struct timespec  timeout;
+    struct timespec *timeout_ptr = NULL;
+
+    bool can_draw = eva_pipeline_enabled() ?
+                    _ctx.configured && eva_pipeline_ready() :
+                    _ctx.configured && _ctx.frame_callback == NULL;
+    uint64_t due = can_draw ? pacer_deadline(&_ctx.pacer, _ctx.coalesce_frames,
+                                             _ctx.request_frame) : UINT64_MAX;
+    if (eva_pipeline_enabled() && frame_ready()) {
+        due = 0; // A finished frame is presented right away
+    }
+    if (eva_timers_deadline() < due) {
+        due = eva_timers_deadline();
+    }
+    if (due != UINT64_MAX) {
+        uint64_t now = eva_time_now();
+        uint64_t wait = due > now ? due - now : 0;
+        timeout.tv_sec  = (time_t)(wait / 1000000000ull);
+        timeout.tv_nsec = (long)(wait % 1000000000ull);
+        timeout_ptr     = &timeout;
+    }
+
+    struct pollfd fds[2] = {
+        { .fd = wl_display_get_fd(_ctx.display), .events = POLLIN },
+        { .fd = _ctx.wake_fds[0],                .events = POLLIN },
+    };
+    int ready = ppoll(fds, _ctx.wake_fds[0] != -1 ? 2 : 1, timeout_ptr, NULL);
+    if (ready > 0 && (fds[0].revents & POLLIN)) {
+        if (wl_display_read_events(_ctx.display) == -1) {
+            return -1;
+        }
+    } else {
+        wl_display_cancel_read(_ctx.display);
+        if (ready > 0 && (fds[0].revents & (POLLERR | POLLHUP))) {
+            return -1;
+        }
+    }
+
+    if (_ctx.wake_fds[0] != -1 && (fds[1].revents & POLLIN)) {
+        char buffer[64];
+        while (read(_ctx.wake_fds[0], buffer, sizeof(buffer)) > 0) {
+        }
+    }
+
+    EVA_TRACE_BEGIN("dispatch");
+    int dispatched = wl_display_dispatch_pending(_ctx.display);
+    EVA_TRACE_END();
+    return dispatched;
+}
+
+static bool try_frame(void)
+{
+    // Coalesced and continuous frames are drawn by the event loop once the
+    // events read from the compositor are all handled.
+    if (pacer_owns_frames(&_ctx.pacer, _ctx.coalesce_frames)) {
+        return false;
+    }
+
+    EVA_TRACE_BEGIN("try_frame");
+    bool drawn = true;
+    if (eva_pipeline_enabled()) {
+        submit_frame();
+    } else if (frame_ready()) {
+        draw_frame();
+    } else {
+        drawn = false;
+    }
+    EVA_TRACE_END();
+    return drawn;
+}
+
+static void handle_close(void)
+{
+    // only give user-code a chance to intervene when eva_quit() wasn't already
+    // called
+    if (!_ctx.quit_ordered) {
+        // if window should be closed and event handling is enabled, give user
+        // code a chance to intervene via eva_cancel_quit()
+        _ctx.quit_requested = true;
+
+        if (_ctx.cancel_quit_fn) {
+            // See if the user code wants to cancel the quit sequence.
+            _ctx.quit_requested = !_ctx.cancel_quit_fn();
+        }
+
+        // user code hasn't intervened, quit the app
+        if (_ctx.quit_requested) {
+            _ctx.quit_ordered = true;
+        }
+    }
+}
+
+// registry
+
+static void registry_global(void *data, struct wl_registry *registry,
+                            uint32_t name, const char *interface,
+                            uint32_t version)
+{
+    (void)data;
+
+    if (strcmp(interface, wl_compositor_interface.name) == 0) {
+        // damage_buffer needs version 4.
+        _ctx.compositor = wl_registry_bind(registry, name,
+                                           &wl_compositor_interface,
+                                           version < 4 ? version : 4);
+    } else if (strcmp(interface, wl_shm_interface.name) == 0) {
+        _ctx.shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+    } else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
+        _ctx.wm_base = wl_registry_bind(registry, name,
+                                        &xdg_wm_base_interface, 1);
+        xdg_wm_base_add_listener(_ctx.wm_base, &wm_base_listener, NULL);
+    } else if (strcmp(interface, wl_seat_interface.name) == 0) {
+        _ctx.seat = wl_registry_bind(registry, name, &wl_seat_interface,
+                                     version < 4 ? version : 4);
+        wl_seat_add_listener(_ctx.seat, &seat_listener, NULL);
+    } else if (strcmp(interface, wl_output_interface.name) == 0) {
+        if (_ctx.output_count < EVA_MAX_WL_OUTPUTS) {
+            eva_wl_output *output = &_ctx.outputs[_ctx.output_count++];
+            output->scale  = 1;
+            output->output = wl_registry_bind(registry, name,
+                                              &wl_output_interface,
+                                              version < 2 ? version : 2);
+            wl_output_add_listener(output->output, &output_listener, output);
+        }
+    }
+}
+
+static void registry_global_remove(void *data, struct wl_registry *registry,
+                                   uint32_t name)
+{
+    (void)data;
+    (void)registry;
+    (void)name;
+}
+
+static const struct wl_registry_listener registry_listener = {
+    .global        = registry_global,
+    .global_remove = registry_global_remove,
+};
+
+// output
+
+static void output_geometry(void *data, struct wl_output *output,
+                            int32_t x, int32_t y,
+                            int32_t physical_width, int32_t physical_height,
+                            int32_t subpixel, const char *make,
+                            const char *model, int32_t transform)
+{
+    (void)data; (void)output; (void)x; (void)y;
+    (void)physical_width; (void)physical_height; (void)subpixel;
+    (void)make; (void)model; (void)transform;
+}
+
+static void output_mode(void *data, struct wl_output *output, uint32_t flags,
+                        int32_t width, int32_t height, int32_t refresh)
+{
+    (void)output;
+
+    eva_wl_output *o = data;
+    if (flags & WL_OUTPUT_MODE_CURRENT) {
+        o->w       = (uint32_t)width;
+        o->h       = (uint32_t)height;
+        o->refresh = refresh > 0 ? (uint32_t)refresh : 0;
+    }
+}
+
+static void output_done(void *data, struct wl_output *output)
+{
+    (void)data;
+    (void)output;
+}
+
+static void output_scale(void *data, struct wl_output *output, int32_t factor)
+{
+    (void)output;
+
+    eva_wl_output *o = data;
+    o->scale = factor > 0 ? factor : 1;
+}
+
+static const struct wl_output_listener output_listener = {
+    .geometry = output_geometry,
+    .mode     = output_mode,
+    .done     = output_done,
+    .scale    = output_scale,
+};
+
+// surface
+
+static void surface_enter(void *data, struct wl_surface *surface,
+                          struct wl_output *output)
+{
+    (void)data;
+    (void)surface;
+
+    for (uint32_t i = 0; i < _ctx.output_count; i++) {
+        // Continuous frames are capped to the refresh rate of the output the
+        // window is shown on.
+        if (_ctx.outputs[i].output == output && _ctx.outputs[i].refresh) {
+            pacer_set_refresh(&_ctx.pacer, 1000000000ull,
+                              1000000000000ull / _ctx.outputs[i].refresh);
+        }
+
+        if (_ctx.outputs[i].output == output &&
+            _ctx.outputs[i].scale != _ctx.scale) {
+            _ctx.scale = _ctx.outputs[i].scale;
+
+            update_window();
+            eva_record_resize(_ctx.framebuffer.w, _ctx.framebuffer.h);
+            if (_ctx.window_resize_fn) {
+                _ctx.window_resize_fn(_ctx.framebuffer.w, _ctx.framebuffer.h);
+            }
+
+            eva_request_frame();
+            try_frame();
+        }
+    }
+}
+
+static void surface_leave(void *data, struct wl_surface *surface,
+                          struct wl_output *output)
+{
+    (void)data;
+    (void)surface;
+    (void)output;
+}
+
+static const struct wl_surface_listener surface_listener = {
+    .enter = surface_enter,
+    .leave = surface_leave,
+};
+
+// frame pacing
+
+static void buffer_release(void *data, struct wl_buffer *wl_buffer)
+{
+    (void)wl_buffer;
+
+    eva_wl_buffer *buffer = data;
+    buffer->busy = false;
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+    .release = buffer_release,
+};
+
+static void frame_done(void *data, struct wl_callback *callback, uint32_t time)
+{
+    (void)data;
+    (void)time;
+
+    wl_callback_destroy(callback);
+    _ctx.frame_callback = NULL;
+
+    try_frame();
+}
+
+static const struct wl_callback_listener frame_listener = {
+    .done = frame_done,
+};
+
+// xdg shell
+
+static void wm_base_ping(void *data, struct xdg_wm_base *wm_base,
+                         uint32_t serial)
+{
+    (void)data;
+    xdg_wm_base_pong(wm_base, serial);
+}
+
+static const struct xdg_wm_base_listener wm_base_listener = {
+    .ping = wm_base_ping,
+};
+
+static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface,
+                                  uint32_t serial)
+{
+    (void)data;
+
+    xdg_surface_ack_configure(xdg_surface, serial);
+
+    // A configure must always be answered with a new buffer.
+    _ctx.configured = true;
+    eva_request_frame();
+    try_frame();
+}
+
+static const struct xdg_surface_listener xdg_surface_listener = {
+    .configure = xdg_surface_configure,
+};
+
+static void xdg_toplevel_configure(void *data, struct xdg_toplevel *toplevel,
+                                   int32_t width, int32_t height,
+                                   struct wl_array *states)
+{
+    (void)data;
+    (void)toplevel;
+    (void)states;
+
+    // Zero means the client should pick its own size.
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+
+    if ((uint32_t)width  != _ctx.window_width ||
+        (uint32_t)height != _ctx.window_height) {
+        _ctx.window_width  = (uint32_t)width;
+        _ctx.window_height = (uint32_t)height;
+
+        update_window();
+        eva_record_resize(_ctx.framebuffer.w, _ctx.framebuffer.h);
+        if (_ctx.window_resize_fn) {
+            _ctx.window_resize_fn(_ctx.framebuffer.w, _ctx.framebuffer.h);
+        }
+    }
+}
+
+static void xdg_toplevel_close(void *data, struct xdg_toplevel *toplevel)
+{
+    (void)data;
+    (void)toplevel;
+
+    handle_close();
+}
+
+static const struct xdg_toplevel_listener xdg_toplevel_listener = {
+    .configure = xdg_toplevel_configure,
+    .close     = xdg_toplevel_close,
+};
+
+// seat
+
+static void seat_capabilities(void *data, struct wl_seat *seat,
+                              uint32_t capabilities)
+{
+    (void)data;
+
+    bool has_pointer = capabilities & WL_SEAT_CAPABILITY_POINTER;
+    if (has_pointer && _ctx.pointer == NULL) {
+        _ctx.pointer = wl_seat_get_pointer(seat);
+        wl_pointer_add_listener(_ctx.pointer, &pointer_listener, NULL);
+    } else if (!has_pointer && _ctx.pointer) {
+        wl_pointer_destroy(_ctx.pointer);
+        _ctx.pointer = NULL;
+    }
+
+    bool has_keyboard = capabilities & WL_SEAT_CAPABILITY_KEYBOARD;
+    if (has_keyboard && _ctx.keyboard == NULL) {
+        _ctx.keyboard = wl_seat_get_keyboard(seat);
+        wl_keyboard_add_listener(_ctx.keyboard, &keyboard_listener, NULL);
+    } else if (!has_keyboard && _ctx.keyboard) {
+        wl_keyboard_destroy(_ctx.keyboard);
+        _ctx.keyboard = NULL;
+    }
+}
+
+static void seat_name(void *data, struct wl_seat *seat, const char *name)
+{
+    (void)data;
+    (void)seat;
+    (void)name;
+}
+
+static const struct wl_seat_listener seat_listener = {
+    .capabilities = seat_capabilities,
+    .name         = seat_name,
+};
+
+// pointer
+
+static void pointer_enter(void *data, struct wl_pointer *pointer,
+                          uint32_t serial, struct wl_surface *surface,
+                          wl_fixed_t x, wl_fixed_t y)
+{
+    (void)data; (void)pointer; (void)serial; (void)surface;
+
+    _ctx.mouse_x = wl_fixed_to_double(x) * _ctx.scale;
+    _ctx.mouse_y = wl_fixed_to_double(y) * _ctx.scale;
+}
+
+static void pointer_leave(void *data, struct wl_pointer *pointer,
+                          uint32_t serial, struct wl_surface *surface)
+{
+    (void)data; (void)pointer; (void)serial; (void)surface;
+}
+
+static void pointer_motion(void *data, struct wl_pointer *pointer,
+                           uint32_t time, wl_fixed_t x, wl_fixed_t y)
+{
+    (void)data; (void)pointer;
+
+    _ctx.mouse_x = wl_fixed_to_double(x) * _ctx.scale;
+    _ctx.mouse_y = wl_fixed_to_double(y) * _ctx.scale;
+
+    eva_input_mouse_moved(_ctx.mouse_x, _ctx.mouse_y);
+    if (eva_pointer_batching()) {
+        eva_pointer_moved(_ctx.mouse_x, _ctx.mouse_y, eva_pointer_time_ms(time));
+    }
+    if (_ctx.mouse_moved_fn) {
+        eva_record_mouse_moved(_ctx.mouse_x, _ctx.mouse_y);
+        _ctx.mouse_moved_fn(_ctx.mouse_x, _ctx.mouse_y);
+        try_frame();
+    }
+}
+
+static void pointer_button(void *data, struct wl_pointer *pointer,
+                           uint32_t serial, uint32_t time, uint32_t button,
+                           uint32_t state)
+{
+    (void)data; (void)pointer; (void)serial;
+
+    eva_mouse_btn btn;
+    switch (button) {
+        case BTN_LEFT:   btn = EVA_MOUSE_BTN_LEFT;   break;
+        case BTN_RIGHT:  btn = EVA_MOUSE_BTN_RIGHT;  break;
+        case BTN_MIDDLE: btn = EVA_MOUSE_BTN_MIDDLE; break;
+        default:         return;
+    }
+
+    eva_input_action action = state == WL_POINTER_BUTTON_STATE_PRESSED ?
+                              EVA_INPUT_PRESSED : EVA_INPUT_RELEASED;
+    eva_input_mouse_btn(_ctx.mouse_x, _ctx.mouse_y, btn, action);
+    eva_pointer_button(_ctx.mouse_x, _ctx.mouse_y, btn, action,
+                       eva_pointer_time_ms(time));
+
+    if (_ctx.mouse_btn_fn) {
+        eva_record_mouse_btn(_ctx.mouse_x, _ctx.mouse_y, btn, action);
+        _ctx.mouse_btn_fn(_ctx.mouse_x, _ctx.mouse_y, btn, action);
+        try_frame();
+    }
+}
+
+static void pointer_axis(void *data, struct wl_pointer *pointer,
+                         uint32_t time, uint32_t axis, wl_fixed_t value)
+{
+    (void)data; (void)pointer; (void)time;
+
+    // Wayland reports scrolling down/right as positive distances in surface
+    // coordinates, eva reports wheel notches with up positive.
+    double delta = -wl_fixed_to_double(value) / 10.0;
+    double delta_x = axis == WL_POINTER_AXIS_VERTICAL_SCROLL ? 0.0 : delta;
+    double delta_y = axis == WL_POINTER_AXIS_VERTICAL_SCROLL ? delta : 0.0;
+    eva_input_scroll(delta_x, delta_y);
+
+    if (_ctx.scroll_fn) {
+        eva_record_scroll(delta_x, delta_y);
+        _ctx.scroll_fn(delta_x, delta_y);
+        try_frame();
+    }
+}
+
+static const struct wl_pointer_listener pointer_listener = {
+    .enter  = pointer_enter,
+    .leave  = pointer_leave,
+    .motion = pointer_motion,
+    .button = pointer_button,
+    .axis   = pointer_axis,
+};
+
+// keyboard
+
+static void keyboard_keymap(void *data, struct wl_keyboard *keyboard,
+                            uint32_t format, int32_t fd, uint32_t size)
+{
+    (void)data;
+    (void)keyboard;
+
+    if (format != WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1) {
+        close(fd);
+        return;
+    }
+
+    char *keymap_str = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (keymap_str == MAP_FAILED) {
+        return;
+    }
+
+    struct xkb_keymap *keymap =
+        xkb_keymap_new_from_string(_ctx.xkb_context, keymap_str,
+                                   XKB_KEYMAP_FORMAT_TEXT_V1,
+                                   XKB_KEYMAP_COMPILE_NO_FLAGS);
+    munmap(keymap_str, size);
+    if (keymap == NULL) {
+        return;
+    }
+
+    if (_ctx.xkb_state)  xkb_state_unref(_ctx.xkb_state);
+    if (_ctx.xkb_keymap) xkb_keymap_unref(_ctx.xkb_keymap);
+    _ctx.xkb_keymap = keymap;
+    _ctx.xkb_state  = xkb_state_new(keymap);
+}
+
+static void keyboard_enter(void *data, struct wl_keyboard *keyboard,
+                           uint32_t serial, struct wl_surface *surface,
+                           struct wl_array *keys)
+{
+    (void)data; (void)keyboard; (void)serial; (void)surface; (void)keys;
+}
+
+static void keyboard_leave(void *data, struct wl_keyboard *keyboard,
+                           uint32_t serial, struct wl_surface *surface)
+{
+    (void)data; (void)keyboard; (void)serial; (void)surface;
+
+    eva_input_release_all();
+}
+
+static void keyboard_key(void *data, struct wl_keyboard *keyboard,
+                         uint32_t serial, uint32_t time, uint32_t key,
+                         uint32_t state)
+{
+    (void)data; (void)keyboard; (void)serial; (void)time;
+
+    eva_input_action action = state == WL_KEYBOARD_KEY_STATE_PRESSED ?
+                              EVA_INPUT_PRESSED : EVA_INPUT_RELEASED;
+    eva_mod_flags mods = translate_mod_flags();
+    eva_key translated = translate_key(key);
+    eva_input_key(translated, action, mods);
+
+    if (_ctx.key_fn) {
+        eva_record_key(translated, action, mods);
+        _ctx.key_fn(translated, action, mods);
+    }
+
+    if (eva_text_input_wanted() && _ctx.xkb_state && action == EVA_INPUT_PRESSED) {
+        // xkb keycodes are evdev keycodes offset by 8.
+        char text[64];
+        int len = xkb_state_key_get_utf8(_ctx.xkb_state, key + 8,
+                                         text, sizeof(text));
+        if (len > 0 && (size_t)len < sizeof(text)) {
+            eva_text_input_utf8(text, (uint32_t)len, mods);
+        }
+    }
+
+    try_frame();
+}
+
+static void keyboard_modifiers(void *data, struct wl_keyboard *keyboard,
+                               uint32_t serial, uint32_t depressed,
+                               uint32_t latched, uint32_t locked,
+                               uint32_t group)
+{
+    (void)data; (void)keyboard; (void)serial;
+
+    if (_ctx.xkb_state) {
+        xkb_state_update_mask(_ctx.xkb_state, depressed, latched, locked,
+                              0, 0, group);
+    }
+}
+
+static void keyboard_repeat_info(void *data, struct wl_keyboard *keyboard,
+                                 int32_t rate, int32_t delay)
+{
+    (void)data; (void)keyboard; (void)rate; (void)delay;
+}
+
+static const struct wl_keyboard_listener keyboard_listener = {
+    .keymap      = keyboard_keymap,
+    .enter       = keyboard_enter,
+    .leave       = keyboard_leave,
+    .key         = keyboard_key,
+    .modifiers   = keyboard_modifiers,
+    .repeat_info = keyboard_repeat_info,
+};
+
+// Translates a linux evdev keycode to an eva keycode.
+static eva_key translate_key(uint32_t key)
+{
+    if (key >= sizeof(_ctx.keycodes) / sizeof(_ctx.keycodes[0]))
+        return EVA_KEY_UNKNOWN;
+
+    return _ctx.keycodes[key];
+}
+
+static eva_mod_flags translate_mod_flags(void)
+{
+    eva_mod_flags mods = 0;
+    if (_ctx.xkb_state == NULL) {
+        return mods;
+    }
+
+    if (xkb_state_mod_name_is_active(_ctx.xkb_state, XKB_MOD_NAME_SHIFT,
+                                     XKB_STATE_MODS_EFFECTIVE) > 0)
+        mods |= EVA_MOD_SHIFT;
+    if (xkb_state_mod_name_is_active(_ctx.xkb_state, XKB_MOD_NAME_CTRL,
+                                     XKB_STATE_MODS_EFFECTIVE) > 0)
+        mods |= EVA_MOD_CONTROL;
+    if (xkb_state_mod_name_is_active(_ctx.xkb_state, XKB_MOD_NAME_ALT,
+                                     XKB_STATE_MODS_EFFECTIVE) > 0)
+        mods |= EVA_MOD_ALT;
+    if (xkb_state_mod_name_is_active(_ctx.xkb_state, XKB_MOD_NAME_LOGO,
+                                     XKB_STATE_MODS_EFFECTIVE) > 0)
+        mods |= EVA_MOD_SUPER;
+    if (xkb_state_mod_name_is_active(_ctx.xkb_state, XKB_MOD_NAME_CAPS,
+                                     XKB_STATE_MODS_EFFECTIVE) > 0)
+        mods |= EVA_MOD_CAPS_LOCK;
+    if (xkb_state_mod_name_is_active(_ctx.xkb_state, XKB_MOD_NAME_NUM,
+                                     XKB_STATE_MODS_EFFECTIVE) > 0)
+        mods |= EVA_MOD_NUM_LOCK;
+
+    return mods;
+}
+
+// Create key code translation tables. Adapted from GLFW.
+static void init_key_tables(void)
+{
+    memset(_ctx.keycodes, -1, sizeof(_ctx.keycodes));
+
+    _ctx.keycodes[KEY_GRAVE]      = EVA_KEY_GRAVE_ACCENT;
+    _ctx.keycodes[KEY_1]          = EVA_KEY_1;
+    _ctx.keycodes[KEY_2]          = EVA_KEY_2;
+    _ctx.keycodes[KEY_3]          = EVA_KEY_3;
+    _ctx.keycodes[KEY_4]          = EVA_KEY_4;
+    _ctx.keycodes[KEY_5]          = EVA_KEY_5;
+    _ctx.keycodes[KEY_6]          = EVA_KEY_6;
+    _ctx.keycodes[KEY_7]          = EVA_KEY_7;
+    _ctx.keycodes[KEY_8]          = EVA_KEY_8;
+    _ctx.keycodes[KEY_9]          = EVA_KEY_9;
+    _ctx.keycodes[KEY_0]          = EVA_KEY_0;
+    _ctx.keycodes[KEY_SPACE]      = EVA_KEY_SPACE;
+    _ctx.keycodes[KEY_MINUS]      = EVA_KEY_MINUS;
+    _ctx.keycodes[KEY_EQUAL]      = EVA_KEY_EQUAL;
+    _ctx.keycodes[KEY_Q]          = EVA_KEY_Q;
+    _ctx.keycodes[KEY_W]          = EVA_KEY_W;
+    _ctx.keycodes[KEY_E]          = EVA_KEY_E;
+    _ctx.keycodes[KEY_R]          = EVA_KEY_R;
+    _ctx.keycodes[KEY_T]          = EVA_KEY_T;
+    _ctx.keycodes[KEY_Y]          = EVA_KEY_Y;
+    _ctx.keycodes[KEY_U]          = EVA_KEY_U;
+    _ctx.keycodes[KEY_I]          = EVA_KEY_I;
+    _ctx.keycodes[KEY_O]          = EVA_KEY_O;
+    _ctx.keycodes[KEY_P]          = EVA_KEY_P;
+    _ctx.keycodes[KEY_LEFTBRACE]  = EVA_KEY_LEFT_BRACKET;
+    _ctx.keycodes[KEY_RIGHTBRACE] = EVA_KEY_RIGHT_BRACKET;
+    _ctx.keycodes[KEY_A]          = EVA_KEY_A;
+    _ctx.keycodes[KEY_S]          = EVA_KEY_S;
+    _ctx.keycodes[KEY_D]          = EVA_KEY_D;
+    _ctx.keycodes[KEY_F]          = EVA_KEY_F;
+    _ctx.keycodes[KEY_G]          = EVA_KEY_G;
+    _ctx.keycodes[KEY_H]          = EVA_KEY_H;
+    _ctx.keycodes[KEY_J]          = EVA_KEY_J;
+    _ctx.keycodes[KEY_K]          = EVA_KEY_K;
+    _ctx.keycodes[KEY_L]          = EVA_KEY_L;
+    _ctx.keycodes[KEY_SEMICOLON]  = EVA_KEY_SEMICOLON;
+    _ctx.keycodes[KEY_APOSTROPHE] = EVA_KEY_APOSTROPHE;
+    _ctx.keycodes[KEY_Z]          = EVA_KEY_Z;
+    _ctx.keycodes[KEY_X]          = EVA_KEY_X;
+    _ctx.keycodes[KEY_C]          = EVA_KEY_C;
+    _ctx.keycodes[KEY_V]          = EVA_KEY_V;
+    _ctx.keycodes[KEY_B]          = EVA_KEY_B;
+    _ctx.keycodes[KEY_N]          = EVA_KEY_N;
+    _ctx.keycodes[KEY_M]          = EVA_KEY_M;
+    _ctx.keycodes[KEY_COMMA]      = EVA_KEY_COMMA;
+    _ctx.keycodes[KEY_DOT]        = EVA_KEY_PERIOD;
+    _ctx.keycodes[KEY_SLASH]      = EVA_KEY_SLASH;
+    _ctx.keycodes[KEY_BACKSLASH]  = EVA_KEY_BACKSLASH;
+    _ctx.keycodes[KEY_ESC]        = EVA_KEY_ESCAPE;
+    _ctx.keycodes[KEY_TAB]        = EVA_KEY_TAB;
+    _ctx.keycodes[KEY_LEFTSHIFT]  = EVA_KEY_LEFT_SHIFT;
+    _ctx.keycodes[KEY_RIGHTSHIFT] = EVA_KEY_RIGHT_SHIFT;
+    _ctx.keycodes[KEY_LEFTCTRL]   = EVA_KEY_LEFT_CONTROL;
+    _ctx.keycodes[KEY_RIGHTCTRL]  = EVA_KEY_RIGHT_CONTROL;
+    _ctx.keycodes[KEY_LEFTALT]    = EVA_KEY_LEFT_ALT;
+    _ctx.keycodes[KEY_RIGHTALT]   = EVA_KEY_RIGHT_ALT;
+    _ctx.keycodes[KEY_LEFTMETA]   = EVA_KEY_LEFT_SUPER;
+    _ctx.keycodes[KEY_RIGHTMETA]  = EVA_KEY_RIGHT_SUPER;
+    _ctx.keycodes[KEY_COMPOSE]    = EVA_KEY_MENU;
+    _ctx.keycodes[KEY_NUMLOCK]    = EVA_KEY_NUM_LOCK;
+    _ctx.keycodes[KEY_CAPSLOCK]   = EVA_KEY_CAPS_LOCK;
+    _ctx.keycodes[KEY_PRINT]      = EVA_KEY_PRINT_SCREEN;
+    _ctx.keycodes[KEY_SCROLLLOCK] = EVA_KEY_SCROLL_LOCK;
+    _ctx.keycodes[KEY_PAUSE]      = EVA_KEY_PAUSE;
+    _ctx.keycodes[KEY_DELETE]     = EVA_KEY_DELETE;
+    _ctx.keycodes[KEY_BACKSPACE]  = EVA_KEY_BACKSPACE;
+    _ctx.keycodes[KEY_ENTER]      = EVA_KEY_ENTER;
+    _ctx.keycodes[KEY_HOME]       = EVA_KEY_HOME;
+    _ctx.keycodes[KEY_END]        = EVA_KEY_END;
+    _ctx.keycodes[KEY_PAGEUP]     = EVA_KEY_PAGE_UP;
+    _ctx.keycodes[KEY_PAGEDOWN]   = EVA_KEY_PAGE_DOWN;
+    _ctx.keycodes[KEY_INSERT]     = EVA_KEY_INSERT;
+    _ctx.keycodes[KEY_LEFT]       = EVA_KEY_LEFT;
+    _ctx.keycodes[KEY_RIGHT]      = EVA_KEY_RIGHT;
+    _ctx.keycodes[KEY_DOWN]       = EVA_KEY_DOWN;
+    _ctx.keycodes[KEY_UP]         = EVA_KEY_UP;
+    _ctx.keycodes[KEY_F1]         = EVA_KEY_F1;
+    _ctx.keycodes[KEY_F2]         = EVA_KEY_F2;
+    _ctx.keycodes[KEY_F3]         = EVA_KEY_F3;
+    _ctx.keycodes[KEY_F4]         = EVA_KEY_F4;
+    _ctx.keycodes[KEY_F5]         = EVA_KEY_F5;
+    _ctx.keycodes[KEY_F6]         = EVA_KEY_F6;
+    _ctx.keycodes[KEY_F7]         = EVA_KEY_F7;
+    _ctx.keycodes[KEY_F8]         = EVA_KEY_F8;
+    _ctx.keycodes[KEY_F9]         = EVA_KEY_F9;
+    _ctx.keycodes[KEY_F10]        = EVA_KEY_F10;
+    _ctx.keycodes[KEY_F11]        = EVA_KEY_F11;
+    _ctx.keycodes[KEY_F12]        = EVA_KEY_F12;
+    _ctx.keycodes[KEY_F13]        = EVA_KEY_F13;
+    _ctx.keycodes[KEY_F14]        = EVA_KEY_F14;
+    _ctx.keycodes[KEY_F15]        = EVA_KEY_F15;
+    _ctx.keycodes[KEY_F16]        = EVA_KEY_F16;
+    _ctx.keycodes[KEY_F17]        = EVA_KEY_F17;
+    _ctx.keycodes[KEY_F18]        = EVA_KEY_F18;
+    _ctx.keycodes[KEY_F19]        = EVA_KEY_F19;
+    _ctx.keycodes[KEY_F20]        = EVA_KEY_F20;
+    _ctx.keycodes[KEY_F21]        = EVA_KEY_F21;
+    _ctx.keycodes[KEY_F22]        = EVA_KEY_F22;
+    _ctx.keycodes[KEY_F23]        = EVA_KEY_F23;
+    _ctx.keycodes[KEY_F24]        = EVA_KEY_F24;
+    _ctx.keycodes[KEY_KPSLASH]    = EVA_KEY_KP_DIVIDE;
+    _ctx.keycodes[KEY_KPASTERISK] = EVA_KEY_KP_MULTIPLY;
+    _ctx.keycodes[KEY_KPMINUS]    = EVA_KEY_KP_SUBTRACT;
+    _ctx.keycodes[KEY_KPPLUS]     = EVA_KEY_KP_ADD;
+    _ctx.keycodes[KEY_KP0]        = EVA_KEY_KP_0;
+    _ctx.keycodes[KEY_KP1]        = EVA_KEY_KP_1;
+    _ctx.keycodes[KEY_KP2]        = EVA_KEY_KP_2;
+    _ctx.keycodes[KEY_KP3]        = EVA_KEY_KP_3;
+    _ctx.keycodes[KEY_KP4]        = EVA_KEY_KP_4;
+    _ctx.keycodes[KEY_KP5]        = EVA_KEY_KP_5;
+    _ctx.keycodes[KEY_KP6]        = EVA_KEY_KP_6;
+    _ctx.keycodes[KEY_KP7]        = EVA_KEY_KP_7;
+    _ctx.keycodes[KEY_KP8]        = EVA_KEY_KP_8;
+    _ctx.keycodes[KEY_KP9]        = EVA_KEY_KP_9;
+    _ctx.keycodes[KEY_KPDOT]      = EVA_KEY_KP_DECIMAL;
+    _ctx.keycodes[KEY_KPEQUAL]    = EVA_KEY_KP_EQUAL;
+    _ctx.keycodes[KEY_KPENTER]    = EVA_KEY_KP_ENTER;
+    _ctx.keycodes[KEY_102ND]      = EVA_KEY_WORLD_2;
+}
+
+// time
+
+void eva_time_init(void)
+{
+    // No-op on linux.
+}
+
+uint64_t eva_time_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t eva_time_real_now(void)
+{
+    return eva_time_now();
+}
+
+uint64_t eva_time_frequency(void)
+{
+    return 1000000000ull;
+}
+
+uint64_t eva_time_since(uint64_t start)
+{
+    return eva_time_now() - start;
+}
+
+float eva_time_ms(uint64_t t)
+{
+    return t / 1000000.0f;
+}
+
+float eva_time_elapsed_ms(uint64_t start, uint64_t end)
+{
+    return eva_time_ms(end - start);
+}
+
+float eva_time_since_ms(uint64_t start)
+{
+    return eva_time_elapsed_ms(start, eva_time_now());
+}
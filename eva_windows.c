@@ -1,4 +1,6 @@
 #include "eva.h"
+#include "eva_internal.h"
+#include "eva_trace.h"
 
 #include <Windows.h>
 
@@ -7,12 +9,33 @@
 
 #pragma comment(lib, "User32.lib")
 
+#define EVA_DEFAULT_REFRESH_RATE 60
+
+// Posted by the pipeline render thread once a frame is ready.
+#define EVA_WM_FRAME_READY (WM_APP + 1)
+
+// Posted by threads that post events with eva_post_event().
+#define EVA_WM_POSTED (WM_APP + 2)
+
+// Only in recent SDKs, supported since Windows 10 1803.
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
 static LRESULT CALLBACK wnd_proc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
 static void update_window();
 static void handle_paint();
 static void handle_close();
 static void handle_resize();
+static void handle_mouse_btn(LPARAM lParam, eva_mouse_btn btn, eva_input_action action);
+static void add_pointer_samples(LPARAM lParam);
 static void try_frame();
+static void draw_frame();
+static void present_frame(eva_rect damage);
+static void present_pipelined();
+static void wake_event_loop();
+static void wake_posted();
+static void wait_for_messages();
 static bool utf8_to_utf16(const char* src, wchar_t* dst, int dst_num_bytes);
 static bool utf16_to_utf8(const wchar_t* src, char* dst, int dst_num_bytes);
 
@@ -33,7 +56,6 @@ typedef struct eva_ctx {
     eva_mouse_btn_fn     mouse_btn_fn;
     eva_scroll_fn        scroll_fn;
     eva_key_fn           key_fn;
-    eva_text_input_fn    text_input_fn;
     eva_window_resize_fn window_resize_fn;
 
     LARGE_INTEGER ticks_per_sec;
@@ -41,6 +63,19 @@ typedef struct eva_ctx {
     bool window_shown;
     bool resizing;
     bool frame_requested;
+    bool coalesce_frames;
+    eva_rect damage; // Union of the rects requested for the next frame
+
+    // Part of the window ScrollWindowEx() moves by scroll_dx, scroll_dy
+    // before the next present, set by eva_scroll_region().
+    eva_rect scroll_src;
+    int32_t  scroll_dx;
+    int32_t  scroll_dy;
+
+    eva_frame_pacer pacer;
+    HANDLE          frame_timer; // Wakes the message loop for paced frames and timers
+
+    MOUSEMOVEPOINT pointer_last; // Newest mouse move added as a pointer sample
 } eva_ctx;
 
 static eva_ctx _ctx;
@@ -54,6 +89,7 @@ void eva_run(const char    *window_title,
     assert(fail_fn);
 
     eva_time_init();
+    eva_trace_set_thread_name("eva event loop");
 
     _ctx.window_title = window_title;
     _ctx.frame_fn     = frame_fn;
@@ -100,34 +136,77 @@ void eva_run(const char    *window_title,
                                 GetModuleHandleW(NULL),
                                 NULL);
     update_window();
+
+    eva_post_start(wake_posted);
+
+    eva_stats_reset();
     if (_ctx.init_fn) {
         _ctx.init_fn();
     }
 
     // Let the application full it's framebuffer before showing the window.
-    _ctx.frame_fn(&_ctx.framebuffer);
+    eva_stats_begin_frame();
+    pacer_begin_frame(&_ctx.pacer, eva_time_now());
+    eva_tiles_render(_ctx.frame_fn, &_ctx.framebuffer, EVA_RECT_FULL);
+    eva_stats_end_frame();
 
     ShowWindow(_ctx.hwnd, SW_SHOW);
     _ctx.window_shown = true;
 
+    _ctx.frame_timer = CreateWaitableTimerExW(NULL, NULL,
+                                              CREATE_WAITABLE_TIMER_HIGH_RESOLUTION,
+                                              TIMER_ALL_ACCESS);
+    if (!_ctx.frame_timer) {
+        _ctx.frame_timer = CreateWaitableTimerW(NULL, FALSE, NULL);
+    }
+
+    eva_pipeline_start(wake_event_loop);
+
     bool done = false;
     while (!(done || _ctx.quit_ordered)) {
-        MSG msg;
-        GetMessageW(&msg, NULL, 0, 0);
+        wait_for_messages();
 
-        if (WM_QUIT == msg.message) {
-            done = true;
-            continue;
+        // Handle every pending message before a coalesced or continuous
+        // frame is drawn.
+        MSG msg;
+        while (!done && PeekMessageW(&msg, NULL, 0, 0, PM_REMOVE)) {
+            if (WM_QUIT == msg.message) {
+                done = true;
+                continue;
+            }
+
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
+
+            if (_ctx.quit_requested) {
+                PostMessage(_ctx.hwnd, WM_CLOSE, 0, 0);
+            }
         }
 
-        TranslateMessage(&msg);
-        DispatchMessage(&msg);
+        if (!done) {
+            eva_timers_run(eva_time_now());
 
-        if (_ctx.quit_requested) {
-            PostMessage(_ctx.hwnd, WM_CLOSE, 0, 0);
+            eva_frame_idle(&_ctx.pacer, _ctx.frame_requested);
+            try_frame();
+        }
+
+        uint64_t due = pacer_deadline(&_ctx.pacer, _ctx.coalesce_frames,
+                                      _ctx.frame_requested);
+        if (!done && eva_time_now() >= due) {
+            eva_frame_continuous(&_ctx.pacer, &_ctx.frame_requested,
+                                 &_ctx.damage);
+            draw_frame();
         }
     }
+    eva_pipeline_shutdown();
+    eva_post_stop();
     _ctx.cleanup_fn();
+    eva_modules_shutdown();
+
+    if (_ctx.frame_timer) {
+        CloseHandle(_ctx.frame_timer);
+        _ctx.frame_timer = NULL;
+    }
 
     DestroyWindow(_ctx.hwnd);
     UnregisterClassW(L"eva", GetModuleHandleW(NULL));
@@ -135,7 +214,46 @@ void eva_run(const char    *window_title,
 
 void eva_request_frame()
 {
-    _ctx.frame_requested = true;
+    if (eva_frame_requested(EVA_RECT_FULL, _ctx.frame_requested)) {
+        _ctx.frame_requested = true;
+        _ctx.damage = EVA_RECT_FULL;
+    }
+}
+
+void eva_request_frame_rect(int32_t x, int32_t y, int32_t w, int32_t h)
+{
+    eva_rect rect = { x, y, w, h };
+    if (eva_frame_requested(rect, _ctx.frame_requested)) {
+        _ctx.frame_requested = true;
+        _ctx.damage = rect_union(_ctx.damage, rect);
+    }
+}
+
+eva_rect eva_scroll_region(eva_rect rect, int32_t dx, int32_t dy)
+{
+    rect = rect_clip(rect, _ctx.framebuffer.w, _ctx.framebuffer.h);
+    if (eva_pipeline_enabled() || rect_is_empty(rect)) {
+        eva_request_frame_rect(rect.x, rect.y, rect.w, rect.h);
+        return rect;
+    }
+
+    eva_rect exposed = eva_format_scroll(&_ctx.framebuffer, rect, dx, dy);
+
+    // While the window shows rect as it was before the scroll it can be
+    // moved with ScrollWindowEx() and only the exposed area is painted.
+    eva_rect src = rect_scroll_source(rect, dx, dy);
+    if (_ctx.window_shown && rect_is_empty(_ctx.scroll_src) &&
+        !rect_is_empty(src) && (dx == 0 || dy == 0) &&
+        rect_is_empty(rect_intersect(_ctx.damage, rect)) &&
+        !eva_layers_overlap(rect)) {
+        _ctx.scroll_src = rect;
+        _ctx.scroll_dx  = dx;
+        _ctx.scroll_dy  = dy;
+        eva_request_frame_rect(exposed.x, exposed.y, exposed.w, exposed.h);
+    } else {
+        eva_request_frame_rect(rect.x, rect.y, rect.w, rect.h);
+    }
+    return exposed;
 }
 
 uint32_t eva_get_window_width()
@@ -150,7 +268,22 @@ uint32_t eva_get_window_height()
 
 eva_framebuffer eva_get_framebuffer()
 {
-    return _ctx.framebuffer;
+    return eva_format_view(&_ctx.framebuffer);
+}
+
+void eva_set_coalesce_frames(bool coalesce)
+{
+    _ctx.coalesce_frames = coalesce;
+}
+
+void eva_set_frame_rate(uint32_t hz)
+{
+    pacer_set_rate(&_ctx.pacer, hz);
+}
+
+eva_frame_timing eva_get_frame_timing(void)
+{
+    return _ctx.pacer.timing;
 }
 
 void eva_set_init_fn(eva_init_fn init_fn)
@@ -193,11 +326,6 @@ void eva_set_key_fn(eva_key_fn key_fn)
     _ctx.key_fn = key_fn;
 }
 
-void eva_set_text_input_fn(eva_text_input_fn text_input_fn)
-{
-    _ctx.text_input_fn = text_input_fn;
-}
-
 void eva_set_window_resize_fn(eva_window_resize_fn window_resize_fn)
 {
     _ctx.window_resize_fn = window_resize_fn;
@@ -215,6 +343,20 @@ uint64_t eva_time_now()
     return qpc.QuadPart;
 }
 
+uint64_t eva_time_real_now()
+{
+    return eva_time_now();
+}
+
+uint64_t eva_time_frequency()
+{
+    // Timers can be set before eva_run() calls eva_time_init().
+    if (_ctx.ticks_per_sec.QuadPart == 0) {
+        QueryPerformanceFrequency(&_ctx.ticks_per_sec);
+    }
+    return (uint64_t)_ctx.ticks_per_sec.QuadPart;
+}
+
 uint64_t eva_time_since(uint64_t start)
 {
     return eva_time_now() - start;
@@ -242,6 +384,7 @@ float eva_time_since_ms(uint64_t start)
 
 static LRESULT CALLBACK wnd_proc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 {
+    EVA_TRACE_BEGIN("dispatch");
     if (_ctx.window_shown)
     {
         switch (uMsg) {
@@ -251,70 +394,61 @@ static LRESULT CALLBACK wnd_proc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lPa
             case WM_DPICHANGED:
                 puts("WM_DPICHANGED");
                 update_window();
-                try_frame();
+                draw_frame();
                 // Redraw?
                 break;
             case WM_PAINT:
                 handle_paint();
                 break;
+            case EVA_WM_FRAME_READY:
+                // Present what the render thread finished, then render a
+                // frame that was requested while it was busy.
+                present_pipelined();
+                try_frame();
+                break;
+            case EVA_WM_POSTED:
+                eva_post_dispatch();
+                try_frame();
+                break;
             case WM_SIZE:
+                // Resizing runs a modal loop that bypasses the message loop
+                // in eva_run, so this frame can't be coalesced.
                 handle_resize();
-                try_frame();
+                draw_frame();
                 break;
-            case WM_MOUSEMOVE:
+            case WM_MOUSEMOVE: {
+                POINTS mouse_pos = MAKEPOINTS(lParam);
+                eva_input_mouse_moved(mouse_pos.x, mouse_pos.y);
+                if (eva_pointer_batching()) {
+                    add_pointer_samples(lParam);
+                }
                 if (_ctx.mouse_moved_fn) {
-                    POINTS mouse_pos = MAKEPOINTS(lParam);
+                    eva_record_mouse_moved(mouse_pos.x, mouse_pos.y);
                     _ctx.mouse_moved_fn(mouse_pos.x, mouse_pos.y);
                     try_frame();
                 }
                 break;
+            }
+            case WM_KILLFOCUS:
+                eva_input_release_all();
+                break;
             case WM_LBUTTONDOWN:
-                if (_ctx.mouse_btn_fn) {
-                    POINTS mouse_pos = MAKEPOINTS(lParam);
-                    _ctx.mouse_btn_fn(mouse_pos.x, mouse_pos.y,
-                                      EVA_MOUSE_BTN_LEFT, EVA_INPUT_PRESSED);
-                    try_frame();
-                }
+                handle_mouse_btn(lParam, EVA_MOUSE_BTN_LEFT, EVA_INPUT_PRESSED);
                 break;
             case WM_LBUTTONUP:
-                if (_ctx.mouse_btn_fn) {
-                    POINTS mouse_pos = MAKEPOINTS(lParam);
-                    _ctx.mouse_btn_fn(mouse_pos.x, mouse_pos.y,
-                                      EVA_MOUSE_BTN_LEFT, EVA_INPUT_RELEASED);
-                    try_frame();
-                }
+                handle_mouse_btn(lParam, EVA_MOUSE_BTN_LEFT, EVA_INPUT_RELEASED);
                 break;
             case WM_RBUTTONDOWN:
-                if (_ctx.mouse_btn_fn) {
-                    POINTS mouse_pos = MAKEPOINTS(lParam);
-                    _ctx.mouse_btn_fn(mouse_pos.x, mouse_pos.y,
-                                      EVA_MOUSE_BTN_RIGHT, EVA_INPUT_PRESSED);
-                    try_frame();
-                }
+                handle_mouse_btn(lParam, EVA_MOUSE_BTN_RIGHT, EVA_INPUT_PRESSED);
                 break;
             case WM_RBUTTONUP:
-                if (_ctx.mouse_btn_fn) {
-                    POINTS mouse_pos = MAKEPOINTS(lParam);
-                    _ctx.mouse_btn_fn(mouse_pos.x, mouse_pos.y,
-                                      EVA_MOUSE_BTN_RIGHT, EVA_INPUT_RELEASED);
-                    try_frame();
-                }
+                handle_mouse_btn(lParam, EVA_MOUSE_BTN_RIGHT, EVA_INPUT_RELEASED);
                 break;
             case WM_MBUTTONDOWN:
-                if (_ctx.mouse_btn_fn) {
-                    POINTS mouse_pos = MAKEPOINTS(lParam);
-                    _ctx.mouse_btn_fn(mouse_pos.x, mouse_pos.y,
-                                      EVA_MOUSE_BTN_MIDDLE, EVA_INPUT_PRESSED);
-                    try_frame();
-                }
+                handle_mouse_btn(lParam, EVA_MOUSE_BTN_MIDDLE, EVA_INPUT_PRESSED);
                 break;
             case WM_MBUTTONUP:
-                if (_ctx.mouse_btn_fn) {
-                    POINTS mouse_pos = MAKEPOINTS(lParam);
-                    _ctx.mouse_btn_fn(mouse_pos.x, mouse_pos.y,
-                                      EVA_MOUSE_BTN_MIDDLE, EVA_INPUT_RELEASED);
-                    try_frame();
-                }
+                handle_mouse_btn(lParam, EVA_MOUSE_BTN_MIDDLE, EVA_INPUT_RELEASED);
                 break;
             default:
                 break;
@@ -322,7 +456,9 @@ static LRESULT CALLBACK wnd_proc(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lPa
         };
     }
 
-    return DefWindowProcW(hWnd, uMsg, wParam, lParam);
+    LRESULT result = DefWindowProcW(hWnd, uMsg, wParam, lParam);
+    EVA_TRACE_END();
+    return result;
 }
 
 static void update_window()
@@ -345,14 +481,31 @@ static void update_window()
         _ctx.framebuffer.h = rect.bottom - rect.top;
     }
 
+    // Coalesced and continuous frames are paced to the refresh rate of the
+    // monitor the window is on. 0 and 1 mean the hardware default.
+    MONITORINFOEXW monitor_info = {
+        .cbSize = sizeof(monitor_info)
+    };
+    DEVMODEW mode = {
+        .dmSize = sizeof(mode)
+    };
+    DWORD refresh_rate = EVA_DEFAULT_REFRESH_RATE;
+    HMONITOR window_monitor = MonitorFromWindow(_ctx.hwnd, MONITOR_DEFAULTTOPRIMARY);
+    if (GetMonitorInfoW(window_monitor, (MONITORINFO *)&monitor_info) &&
+        EnumDisplaySettingsW(monitor_info.szDevice, ENUM_CURRENT_SETTINGS, &mode) &&
+        mode.dmDisplayFrequency > 1) {
+        refresh_rate = mode.dmDisplayFrequency;
+    }
+    pacer_set_refresh(&_ctx.pacer, _ctx.ticks_per_sec.QuadPart,
+                      _ctx.ticks_per_sec.QuadPart / refresh_rate);
+
     uint32_t capacity = _ctx.framebuffer.pitch * _ctx.framebuffer.max_height;
     if (capacity == 0 ||
         _ctx.framebuffer.w > _ctx.framebuffer.pitch ||
         _ctx.framebuffer.h > _ctx.framebuffer.max_height) {
+        EVA_TRACE_BEGIN("update_window");
 
-        if (_ctx.framebuffer.pixels) {
-            free(_ctx.framebuffer.pixels);
-        }
+        eva_alloc_free(_ctx.framebuffer.pixels);
 
         // Make the framebuffer large enough to hold pixels for the entire
         // screen. This makes it unnecessary to reallocate the framebuffer
@@ -371,11 +524,12 @@ static void update_window()
         uint32_t monitor_w = max(0, mi.rcMonitor.right - mi.rcMonitor.left);
         uint32_t monitor_h = max(0, mi.rcMonitor.bottom - mi.rcMonitor.top);
 
-        _ctx.framebuffer.pitch = max(_ctx.framebuffer.w, monitor_w);
+        _ctx.framebuffer.pitch = eva_alloc_pitch(max(_ctx.framebuffer.w, monitor_w));
         _ctx.framebuffer.max_height = max(_ctx.framebuffer.h, monitor_h);
 
-        int32_t size = _ctx.framebuffer.pitch * _ctx.framebuffer.max_height;
-        _ctx.framebuffer.pixels = calloc((size_t)size, sizeof(eva_pixel));
+        _ctx.framebuffer.pixels = eva_alloc_pixels(_ctx.framebuffer.pitch,
+                                                   _ctx.framebuffer.max_height);
+        EVA_TRACE_END();
     }
 
     printf("window %d x %d\n", _ctx.window_width, _ctx.window_height);
@@ -386,15 +540,8 @@ static void update_window()
 
 static void handle_paint()
 {
-    //uint64_t start = eva_time_now();
-
-    BITMAPINFO bmi = {0};
-    bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
-    bmi.bmiHeader.biWidth = _ctx.framebuffer.pitch;
-    bmi.bmiHeader.biHeight = -(int32_t)_ctx.framebuffer.max_height;
-    bmi.bmiHeader.biPlanes = 1;
-    bmi.bmiHeader.biBitCount = 32;
-    bmi.bmiHeader.biCompression = BI_RGB;
+    EVA_TRACE_BEGIN("present");
+    uint64_t start = eva_time_now();
 
     // Get a paint DC for current window.
     // Paint DC contains the right scaling to match
@@ -402,25 +549,55 @@ static void handle_paint()
     PAINTSTRUCT ps;
     HDC hdc = BeginPaint(_ctx.hwnd, &ps);
 
-    // Draw the framebuffer to screen
-    SetDIBitsToDevice(
-            hdc,
-            0,                   // x dest
-            0,                   // y dest
-            _ctx.framebuffer.w, // width
-            _ctx.framebuffer.h, // height
-            0,                   // x src
-            0,                    // y src
-            0,                                // scanline 0
-            _ctx.framebuffer.h, // n scanlines
-            _ctx.framebuffer.pixels,          // buffer
-            &bmi,                             // buffer info
-            DIB_RGB_COLORS                    // raw colors
-            );
+    // Only copy the invalidated part of the window. This is the union of the
+    // rects requested with eva_request_frame_rect() and anything the window
+    // system needs repainted.
+    eva_rect rect = {
+        ps.rcPaint.left,
+        ps.rcPaint.top,
+        ps.rcPaint.right  - ps.rcPaint.left,
+        ps.rcPaint.bottom - ps.rcPaint.top
+    };
+    rect = rect_clip(rect, _ctx.framebuffer.w, _ctx.framebuffer.h);
+
+    if (!rect_is_empty(rect)) {
+        // The DIB starts at the first damaged row so the source y is always
+        // 0. This avoids the bottom-up origin SetDIBitsToDevice uses for y.
+        BITMAPINFO bmi = {0};
+        bmi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+        bmi.bmiHeader.biWidth = _ctx.framebuffer.pitch;
+        bmi.bmiHeader.biHeight = -rect.h;
+        bmi.bmiHeader.biPlanes = 1;
+        bmi.bmiHeader.biBitCount = 32;
+        bmi.bmiHeader.biCompression = BI_RGB;
+
+        eva_pixel *rows = _ctx.framebuffer.pixels +
+                          (size_t)rect.y * _ctx.framebuffer.pitch;
+
+        // Draw the framebuffer to screen
+        SetDIBitsToDevice(
+                hdc,
+                rect.x,              // x dest
+                rect.y,              // y dest
+                rect.w,              // width
+                rect.h,              // height
+                rect.x,              // x src
+                0,                   // y src
+                0,                   // scanline 0
+                rect.h,              // n scanlines
+                rows,                // buffer
+                &bmi,                // buffer info
+                DIB_RGB_COLORS       // raw colors
+                );
+    }
 
     EndPaint(_ctx.hwnd, &ps);
 
-    //printf("handle_paint - %.1f ms\n", eva_time_since_ms(start));
+    // Only counted while a frame is being drawn, not for repaints the window
+    // system asks for on its own.
+    eva_stats_add_present(eva_time_since(start),
+                          (uint64_t)rect.w * (uint64_t)rect.h * sizeof(eva_pixel));
+    EVA_TRACE_END();
 }
 
 static void handle_close()
@@ -450,23 +627,225 @@ static void handle_close()
 static void handle_resize()
 {
     update_window();
+    _ctx.scroll_src = EVA_RECT_EMPTY;
+    eva_record_resize(_ctx.framebuffer.w, _ctx.framebuffer.h);
     if (_ctx.window_resize_fn) {
         _ctx.window_resize_fn(_ctx.framebuffer.w, _ctx.framebuffer.h);
     }
 }
 
+static void handle_mouse_btn(LPARAM lParam, eva_mouse_btn btn, eva_input_action action)
+{
+    POINTS mouse_pos = MAKEPOINTS(lParam);
+    eva_input_mouse_btn(mouse_pos.x, mouse_pos.y, btn, action);
+    eva_pointer_button(mouse_pos.x, mouse_pos.y, btn, action,
+                       eva_pointer_time_ms((uint32_t)GetMessageTime()));
+
+    if (_ctx.mouse_btn_fn) {
+        eva_record_mouse_btn(mouse_pos.x, mouse_pos.y, btn, action);
+        _ctx.mouse_btn_fn(mouse_pos.x, mouse_pos.y, btn, action);
+        try_frame();
+    }
+}
+
+// Windows folds mouse moves that arrive faster than they are handled into
+// one WM_MOUSEMOVE. The positions in between are kept in a history of the
+// last 64 that GetMouseMovePointsEx() reads back, newest first.
+static void add_pointer_samples(LPARAM lParam)
+{
+    POINTS mouse_pos = MAKEPOINTS(lParam);
+    POINT  screen    = { mouse_pos.x, mouse_pos.y };
+    ClientToScreen(_ctx.hwnd, &screen);
+
+    MOUSEMOVEPOINT current = {
+        .x    = screen.x & 0xFFFF,
+        .y    = screen.y & 0xFFFF,
+        .time = (DWORD)GetMessageTime(),
+    };
+    MOUSEMOVEPOINT history[64];
+    int count = GetMouseMovePointsEx(sizeof(current), &current, history,
+                                     64, GMMP_USE_DISPLAY_POINTS);
+    if (count <= 0) {
+        history[0] = current;
+        count      = 1;
+    }
+
+    // Only the points after the last one that was added are new. The
+    // history from before the first move is left out.
+    int fresh = 1;
+    if (_ctx.pointer_last.time != 0) {
+        fresh = 0;
+        while (fresh < count) {
+            const MOUSEMOVEPOINT *point = &history[fresh];
+            int32_t age = (int32_t)(_ctx.pointer_last.time - point->time);
+            if (age > 0 || (age == 0 && point->x == _ctx.pointer_last.x &&
+                                        point->y == _ctx.pointer_last.y)) {
+                break;
+            }
+            fresh++;
+        }
+    }
+
+    for (int i = fresh - 1; i >= 0; i--) {
+        // Display points are 16 bit, monitors left of or above the primary
+        // one have negative coordinates.
+        POINT point = {
+            history[i].x > 32767 ? history[i].x - 65536 : history[i].x,
+            history[i].y > 32767 ? history[i].y - 65536 : history[i].y,
+        };
+        ScreenToClient(_ctx.hwnd, &point);
+        eva_pointer_moved(point.x, point.y,
+                          eva_pointer_time_ms((uint32_t)history[i].time));
+    }
+    _ctx.pointer_last = history[0];
+}
+
+static void wait_for_messages()
+{
+    // Sleep until a message arrives, or until the loop has a frame to draw
+    // or a timer to call. While the render thread is busy the next frame
+    // can't be drawn before it posts EVA_WM_FRAME_READY.
+    uint64_t due = pacer_deadline(&_ctx.pacer, _ctx.coalesce_frames,
+                                  _ctx.frame_requested);
+    if (eva_pipeline_enabled() && !eva_pipeline_ready()) {
+        due = UINT64_MAX;
+    }
+    if (eva_timers_deadline() < due) {
+        due = eva_timers_deadline();
+    }
+    if (due == UINT64_MAX) {
+        MsgWaitForMultipleObjects(0, NULL, FALSE, INFINITE, QS_ALLINPUT);
+        return;
+    }
+
+    uint64_t now = eva_time_now();
+    if (now >= due) {
+        return;
+    }
+
+    // Timers can be days away, the loop wakes up at least once an hour so the
+    // conversions below can't overflow.
+    uint64_t hour = (uint64_t)_ctx.ticks_per_sec.QuadPart * 3600;
+    if (due - now > hour) {
+        due = now + hour;
+    }
+
+    // The timeout of MsgWaitForMultipleObjects is only as precise as the
+    // scheduler tick, the waitable timer fires on time.
+    LARGE_INTEGER delay;
+    delay.QuadPart = -(LONGLONG)((due - now) * 10000000 /
+                                 (uint64_t)_ctx.ticks_per_sec.QuadPart);
+    if (_ctx.frame_timer &&
+        SetWaitableTimer(_ctx.frame_timer, &delay, 0, NULL, NULL, FALSE)) {
+        MsgWaitForMultipleObjects(1, &_ctx.frame_timer, FALSE, INFINITE,
+                                  QS_ALLINPUT);
+    } else {
+        DWORD timeout = (DWORD)(((due - now) * 1000 + _ctx.ticks_per_sec.QuadPart - 1) /
+                                _ctx.ticks_per_sec.QuadPart);
+        MsgWaitForMultipleObjects(0, NULL, FALSE, timeout, QS_ALLINPUT);
+    }
+}
+
 static void try_frame()
 {
-    if (_ctx.frame_requested) {
-        if (_ctx.frame_fn) {
-            _ctx.frame_fn(&_ctx.framebuffer);
+    // Coalesced and continuous frames are drawn by the message loop once the
+    // queue is empty.
+    if (!pacer_owns_frames(&_ctx.pacer, _ctx.coalesce_frames)) {
+        EVA_TRACE_BEGIN("try_frame");
+        draw_frame();
+        EVA_TRACE_END();
+    }
+}
+
+static void draw_frame()
+{
+    // The input state is taken and pointer samples go out right before the
+    // frame, so what the application requests from them is drawn with it.
+    if (_ctx.frame_requested && (!eva_pipeline_enabled() || eva_pipeline_ready())) {
+        eva_input_begin_frame();
+        eva_pointer_flush();
+    }
+
+    if (_ctx.frame_requested && eva_pipeline_enabled()) {
+        // Drawn once the render thread is done with the previous frame.
+        if (eva_pipeline_ready()) {
+            _ctx.frame_requested = false;
+            pacer_begin_frame(&_ctx.pacer, eva_time_now());
+            eva_pipeline_submit(_ctx.frame_fn, &_ctx.framebuffer, _ctx.damage);
+            _ctx.damage = EVA_RECT_EMPTY;
         }
+        return;
+    }
+
+    if (_ctx.frame_requested) {
+        _ctx.frame_requested = false;
+
+        eva_stats_begin_frame();
+        pacer_begin_frame(&_ctx.pacer, eva_time_now());
+        present_frame(eva_tiles_render(_ctx.frame_fn, &_ctx.framebuffer, _ctx.damage));
+        _ctx.damage = EVA_RECT_EMPTY;
+        pacer_end_frame(&_ctx.pacer, eva_time_now());
+        eva_stats_end_frame();
+    }
+}
 
-        InvalidateRect(_ctx.hwnd, NULL, FALSE);
+static void present_frame(eva_rect damage)
+{
+    if (!rect_is_empty(_ctx.scroll_src)) {
+        // Moves the pixels on screen, anything that couldn't be moved
+        // because it was obscured is invalidated along with damage.
+        RECT scroll = {
+            _ctx.scroll_src.x,
+            _ctx.scroll_src.y,
+            _ctx.scroll_src.x + _ctx.scroll_src.w,
+            _ctx.scroll_src.y + _ctx.scroll_src.h
+        };
+        ScrollWindowEx(_ctx.hwnd, _ctx.scroll_dx, _ctx.scroll_dy,
+                       &scroll, &scroll, NULL, NULL, SW_INVALIDATE);
+        _ctx.scroll_src = EVA_RECT_EMPTY;
+    }
+
+    // Only invalidate what the application changed, handle_paint copies
+    // no more than the invalidated region.
+    damage = rect_clip(damage, _ctx.framebuffer.w, _ctx.framebuffer.h);
+    if (!rect_is_empty(damage)) {
+        RECT rect = {
+            damage.x,
+            damage.y,
+            damage.x + damage.w,
+            damage.y + damage.h
+        };
+        InvalidateRect(_ctx.hwnd, &rect, FALSE);
         UpdateWindow(_ctx.hwnd); // Force WM_PAINT immediately
     }
 }
 
+static void present_pipelined()
+{
+    if (!eva_pipeline_frame_ready()) {
+        return;
+    }
+
+    eva_rect damage;
+    eva_stats_begin_frame();
+    eva_pipeline_present(&_ctx.framebuffer, &damage);
+    present_frame(damage);
+    pacer_end_frame(&_ctx.pacer, eva_time_now());
+    eva_stats_end_frame();
+}
+
+static void wake_event_loop()
+{
+    // Called from the render thread, PostMessage can be called from any
+    // thread.
+    PostMessageW(_ctx.hwnd, EVA_WM_FRAME_READY, 0, 0);
+}
+
+static void wake_posted()
+{
+    PostMessageW(_ctx.hwnd, EVA_WM_POSTED, 0, 0);
+}
+
 static bool utf8_to_utf16(const char* src, wchar_t* dst, int dst_num_bytes)
 {
     assert(src && dst && (dst_num_bytes > 1));
@@ -0,0 +1,1298 @@
+#define _GNU_SOURCE // ppoll, pipe2, SHM_HUGETLB, MADV_HUGEPAGE
+
+#include "eva.h"
+#include "eva_internal.h"
+#include "eva_trace.h"
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/Xresource.h>
+#include <X11/keysym.h>
+#include <X11/extensions/XShm.h>
+#ifdef EVA_XRANDR
+#include <X11/extensions/Xrandr.h>
+#endif
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <sys/ipc.h>
+#include <sys/mman.h>
+#include <sys/shm.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define EVA_DEFAULT_REFRESH_RATE 60
+
+static void update_window(void);
+static bool create_image(void);
+static void destroy_image(void);
+static void destroy_window(void);
+static void handle_event(XEvent *event);
+static void handle_close(void);
+static void handle_resize(uint32_t w, uint32_t h);
+static void handle_text_input(XKeyEvent *event, eva_mod_flags mods);
+static bool try_frame(void);
+static bool draw_frame(void);
+static void wait_for_events(void);
+static void wake_event_loop(void);
+static void present_pipelined(void);
+static void present(eva_rect rect);
+static void wait_for_present(void);
+static float query_dpi_scale(void);
+static eva_key translate_key(XKeyEvent *event);
+static eva_mod_flags translate_mod_flags(unsigned int state);
+
+typedef struct eva_ctx {
+    eva_framebuffer framebuffer;
+    uint32_t window_width, window_height;
+
+    const char *window_title;
+    bool        quit_requested;
+    bool        quit_ordered;
+
+    eva_init_fn        init_fn;
+    eva_frame_fn       frame_fn;
+    eva_cleanup_fn     cleanup_fn;
+    eva_cancel_quit_fn cancel_quit_fn;
+    eva_fail_fn        fail_fn;
+
+    eva_mouse_moved_fn   mouse_moved_fn;
+    eva_mouse_btn_fn     mouse_btn_fn;
+    eva_scroll_fn        scroll_fn;
+    eva_key_fn           key_fn;
+    eva_window_resize_fn window_resize_fn;
+
+    Display *display;
+    int      screen;
+    Visual  *visual;
+    int      depth;
+    Window   window;
+    GC       gc;
+    Atom     wm_protocols;
+    Atom     wm_delete_window;
+    XIM      im;
+    XIC      ic;
+
+    // The image shares its pixels with the framebuffer. With MIT-SHM the
+    // pixels live in a shared memory segment that the X server reads from
+    // directly, otherwise they are sent through the socket by XPutImage.
+    XImage         *image;
+    XShmSegmentInfo shm_info;
+    bool            shm_available;
+    bool            shm_attached;
+    int             shm_completion_event;
+    bool            shm_present_pending; // Server may still be reading pixels
+
+    eva_rect damage; // Union of the rects requested for the next frame
+
+    // Part of the window the server moves by scroll_dx, scroll_dy before the
+    // next present, set by eva_scroll_region().
+    eva_rect scroll_src;
+    int32_t  scroll_dx;
+    int32_t  scroll_dy;
+
+    eva_frame_pacer pacer;
+
+    // The pipeline render thread writes to the pipe once a frame is ready.
+    int wake_fds[2];
+
+    bool window_mapped;
+    bool request_frame;
+    bool coalesce_frames;
+} eva_ctx;
+
+static eva_ctx _ctx;
+static bool    _shm_attach_failed;
+
+void eva_run(const char     *window_title,
+             eva_frame_fn    frame_fn,
+             eva_fail_fn     fail_fn)
+{
+    assert(window_title);
+    assert(frame_fn);
+    assert(fail_fn);
+
+    eva_time_init();
+    eva_trace_set_thread_name("eva event loop");
+
+    _ctx.window_title = window_title;
+    _ctx.frame_fn     = frame_fn;
+    _ctx.fail_fn      = fail_fn;
+
+    XrmInitialize();
+
+    _ctx.display = XOpenDisplay(NULL);
+    if (_ctx.display == NULL) {
+        _ctx.fail_fn(0, "Failed to open X display");
+        return;
+    }
+
+    _ctx.screen = DefaultScreen(_ctx.display);
+    _ctx.visual = DefaultVisual(_ctx.display, _ctx.screen);
+    _ctx.depth  = DefaultDepth(_ctx.display, _ctx.screen);
+
+    // eva_pixel is BGRA in memory which is what a little-endian 24/32 bit
+    // TrueColor visual expects. Anything else would need a conversion.
+    if (_ctx.visual->class != TrueColor ||
+        _ctx.depth < 24 ||
+        _ctx.visual->red_mask   != 0xff0000 ||
+        _ctx.visual->green_mask != 0x00ff00 ||
+        _ctx.visual->blue_mask  != 0x0000ff) {
+        _ctx.fail_fn(0, "Unsupported X visual, need 24 bit BGRX TrueColor");
+        XCloseDisplay(_ctx.display);
+        return;
+    }
+
+    int shm_major, shm_minor;
+    Bool shm_pixmaps;
+    _ctx.shm_available = XShmQueryVersion(_ctx.display, &shm_major, &shm_minor,
+                                          &shm_pixmaps);
+    if (_ctx.shm_available) {
+        _ctx.shm_completion_event = XShmGetEventBase(_ctx.display) + ShmCompletion;
+    }
+
+    Window root = RootWindow(_ctx.display, _ctx.screen);
+
+    // Coalesced frames are paced to the refresh rate of the screen.
+    uint32_t refresh_rate = EVA_DEFAULT_REFRESH_RATE;
+#ifdef EVA_XRANDR
+    XRRScreenConfiguration *screen_config = XRRGetScreenInfo(_ctx.display, root);
+    if (screen_config) {
+        short rate = XRRConfigCurrentRate(screen_config);
+        if (rate > 0) {
+            refresh_rate = (uint32_t)rate;
+        }
+        XRRFreeScreenConfigInfo(screen_config);
+    }
+#endif
+    pacer_set_refresh(&_ctx.pacer, 1000000000ull, 1000000000ull / refresh_rate);
+
+    uint32_t screen_w = (uint32_t)DisplayWidth(_ctx.display, _ctx.screen);
+    uint32_t screen_h = (uint32_t)DisplayHeight(_ctx.display, _ctx.screen);
+
+    XSetWindowAttributes attributes = {
+        .background_pixmap = None,
+        .event_mask        = ExposureMask          |
+                             StructureNotifyMask   |
+                             KeyPressMask          |
+                             KeyReleaseMask        |
+                             ButtonPressMask       |
+                             ButtonReleaseMask     |
+                             PointerMotionMask     |
+                             FocusChangeMask,
+    };
+
+    _ctx.window = XCreateWindow(_ctx.display, root,
+                                0, 0,
+                                (unsigned int)(screen_w * 0.8f),
+                                (unsigned int)(screen_h * 0.8f),
+                                0,
+                                _ctx.depth,
+                                InputOutput,
+                                _ctx.visual,
+                                CWBackPixmap | CWEventMask,
+                                &attributes);
+
+    XStoreName(_ctx.display, _ctx.window, window_title);
+    Atom net_wm_name = XInternAtom(_ctx.display, "_NET_WM_NAME", False);
+    Atom utf8_string = XInternAtom(_ctx.display, "UTF8_STRING", False);
+    XChangeProperty(_ctx.display, _ctx.window, net_wm_name, utf8_string, 8,
+                    PropModeReplace, (const unsigned char *)window_title,
+                    (int)strlen(window_title));
+
+    _ctx.wm_protocols     = XInternAtom(_ctx.display, "WM_PROTOCOLS", False);
+    _ctx.wm_delete_window = XInternAtom(_ctx.display, "WM_DELETE_WINDOW", False);
+    XSetWMProtocols(_ctx.display, _ctx.window, &_ctx.wm_delete_window, 1);
+
+    _ctx.gc = XCreateGC(_ctx.display, _ctx.window, 0, NULL);
+
+    _ctx.im = XOpenIM(_ctx.display, NULL, NULL, NULL);
+    if (_ctx.im) {
+        _ctx.ic = XCreateIC(_ctx.im,
+                            XNInputStyle, XIMPreeditNothing | XIMStatusNothing,
+                            XNClientWindow, _ctx.window,
+                            XNFocusWindow, _ctx.window,
+                            NULL);
+    }
+
+    update_window();
+    if (_ctx.framebuffer.pixels == NULL) {
+        _ctx.fail_fn(0, "Failed to create framebuffer image");
+        destroy_window();
+        return;
+    }
+
+    _ctx.wake_fds[0] = -1;
+    _ctx.wake_fds[1] = -1;
+    if (pipe2(_ctx.wake_fds, O_NONBLOCK | O_CLOEXEC) != 0) {
+        _ctx.wake_fds[0] = -1;
+        _ctx.wake_fds[1] = -1;
+    }
+    eva_post_start(_ctx.wake_fds[1] != -1 ? wake_event_loop : NULL);
+
+    eva_stats_reset();
+    if (_ctx.init_fn) {
+        _ctx.init_fn();
+    }
+
+    // Let the application fill it's framebuffer before showing the window.
+    eva_stats_begin_frame();
+    pacer_begin_frame(&_ctx.pacer, eva_time_now());
+    eva_tiles_render(_ctx.frame_fn, &_ctx.framebuffer, EVA_RECT_FULL);
+    eva_stats_end_frame();
+
+    XMapWindow(_ctx.display, _ctx.window);
+    XFlush(_ctx.display);
+
+    if (_ctx.wake_fds[1] != -1) {
+        eva_pipeline_start(wake_event_loop);
+    }
+
+    while (!_ctx.quit_ordered) {
+        wait_for_events();
+
+        // Handle everything that is queued before a coalesced or continuous
+        // frame is drawn.
+        while (!_ctx.quit_ordered && XPending(_ctx.display)) {
+            XEvent event;
+            XNextEvent(_ctx.display, &event);
+
+            if (XFilterEvent(&event, None)) {
+                continue;
+            }
+
+            EVA_TRACE_BEGIN("dispatch");
+            handle_event(&event);
+            EVA_TRACE_END();
+        }
+        eva_post_dispatch();
+        eva_timers_run(eva_time_now());
+
+        eva_frame_idle(&_ctx.pacer, _ctx.request_frame);
+
+        // Present what the render thread finished, then draw a frame that
+        // was requested while it was busy.
+        present_pipelined();
+        try_frame();
+
+        uint64_t due = pacer_deadline(&_ctx.pacer, _ctx.coalesce_frames,
+                                      _ctx.request_frame);
+        if (!_ctx.quit_ordered && eva_time_now() >= due) {
+            eva_frame_continuous(&_ctx.pacer, &_ctx.request_frame,
+                                 &_ctx.damage);
+            draw_frame();
+        }
+    }
+
+    eva_pipeline_shutdown();
+    eva_post_stop();
+    if (_ctx.wake_fds[0] != -1) {
+        close(_ctx.wake_fds[0]);
+        close(_ctx.wake_fds[1]);
+    }
+
+    if (_ctx.cleanup_fn) {
+        _ctx.cleanup_fn();
+    }
+    eva_modules_shutdown();
+
+    wait_for_present();
+    destroy_image();
+    destroy_window();
+}
+
+void eva_request_frame(void)
+{
+    if (eva_frame_requested(EVA_RECT_FULL, _ctx.request_frame)) {
+        _ctx.request_frame = true;
+        _ctx.damage = EVA_RECT_FULL;
+    }
+}
+
+void eva_request_frame_rect(int32_t x, int32_t y, int32_t w, int32_t h)
+{
+    eva_rect rect = { x, y, w, h };
+    if (eva_frame_requested(rect, _ctx.request_frame)) {
+        _ctx.request_frame = true;
+        _ctx.damage = rect_union(_ctx.damage, rect);
+    }
+}
+
+eva_rect eva_scroll_region(eva_rect rect, int32_t dx, int32_t dy)
+{
+    rect = rect_clip(rect, _ctx.framebuffer.w, _ctx.framebuffer.h);
+    if (eva_pipeline_enabled() || rect_is_empty(rect)) {
+        eva_request_frame_rect(rect.x, rect.y, rect.w, rect.h);
+        return rect;
+    }
+
+    // The server may still be reading the pixels that are about to move.
+    wait_for_present();
+    eva_rect exposed = eva_format_scroll(&_ctx.framebuffer, rect, dx, dy);
+
+    // While the window shows rect as it was before the scroll the server can
+    // move it with XCopyArea() and only the exposed area has to be sent.
+    eva_rect src = rect_scroll_source(rect, dx, dy);
+    if (_ctx.window_mapped && rect_is_empty(_ctx.scroll_src) &&
+        !rect_is_empty(src) && (dx == 0 || dy == 0) &&
+        rect_is_empty(rect_intersect(_ctx.damage, rect)) &&
+        !eva_layers_overlap(rect)) {
+        _ctx.scroll_src = src;
+        _ctx.scroll_dx  = dx;
+        _ctx.scroll_dy  = dy;
+        eva_request_frame_rect(exposed.x, exposed.y, exposed.w, exposed.h);
+    } else {
+        eva_request_frame_rect(rect.x, rect.y, rect.w, rect.h);
+    }
+    return exposed;
+}
+
+uint32_t eva_get_window_width(void)
+{
+    return _ctx.window_width;
+}
+
+uint32_t eva_get_window_height(void)
+{
+    return _ctx.window_height;
+}
+
+eva_framebuffer eva_get_framebuffer(void)
+{
+    return eva_format_view(&_ctx.framebuffer);
+}
+
+void eva_set_coalesce_frames(bool coalesce)
+{
+    _ctx.coalesce_frames = coalesce;
+}
+
+void eva_set_frame_rate(uint32_t hz)
+{
+    pacer_set_rate(&_ctx.pacer, hz);
+}
+
+eva_frame_timing eva_get_frame_timing(void)
+{
+    return _ctx.pacer.timing;
+}
+
+void eva_set_init_fn(eva_init_fn init_fn)
+{
+    _ctx.init_fn = init_fn;
+}
+
+void eva_set_cleanup_fn(eva_cleanup_fn cleanup_fn)
+{
+    _ctx.cleanup_fn = cleanup_fn;
+}
+
+void eva_set_cancel_quit_fn(eva_cancel_quit_fn cancel_quit_fn)
+{
+    _ctx.cancel_quit_fn = cancel_quit_fn;
+}
+
+void eva_set_mouse_moved_fn(eva_mouse_moved_fn mouse_moved_fn)
+{
+    _ctx.mouse_moved_fn = mouse_moved_fn;
+}
+
+void eva_set_mouse_btn_fn(eva_mouse_btn_fn mouse_btn_fn)
+{
+    _ctx.mouse_btn_fn = mouse_btn_fn;
+}
+
+void eva_set_scroll_fn(eva_scroll_fn scroll_fn)
+{
+    _ctx.scroll_fn = scroll_fn;
+}
+
+void eva_set_key_fn(eva_key_fn key_fn)
+{
+    _ctx.key_fn = key_fn;
+}
+
+void eva_set_window_resize_fn(eva_window_resize_fn window_resize_fn)
+{
+    _ctx.window_resize_fn = window_resize_fn;
+}
+
+static void update_window(void)
+{
+    XWindowAttributes attributes;
+    XGetWindowAttributes(_ctx.display, _ctx.window, &attributes);
+
+    // X11 has no logical coordinates, the window is always sized in pixels.
+    _ctx.window_width  = (uint32_t)attributes.width;
+    _ctx.window_height = (uint32_t)attributes.height;
+
+    _ctx.framebuffer.w = _ctx.window_width;
+    _ctx.framebuffer.h = _ctx.window_height;
+
+    _ctx.framebuffer.scale_x = query_dpi_scale();
+    _ctx.framebuffer.scale_y = _ctx.framebuffer.scale_x;
+
+    uint32_t capacity = _ctx.framebuffer.pitch * _ctx.framebuffer.max_height;
+    if (capacity == 0 ||
+        _ctx.framebuffer.w > _ctx.framebuffer.pitch ||
+        _ctx.framebuffer.h > _ctx.framebuffer.max_height) {
+        EVA_TRACE_BEGIN("update_window");
+
+        // The server may still be reading from the old segment.
+        wait_for_present();
+        destroy_image();
+
+        // Make the framebuffer large enough to hold pixels for the entire
+        // screen. This makes it unnecessary to reallocate the framebuffer
+        // (and the shared memory segment) when the window is resized. It
+        // should only need to be resized when the screen grows.
+        uint32_t screen_w = (uint32_t)DisplayWidth(_ctx.display, _ctx.screen);
+        uint32_t screen_h = (uint32_t)DisplayHeight(_ctx.display, _ctx.screen);
+
+        _ctx.framebuffer.pitch = eva_alloc_pitch(_ctx.framebuffer.w > screen_w ?
+                                                 _ctx.framebuffer.w : screen_w);
+        _ctx.framebuffer.max_height = _ctx.framebuffer.h > screen_h ?
+                                      _ctx.framebuffer.h : screen_h;
+
+        if (!create_image()) {
+            _ctx.framebuffer.pitch      = 0;
+            _ctx.framebuffer.max_height = 0;
+        }
+        EVA_TRACE_END();
+    }
+}
+
+static int handle_shm_attach_error(Display *display, XErrorEvent *error)
+{
+    (void)display;
+    (void)error;
+    _shm_attach_failed = true;
+    return 0;
+}
+
+// Creates the shared memory segment for the framebuffer, with huge pages
+// when they were asked for.
+static int create_segment(size_t size)
+{
+    eva_huge_pages huge_pages = eva_alloc_huge_pages();
+    if (huge_pages == EVA_HUGE_PAGES_EXPLICIT && size >= EVA_HUGE_PAGE_SIZE) {
+        int shmid = shmget(IPC_PRIVATE, eva_alloc_huge_size(size),
+                           IPC_CREAT | SHM_HUGETLB | 0600);
+        if (shmid != -1) {
+            return shmid;
+        }
+    }
+
+    return shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+}
+
+static bool create_image(void)
+{
+    uint32_t w = _ctx.framebuffer.pitch;
+    uint32_t h = _ctx.framebuffer.max_height;
+    size_t size = (size_t)w * h * sizeof(eva_pixel);
+
+    if (_ctx.shm_available) {
+        _ctx.image = XShmCreateImage(_ctx.display, _ctx.visual,
+                                     (unsigned int)_ctx.depth, ZPixmap, NULL,
+                                     &_ctx.shm_info, w, h);
+        if (_ctx.image) {
+            _ctx.shm_info.shmid = create_segment(size);
+            if (_ctx.shm_info.shmid != -1) {
+                _ctx.shm_info.shmaddr  = shmat(_ctx.shm_info.shmid, NULL, 0);
+                _ctx.shm_info.readOnly = False;
+                _ctx.image->data       = _ctx.shm_info.shmaddr;
+
+                // Segments are shmem, which only uses transparent huge pages
+                // when /sys/kernel/mm/transparent_hugepage/shmem_enabled
+                // allows it.
+                if (_ctx.shm_info.shmaddr != (char *)-1 &&
+                    eva_alloc_huge_pages() != EVA_HUGE_PAGES_OFF) {
+                    madvise(_ctx.shm_info.shmaddr, size, MADV_HUGEPAGE);
+                }
+
+                // Attaching fails asynchronously when the server is remote,
+                // so sync with a temporary error handler to find out.
+                _shm_attach_failed = false;
+                XErrorHandler prev_handler = XSetErrorHandler(handle_shm_attach_error);
+                if (_ctx.shm_info.shmaddr != (char *)-1) {
+                    XShmAttach(_ctx.display, &_ctx.shm_info);
+                    XSync(_ctx.display, False);
+                } else {
+                    _shm_attach_failed = true;
+                }
+                XSetErrorHandler(prev_handler);
+
+                // Mark for removal now, the segment stays alive until both
+                // eva and the server have detached from it.
+                shmctl(_ctx.shm_info.shmid, IPC_RMID, NULL);
+
+                if (!_shm_attach_failed) {
+                    _ctx.shm_attached = true;
+                    _ctx.framebuffer.pixels = (eva_pixel *)_ctx.shm_info.shmaddr;
+                    memset(_ctx.framebuffer.pixels, 0, size);
+                    return true;
+                }
+
+                if (_ctx.shm_info.shmaddr != (char *)-1) {
+                    shmdt(_ctx.shm_info.shmaddr);
+                }
+            }
+
+            _ctx.image->data = NULL;
+            XDestroyImage(_ctx.image);
+            _ctx.image = NULL;
+        }
+
+        // Don't try again on the next resize.
+        _ctx.shm_available = false;
+    }
+
+    // Fall back to sending the pixels through the socket with XPutImage.
+    eva_pixel *pixels = eva_alloc_pixels(w, h);
+    if (pixels == NULL) {
+        return false;
+    }
+
+    _ctx.image = XCreateImage(_ctx.display, _ctx.visual,
+                              (unsigned int)_ctx.depth, ZPixmap, 0,
+                              (char *)pixels, w, h,
+                              32, (int)(w * sizeof(eva_pixel)));
+    if (_ctx.image == NULL) {
+        eva_alloc_free(pixels);
+        return false;
+    }
+
+    _ctx.framebuffer.pixels = pixels;
+    return true;
+}
+
+static void destroy_image(void)
+{
+    if (_ctx.image == NULL) {
+        return;
+    }
+
+    if (_ctx.shm_attached) {
+        XShmDetach(_ctx.display, &_ctx.shm_info);
+        XSync(_ctx.display, False);
+        shmdt(_ctx.shm_info.shmaddr);
+        _ctx.shm_attached = false;
+
+    } else {
+        eva_alloc_free(_ctx.framebuffer.pixels);
+    }
+
+    // The pixels are owned by the segment or by eva, not by Xlib.
+    _ctx.image->data = NULL;
+    XDestroyImage(_ctx.image);
+    _ctx.image = NULL;
+    _ctx.framebuffer.pixels = NULL;
+}
+
+// Releases what eva_run() created for the window and closes the display.
+static void destroy_window(void)
+{
+    if (_ctx.ic) {
+        XDestroyIC(_ctx.ic);
+        _ctx.ic = NULL;
+    }
+    if (_ctx.im) {
+        XCloseIM(_ctx.im);
+        _ctx.im = NULL;
+    }
+    XFreeGC(_ctx.display, _ctx.gc);
+    XDestroyWindow(_ctx.display, _ctx.window);
+    XCloseDisplay(_ctx.display);
+    _ctx.display = NULL;
+}
+
+static void handle_event(XEvent *event)
+{
+    if (event->type == _ctx.shm_completion_event && _ctx.shm_available) {
+        _ctx.shm_present_pending = false;
+        return;
+    }
+
+    switch (event->type) {
+        case ClientMessage:
+            if (event->xclient.message_type == _ctx.wm_protocols &&
+                (Atom)event->xclient.data.l[0] == _ctx.wm_delete_window) {
+                handle_close();
+            }
+            break;
+        case MapNotify:
+            _ctx.window_mapped = true;
+            break;
+        case UnmapNotify:
+            _ctx.window_mapped = false;
+            break;
+        case Expose:
+            // Only present once for a batch of expose events.
+            if (event->xexpose.count == 0) {
+                present(EVA_RECT_FULL);
+            }
+            break;
+        case GraphicsExpose:
+            // The part of a scroll the server couldn't move because it was
+            // obscured.
+            present((eva_rect){
+                event->xgraphicsexpose.x,
+                event->xgraphicsexpose.y,
+                event->xgraphicsexpose.width,
+                event->xgraphicsexpose.height
+            });
+            break;
+        case ConfigureNotify:
+            if ((uint32_t)event->xconfigure.width  != _ctx.window_width ||
+                (uint32_t)event->xconfigure.height != _ctx.window_height) {
+                handle_resize((uint32_t)event->xconfigure.width,
+                              (uint32_t)event->xconfigure.height);
+                try_frame();
+            }
+            break;
+        case MotionNotify:
+            eva_input_mouse_moved(event->xmotion.x, event->xmotion.y);
+            if (eva_pointer_batching()) {
+                eva_pointer_moved(event->xmotion.x, event->xmotion.y,
+                                  eva_pointer_time_ms((uint32_t)event->xmotion.time));
+            }
+            if (_ctx.mouse_moved_fn) {
+                eva_record_mouse_moved(event->xmotion.x, event->xmotion.y);
+                _ctx.mouse_moved_fn(event->xmotion.x, event->xmotion.y);
+                try_frame();
+            }
+            break;
+        case ButtonPress:
+        case ButtonRelease: {
+            eva_input_action action = event->type == ButtonPress ?
+                                      EVA_INPUT_PRESSED : EVA_INPUT_RELEASED;
+            double x = event->xbutton.x;
+            double y = event->xbutton.y;
+
+            switch (event->xbutton.button) {
+                case Button1:
+                case Button2:
+                case Button3: {
+                    eva_mouse_btn btn =
+                        event->xbutton.button == Button1 ? EVA_MOUSE_BTN_LEFT   :
+                        event->xbutton.button == Button2 ? EVA_MOUSE_BTN_MIDDLE :
+                                                           EVA_MOUSE_BTN_RIGHT;
+                    eva_input_mouse_btn(x, y, btn, action);
+                    eva_pointer_button(x, y, btn, action,
+                                       eva_pointer_time_ms((uint32_t)event->xbutton.time));
+                    if (_ctx.mouse_btn_fn) {
+                        eva_record_mouse_btn(x, y, btn, action);
+                        _ctx.mouse_btn_fn(x, y, btn, action);
+                    }
+                    break;
+                }
+                // Scrolling is reported as presses of buttons 4-7.
+                case Button4:
+                case Button5:
+                case 6:
+                case 7:
+                    if (action == EVA_INPUT_PRESSED) {
+                        double delta_x = 0.0;
+                        double delta_y = 0.0;
+                        if (event->xbutton.button == Button4) delta_y =  1.0;
+                        if (event->xbutton.button == Button5) delta_y = -1.0;
+                        if (event->xbutton.button == 6)       delta_x =  1.0;
+                        if (event->xbutton.button == 7)       delta_x = -1.0;
+                        eva_input_scroll(delta_x, delta_y);
+                        if (_ctx.scroll_fn) {
+                            eva_record_scroll(delta_x, delta_y);
+                            _ctx.scroll_fn(delta_x, delta_y);
+                        }
+                    }
+                    break;
+                default:
+                    break;
+            }
+            try_frame();
+            break;
+        }
+        case KeyPress: {
+            eva_key key = translate_key(&event->xkey);
+            eva_mod_flags mods = translate_mod_flags(event->xkey.state);
+            eva_input_key(key, EVA_INPUT_PRESSED, mods);
+            if (_ctx.key_fn) {
+                eva_record_key(key, EVA_INPUT_PRESSED, mods);
+                _ctx.key_fn(key, EVA_INPUT_PRESSED, mods);
+            }
+            handle_text_input(&event->xkey, mods);
+            try_frame();
+            break;
+        }
+        case KeyRelease: {
+            // Key repeat sends a release immediately followed by a press
+            // with the same timestamp. Report only the presses.
+            if (XEventsQueued(_ctx.display, QueuedAfterReading)) {
+                XEvent next;
+                XPeekEvent(_ctx.display, &next);
+                if (next.type == KeyPress &&
+                    next.xkey.time == event->xkey.time &&
+                    next.xkey.keycode == event->xkey.keycode) {
+                    break;
+                }
+            }
+
+            eva_key key = translate_key(&event->xkey);
+            eva_mod_flags mods = translate_mod_flags(event->xkey.state);
+            eva_input_key(key, EVA_INPUT_RELEASED, mods);
+            if (_ctx.key_fn) {
+                eva_record_key(key, EVA_INPUT_RELEASED, mods);
+                _ctx.key_fn(key, EVA_INPUT_RELEASED, mods);
+            }
+            try_frame();
+            break;
+        }
+        case FocusIn:
+            if (_ctx.ic) {
+                XSetICFocus(_ctx.ic);
+            }
+            break;
+        case FocusOut:
+            if (_ctx.ic) {
+                XUnsetICFocus(_ctx.ic);
+            }
+            eva_input_release_all();
+            break;
+        default:
+            break;
+    }
+}
+
+static void handle_close(void)
+{
+    // only give user-code a chance to intervene when eva_quit() wasn't already
+    // called
+    if (!_ctx.quit_ordered) {
+        // if window should be closed and event handling is enabled, give user
+        // code a chance to intervene via eva_cancel_quit()
+        _ctx.quit_requested = true;
+
+        if (_ctx.cancel_quit_fn) {
+            // See if the user code wants to cancel the quit sequence.
+            _ctx.quit_requested = !_ctx.cancel_quit_fn();
+        }
+
+        // user code hasn't intervened, quit the app
+        if (_ctx.quit_requested) {
+            _ctx.quit_ordered = true;
+        }
+    }
+}
+
+static void handle_resize(uint32_t w, uint32_t h)
+{
+    (void)w;
+    (void)h;
+
+    update_window();
+    eva_record_resize(_ctx.framebuffer.w, _ctx.framebuffer.h);
+    if (_ctx.window_resize_fn) {
+        _ctx.window_resize_fn(_ctx.framebuffer.w, _ctx.framebuffer.h);
+    }
+
+    // The server has to be sent everything again after a resize.
+    _ctx.damage     = EVA_RECT_FULL;
+    _ctx.scroll_src = EVA_RECT_EMPTY;
+}
+
+static void handle_text_input(XKeyEvent *event, eva_mod_flags mods)
+{
+    if (!eva_text_input_wanted()) {
+        return;
+    }
+
+    char buffer[128];
+    char *text = buffer;
+    int len;
+    Status status = XLookupNone;
+
+    if (_ctx.ic) {
+        len = Xutf8LookupString(_ctx.ic, event, buffer, sizeof(buffer) - 1,
+                                NULL, &status);
+        if (status == XBufferOverflow) {
+            text = malloc((size_t)len + 1);
+            if (text == NULL) {
+                return;
+            }
+            len = Xutf8LookupString(_ctx.ic, event, text, len, NULL, &status);
+        }
+        if (status != XLookupChars && status != XLookupBoth) {
+            len = 0;
+        }
+    } else {
+        // Latin-1 is a subset of UTF-16 but not of UTF-8, so only accept
+        // plain ASCII without an input method.
+        len = XLookupString(event, buffer, sizeof(buffer) - 1, NULL, NULL);
+        for (int i = 0; i < len; i++) {
+            if ((unsigned char)buffer[i] > 127) {
+                len = 0;
+            }
+        }
+    }
+
+    if (len > 0) {
+        eva_text_input_utf8(text, (uint32_t)len, mods);
+    }
+
+    if (text != buffer) {
+        free(text);
+    }
+}
+
+static void wait_for_events(void)
+{
+    if (XPending(_ctx.display) || eva_pipeline_frame_ready()) {
+        return;
+    }
+
+    // Block until the server sends something, or until the event loop has
+    // a frame to draw or a timer to call. While the render thread is busy
+    // the next frame can't be drawn before it wakes the loop.
+    struct timespec  timeout;
+    struct timespec *timeout_ptr = NULL;
+
+    uint64_t due = pacer_deadline(&_ctx.pacer, _ctx.coalesce_frames,
+                                  _ctx.request_frame);
+    if (eva_pipeline_enabled() && !eva_pipeline_ready()) {
+        due = UINT64_MAX;
+    }
+    if (eva_timers_deadline() < due) {
+        due = eva_timers_deadline();
+    }
+    if (due != UINT64_MAX) {
+        uint64_t now = eva_time_now();
+        if (now >= due) {
+            return;
+        }
+        timeout.tv_sec  = (time_t)((due - now) / 1000000000ull);
+        timeout.tv_nsec = (long)((due - now) % 1000000000ull);
+        timeout_ptr     = &timeout;
+    }
+
+    struct pollfd fds[2] = {
+        { .fd = ConnectionNumber(_ctx.display), .events = POLLIN },
+        { .fd = _ctx.wake_fds[0],               .events = POLLIN },
+    };
+    ppoll(fds, _ctx.wake_fds[0] != -1 ? 2 : 1, timeout_ptr, NULL);
+
+    if (_ctx.wake_fds[0] != -1 && (fds[1].revents & POLLIN)) {
+        char buffer[64];
+        while (read(_ctx.wake_fds[0], buffer, sizeof(buffer)) > 0) {
+        }
+    }
+}
+
+static void wake_event_loop(void)
+{
+    // Called from the render thread and threads posting events. A full
+    // pipe already wakes the loop.
+    char byte = 0;
+    ssize_t written = write(_ctx.wake_fds[1], &byte, 1);
+    (void)written;
+}
+
+static bool try_frame(void)
+{
+    // Coalesced and continuous frames are drawn by the event loop once the
+    // queue is empty.
+    if (pacer_owns_frames(&_ctx.pacer, _ctx.coalesce_frames)) {
+        return false;
+    }
+
+    EVA_TRACE_BEGIN("try_frame");
+    bool drawn = draw_frame();
+    EVA_TRACE_END();
+    return drawn;
+}
+
+static bool draw_frame(void)
+{
+    // The input state is taken and pointer samples go out right before the
+    // frame, so what the application requests from them is drawn with it.
+    if (_ctx.request_frame && (!eva_pipeline_enabled() || eva_pipeline_ready())) {
+        eva_input_begin_frame();
+        eva_pointer_flush();
+    }
+
+    if (_ctx.request_frame && eva_pipeline_enabled()) {
+        // Drawn once the render thread is done with the previous frame.
+        if (!eva_pipeline_ready()) {
+            return false;
+        }
+
+        _ctx.request_frame = false;
+        pacer_begin_frame(&_ctx.pacer, eva_time_now());
+        eva_pipeline_submit(_ctx.frame_fn, &_ctx.framebuffer, _ctx.damage);
+        _ctx.damage = EVA_RECT_EMPTY;
+        return true;
+    }
+
+    if (_ctx.request_frame) {
+        _ctx.request_frame = false;
+        eva_stats_begin_frame();
+
+        // The framebuffer is shared with the X server so don't touch it until
+        // the previous present has been read.
+        wait_for_present();
+
+        // There is a chance that the frame_fn is not set and the application
+        // is just writing directly to the framebuffer in the event handlers
+        // and then requesting to draw with eva_request_frame(). In this case
+        // we still want to draw but don't have a frame function to call.
+        pacer_begin_frame(&_ctx.pacer, eva_time_now());
+        present(eva_tiles_render(_ctx.frame_fn, &_ctx.framebuffer, _ctx.damage));
+        _ctx.damage = EVA_RECT_EMPTY;
+        pacer_end_frame(&_ctx.pacer, eva_time_now());
+        eva_stats_end_frame();
+        return true;
+    }
+
+    return false;
+}
+
+static void present_pipelined(void)
+{
+    if (!eva_pipeline_frame_ready()) {
+        return;
+    }
+
+    eva_stats_begin_frame();
+
+    // The framebuffer is shared with the X server so don't touch it until
+    // the previous present has been read.
+    wait_for_present();
+
+    eva_rect damage;
+    eva_pipeline_present(&_ctx.framebuffer, &damage);
+    present(damage);
+    pacer_end_frame(&_ctx.pacer, eva_time_now());
+    eva_stats_end_frame();
+}
+
+static void present(eva_rect rect)
+{
+    // A pending scroll only applies to this present.
+    eva_rect scroll = _ctx.scroll_src;
+    _ctx.scroll_src = EVA_RECT_EMPTY;
+
+    if (!_ctx.window_mapped || _ctx.image == NULL) {
+        return;
+    }
+
+    // Only the damaged part of the framebuffer is sent to the server.
+    rect = rect_clip(rect, _ctx.framebuffer.w, _ctx.framebuffer.h);
+    if (rect_is_empty(rect)) {
+        return;
+    }
+
+    EVA_TRACE_BEGIN("present");
+    wait_for_present();
+
+    uint64_t start = eva_time_now();
+    if (!rect_is_empty(scroll)) {
+        XCopyArea(_ctx.display, _ctx.window, _ctx.window, _ctx.gc,
+                  scroll.x, scroll.y,
+                  (unsigned int)scroll.w, (unsigned int)scroll.h,
+                  scroll.x + _ctx.scroll_dx, scroll.y + _ctx.scroll_dy);
+    }
+    if (_ctx.shm_attached) {
+        // The server reads the pixels straight out of the shared segment and
+        // sends a completion event once it is done with them.
+        XShmPutImage(_ctx.display, _ctx.window, _ctx.gc, _ctx.image,
+                     rect.x, rect.y,
+                     rect.x, rect.y,
+                     (unsigned int)rect.w, (unsigned int)rect.h,
+                     True);
+        _ctx.shm_present_pending = true;
+    } else {
+        XPutImage(_ctx.display, _ctx.window, _ctx.gc, _ctx.image,
+                  rect.x, rect.y,
+                  rect.x, rect.y,
+                  (unsigned int)rect.w, (unsigned int)rect.h);
+    }
+    XFlush(_ctx.display);
+
+    eva_stats_add_present(eva_time_since(start),
+                          (uint64_t)rect.w * (uint64_t)rect.h * sizeof(eva_pixel));
+    EVA_TRACE_END();
+}
+
+static Bool is_shm_completion(Display *display, XEvent *event, XPointer arg)
+{
+    (void)display;
+    (void)arg;
+    return event->type == _ctx.shm_completion_event;
+}
+
+static void wait_for_present(void)
+{
+    if (_ctx.shm_present_pending) {
+        // Leaves all other events in the queue for the main loop.
+        uint64_t start = eva_time_now();
+        XEvent event;
+        XIfEvent(_ctx.display, &event, is_shm_completion, NULL);
+        _ctx.shm_present_pending = false;
+        eva_stats_add_wait(eva_time_since(start));
+    }
+}
+
+static float query_dpi_scale(void)
+{
+    float scale = 1.0f;
+
+    // Desktop environments publish the user's dpi through Xft.dpi.
+    char *resources = XResourceManagerString(_ctx.display);
+    if (resources) {
+        XrmDatabase db = XrmGetStringDatabase(resources);
+        if (db) {
+            char *type = NULL;
+            XrmValue value;
+            if (XrmGetResource(db, "Xft.dpi", "Xft.Dpi", &type, &value) &&
+                type && strcmp(type, "String") == 0) {
+                float dpi = (float)atof(value.addr);
+                if (dpi > 0.0f) {
+                    scale = dpi / 96.0f;
+                }
+            }
+            XrmDestroyDatabase(db);
+        }
+    }
+
+    return scale;
+}
+
+// Translates an X11 key event to an eva keycode. Adapted from GLFW.
+static eva_key translate_key(XKeyEvent *event)
+{
+    // The keypad keys are checked with the num lock applied first so that
+    // the digits map to keypad keys rather than navigation keys.
+    KeySym keysym = XLookupKeysym(event, 1);
+    switch (keysym) {
+        case XK_KP_0:           return EVA_KEY_KP_0;
+        case XK_KP_1:           return EVA_KEY_KP_1;
+        case XK_KP_2:           return EVA_KEY_KP_2;
+        case XK_KP_3:           return EVA_KEY_KP_3;
+        case XK_KP_4:           return EVA_KEY_KP_4;
+        case XK_KP_5:           return EVA_KEY_KP_5;
+        case XK_KP_6:           return EVA_KEY_KP_6;
+        case XK_KP_7:           return EVA_KEY_KP_7;
+        case XK_KP_8:           return EVA_KEY_KP_8;
+        case XK_KP_9:           return EVA_KEY_KP_9;
+        case XK_KP_Separator:
+        case XK_KP_Decimal:     return EVA_KEY_KP_DECIMAL;
+        case XK_KP_Equal:       return EVA_KEY_KP_EQUAL;
+        case XK_KP_Enter:       return EVA_KEY_KP_ENTER;
+        default:                break;
+    }
+
+    keysym = XLookupKeysym(event, 0);
+    switch (keysym) {
+        case XK_Escape:         return EVA_KEY_ESCAPE;
+        case XK_Tab:            return EVA_KEY_TAB;
+        case XK_Shift_L:        return EVA_KEY_LEFT_SHIFT;
+        case XK_Shift_R:        return EVA_KEY_RIGHT_SHIFT;
+        case XK_Control_L:      return EVA_KEY_LEFT_CONTROL;
+        case XK_Control_R:      return EVA_KEY_RIGHT_CONTROL;
+        case XK_Meta_L:
+        case XK_Alt_L:          return EVA_KEY_LEFT_ALT;
+        case XK_Mode_switch:
+        case XK_ISO_Level3_Shift:
+        case XK_Meta_R:
+        case XK_Alt_R:          return EVA_KEY_RIGHT_ALT;
+        case XK_Super_L:        return EVA_KEY_LEFT_SUPER;
+        case XK_Super_R:        return EVA_KEY_RIGHT_SUPER;
+        case XK_Menu:           return EVA_KEY_MENU;
+        case XK_Num_Lock:       return EVA_KEY_NUM_LOCK;
+        case XK_Caps_Lock:      return EVA_KEY_CAPS_LOCK;
+        case XK_Print:          return EVA_KEY_PRINT_SCREEN;
+        case XK_Scroll_Lock:    return EVA_KEY_SCROLL_LOCK;
+        case XK_Pause:          return EVA_KEY_PAUSE;
+        case XK_Delete:         return EVA_KEY_DELETE;
+        case XK_BackSpace:      return EVA_KEY_BACKSPACE;
+        case XK_Return:         return EVA_KEY_ENTER;
+        case XK_Home:           return EVA_KEY_HOME;
+        case XK_End:            return EVA_KEY_END;
+        case XK_Page_Up:        return EVA_KEY_PAGE_UP;
+        case XK_Page_Down:      return EVA_KEY_PAGE_DOWN;
+        case XK_Insert:         return EVA_KEY_INSERT;
+        case XK_Left:           return EVA_KEY_LEFT;
+        case XK_Right:          return EVA_KEY_RIGHT;
+        case XK_Down:           return EVA_KEY_DOWN;
+        case XK_Up:             return EVA_KEY_UP;
+        case XK_F1:             return EVA_KEY_F1;
+        case XK_F2:             return EVA_KEY_F2;
+        case XK_F3:             return EVA_KEY_F3;
+        case XK_F4:             return EVA_KEY_F4;
+        case XK_F5:             return EVA_KEY_F5;
+        case XK_F6:             return EVA_KEY_F6;
+        case XK_F7:             return EVA_KEY_F7;
+        case XK_F8:             return EVA_KEY_F8;
+        case XK_F9:             return EVA_KEY_F9;
+        case XK_F10:            return EVA_KEY_F10;
+        case XK_F11:            return EVA_KEY_F11;
+        case XK_F12:            return EVA_KEY_F12;
+        case XK_F13:            return EVA_KEY_F13;
+        case XK_F14:            return EVA_KEY_F14;
+        case XK_F15:            return EVA_KEY_F15;
+        case XK_F16:            return EVA_KEY_F16;
+        case XK_F17:            return EVA_KEY_F17;
+        case XK_F18:            return EVA_KEY_F18;
+        case XK_F19:            return EVA_KEY_F19;
+        case XK_F20:            return EVA_KEY_F20;
+        case XK_F21:            return EVA_KEY_F21;
+        case XK_F22:            return EVA_KEY_F22;
+        case XK_F23:            return EVA_KEY_F23;
+        case XK_F24:            return EVA_KEY_F24;
+        case XK_F25:            return EVA_KEY_F25;
+
+        // Numeric keypad
+        case XK_KP_Divide:      return EVA_KEY_KP_DIVIDE;
+        case XK_KP_Multiply:    return EVA_KEY_KP_MULTIPLY;
+        case XK_KP_Subtract:    return EVA_KEY_KP_SUBTRACT;
+        case XK_KP_Add:         return EVA_KEY_KP_ADD;
+
+        // These should have been detected in secondary keysym test above!
+        case XK_KP_Insert:      return EVA_KEY_KP_0;
+        case XK_KP_End:         return EVA_KEY_KP_1;
+        case XK_KP_Down:        return EVA_KEY_KP_2;
+        case XK_KP_Page_Down:   return EVA_KEY_KP_3;
+        case XK_KP_Left:        return EVA_KEY_KP_4;
+        case XK_KP_Right:       return EVA_KEY_KP_6;
+        case XK_KP_Home:        return EVA_KEY_KP_7;
+        case XK_KP_Up:          return EVA_KEY_KP_8;
+        case XK_KP_Page_Up:     return EVA_KEY_KP_9;
+        case XK_KP_Delete:      return EVA_KEY_KP_DECIMAL;
+        case XK_KP_Equal:       return EVA_KEY_KP_EQUAL;
+        case XK_KP_Enter:       return EVA_KEY_KP_ENTER;
+
+        // Printable keys
+        case XK_a:              return EVA_KEY_A;
+        case XK_b:              return EVA_KEY_B;
+        case XK_c:              return EVA_KEY_C;
+        case XK_d:              return EVA_KEY_D;
+        case XK_e:              return EVA_KEY_E;
+        case XK_f:              return EVA_KEY_F;
+        case XK_g:              return EVA_KEY_G;
+        case XK_h:              return EVA_KEY_H;
+        case XK_i:              return EVA_KEY_I;
+        case XK_j:              return EVA_KEY_J;
+        case XK_k:              return EVA_KEY_K;
+        case XK_l:              return EVA_KEY_L;
+        case XK_m:              return EVA_KEY_M;
+        case XK_n:              return EVA_KEY_N;
+        case XK_o:              return EVA_KEY_O;
+        case XK_p:              return EVA_KEY_P;
+        case XK_q:              return EVA_KEY_Q;
+        case XK_r:              return EVA_KEY_R;
+        case XK_s:              return EVA_KEY_S;
+        case XK_t:              return EVA_KEY_T;
+        case XK_u:              return EVA_KEY_U;
+        case XK_v:              return EVA_KEY_V;
+        case XK_w:              return EVA_KEY_W;
+        case XK_x:              return EVA_KEY_X;
+        case XK_y:              return EVA_KEY_Y;
+        case XK_z:              return EVA_KEY_Z;
+        case XK_1:              return EVA_KEY_1;
+        case XK_2:              return EVA_KEY_2;
+        case XK_3:              return EVA_KEY_3;
+        case XK_4:              return EVA_KEY_4;
+        case XK_5:              return EVA_KEY_5;
+        case XK_6:              return EVA_KEY_6;
+        case XK_7:              return EVA_KEY_7;
+        case XK_8:              return EVA_KEY_8;
+        case XK_9:              return EVA_KEY_9;
+        case XK_0:              return EVA_KEY_0;
+        case XK_space:          return EVA_KEY_SPACE;
+        case XK_minus:          return EVA_KEY_MINUS;
+        case XK_equal:          return EVA_KEY_EQUAL;
+        case XK_bracketleft:    return EVA_KEY_LEFT_BRACKET;
+        case XK_bracketright:   return EVA_KEY_RIGHT_BRACKET;
+        case XK_backslash:      return EVA_KEY_BACKSLASH;
+        case XK_semicolon:      return EVA_KEY_SEMICOLON;
+        case XK_apostrophe:     return EVA_KEY_APOSTROPHE;
+        case XK_grave:          return EVA_KEY_GRAVE_ACCENT;
+        case XK_comma:          return EVA_KEY_COMMA;
+        case XK_period:         return EVA_KEY_PERIOD;
+        case XK_slash:          return EVA_KEY_SLASH;
+        case XK_less:           return EVA_KEY_WORLD_1; // At least in some layouts...
+        default:                break;
+    }
+
+    return EVA_KEY_UNKNOWN;
+}
+
+// Translates X11 key modifiers into eva ones. Taken from GLFW
+static eva_mod_flags translate_mod_flags(unsigned int state)
+{
+    eva_mod_flags mods = 0;
+
+    if (state & ShiftMask)
+        mods |= EVA_MOD_SHIFT;
+    if (state & ControlMask)
+        mods |= EVA_MOD_CONTROL;
+    if (state & Mod1Mask)
+        mods |= EVA_MOD_ALT;
+    if (state & Mod4Mask)
+        mods |= EVA_MOD_SUPER;
+    if (state & LockMask)
+        mods |= EVA_MOD_CAPS_LOCK;
+    if (state & Mod2Mask)
+        mods |= EVA_MOD_NUM_LOCK;
+
+    return mods;
+}
+
+// time
+
+void eva_time_init(void)
+{
+    // No-op on linux.
+}
+
+uint64_t eva_time_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t eva_time_real_now(void)
+{
+    return eva_time_now();
+}
+
+uint64_t eva_time_frequency(void)
+{
+    return 1000000000ull;
+}
+
+uint64_t eva_time_since(uint64_t start)
+{
+    return eva_time_now() - start;
+}
+
+float eva_time_ms(uint64_t t)
+{
+    return t / 1000000.0f;
+}
+
+float eva_time_elapsed_ms(uint64_t start, uint64_t end)
+{
+    return eva_time_ms(end - start);
+}
+
+float eva_time_since_ms(uint64_t start)
+{
+    return eva_time_elapsed_ms(start, eva_time_now());
+}
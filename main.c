@@ -1,37 +1,17 @@
 #include "eva.h"
+#include "eva_draw.h"
 
 #include <stdio.h>
 
-typedef struct rectangle {
-    int x, y, w, h;
-} rectangle;
+static eva_rect rect;
 
-static rectangle rect;
-
-void clear(const eva_framebuffer *fb)
+void frame(const eva_framebuffer *fb)
 {
     eva_pixel gray = { .r = 20, .g = 20, .b = 20, .a = 255 };
-    for (int j = 0; j < fb->h; j++) {
-        for (int i = 0; i < fb->w; i++) {
-            fb->pixels[i + j * fb->w] = gray;
-        }
-    }
-}
-
-void draw_rect(const eva_framebuffer *fb)
-{
     eva_pixel red = { .r = 255, .g = 0, .b = 0, .a = 255 };
-    for (int j = rect.y; j < rect.y + rect.h; j++) {
-        for (int i = rect.x; i < rect.x + rect.w; i++) {
-            fb->pixels[i + j * fb->w] = red;
-        }
-    }
-}
 
-void frame(const eva_framebuffer *fb)
-{
-    clear(fb);
-    draw_rect(fb);
+    eva_draw_clear(fb, gray);
+    eva_draw_fill_rect(fb, rect, red);
 }
 
 void init()